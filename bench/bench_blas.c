@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Times the BLAS and LAPACK calls made by the DGNSS filters, at the shapes
+ * they have with 11 channels, against whichever implementation the build
+ * links (see LIBSWIFTNAV_SYSTEM_BLAS). Prints the mean time per call. */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cblas.h>
+#include <clapack.h>
+
+#include <libswiftnav/common.h>
+
+#define NUM_DDS     10               /* Double differenced ambiguities. */
+#define NUM_STATES  7                /* Non-ambiguity filter states. */
+#define STATE_DIM   (NUM_DDS + NUM_STATES)
+#define OBS_DIM     (2 * NUM_DDS)
+#define HYP_BATCH   32               /* Hypotheses tested per batch. */
+
+#define ITERATIONS  100000
+
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+static void fill(u32 n, double *a)
+{
+  for (u32 i = 0; i < n; i++) {
+    a[i] = (double)rand() / RAND_MAX - 0.5;
+  }
+}
+
+/* Runs setup then body ITERATIONS times and prints the mean time of one
+ * iteration. The setup restores inputs the call overwrites. */
+#define BENCH(name, setup, body) do {                                   \
+    double t0 = now();                                                  \
+    for (u32 it = 0; it < ITERATIONS; it++) {                           \
+      setup;                                                            \
+      body;                                                             \
+    }                                                                   \
+    printf("%-42s %8.3f us\n", name, 1e6 * (now() - t0) / ITERATIONS);  \
+  } while (0)
+
+int main(void)
+{
+  static double A[64*64], A0[64*64], B[64*64], C[64*64], S[64*64];
+  double tau[64], work[4096];
+  integer jpvt[64], info, rank;
+  integer m = NUM_DDS, n = 3, lwork = 4096, one = 1, ldb = NUM_DDS;
+  integer dim = STATE_DIM;
+  double rcond = 1e-12;
+  char upper = 'U', lower = 'L', unit = 'U';
+
+  fill(sizeof(A0) / sizeof(A0[0]), A0);
+  fill(sizeof(B) / sizeof(B[0]), B);
+  /* Symmetric positive definite state covariance. */
+  for (u32 i = 0; i < STATE_DIM; i++) {
+    for (u32 j = 0; j < STATE_DIM; j++) {
+      S[i*STATE_DIM + j] = A0[i] * A0[j] + (i == j ? STATE_DIM : 0);
+    }
+  }
+
+  BENCH("amb_kf dgeqp3 10x3",
+        memcpy(A, A0, 30 * sizeof(double)); memset(jpvt, 0, sizeof(jpvt)),
+        dgeqp3_(&m, &n, A, &m, jpvt, tau, work, &lwork, &info));
+  BENCH("amb_kf dorgqr 10x10 (3 reflectors)",
+        memcpy(A, A0, 100 * sizeof(double)),
+        dorgqr_(&m, &m, &n, A, &m, tau, work, &lwork, &info));
+  BENCH("amb_kf dsymm 17x20 * 20x20", ,
+        cblas_dsymm(CblasRowMajor, CblasRight, CblasUpper, STATE_DIM, OBS_DIM,
+                    1, A0, OBS_DIM, B, OBS_DIM, 0, C, OBS_DIM));
+  BENCH("amb_kf dgemm 17x20 * 20x17'", ,
+        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                    STATE_DIM, STATE_DIM, OBS_DIM,
+                    1, A0, OBS_DIM, B, OBS_DIM, 0, C, STATE_DIM));
+  BENCH("amb_kf dtrtri 17 unit upper",
+        memcpy(A, S, STATE_DIM * STATE_DIM * sizeof(double)),
+        dtrtri_(&upper, &unit, &dim, A, &dim, &info));
+  BENCH("amb_kf dtrmm 17x17 * 17x10",
+        memcpy(C, A0, STATE_DIM * NUM_DDS * sizeof(double)),
+        cblas_dtrmm(CblasRowMajor, CblasLeft, CblasUpper, CblasNoTrans,
+                    CblasUnit, STATE_DIM, NUM_DDS, 1, S, STATE_DIM,
+                    C, NUM_DDS));
+  BENCH("ambiguity_test dgemm 32x7 += 32x10 * 7x10'", ,
+        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                    HYP_BATCH, NUM_STATES, NUM_DDS,
+                    -1, A0, NUM_DDS, B, NUM_DDS, 1, C, STATE_DIM));
+  BENCH("ambiguity_test dtrmm 32x17 * 17x17'",
+        memcpy(C, A0, HYP_BATCH * STATE_DIM * sizeof(double)),
+        cblas_dtrmm(CblasRowMajor, CblasRight, CblasUpper, CblasTrans,
+                    CblasNonUnit, HYP_BATCH, STATE_DIM, 1, S, STATE_DIM,
+                    C, STATE_DIM));
+  BENCH("ambiguity_test dpotrf 17",
+        memcpy(A, S, STATE_DIM * STATE_DIM * sizeof(double)),
+        dpotrf_(&lower, &dim, A, &dim, &info));
+  BENCH("baseline dgelsy 10x3",
+        memcpy(A, A0, 30 * sizeof(double));
+        memcpy(C, B, NUM_DDS * sizeof(double));
+        memset(jpvt, 0, sizeof(jpvt)),
+        dgelsy_(&m, &n, &one, A, &m, C, &ldb, jpvt, &rcond, &rank,
+                work, &lwork, &info));
+
+  return 0;
+}
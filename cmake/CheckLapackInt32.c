@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Configure time probe, exits with 0 if the LAPACK being linked takes 32 bit
+ * integers as libswiftnav's f2c prototypes assume.
+ *
+ * The order is passed as two words {2, 1} and the leading dimension as
+ * {2, 0}. A 32 bit LAPACK only reads the first words and factors the 2x2
+ * matrix. An ILP64 one also reads the second words, sees an order above 2^32
+ * with a leading dimension of 2 and rejects the call. */
+
+extern void dpotrf_(const char *uplo, const int *n, double *a,
+                    const int *lda, int *info);
+
+int main(void)
+{
+  const int n[2] = {2, 1};
+  const int lda[2] = {2, 0};
+  int info[2] = {-1, -1};
+  double a[4] = {4, 2, 2, 5};
+
+  dpotrf_("L", n, a, lda, info);
+  if (info[0] != 0 || info[1] != -1) {
+    return 1;
+  }
+  /* Lower Cholesky factor of [4 2; 2 5] is [2 0; 1 2]. */
+  return (a[0] == 2 && a[1] == 1 && a[3] == 2) ? 0 : 1;
+}
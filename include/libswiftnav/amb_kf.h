@@ -38,8 +38,9 @@ typedef struct {
   /** The variance to use for the prediction update step (diffusion). */
   double amb_drift_var;
   /** The observation decorrelation matrix. Takes raw measurements and
-   * decorrelates them. */
-  double decor_mtx[MAX_OBS_DIM * MAX_OBS_DIM];
+   * decorrelates them. It is unit upper triangular, only the elements above
+   * the diagonal are stored, packed row by row. */
+  double decor_mtx[MAX_OBS_DIM * (MAX_OBS_DIM - 1) / 2];
   /** The observation matrix for decorrelated measurements. */
   double decor_obs_mtx[MAX_STATE_DIM * MAX_OBS_DIM];
   /** The diagonal of the decorrelated observation covariance (for cholesky it's
@@ -52,8 +53,9 @@ typedef struct {
   /** The current state estimate. */
   double state_mean[MAX_STATE_DIM];
   /** The upper unit triangular U matrix of the UDU decomposition of the
-   * covariance of the current state estimate. Stored dense. */
-  double state_cov_U[MAX_STATE_DIM * MAX_STATE_DIM];
+   * covariance of the current state estimate. Only the elements above the
+   * diagonal are stored, packed column by column, see nkf_unpack_U(). */
+  double state_cov_U[MAX_STATE_DIM * (MAX_STATE_DIM - 1) / 2];
   /** The diagonal D matrix of the UDU decomposition of the covariance of the current
    * state estimate. Stored as a vector. */
   double state_cov_D[MAX_STATE_DIM];
@@ -63,7 +65,12 @@ typedef struct {
 
 /** \} */
 
+void nkf_unpack_U(const nkf_t *kf, double *U);
+void nkf_pack_U(nkf_t *kf, const double *U);
+void nkf_get_cov(const nkf_t *kf, double *cov);
 bool nkf_update(nkf_t *kf, const double *measurements);
+void nkf_add_process_noise(nkf_t *kf, u32 rank, const double *c,
+                           const double *V);
 
 void assign_phase_obs_null_basis(u8 num_dds, double *DE_mtx, double *q);
 void set_nkf(nkf_t *kf, double amb_drift_var, double phase_var, double code_var, double amb_init_var,
@@ -73,10 +80,10 @@ void set_nkf_matrices(nkf_t *kf, double phase_var, double code_var,
 s32 find_index_of_signal(const u32 num_elements, const gnss_signal_t x, const gnss_signal_t *list);
 void rebase_nkf(nkf_t *kf, u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids);
 
-void nkf_state_projection(nkf_t *kf,
-                                    u8 num_old_non_ref_sats,
-                                    u8 num_new_non_ref_sats,
-                                    u8 *ndx_of_new_sat_in_old);
+s8 nkf_state_projection(nkf_t *kf,
+                        u8 num_old_non_ref_sats,
+                        u8 num_new_non_ref_sats,
+                        u8 *ndx_of_new_sat_in_old);
 void nkf_state_inclusion(nkf_t *kf,
                          u8 num_old_non_ref_sats,
                          u8 num_new_non_ref_sats,
@@ -35,16 +35,62 @@ typedef struct {
   u8 num_matching_ndxs;
   u8 matching_ndxs[MAX_CHANNELS-1];
   s32 ambs[MAX_CHANNELS-1];
+  u32 generation;  /**< Pool generation the check was made at. */
 } unanimous_amb_check_t; //NOTE maybe do this in a semi-decorrelated space, where more should match sooner.
 
+/** Policy applied when the hypotheses needed to add satellites to an
+ * ambiguity test don't fit in its pool. */
+typedef enum {
+  /** Don't add the satellites until fewer hypotheses are needed. */
+  AMBIGUITY_OVERFLOW_DEFER = 0,
+  /** Add the satellites, keeping only the most likely hypotheses that fit. */
+  AMBIGUITY_OVERFLOW_TOP_K,
+  /** Add all the satellites, generating the most likely candidates for them
+   * first until the pool is full. The whole box of candidates is never
+   * enumerated. */
+  AMBIGUITY_OVERFLOW_BEST_FIRST,
+} ambiguity_overflow_policy_t;
+
+/** Hash index from ambiguity vectors to the hypotheses in the pool, see
+ * ambiguity_test_enable_index(). */
+typedef struct {
+  hypothesis_t **slots;  /**< Open addressing table, NULL when disabled. */
+  u32 n_slots;
+  u8 valid;              /**< Whether the table has been built. */
+  u8 num_dds;            /**< Length of the indexed ambiguity vectors. */
+  u32 generation;        /**< Pool generation the table is up to date with. */
+  double prob_sum;       /**< Sum of exp(ll) over the pool. */
+} hypothesis_index_t;
+
 typedef struct {
   u8 num_dds;
   memory_pool_t *pool;
+  hypothesis_index_t index;
+  ambiguity_overflow_policy_t overflow_policy;
+  /** Candidate scores for `AMBIGUITY_OVERFLOW_TOP_K`, one per pool element. */
+  float *prune_scores;
   residual_mtxs_t res_mtxs;
   sats_management_t sats;
   unanimous_amb_check_t amb_check;
+  /** Greatest log likelihood of the last test_ambiguities(). The `ll` of the
+   * hypotheses are only normalized by it as they are next tested. */
+  double ll_offset;
 } ambiguity_test_t;
 
+/** Hypotheses of an ambiguity test in compact form, see
+ * ambiguity_test_pack(). This is a serialization format only, the
+ * hypotheses are tested in the pool where they are stored uncompressed as
+ * ::hypothesis_t. */
+typedef struct {
+  u8 num_dds;
+  u32 n_hyps;
+  u32 max_hyps;
+  s32 base[MAX_CHANNELS-1]; /**< Ambiguities the deltas are relative to. */
+  s16 *deltas;              /**< Ambiguities less `base`, `num_dds` per
+                                 hypothesis. */
+  float *ll;                /**< Log likelihood of each hypothesis. */
+} hypothesis_pack_t;
+
 typedef s64 z_t;
 
 /* See doc string above inclusion_loop_body in ambiguity_test.c for info on
@@ -73,7 +119,38 @@ typedef struct {
   z_t *Z_new_inv;
 } generate_hypothesis_state_t2;
 
+/** Size of the working area for a pool of `n` hypotheses. */
+#define AMBIGUITY_TEST_POOL_SIZE(n) \
+  ((n) * (sizeof(hypothesis_t) + sizeof(void *)))
+
+/** Size of the working area for a pool of `MAX_HYPOTHESES` hypotheses, see
+ * init_ambiguity_test(). */
+#define AMBIGUITY_TEST_POOL_BUFF_SIZE AMBIGUITY_TEST_POOL_SIZE(MAX_HYPOTHESES)
+
+/** Suggested size of the working area for a hash index of a pool of `n`
+ * hypotheses, see ambiguity_test_enable_index(). */
+#define AMBIGUITY_TEST_INDEX_SIZE(n) (2 * (n) * sizeof(hypothesis_t *))
+
+/** Size of the arena needed for an ambiguity test of `n` hypotheses with
+ * overflow policy `policy`, see init_ambiguity_test_arena(). */
+#define AMBIGUITY_TEST_ARENA_SIZE(n, policy) \
+  (AMBIGUITY_TEST_POOL_SIZE(n) + \
+   ((policy) == AMBIGUITY_OVERFLOW_TOP_K ? (n) * sizeof(float) : 0))
+
+/** Size of the working area for a compact set of `n` hypotheses, see
+ * init_hypothesis_pack(). */
+#define AMBIGUITY_TEST_PACK_SIZE(n) \
+  ((n) * ((MAX_CHANNELS-1) * sizeof(s16) + sizeof(float)))
+
 s8 get_single_hypothesis(ambiguity_test_t *amb_test, s32 *hyp_N);
+void init_ambiguity_test(ambiguity_test_t *amb_test, memory_pool_t *pool,
+                         void *pool_buff);
+s8 init_ambiguity_test_arena(ambiguity_test_t *amb_test, memory_pool_t *pool,
+                             u32 max_hyps,
+                             ambiguity_overflow_policy_t overflow_policy,
+                             void *arena, size_t arena_size);
+s8 ambiguity_test_enable_index(ambiguity_test_t *amb_test, void *buff,
+                               size_t buff_size);
 void create_empty_ambiguity_test(ambiguity_test_t *amb_test);
 void create_ambiguity_test(ambiguity_test_t *amb_test);
 void reset_ambiguity_test(ambiguity_test_t *amb_test);
@@ -84,6 +161,10 @@ void update_ambiguity_test(double ref_ecef[3], double phase_var, double code_var
                            ambiguity_test_t *amb_test, u8 state_dim, sdiff_t *sdiffs,
                            u8 changed_sats);
 void update_unanimous_ambiguities(ambiguity_test_t *amb_test);
+void init_hypothesis_pack(hypothesis_pack_t *pack, void *buff, size_t buff_size);
+s8 ambiguity_test_pack(ambiguity_test_t *amb_test, hypothesis_pack_t *pack);
+s8 ambiguity_test_unpack(ambiguity_test_t *amb_test,
+                         const hypothesis_pack_t *pack);
 u32 ambiguity_test_n_hypotheses(ambiguity_test_t *amb_test);
 u8 ambiguity_test_pool_contains(ambiguity_test_t *amb_test, double *ambs);
 double ambiguity_test_pool_ll(ambiguity_test_t *amb_test, u8 num_ambs, double *ambs);
@@ -15,12 +15,12 @@
 
 #include <math.h>
 
+#include <libswiftnav/config.h>
+
 /** \defgroup constants Constants
  * Useful constants.
  * \{ */
 
-#define MAX_CHANNELS 11 /**< Maximum sats we can track */
-
 #define R2D (180.0 / M_PI) /**< Conversion factor from radians to degrees. */
 #define D2R (M_PI / 180.0) /**< Conversion factor from degrees to radians. */
 
@@ -109,6 +109,12 @@
 /** The variance with which to add new sats to the Kalman Filter.
  * TODO deprecate in lieu of amb_init_var once we do some tuning. */
 #define DEFAULT_NEW_INT_VAR     1e25
+/** The default minimum bootstrapped success rate of a partially fixed subset
+ * of the ambiguities. */
+#define DEFAULT_PAR_SUCCESS_RATE 0.999
+/** The default minimum ratio of the second best to the best squared distance
+ * of a partially fixed subset of the ambiguities. */
+#define DEFAULT_PAR_RATIO       3.0
 
 /* \} */
 
@@ -32,6 +32,12 @@ typedef struct {
   double vel_init_var;
   double amb_init_var;
   double new_int_var;
+  /** Fix a subset of the float ambiguities while IAR is unresolved. */
+  bool partial_fix;
+  /** Minimum bootstrapped success rate of the partially fixed subset. */
+  double par_success_rate;
+  /** Minimum ratio test value of the partially fixed subset. */
+  double par_ratio;
 } dgnss_settings_t;
 
 typedef struct {
@@ -39,13 +45,87 @@ typedef struct {
   ambiguities_t float_ambs;
 } ambiguity_state_t;
 
-extern dgnss_settings_t dgnss_settings;
+/** State of the float and integer ambiguity filters of one baseline.
+ *
+ * Initialize with dgnss_ctx_init(). Contexts are independent of each other
+ * and hold pointers into themselves, so must not be copied or moved. */
+typedef struct {
+  dgnss_settings_t settings;
+  nkf_t nkf;
+  sats_management_t sats_management;
+  ambiguity_test_t ambiguity_test;
+  /** Hypothesis pool of `ambiguity_test`. */
+  memory_pool_t hyp_pool;
+  /** Working area of `hyp_pool`, must be the last member. */
+  u8 hyp_pool_buff[AMBIGUITY_TEST_POOL_BUFF_SIZE];
+} dgnss_ctx_t;
+
+void make_measurements(u8 num_diffs, const sdiff_t *sdiffs, double *raw_measurements);
+s8 dgnss_baseline(u8 num_sdiffs, const sdiff_t *sdiffs,
+                  const double ref_ecef[3], const ambiguity_state_t *s,
+                  u8 *num_used, double b[3],
+                  bool disable_raim, double raim_threshold);
+
+void dgnss_ctx_init(dgnss_ctx_t *ctx);
+void dgnss_ctx_set_settings(dgnss_ctx_t *ctx,
+                            double phase_var_test, double code_var_test,
+                            double phase_var_kf, double code_var_kf,
+                            double amb_drift_var, double amb_init_var,
+                            double new_int_var);
+void dgnss_ctx_set_partial_fix(dgnss_ctx_t *ctx, bool enable,
+                               double success_rate, double ratio);
+void dgnss_ctx_init_filters(dgnss_ctx_t *ctx, u8 num_sats, sdiff_t *sdiffs,
+                            double receiver_ecef[3]);
+void dgnss_ctx_update(dgnss_ctx_t *ctx, u8 num_sats, sdiff_t *sdiffs,
+                      double receiver_ecef[3],
+                      bool disable_raim, double raim_threshold);
+void dgnss_ctx_rebase_ref(dgnss_ctx_t *ctx, u8 num_sdiffs, sdiff_t *sdiffs,
+                          double receiver_ecef[3],
+                          gnss_signal_t old_sids[MAX_CHANNELS],
+                          sdiff_t *corrected_sdiffs);
+s8 dgnss_ctx_iar_resolved(dgnss_ctx_t *ctx);
+u32 dgnss_ctx_iar_num_hyps(dgnss_ctx_t *ctx);
+u32 dgnss_ctx_iar_num_sats(const dgnss_ctx_t *ctx);
+s8 dgnss_ctx_iar_get_single_hyp(dgnss_ctx_t *ctx, double *hyp);
+void dgnss_ctx_reset_iar(dgnss_ctx_t *ctx);
+void dgnss_ctx_init_known_baseline(dgnss_ctx_t *ctx, u8 num_sats,
+                                   sdiff_t *sdiffs, double receiver_ecef[3],
+                                   double b[3]);
+void dgnss_ctx_update_ambiguity_state(dgnss_ctx_t *ctx, ambiguity_state_t *s);
+void dgnss_ctx_measure_amb_kf_b(dgnss_ctx_t *ctx, u8 num_sdiffs,
+                                sdiff_t *sdiffs,
+                                const double receiver_ecef[3], double *b);
+void dgnss_ctx_measure_b_with_external_ambs(dgnss_ctx_t *ctx, u8 state_dim,
+                                            const double *state_mean,
+                                            u8 num_sdiffs, sdiff_t *sdiffs,
+                                            const double receiver_ecef[3],
+                                            double *b);
+void dgnss_ctx_measure_iar_b_with_external_ambs(dgnss_ctx_t *ctx,
+                                                double *state_mean,
+                                                u8 num_sdiffs, sdiff_t *sdiffs,
+                                                double receiver_ecef[3],
+                                                double *b);
+u8 dgnss_ctx_get_amb_kf_de_and_phase(dgnss_ctx_t *ctx, u8 num_sdiffs,
+                                     sdiff_t *sdiffs, double ref_ecef[3],
+                                     double *de, double *phase);
+u8 dgnss_ctx_get_iar_de_and_phase(dgnss_ctx_t *ctx, u8 num_sdiffs,
+                                  sdiff_t *sdiffs, double ref_ecef[3],
+                                  double *de, double *phase);
+u8 dgnss_ctx_iar_pool_contains(dgnss_ctx_t *ctx, double *ambs);
+double dgnss_ctx_iar_pool_ll(dgnss_ctx_t *ctx, u8 num_ambs, double *ambs);
+double dgnss_ctx_iar_pool_prob(dgnss_ctx_t *ctx, u8 num_ambs, double *ambs);
+u8 dgnss_ctx_get_amb_kf_mean(const dgnss_ctx_t *ctx, double *ambs);
+u8 dgnss_ctx_get_amb_kf_cov(const dgnss_ctx_t *ctx, double *cov);
+u8 dgnss_ctx_get_amb_kf_sids(const dgnss_ctx_t *ctx, gnss_signal_t *sids);
+u8 dgnss_ctx_get_amb_test_sids(const dgnss_ctx_t *ctx, gnss_signal_t *sids);
+u8 dgnss_ctx_iar_MLE_ambs(dgnss_ctx_t *ctx, s32 *ambs);
 
+/* Functions operating on the default context. */
 void dgnss_set_settings(double phase_var_test, double code_var_test,
                         double phase_var_kf, double code_var_kf,
                         double amb_drift_var, double amb_init_var,
                         double new_int_var);
-void make_measurements(u8 num_diffs, const sdiff_t *sdiffs, double *raw_measurements);
+void dgnss_set_partial_fix(bool enable, double success_rate, double ratio);
 void dgnss_init(u8 num_sats, sdiff_t *sdiffs, double reciever_ecef[3]);
 void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double reciever_ecef[3],
                   bool disable_raim, double raim_threshold);
@@ -62,10 +142,6 @@ s8 dgnss_iar_get_single_hyp(double *hyp);
 void dgnss_reset_iar(void);
 void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3], double b[3]);
 void dgnss_update_ambiguity_state(ambiguity_state_t *s);
-s8 dgnss_baseline(u8 num_sdiffs, const sdiff_t *sdiffs,
-                  const double ref_ecef[3], const ambiguity_state_t *s,
-                  u8 *num_used, double b[3],
-                  bool disable_raim, double raim_threshold);
 void measure_amb_kf_b(u8 num_sdiffs, sdiff_t *sdiffs,
                       const double receiver_ecef[3], double *b);
 void measure_b_with_external_ambs(u8 state_dim, const double *state_mean,
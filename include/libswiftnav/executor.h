@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_EXECUTOR_H
+#define LIBSWIFTNAV_EXECUTOR_H
+
+#include <libswiftnav/common.h>
+
+/* Caller supplied executor for the parallel operations. `run` must call
+ * `task(arg, i)` exactly once for each `i` in `[0, n_tasks)`, possibly
+ * concurrently, and only return once they have all completed. Work is split
+ * into at most `n_workers` tasks. A NULL executor, or one with no workers,
+ * runs everything inline on the calling thread. */
+typedef struct {
+  u32 n_workers;
+  void *ctx;
+  void (*run)(void *ctx, u32 n_tasks,
+              void (*task)(void *arg, u32 i), void *arg);
+} executor_t;
+
+#endif /* LIBSWIFTNAV_EXECUTOR_H */
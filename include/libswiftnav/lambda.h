@@ -15,9 +15,46 @@
 #define LIBSWIFTNAV_LAMBDA_H
 
 #include <libswiftnav/common.h>
+#include <libswiftnav/constants.h>
+#include <libswiftnav/executor.h>
+
+/** Most tasks lambda_solution_parallel() runs at a time, whatever the number
+ * of workers of its executor. */
+#define LAMBDA_MAX_TASKS 16
+
+/** Largest dimension lambda_solution_warm() keeps state for. */
+#define LAMBDA_WARM_MAX_DIM (MAX_CHANNELS-1)
+
+/** State kept between calls of lambda_solution_warm(). */
+typedef struct {
+  int n;        /**< Dimension of the last problem, 0 if none. */
+  /** Reduction transformation of the last problem, column major. */
+  double Z[LAMBDA_WARM_MAX_DIM * LAMBDA_WARM_MAX_DIM];
+  /** Inverse of the transpose of `Z`, column major. */
+  double Zi[LAMBDA_WARM_MAX_DIM * LAMBDA_WARM_MAX_DIM];
+  bool has_fix; /**< Whether `fix` is valid. */
+  double fix[LAMBDA_WARM_MAX_DIM]; /**< Best fixed solution of the last
+                                        problem. */
+} lambda_warm_t;
 
 int lambda_reduction(int n, const double *Q, double *Z);
 int lambda_solution(int n, int m, const double *a, const double *Q, double *F,
                     double *s);
+int lambda_solution_split(int n, int m, int levels, const double *a,
+                          const double *Q, double *F, double *s);
+int lambda_factor(int n, const double *Q, double *L, double *D, double *Z,
+                  double *Zi);
+int lambda_search(int n, int m, const double *L, const double *D,
+                  const double *Z, const double *Zi, const double *a,
+                  double maxdist, double *F, double *s);
+int lambda_solution_parallel(const executor_t *ex, int n, int m,
+                             int levels, const double *a, const double *Q,
+                             double *F, double *s);
+void lambda_warm_init(lambda_warm_t *w);
+int lambda_solution_warm(lambda_warm_t *w, int n, int m, const double *a,
+                         const double *Q, double *F, double *s);
+double lambda_success_rate(int n, const double *Q);
+int lambda_partial(int n, const double *a, const double *Q, double p0,
+                   double ratio, double *F, bool *fixed);
 
 #endif /* LIBSWIFTNAV_LAMBDA_H */
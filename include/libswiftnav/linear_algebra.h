@@ -58,6 +58,8 @@ void matrix_triu(u32 n, double *M);
 void matrix_eye(u32 n, double *M);
 void matrix_udu(u32 n, double *M, double *U, double *D);
 void matrix_reconstruct_udu(const u32 n, const double *U, const double *D, double *M);
+void matrix_udu_rank_one(u32 n, double *U, double *D, double c,
+                         const double *a);
 void matrix_add_sc(u32 n, u32 m, const double *a,
                    const double *b, double gamma, double *c);
 void matrix_transpose(u32 n, u32 m, const double *a, double *b);
@@ -16,6 +16,7 @@
 #include <stddef.h>
 
 #include <libswiftnav/common.h>
+#include <libswiftnav/executor.h>
 
 /* Type for elements of the memory pool, unfortunately typedef doesn't enforce
  * type safety and an opaque struct definition wouldn't be compatible with the
@@ -37,18 +38,35 @@ typedef struct node {
   element_t elem[];
 } node_t;
 
+/* Storage layout of a memory pool. */
+typedef enum {
+  /* Elements are nodes of a linked list, each with a one pointer header. */
+  MEMORY_POOL_LIST = 0,
+  /* Elements are packed contiguously at the start of the buffer. */
+  MEMORY_POOL_ARRAY,
+} memory_pool_layout_t;
+
 struct _memory_pool {
   u32 n_elements;
   size_t element_size;
   node_t *pool;
   node_t *free_nodes_head;
   node_t *allocated_nodes_head;
+  memory_pool_layout_t layout;
+  /* Number of allocated elements, only maintained for MEMORY_POOL_ARRAY. */
+  u32 n_allocated;
+  /* Incremented by every operation that may add, remove, move or modify
+   * elements, so that users can tell when derived data is stale. The folds
+   * are read only for this purpose and leave it unchanged. */
+  u32 generation;
 };
 
-
 memory_pool_t *memory_pool_new(u32 n_elements, size_t element_size);
 s8 memory_pool_init(memory_pool_t *new_pool, u32 n_elements,
                     size_t element_size, void *buff);
+memory_pool_t *memory_pool_new_array(u32 n_elements, size_t element_size);
+s8 memory_pool_init_array(memory_pool_t *new_pool, u32 n_elements,
+                          size_t element_size, void *buff);
 void memory_pool_destroy(memory_pool_t *pool);
 s32 memory_pool_n_free(memory_pool_t *pool);
 s32 memory_pool_n_allocated(memory_pool_t *pool);
@@ -62,6 +80,9 @@ s32 memory_pool_map(memory_pool_t *pool, void *arg,
                     void (*f)(void *arg, element_t *elem));
 s32 memory_pool_filter(memory_pool_t *pool, void *arg,
                        s8 (*f)(void *arg, element_t *elem));
+s32 memory_pool_filter_batch(memory_pool_t *pool, void *arg,
+                             void (*f)(void *arg, u32 n, element_t **elems,
+                                       u8 *keep));
 s32 memory_pool_clear(memory_pool_t *pool);
 s32 memory_pool_fold(memory_pool_t *pool, void *x0,
                      void (*f)(void *x, element_t *elem));
@@ -84,4 +105,16 @@ s32 memory_pool_product_generator(memory_pool_t *pool, void *x0, u32 n_xs, size_
                                   s8 (*init)(void *x, element_t *elem),
                                   s8 (*next)(void *x, u32 n),
                                   void (*prod)(element_t *new, void *x, u32 n, element_t *elem));
+
+s32 memory_pool_map_parallel(memory_pool_t *pool,
+                             const executor_t *ex, void *arg,
+                             void (*f)(void *arg, element_t *elem));
+s32 memory_pool_fold_parallel(memory_pool_t *pool,
+                              const executor_t *ex,
+                              void *x0, size_t x_size,
+                              void (*f)(void *x, element_t *elem),
+                              void (*combine)(void *x, const void *y));
+s32 memory_pool_filter_parallel(memory_pool_t *pool,
+                                const executor_t *ex, void *arg,
+                                s8 (*f)(void *arg, element_t *elem));
 #endif /* LIBSWIFTNAV_MEMORY_POOL_H */
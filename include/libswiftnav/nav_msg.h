@@ -13,9 +13,13 @@
 #ifndef LIBSWIFTNAV_NAV_MSG_H
 #define LIBSWIFTNAV_NAV_MSG_H
 
+#include <stddef.h>
+
 #include <libswiftnav/common.h>
+#include <libswiftnav/signal.h>
 #include <libswiftnav/ephemeris.h>
 #include <libswiftnav/ionosphere.h>
+#include <libswiftnav/executor.h>
 
 #define NAV_MSG_SUBFRAME_BITS_LEN 14 /* Buffer 448 nav bits. */
 
@@ -54,6 +58,43 @@ typedef struct {
   bool gps_l2c_sv_capability_upd_flag;
 } gps_l1ca_decoded_data_t;
 
+/** Number of words in a GPS L1 C/A subframe. */
+#define GPS_L1CA_SUBFRAME_WORDS 10
+
+/** Raw GPS L1 C/A subframe, e.g. as stored in a nav bit log.
+ *
+ * Each word holds D29* and D30* of the preceding word in bits 31-30 followed
+ * by the 30 transmitted bits D1..D30, i.e. the same layout that the bit-level
+ * decoder extracts from its buffer. The TLM word (word 1) is not used. */
+typedef struct {
+  gnss_signal_t sid;                  /**< Signal ID. */
+  u32 words[GPS_L1CA_SUBFRAME_WORDS]; /**< Words 1 through 10. */
+} gps_l1ca_subframe_t;
+
+/** Navigation data decoded in bulk from raw subframes. */
+typedef struct {
+  /** Words 3 through 10 of subframes 1 to 3 collected for each satellite. */
+  u32 frame_words[NUM_SATS_GPS][4][8];
+  /** Next subframe id expected for each satellite. */
+  u8 next_subframe_id[NUM_SATS_GPS];
+  /** Latest ephemeris decoded for each satellite. */
+  ephemeris_t ephemerides[NUM_SATS_GPS];
+
+  ionosphere_t iono;
+  bool iono_valid;
+
+  u32 gps_l2c_sv_capability;
+  bool l2c_capability_valid;
+
+  u32 n_parity_errors; /**< Number of subframes dropped on parity. */
+} gps_l1ca_nav_store_t;
+
+/** Size of the working area decode_subframes_parallel() needs for `n_groups`
+ * groups, `n_subframes` subframes and an output capacity of `max_eph_out`
+ * ephemerides. */
+#define DECODE_SUBFRAMES_WORK_SIZE(n_groups, n_subframes, max_eph_out) \
+  ((n_groups) * (max_eph_out) * (sizeof(ephemeris_t) + sizeof(u32)) + \
+   ((n_subframes) + 2 * (n_groups) + 1) * sizeof(u32))
 
 void nav_msg_init(nav_msg_t *n);
 s32 nav_msg_update(nav_msg_t *n, bool bit_val);
@@ -61,4 +102,15 @@ bool subframe_ready(nav_msg_t *n);
 s8 process_subframe(nav_msg_t *n, gnss_signal_t sid,
                     gps_l1ca_decoded_data_t *data);
 
+void nav_store_init(gps_l1ca_nav_store_t *s);
+u32 decode_subframes(gps_l1ca_nav_store_t *s,
+                     const gps_l1ca_subframe_t *subframes, u32 n_subframes,
+                     ephemeris_t *eph_out, u32 max_eph_out);
+s32 decode_subframes_parallel(const executor_t *ex,
+                              gps_l1ca_nav_store_t *stores,
+                              const gps_l1ca_subframe_t *subframes,
+                              u32 n_subframes,
+                              ephemeris_t *eph_out, u32 max_eph_out,
+                              void *work, size_t work_size);
+
 #endif /* LIBSWIFTNAV_NAV_MSG_H */
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_NAV_SNAPSHOT_H
+#define LIBSWIFTNAV_NAV_SNAPSHOT_H
+
+#include <libswiftnav/common.h>
+#include <libswiftnav/time.h>
+#include <libswiftnav/ephemeris.h>
+#include <libswiftnav/almanac.h>
+#include <libswiftnav/ionosphere.h>
+
+/** \addtogroup nav_snapshot
+ * \{ */
+
+/** Snapshot format version, bump whenever the encoding changes. */
+#define NAV_SNAPSHOT_VERSION 1
+
+/** Length of the snapshot header in bytes. */
+#define NAV_SNAPSHOT_HEADER_LEN 16
+/** Length of the CRC-24Q trailer in bytes. */
+#define NAV_SNAPSHOT_CRC_LEN 3
+
+#define NAV_SNAPSHOT_OK              0
+#define NAV_SNAPSHOT_ERR_SHORT      -1 /**< Buffer too short. */
+#define NAV_SNAPSHOT_ERR_MAGIC      -2 /**< Not a snapshot. */
+#define NAV_SNAPSHOT_ERR_VERSION    -3 /**< Unsupported format version. */
+#define NAV_SNAPSHOT_ERR_CRC        -4 /**< CRC mismatch. */
+#define NAV_SNAPSHOT_ERR_CORRUPT    -5 /**< Malformed record. */
+
+/** Navigation data state needed to compute a PVT solution.
+ *
+ * The ephemeris and almanac arrays are owned by the caller. When loading a
+ * snapshot `n_ephemerides` and `n_almanacs` give the capacity of the arrays
+ * on entry and the number of restored records on exit. */
+typedef struct {
+  ephemeris_t *ephemerides;  /**< Array of ephemerides. */
+  u16 n_ephemerides;         /**< Number of ephemerides. */
+  almanac_t *almanacs;       /**< Array of almanacs. */
+  u16 n_almanacs;            /**< Number of almanacs. */
+  ionosphere_t iono;         /**< Klobuchar ionospheric parameters. */
+  bool iono_valid;           /**< `iono` has been decoded. */
+  u32 gps_l2c_sv_capability; /**< GPS L2C capability bitmask. */
+  bool l2c_capability_valid; /**< `gps_l2c_sv_capability` has been decoded. */
+} nav_snapshot_t;
+
+/** \} */
+
+u32 nav_snapshot_size(const nav_snapshot_t *s);
+s32 nav_snapshot_save(const nav_snapshot_t *s, u8 *buff, u32 buff_len);
+s8 nav_snapshot_load(const u8 *buff, u32 buff_len, const gps_time_t *t,
+                     nav_snapshot_t *s);
+
+#endif /* LIBSWIFTNAV_NAV_SNAPSHOT_H */
@@ -15,6 +15,8 @@
 #define LIBSWIFTNAV_PVT_H
 
 #include <libswiftnav/common.h>
+#include <libswiftnav/constants.h>
+#include <libswiftnav/executor.h>
 #include <libswiftnav/track.h>
 
 #define PVT_MAX_ITERATIONS 10
@@ -79,6 +81,51 @@ typedef struct __attribute__((packed)) {
   u8 n_used;
 } gnss_solution;
 
+/** Maximum time between epochs over which the previous solution is
+ * propagated by its velocity to seed the next one [s]. */
+#define PVT_WARM_START_MAX_DT 60.0
+
+/** Solver state carried between epochs by calc_PVT_ctx().
+ *
+ * Each receiver should use its own context, see pvt_ctx_init(). */
+typedef struct {
+  /** Last solution: pos[3], clock error, vel[3], clock drift. */
+  double rx_state[8];
+  /** Time of transmission of the measurements of the last solution. */
+  gps_time_t time;
+  /** `rx_state` and `time` hold a valid solution. */
+  bool valid;
+  /** Signals used to form `X`, in measurement order. */
+  gnss_signal_t sids[MAX_CHANNELS];
+  /** Number of signals in `sids`, zero if `X` is not valid. */
+  u8 n_sids;
+  /** Least squares map (G^T G)^-1 G^T from the last converged solution. */
+  double X[4][MAX_CHANNELS];
+} pvt_ctx_t;
+
+/** Measurements of one epoch for calc_PVT_batch(). */
+typedef struct {
+  /** Measurements, length `n_used`. */
+  const navigation_measurement_t *nav_meas;
+  /** Number of measurements. */
+  u8 n_used;
+} pvt_epoch_t;
+
+void pvt_ctx_init(pvt_ctx_t *ctx);
+s8 calc_PVT_ctx(pvt_ctx_t *ctx,
+                const u8 n_used,
+                const navigation_measurement_t nav_meas[n_used],
+                bool disable_raim,
+                gnss_solution *soln,
+                dops_t *dops);
+u32 calc_PVT_batch(const executor_t *ex,
+                   pvt_ctx_t *ctx,
+                   u32 n_epochs,
+                   const pvt_epoch_t epochs[n_epochs],
+                   bool disable_raim,
+                   gnss_solution solns[n_epochs],
+                   dops_t dops[n_epochs],
+                   s8 *codes);
 s8 calc_PVT(const u8 n_used,
             const navigation_measurement_t nav_meas[n_used],
             bool disable_raim,
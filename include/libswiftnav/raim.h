@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_RAIM_H
+#define LIBSWIFTNAV_RAIM_H
+
+#include <libswiftnav/common.h>
+
+/** \addtogroup raim
+ * \{ */
+
+/** Maximum number of states in a RAIM least squares problem. */
+#define RAIM_MAX_STATES 4
+
+/** Least squares solution with one observation removed. */
+typedef struct {
+  double x[RAIM_MAX_STATES]; /**< Solution without the observation. */
+  double residual;           /**< Norm of the residuals of the remaining
+                                  observations. */
+  bool valid;                /**< False if the problem is rank deficient
+                                  without the observation. */
+} raim_subset_t;
+
+/** \} */
+
+s8 raim_leave_one_out(u8 n_obs, u8 n_states, const double *A, const double *y,
+                      double *x, double *residual, raim_subset_t *subsets);
+void raim_subset_residuals(u8 n_obs, u8 n_states, const double *A,
+                           const double *y, u8 dropped,
+                           const raim_subset_t *subset, double *resid);
+
+#endif /* LIBSWIFTNAV_RAIM_H */
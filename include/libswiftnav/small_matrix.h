@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_SMALL_MATRIX_H
+#define LIBSWIFTNAV_SMALL_MATRIX_H
+
+#include <libswiftnav/common.h>
+#include <libswiftnav/constants.h>
+
+/** \addtogroup small_matrix
+ * \{ */
+
+/** Smallest dimension with a specialized set of kernels. */
+#define SMALL_KERNELS_MIN_DIM 3
+/** Largest dimension a specialized set of kernels can be instantiated for.
+ * Full unrolling gains little over the generic kernels beyond it. */
+#define SMALL_KERNELS_CAP_DIM 24
+/** Largest dimension with a specialized set of kernels. This is the largest
+ * DGNSS dimension for the configured `MAX_CHANNELS`, that of the ambiguity
+ * test residuals, `2 * MAX_CHANNELS - 5`, up to `SMALL_KERNELS_CAP_DIM`.
+ * Larger dimensions use the generic kernels. */
+#if 2 * MAX_CHANNELS - 5 < SMALL_KERNELS_CAP_DIM
+#define SMALL_KERNELS_MAX_DIM (2 * MAX_CHANNELS - 5)
+#else
+#define SMALL_KERNELS_MAX_DIM SMALL_KERNELS_CAP_DIM
+#endif
+
+/** Set of matrix kernels for one dimension `n`.
+ * All matrices are dense and row major. Every kernel takes `n` so that the
+ * specialized and generic sets share a signature, the specialized kernels
+ * ignore it. */
+typedef struct {
+  /** The dimension the kernels are specialized for, 0 for the generic set. */
+  u32 n;
+  /** \f$ x \leftarrow U x \f$, U `n` by `n` unit upper triangular. */
+  void (*trmv_unit_upper)(u32 n, const double *U, double *x);
+  /** \f$ x \leftarrow U^T x \f$, U `n` by `n` unit upper triangular. */
+  void (*trmv_unit_upper_t)(u32 n, const double *U, double *x);
+  /** \f$ y \leftarrow A x \f$, A `m` by `n`. */
+  void (*gemv)(u32 m, u32 n, const double *A, const double *x, double *y);
+  /** \f$ y \leftarrow S x \f$, S `n` by `n` symmetric, only the upper
+   * triangle is read. */
+  void (*symv)(u32 n, const double *S, const double *x, double *y);
+  /** In place Cholesky factorization \f$ A = L L^T \f$, reading the lower
+   * triangle of A and zeroing the upper. Returns -1 if A is not positive
+   * definite. */
+  s8 (*cholesky)(u32 n, double *A);
+  /** UDU decomposition, same contract as matrix_udu(). */
+  void (*udu)(u32 n, double *M, double *U, double *D);
+  /** Least squares \f$ \min \|A x - y\| \f$, A `n` by 3. Returns -1 if A is
+   * rank deficient. */
+  s8 (*lesq3)(u32 n, const double *A, const double *y, double x[3]);
+} small_kernels_t;
+
+/** \} */
+
+const small_kernels_t *small_kernels(u32 n);
+
+#endif /* LIBSWIFTNAV_SMALL_MATRIX_H */
@@ -25,12 +25,12 @@ cdef extern from "libswiftnav/amb_kf.h":
     u32 state_dim
     u32 obs_dim
     double amb_drift_var
-    double decor_mtx[MAX_OBS_DIM * MAX_OBS_DIM]
+    double decor_mtx[MAX_OBS_DIM * (MAX_OBS_DIM - 1) / 2]
     double decor_obs_mtx[MAX_STATE_DIM * MAX_OBS_DIM]
     double decor_obs_cov[MAX_OBS_DIM]
     double null_basis_Q[(MAX_STATE_DIM - 3) * MAX_OBS_DIM]
     double state_mean[MAX_STATE_DIM]
-    double state_cov_U[MAX_STATE_DIM * MAX_STATE_DIM]
+    double state_cov_U[MAX_STATE_DIM * (MAX_STATE_DIM - 1) / 2]
     double state_cov_D[MAX_STATE_DIM]
     double l_sos_avg
 
@@ -46,16 +46,18 @@ cdef extern from "libswiftnav/amb_kf.h":
                                   const double *D, double *f, double *g)
 
   # Kalman filter stuff
+  void nkf_unpack_U(const nkf_t *kf, double *U)
+  void nkf_pack_U(nkf_t *kf, const double *U)
   bool_ nkf_update(nkf_t *kf, const double *measurements)
   void set_nkf(nkf_t *kf, double amb_drift_var, double phase_var, double code_var, double amb_init_var,
                u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first, double *dd_measurements, double ref_ecef[3])
   void set_nkf_matrices(nkf_t *kf, double phase_var, double code_var,
                         u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first, double ref_ecef[3])
   void rebase_nkf(nkf_t *kf, u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids)
-  void nkf_state_projection(nkf_t *kf,
-                            u8 num_old_non_ref_sats,
-                            u8 num_new_non_ref_sats,
-                            u8 *ndx_of_new_sat_in_old)
+  s8 nkf_state_projection(nkf_t *kf,
+                          u8 num_old_non_ref_sats,
+                          u8 num_new_non_ref_sats,
+                          u8 *ndx_of_new_sat_in_old)
   void nkf_state_inclusion(nkf_t *kf,
                            u8 num_old_non_ref_sats,
                            u8 num_new_non_ref_sats,
@@ -123,14 +123,22 @@ cdef class KalmanFilter:
       self._thisptr.amb_drift_var = amb_drift_var
 
   property decor_mtx:
+    # Stored packed, only the elements above the unit diagonal.
     def __get__(self):
       cdef np.ndarray[np.double_t, ndim=2, mode="c"] decor_mtx = \
-        np.empty((self.obs_dim/2, self.obs_dim/2), dtype=np.double)
-      memcpy(&decor_mtx[0,0], self._thisptr.decor_mtx, self.obs_dim * self.obs_dim * sizeof(double) / 4)
+        np.eye(self.obs_dim, dtype=np.double)
+      k = 0
+      for i in range(self.obs_dim):
+        for j in range(i + 1, self.obs_dim):
+          decor_mtx[i, j] = self._thisptr.decor_mtx[k]
+          k += 1
       return decor_mtx
     def __set__(self, np.ndarray[np.double_t, ndim=2, mode="c"] decor_mtx):
-      memcpy(self._thisptr.decor_mtx, &decor_mtx[0,0], self.obs_dim * self.obs_dim * sizeof(double) / 4)
-      print 15
+      k = 0
+      for i in range(self.obs_dim):
+        for j in range(i + 1, self.obs_dim):
+          self._thisptr.decor_mtx[k] = decor_mtx[i, j]
+          k += 1
 
   property decor_obs_mtx:
     def __get__(self):
@@ -169,13 +177,14 @@ cdef class KalmanFilter:
       memcpy(self._thisptr.state_mean, &state_mean[0], self.state_dim * sizeof(double))
 
   property state_cov_U:
+    # Stored packed, only the elements above the unit diagonal.
     def __get__(self):
       cdef np.ndarray[np.double_t, ndim=2, mode="c"] state_cov_U = \
         np.empty((self.state_dim, self.state_dim), dtype=np.double)
-      memcpy(&state_cov_U[0,0], self._thisptr.state_cov_U, self.state_dim * self.state_dim * sizeof(double))
+      nkf_unpack_U(&self._thisptr, &state_cov_U[0,0])
       return state_cov_U
     def __set__(self, np.ndarray[np.double_t, ndim=2, mode="c"] state_cov_U):
-      memcpy(self._thisptr.state_cov_U, &state_cov_U[0,0], self.state_dim * self.state_dim * sizeof(double))
+      nkf_pack_U(&self._thisptr, &state_cov_U[0,0])
 
   property state_cov_D:
     def __get__(self):
@@ -38,3 +38,5 @@ cdef extern from "libswiftnav/constants.h":
   float DEFAULT_AMB_DRIFT_VAR
   float DEFAULT_AMB_INIT_VAR
   float DEFAULT_NEW_INT_VAR
+  float DEFAULT_PAR_SUCCESS_RATE
+  float DEFAULT_PAR_RATIO
@@ -31,5 +31,7 @@ DEFAULT_CODE_VAR_KF_ = DEFAULT_CODE_VAR_KF
 DEFAULT_AMB_DRIFT_VAR_ = DEFAULT_AMB_DRIFT_VAR
 DEFAULT_AMB_INIT_VAR_ = DEFAULT_AMB_INIT_VAR
 DEFAULT_NEW_INT_VAR_ = DEFAULT_NEW_INT_VAR
+DEFAULT_PAR_SUCCESS_RATE_ = DEFAULT_PAR_SUCCESS_RATE
+DEFAULT_PAR_RATIO_ = DEFAULT_PAR_RATIO
 
 MAX_CHANNELS_ = MAX_CHANNELS
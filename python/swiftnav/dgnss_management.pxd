@@ -35,6 +35,9 @@ cdef extern from "libswiftnav/dgnss_management.h":
     double vel_init_var
     double amb_init_var
     double new_int_var
+    bool partial_fix
+    double par_success_rate
+    double par_ratio
 
   ctypedef struct ambiguity_state_t:
     ambiguities_t fixed_ambs
@@ -44,6 +47,7 @@ cdef extern from "libswiftnav/dgnss_management.h":
                           double phase_var_kf, double code_var_kf,
                           double amb_drift_var, double amb_init_var,
                           double new_int_var)
+  void dgnss_set_partial_fix(bool enable, double success_rate, double ratio)
   void make_measurements(u8 num_diffs, const sdiff_t *sdiffs, double *raw_measurements)
 
   void dgnss_init(u8 num_sats, sdiff_t *sdiffs, double reciever_ecef[3])
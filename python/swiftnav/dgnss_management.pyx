@@ -33,6 +33,9 @@ def dgnss_set_settings_(phase_var_test, code_var_test,
                      phase_var_kf, code_var_kf,
                      amb_drift_var, amb_init_var,new_int_var)
 
+def dgnss_set_partial_fix_(enable, success_rate, ratio):
+  dgnss_set_partial_fix(enable, success_rate, ratio)
+
 def make_measurements_(sdiffs):
   num_ddiffs = len(sdiffs) - 1
   cdef sdiff_t sdiffs_[32]
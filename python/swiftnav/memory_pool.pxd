@@ -28,6 +28,8 @@ cdef extern from "libswiftnav/memory_pool.h":
 
   memory_pool_t *memory_pool_new(u32 n_elements, size_t element_size)
   s8 memory_pool_init(memory_pool_t *new_pool, u32 n_elements, size_t element_size, void *buff)
+  memory_pool_t *memory_pool_new_array(u32 n_elements, size_t element_size)
+  s8 memory_pool_init_array(memory_pool_t *new_pool, u32 n_elements, size_t element_size, void *buff)
   void memory_pool_destroy(memory_pool_t *pool)
   s32 memory_pool_n_free(memory_pool_t *pool)
   s32 memory_pool_n_allocated(memory_pool_t *pool)
@@ -34,12 +34,110 @@
 #include <libswiftnav/filter_utils.h>
 #include <libswiftnav/amb_kf.h>
 #include <libswiftnav/set.h>
+#include <libswiftnav/small_matrix.h>
 
 
 /** \defgroup amb_kf Float Ambiguity Resolution
  * Preliminary integer ambiguity estimation with a Kalman Filter.
  * \{ */
 
+/* The packed state_cov_U holds the elements above the diagonal of the unit
+ * upper triangular U column by column, so column j, rows 0 to j-1, starts at
+ * j*(j-1)/2 whatever the dimension. */
+#define U_COL(U, j) (&(U)[(j) * ((j) - 1) / 2])
+
+/* Expands the n by n packed unit upper triangular U into rows of length ld
+ * of a dense matrix. */
+static void unpack_U(u32 n, const double *packed, double *U, u32 ld)
+{
+  for (u32 i=0; i<n; i++) {
+    memset(&U[i*ld], 0, i * sizeof(double));
+    U[i*ld + i] = 1;
+  }
+  for (u32 j=1; j<n; j++) {
+    const double *u = U_COL(packed, j);
+    for (u32 i=0; i<j; i++) {
+      U[i*ld + j] = u[i];
+    }
+  }
+}
+
+/* Packs the elements above the diagonal of the n by n unit upper triangular
+ * U, stored in rows of length ld. */
+static void pack_U(u32 n, const double *U, u32 ld, double *packed)
+{
+  for (u32 j=1; j<n; j++) {
+    double *u = U_COL(packed, j);
+    for (u32 i=0; i<j; i++) {
+      u[i] = U[i*ld + j];
+    }
+  }
+}
+
+/* In place x <- U^T * x for the packed n by n unit upper triangular U. */
+static void trmv_packed_t(u32 n, const double *U, double *x)
+{
+  for (u32 j = n; j-- > 0;) {
+    const double *u = U_COL(U, j);
+    double s = x[j];
+    for (u32 i=0; i<j; i++) {
+      s += u[i] * x[i];
+    }
+    x[j] = s;
+  }
+}
+
+/** Get the U matrix of the UDU factored state covariance in dense form.
+ *
+ * \param kf The KF.
+ * \param U  Output unit upper triangular U, `kf->state_dim` by
+ *           `kf->state_dim`.
+ */
+void nkf_unpack_U(const nkf_t *kf, double *U)
+{
+  unpack_U(kf->state_dim, kf->state_cov_U, U, kf->state_dim);
+}
+
+/** Set the U matrix of the UDU factored state covariance from dense form.
+ * Only the elements above the diagonal are read.
+ *
+ * \param kf The KF.
+ * \param U  Unit upper triangular U, `kf->state_dim` by `kf->state_dim`.
+ */
+void nkf_pack_U(nkf_t *kf, const double *U)
+{
+  pack_U(kf->state_dim, U, kf->state_dim, kf->state_cov_U);
+}
+
+/** Get the state covariance, \f$ U D U^T \f$, from the packed UDU factors.
+ *
+ * \param kf  The KF.
+ * \param cov Output covariance, `kf->state_dim` by `kf->state_dim`.
+ */
+void nkf_get_cov(const nkf_t *kf, double *cov)
+{
+  u32 n = kf->state_dim;
+  memset(cov, 0, n * n * sizeof(double));
+  /* Accumulate D_k * U[:,k] * U[:,k]^T into the upper triangle. */
+  for (u32 k=0; k<n; k++) {
+    const double *u = U_COL(kf->state_cov_U, k);
+    double d = kf->state_cov_D[k];
+    for (u32 i=0; i<k; i++) {
+      double du = d * u[i];
+      for (u32 j=i; j<k; j++) {
+        cov[i*n + j] += du * u[j];
+      }
+      cov[i*n + k] += du;
+    }
+    cov[k*n + k] += d;
+  }
+  for (u32 i=0; i<n; i++) {
+    for (u32 j=0; j<i; j++) {
+      cov[i*n + j] = cov[j*n + i];
+    }
+  }
+}
+
 /** Calculation of vectors needed for the innovation scaling.
  * We compute two vectors needed to make the Bierman update,
  * as well as the variance of the innovation.
@@ -59,11 +157,7 @@ double compute_innovation_terms(u32 state_dim, const double *h,
 {
   memcpy(f, h, state_dim * sizeof(double));
   /*  f = U^T * h. */
-  cblas_dtrmv(CblasRowMajor, CblasUpper, CblasTrans, CblasUnit,
-              /* ^ CBLAS_ORDER, CBLAS_UPLO, CBLAS_TRANSPOSE transA, CBLAS_DIAG. */
-              state_dim, U,     /* int N, double *A. */
-              state_dim, f, 1); /*  int lda, double *X, int incX. */
-
+  small_kernels(state_dim)->trmv_unit_upper_t(state_dim, U, f);
 
   /*  g = diag(D) * f.
       alpha = f * g + R = f^T * diag(D) * f + R. */
@@ -76,123 +170,100 @@ double compute_innovation_terms(u32 state_dim, const double *h,
 }
 
 
-/** In place updating of the state cov and k vec using a scalar observation
- * This is from section 10.2.1 of Gibbs [1], with some extra logic for handling
- * singular matrices, dictating that zeros from cov_D dominate in a particular
- * potential 0 / 0.
- * We also make it more robust, by multiplying k by k_scalar <=  1.
- *
- * \param kf        The KF to update
- * \param R         The measurement variance
- * \param f         U^T * h
- * \param g         diag(D) * f
- * \param alpha     The innovation variance
- * \param k_scalar  A scalar to multiply the Kalman gain by (softens outliers).
- *                  Must be between 0 and 1 inclusive.
- * \param innov     The difference between the actual and predicted observation
+/** Bierman measurement update of the columns from `j0` on.
+ * When the leading `j0` elements of f (and so of g) are zero, the leading
+ * columns of U and elements of D are unchanged by the update and are
+ * skipped. The gain still has all elements. The packed kf->state_cov_U and D
+ * are updated in place, column j of U is only read by the step that writes
+ * it.
  */
-void update_kf_state(nkf_t *kf, double R, const double *f, const double *g,
-                     double alpha, double k_scalar,
-                     double innov)
+static void bierman_update(nkf_t *kf, u32 j0, double R,
+                           const double *f, const double *g, double alpha,
+                           double k_scalar, double innov)
 {
-  DEBUG_ENTRY();
-  if (kf->state_dim == 0) {
-    return;
-  }
-  /* If we are scaling the update by 0, we aren't updating at all,
-   * so return early. */
-  if (k_scalar == 0) {
-    return;
-  }
-  assert(k_scalar <= 1);
-  assert(k_scalar >= 0);
   u32 state_dim = kf->state_dim;
-  double *U = kf->state_cov_U;
   double *D = kf->state_cov_D;
   double k[state_dim];
-
-  double U_bar[state_dim * state_dim];
-  double D_bar[state_dim];
-
-  memset(U_bar, 0, state_dim * state_dim * sizeof(double));
-  memset(D_bar, 0,             state_dim * sizeof(double));
-  memset(k,     0,             state_dim * sizeof(double));
+  memset(k, 0, state_dim * sizeof(double));
 
   /* K is inversely proportional to alpha, so we scale alpha to scale K.
    * Solving for an R that would give the properly scaled alpha and thus the
    * correct K, we get the following: */
   R += alpha * (1 - k_scalar) / k_scalar;
-  double gamma = R  + g[0] * f[0];
-  if (D[0] == 0 || R == 0) {
-    /*  This is just an expansion of the other branch with the proper
-     *  0 `div` 0 definitions. */
-    D_bar[0] = 0;
-  }
-  else {
-    D_bar[0] = D[0] * R / gamma;
-  }
-  k[0] = g[0];
-  U_bar[0] = 1;
-  if (DEBUG) {
-    printf("gamma[0] = %f\n", gamma);
-    printf("D_bar[0] = %f\n", D_bar[0]);
-    VEC_PRINTF(k, state_dim);
-    printf("U_bar[:,0] = {");
-    for (u32 i=0; i < state_dim; i++) {
-      printf("%f, ", U_bar[i*state_dim]);
-    }
-    printf("}\n");
-  }
-  for (u32 j=1; j<state_dim; j++) {
+  double gamma = R;
+  for (u32 j=j0; j<state_dim; j++) {
     double gamma_prev = gamma;
     gamma += g[j] * f[j];
     if (D[j] == 0 || gamma_prev == 0) {
       /* This is just an expansion of the other branch with the proper
        * 0 `div` 0 definitions. */
-      D_bar[j] = 0;
+      D[j] = 0;
     }
     else {
-      D_bar[j] = D[j] * gamma_prev / gamma;
+      D[j] = D[j] * gamma_prev / gamma;
     }
     double f_over_gamma = f[j] / gamma_prev;
-    for (u32 i=0; i<=j; i++) {
-      if (k[i] == 0) {
-      /* This is just an expansion of the other branch with the proper
-       * 0 `div` 0 definitions. */
-        U_bar[i*state_dim + j] = U[i*state_dim + j];
-      }
-      else {
+    double *u = U_COL(kf->state_cov_U, j);
+    for (u32 i=0; i<j; i++) {
+      double u_ij = u[i];
+      if (k[i] != 0) {
         /*  U_bar[:,j] = U[:,j] - f[j]/gamma[j-1] * k. */
-        U_bar[i*state_dim + j] = U[i*state_dim + j] - f_over_gamma * k[i];
+        u[i] = u_ij - f_over_gamma * k[i];
       }
-      k[i] += g[j] * U[i*state_dim + j]; /*  k = k + g[j] * U[:,j]. */
+      /* Otherwise this is just an expansion of the other branch with the
+       * proper 0 `div` 0 definitions. */
+      k[i] += g[j] * u_ij; /*  k = k + g[j] * U[:,j]. */
     }
+    /* U[j][j] = 1 and k[j] is still zero. */
+    k[j] = g[j];
     if (DEBUG) {
       printf("gamma[%"PRIu32"] = %f\n", j, gamma);
-      printf("D_bar[%"PRIu32"] = %f\n", j, D_bar[j]);
+      printf("D_bar[%"PRIu32"] = %f\n", j, D[j]);
       VEC_PRINTF(k, state_dim);
-      printf("U_bar[:,%"PRIu32"] = {", j);
-      for (u32 i=0; i < state_dim; i++) {
-        printf("%f, ", U_bar[i*state_dim + j]);
-      }
-      printf("}\n");
     }
   }
-  for (u32 i=0; i<state_dim; i++) {
-    k[i] /= alpha;
-  }
-  memcpy(U, U_bar, state_dim * state_dim * sizeof(double));
-  memcpy(D, D_bar,             state_dim * sizeof(double));
 
   /* Update the KF mean, scaled by some heuristic term for robustness */
-  for (u32 j=0; j<kf->state_dim; j++) {
-      kf->state_mean[j] += k[j] * k_scalar * innov;
+  for (u32 j=0; j<state_dim; j++) {
+      kf->state_mean[j] += k[j] / alpha * k_scalar * innov;
   }
   if (DEBUG) {
-    MAT_PRINTF(U, state_dim, state_dim);
+    VEC_PRINTF(kf->state_cov_U, state_dim * (state_dim - 1) / 2);
     VEC_PRINTF(D, state_dim);
   }
+}
 
+/** In place updating of the state cov and k vec using a scalar observation
+ * This is from section 10.2.1 of Gibbs [1], with some extra logic for handling
+ * singular matrices, dictating that zeros from cov_D dominate in a particular
+ * potential 0 / 0.
+ * We also make it more robust, by multiplying k by k_scalar <=  1.
+ *
+ * \param kf        The KF to update
+ * \param R         The measurement variance
+ * \param f         U^T * h
+ * \param g         diag(D) * f
+ * \param alpha     The innovation variance
+ * \param k_scalar  A scalar to multiply the Kalman gain by (softens outliers).
+ *                  Must be between 0 and 1 inclusive.
+ * \param innov     The difference between the actual and predicted observation
+ */
+void update_kf_state(nkf_t *kf, double R, const double *f, const double *g,
+                     double alpha, double k_scalar,
+                     double innov)
+{
+  DEBUG_ENTRY();
+  if (kf->state_dim == 0) {
+    return;
+  }
+  /* If we are scaling the update by 0, we aren't updating at all,
+   * so return early. */
+  if (k_scalar == 0) {
+    return;
+  }
+  assert(k_scalar <= 1);
+  assert(k_scalar >= 0);
+  bierman_update(kf, 0, R, f, g, alpha, k_scalar, innov);
   DEBUG_EXIT();
 }
 
@@ -220,13 +291,16 @@ double get_sos_innov(const nkf_t *kf, const double *decor_obs)
     return 0;
   }
 
+  const small_kernels_t *k = small_kernels(kf->state_dim);
   double predicted_obs[kf->obs_dim];
-  matrix_multiply(kf->obs_dim, kf->state_dim, 1,
-                  kf->decor_obs_mtx, kf->state_mean, predicted_obs);
+  k->gemv(kf->obs_dim, kf->state_dim,
+          kf->decor_obs_mtx, kf->state_mean, predicted_obs);
+  /* Row i of H * U is (U^T * h_i)^T. */
   double hu[kf->obs_dim * kf->state_dim];
-  /* TODO use the fact that U is unit triangular to save a ton of time */
-  matrix_multiply(kf->obs_dim, kf->state_dim, kf->state_dim,
-                  kf->decor_obs_mtx, kf->state_cov_U, hu);
+  memcpy(hu, kf->decor_obs_mtx, sizeof(hu));
+  for (u8 i=0; i < kf->obs_dim; i++) {
+    trmv_packed_t(kf->state_dim, kf->state_cov_U, &hu[i * kf->state_dim]);
+  }
   /* (H * U * D * U^T * H^T)_ii = (HU * D * HU^T)_ii
    *                            = Sum_kl (HU_ik * D_kl * HU^T_li)
    *                            = Sum_kl (HU_ik * D_kl * HU_il)
@@ -301,39 +375,84 @@ static bool incorporate_obs(nkf_t *kf, double *decor_obs)
   double k_scalar;
   bool is_outlier = outlier_check(kf, decor_obs, &k_scalar);
 
+  u32 n = kf->state_dim;
+  if (n == 0 || k_scalar == 0) {
+    DEBUG_EXIT();
+    return is_outlier;
+  }
+
   for (u32 i=0; i<kf->obs_dim; i++) {
-    double *h = &kf->decor_obs_mtx[kf->state_dim * i]; /* vector of length kf->state_dim. */
+    double *h = &kf->decor_obs_mtx[n * i]; /* vector of length kf->state_dim. */
     double R = kf->decor_obs_cov[i]; /* scalar. */
 
-    double f[kf->state_dim];
-    double g[kf->state_dim];
+    /* The decorrelated observations of the ambiguities have leading zeros,
+     * which stay zero in f = U^T * h as U is upper triangular. With R = 0
+     * the update of the leading elements of D isn't a no-op, see
+     * update_kf_state(). */
+    u32 j0 = 0;
+    if (R > 0) {
+      while (j0 < n && h[j0] == 0) {
+        j0++;
+      }
+    }
 
-    double alpha = compute_innovation_terms(kf->state_dim, h, R,
-                                            kf->state_cov_U, kf->state_cov_D,
-                                            f, g);
+    double f[n];
+    double g[n];
+    double alpha = R;
     double predicted_obs = 0;
-    /* TODO take advantage of sparsity of h. */
-    for (u32 j=0; j<kf->state_dim; j++) {
+    for (u32 j=j0; j<n; j++) {
+      /*  f = U^T * h. */
+      const double *u = U_COL(kf->state_cov_U, j);
+      f[j] = h[j];
+      for (u32 l=j0; l<j; l++) {
+        f[j] += u[l] * h[l];
+      }
+      g[j] = kf->state_cov_D[j] * f[j];
+      alpha += f[j] * g[j];
       predicted_obs += h[j] * kf->state_mean[j];
     }
     double obs_minus_predicted_obs = decor_obs[i] - predicted_obs;
 
     /* updates kf state. */
-    update_kf_state(kf, R, f, g, alpha, k_scalar, obs_minus_predicted_obs);
+    bierman_update(kf, j0, R, f, g, alpha, k_scalar,
+                   obs_minus_predicted_obs);
   }
   DEBUG_EXIT();
   return is_outlier;
 }
 
+/* Stores the part of the dense unit upper triangular decorrelation matrix
+ * above the diagonal in kf->decor_mtx. */
+static void pack_decor_mtx(nkf_t *kf, const double *decor_mtx)
+{
+  double *row = kf->decor_mtx;
+  for (u32 i=0; i < kf->obs_dim; i++) {
+    u32 len = kf->obs_dim - i - 1;
+    memcpy(row, &decor_mtx[i * kf->obs_dim + i + 1], len * sizeof(double));
+    row += len;
+  }
+}
+
+/* In place multiplication by the packed unit upper triangular decorrelation
+ * matrix, x <- decor_mtx * x. */
+static void decorrelate(const nkf_t *kf, double *x)
+{
+  const double *row = kf->decor_mtx;
+  for (u32 i=0; i < kf->obs_dim; i++) {
+    for (u32 j=i+1; j < kf->obs_dim; j++) {
+      x[i] += row[j - i - 1] * x[j];
+    }
+    row += kf->obs_dim - i - 1;
+  }
+}
+
 /*  Turns (phi, rho) into Q_tilde * (phi, rho). */
 static void make_residual_measurements(const nkf_t *kf, const double *measurements, double *resid_measurements)
 {
   u8 constraint_dim = CLAMP_DIFF(kf->state_dim, 3);
-  cblas_dgemv (CblasRowMajor, CblasNoTrans, /* Order, TransA. */
-               constraint_dim, kf->state_dim, /*  M, N. */
-               1, kf->null_basis_Q, kf->state_dim, /*  alpha A, lda. */
-               measurements, 1, /*  X, incX. */
-               0, resid_measurements, 1); /*  beta, Y, incY. */
+  small_kernels(kf->state_dim)->gemv(constraint_dim, kf->state_dim,
+                                     kf->null_basis_Q, measurements,
+                                     resid_measurements);
   for (u8 i=0; i< kf->state_dim; i++) {
     resid_measurements[i+constraint_dim] =
       simple_amb_measurement(measurements[i],
@@ -341,25 +460,87 @@ static void make_residual_measurements(const nkf_t *kf, const double *measuremen
   }
 }
 
+/* Rank one update of the UDU factored state covariance with the packed U,
+ * U D U^T += c a a^T. This is matrix_udu_rank_one() on the packed form. */
+static void udu_rank_one_packed(u32 n, double *U, double *D, double c,
+                                const double *a)
+{
+  assert(c >= 0);
+  u32 m = n;
+  while (m > 0 && a[m-1] == 0) {
+    m--;
+  }
+  if (m == 0 || c == 0) {
+    return;
+  }
+
+  double v[m];
+  memcpy(v, a, m * sizeof(double));
+  for (u32 j = m - 1; j > 0; j--) {
+    double s = v[j];
+    double d = D[j] + c * s * s;
+    if (d > 0) {
+      double b = c / d;
+      double beta = s * b;
+      c = b * D[j];
+      double *u = U_COL(U, j);
+      for (u32 i = 0; i < j; i++) {
+        v[i] -= s * u[i];
+        u[i] += beta * v[i];
+      }
+    }
+    D[j] = d;
+  }
+  D[0] += c * v[0] * v[0];
+}
+
+/** Add low rank process noise to the KF state covariance.
+ * The covariance is updated in its UDU form by a rank one update per term,
+ * \f$ \Sigma \mathrel{+}= \sum_k c_k v_k v_k^T \f$.
+ *
+ * For example the strictly correct drift for changes equally likely on all
+ * channels, \f$ (I + 1 1^T) \sigma^2 \f$, is `state_dim + 1` terms, the unit
+ * vectors and the vector of ones, all with \f$ c_k = \sigma^2 \f$.
+ *
+ * \param kf   The KF to be updated.
+ * \param rank The number of terms.
+ * \param c    The non-negative scale of each term, length `rank`.
+ * \param V    The vectors of each term, one per row, `rank` by
+ *             `kf->state_dim`.
+ */
+void nkf_add_process_noise(nkf_t *kf, u32 rank, const double *c,
+                           const double *V)
+{
+  for (u32 k=0; k<rank; k++) {
+    udu_rank_one_packed(kf->state_dim, kf->state_cov_U, kf->state_cov_D,
+                        c[k], &V[k * kf->state_dim]);
+  }
+}
+
 /** The prediction step of the KF.
  * Since we're just doing parameter estimation, where we allow the parameters
  * to drift a bit (cycle slips and biases), we only update the covariances.
  *
  * To be really strict, since changes are equally likely on all channels,
  * This should be += (I + 1 * 1^T)*var instead of I*var, but it's
- * unlikely to be significant.
+ * unlikely to be significant. See nkf_add_process_noise() for the former.
+ *
+ * The diagonal is added in UDU form, one unit vector at a time, so that
+ * adding to element i only updates the leading i+1 columns of U.
  *
  * \param kf The KF to be updated.
  */
 static void diffuse_state(nkf_t *kf)
 {
-  double cov[kf->state_dim * kf->state_dim];
-  matrix_reconstruct_udu(kf->state_dim, kf->state_cov_U, kf->state_cov_D, cov);
+  double e[kf->state_dim];
+  memset(e, 0, sizeof(e));
   for (u8 i=0; i< kf->state_dim; i++) {
     /* TODO make this a tunable parameter defined at the right time. */
-    cov[i*kf->state_dim + i] += kf->amb_drift_var;
+    e[i] = 1;
+    udu_rank_one_packed(kf->state_dim, kf->state_cov_U, kf->state_cov_D,
+                        kf->amb_drift_var, e);
+    e[i] = 0;
   }
-  matrix_udu(kf->state_dim, cov, kf->state_cov_U, kf->state_cov_D);
 }
 
 /** In place updating of the KF state mean and covariance.
@@ -380,9 +561,7 @@ bool nkf_update(nkf_t *kf, const double *measurements)
   make_residual_measurements(kf, measurements, resid_measurements);
 
   /* Replaces residual measurements by their decorrelated version. */
-  cblas_dtrmv(CblasRowMajor, CblasUpper, CblasNoTrans, CblasUnit, /*  Order, Uplo, TransA, Diag. */
-              kf->obs_dim, kf->decor_mtx, kf->obs_dim, /*  N, A, lda. */
-              resid_measurements, 1); /*  X, incX. */
+  decorrelate(kf, resid_measurements);
 
   /*  Prediction update */
   diffuse_state(kf);
@@ -390,7 +569,7 @@ bool nkf_update(nkf_t *kf, const double *measurements)
   bool is_bad_measurement = incorporate_obs(kf, resid_measurements);
 
   if (DEBUG) {
-    MAT_PRINTF(kf->state_cov_U, kf->state_dim, kf->state_dim);
+    VEC_PRINTF(kf->state_cov_U, kf->state_dim * (kf->state_dim - 1) / 2);
     VEC_PRINTF(kf->state_cov_D, kf->state_dim);
     VEC_PRINTF(kf->state_mean, kf->state_dim);
   }
@@ -399,7 +578,8 @@ bool nkf_update(nkf_t *kf, const double *measurements)
 }
 
 /* Initializes the ambiguity means and variances.
- * Note that the covariance is  in UDU form, and U starts as identity. */
+ * Note that the covariance is  in UDU form, and U starts as identity, i.e. the
+ * packed elements above its diagonal are zero. */
 static void initialize_state(nkf_t *kf, double *dd_measurements, double init_var)
 {
   u8 num_dds = kf->state_dim;
@@ -410,7 +590,7 @@ static void initialize_state(nkf_t *kf, double *dd_measurements, double init_var
     /*  Sigma begins as a diagonal. */
     kf->state_cov_D[i] = init_var;
   }
-  matrix_eye(num_dds, kf->state_cov_U);
+  memset(kf->state_cov_U, 0, num_dds * (num_dds - 1) / 2 * sizeof(double));
 }
 
 static void QR_part1(integer m, integer n, double *A, double *tau)
@@ -619,7 +799,7 @@ static void get_kf_matrices(u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first,
     assign_phase_obs_null_basis(num_dds, DE, null_basis_Q);
     assign_residual_obs_cov(num_dds, phase_var, code_var, null_basis_Q, Sig);
     /* TODO U seems to have that fancy blockwise structure we love so much. Use it. */
-    matrix_udu(res_dim, Sig, U_inv, D); /* U_inv holds U after this. */
+    small_kernels(res_dim)->udu(res_dim, Sig, U_inv, D); /* U_inv holds U after this. */
     invert_U(res_dim, U_inv);
     /* TODO this also has fancy structure. */
     assign_H_prime(res_dim, constraint_dim, num_dds, null_basis_Q, U_inv, H_prime);
@@ -628,7 +808,7 @@ static void get_kf_matrices(u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first,
     assign_simple_sig(num_dds,
                       phase_var + code_var / (GPS_L1_LAMBDA_NO_VAC * GPS_L1_LAMBDA_NO_VAC),
                       Sig);
-    matrix_udu(res_dim, Sig, U_inv, D); /* U_inv holds U after this. */
+    small_kernels(res_dim)->udu(res_dim, Sig, U_inv, D); /* U_inv holds U after this. */
     invert_U(res_dim, U_inv);
 
     /* H = I in this case, so H' = U^-1 * H = U^-1. */
@@ -662,12 +842,14 @@ void set_nkf_matrices(nkf_t *kf, double phase_var, double code_var,
   u32 constraint_dim = CLAMP_DIFF(num_diffs, 3);
   kf->obs_dim = num_diffs + constraint_dim;
 
+  double decor_mtx[kf->obs_dim * kf->obs_dim];
   get_kf_matrices(num_sdiffs, sdiffs_with_ref_first,
                   ref_ecef,
                   phase_var, code_var,
                   kf->null_basis_Q,
-                  kf->decor_mtx, kf->decor_obs_cov,
+                  decor_mtx, kf->decor_obs_cov,
                   kf->decor_obs_mtx);
+  pack_decor_mtx(kf, decor_mtx);
 }
 
 /** Currently this function is only used to find the index of a prn in a
@@ -720,73 +902,197 @@ void rebase_mean_N(double *mean, const u8 num_sats, const gnss_signal_t *old_sid
   memcpy(mean, new_mean, (state_dim) * sizeof(double));
 }
 
+/* Index in the old basis of each new state element, given a change of
+ * reference. The old reference takes the place of the new one. */
+static void rebase_src_ndxs(u8 num_sats, const gnss_signal_t *old_sids,
+                            const gnss_signal_t *new_sids, u8 ref_ndx,
+                            u8 *src)
+{
+  for (u8 i=0; i<num_sats-1; i++) {
+    if (sid_is_equal(new_sids[1+i], old_sids[0])) {
+      src[i] = ref_ndx;
+    } else {
+      s32 ndx = find_index_of_signal(num_sats-1, new_sids[1+i], &old_sids[1]);
+      assert(ndx != -1);
+      src[i] = ndx;
+    }
+  }
+}
+
 /* REQUIRES num_sats > 1 */
-static void assign_state_rebase_mtx(const u8 num_sats, const gnss_signal_t *old_sids,
-                                    const gnss_signal_t *new_sids, double *rebase_mtx)
+/** Change the reference of a DD ambiguity covariance matrix.
+ * A change of reference from r to r' maps the DDs to
+ * \f$ x'_k = x_k - x_{r'} \f$, and \f$ x'_r = -x_{r'} \f$ for the old
+ * reference, followed by a reordering. Element (i, j) of the result only
+ * depends on four elements of the input, so this is \f$ O(n^2) \f$.
+ *
+ * \param state_cov The covariance, `num_sats-1` by `num_sats-1`, updated in
+ *                  place.
+ * \param num_sats  The number of satellites, including the reference.
+ * \param old_sids  The satellites of the current basis, reference first.
+ * \param new_sids  The satellites of the new basis, reference first.
+ */
+void rebase_covariance_sigma(double *state_cov, const u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids)
 {
   assert(num_sats > 1);
   u8 state_dim = num_sats - 1;
 
-  memset(rebase_mtx, 0, state_dim * state_dim * sizeof(double));
-  gnss_signal_t old_ref = old_sids[0];
-  gnss_signal_t new_ref = new_sids[0];
-
-  if (sid_is_equal(old_ref, new_ref)) {
-    /* No rebase needs to occur, return identity. */
-    matrix_eye(state_dim, rebase_mtx);
+  if (sid_is_equal(old_sids[0], new_sids[0])) {
+    /* Nothing needs to be done; same basis. */
     return;
   }
 
-  s32 index_of_new_ref_in_old = find_index_of_signal(num_sats-1, new_ref, &old_sids[1]);
-  assert(index_of_new_ref_in_old != -1);
-  s32 index_of_old_ref_in_new = find_index_of_signal(num_sats-1, old_ref, &new_sids[1]);
-  assert(index_of_old_ref_in_new != -1);
-
+  s32 r = find_index_of_signal(num_sats-1, new_sids[0], &old_sids[1]);
+  assert(r != -1);
+  u8 src[state_dim];
+  rebase_src_ndxs(num_sats, old_sids, new_sids, r, src);
+
+  double old_cov[state_dim * state_dim];
+  memcpy(old_cov, state_cov, sizeof(old_cov));
+  /* x'_k = x_k - w_k * x_r with w = 1 + e_r. */
+  double w[state_dim];
+  for (u8 k=0; k<state_dim; k++) {
+    w[k] = (k == r) ? 2 : 1;
+  }
+  double s_rr = old_cov[r*state_dim + r];
   for (u8 i=0; i<state_dim; i++) {
-    rebase_mtx[i*state_dim + index_of_new_ref_in_old] = -1;
-    if (i != (u8) index_of_old_ref_in_new) {
-      s32 index_of_this_sat_in_old_basis = find_index_of_signal(num_sats-1, new_sids[i+1], &old_sids[1]);
-      assert(index_of_this_sat_in_old_basis != -1);
-      rebase_mtx[i*state_dim + index_of_this_sat_in_old_basis] = 1;
+    u8 k = src[i];
+    for (u8 j=0; j<state_dim; j++) {
+      u8 l = src[j];
+      state_cov[i*state_dim + j] = old_cov[k*state_dim + l]
+                                   - w[l] * old_cov[k*state_dim + r]
+                                   - w[k] * old_cov[r*state_dim + l]
+                                   + w[k] * w[l] * s_rr;
     }
   }
 }
 
-/* REQUIRES num_sats > 1 */
-void rebase_covariance_sigma(double *state_cov, const u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids)
+/** Swap elements k and k+1 of the state of a UDU factored covariance.
+ * With the state written as \f$ x = U e \f$ for independent \f$ e \f$, only
+ * the two innovations shared by the swapped elements need to be
+ * re-decorrelated, so this is \f$ O(n) \f$.
+ *
+ * \param n The state dimension.
+ * \param U The packed unit upper triangular U, updated in place.
+ * \param D The diagonal D, updated in place.
+ * \param k The first of the two elements.
+ */
+static void udu_swap_adjacent(u32 n, double *U, double *D, u32 k)
 {
-  assert(num_sats > 1);
-  u8 state_dim = num_sats - 1;
-
-  double rebase_mtx[state_dim * state_dim];
-  assign_state_rebase_mtx(num_sats, old_sids, new_sids, rebase_mtx);
+  assert(k + 1 < n);
+  double *u_k = U_COL(U, k);
+  double *u_k1 = U_COL(U, k+1);
+  double a = u_k1[k];
+  double d1 = D[k];
+  double d2 = D[k+1];
+
+  /* The new last of the pair is the old x_k, with innovation
+   * f = e_k + a * e_(k+1). */
+  double d2_new = d1 + a * a * d2;
+  double b = 0;
+  double d1_new = d2;
+  if (d2_new > 0) {
+    b = a * d2 / d2_new;
+    d1_new = d1 * d2 / d2_new;
+  }
 
-  double intermediate_cov[state_dim * state_dim];
-  /* TODO make more efficient via structure of rebase_mtx. */
-  cblas_dsymm(CblasRowMajor, CblasRight, CblasUpper, /* CBLAS_ORDER, CBLAS_SIDE, CBLAS_UPLO. */
-              state_dim, state_dim,                  /* int M, int N. */
-              1, state_cov, state_dim,               /* double alpha, double *A, int lda. */
-              rebase_mtx, state_dim,                 /* double *B, int ldb. */
-              0, intermediate_cov, state_dim);       /* double beta, double *C, int ldc. */
+  for (u32 i=0; i<k; i++) {
+    double c = u_k1[i] - a * u_k[i];
+    u_k1[i] = u_k[i] + b * c;
+    u_k[i] = c;
+  }
+  for (u32 j=k+2; j<n; j++) {
+    double *u = U_COL(U, j);
+    double t = u[k];
+    u[k] = u[k+1];
+    u[k+1] = t;
+  }
+  u_k1[k] = b;
+  D[k] = d1_new;
+  D[k+1] = d2_new;
+}
 
-  /* TODO make more efficient via the structure of rebase_mtx. */
-  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, /* CBLAS_ORDER, CBLAS_TRANSPOSE transA, cBLAS_TRANSPOSE transB. */
-              state_dim, state_dim, state_dim,         /* int M, int N, int K. */
-              1, intermediate_cov, state_dim,          /* double alpha, double *A, int lda. */
-              rebase_mtx, state_dim,                   /* double *B, int ldb. */
-              0, state_cov, state_dim);                /* beta, double *C, int ldc. */
+/** Reorder the state of a UDU factored covariance by adjacent swaps.
+ * Costs \f$ O(n) \f$ per position each element moves, so moving a single
+ * element is \f$ O(n^2) \f$.
+ *
+ * \param n   The state dimension.
+ * \param U   The packed unit upper triangular U, updated in place.
+ * \param D   The diagonal D, updated in place.
+ * \param src The current index of each element of the new order, a
+ *            permutation of `0..n-1`.
+ */
+static void udu_permute(u32 n, double *U, double *D, const u8 *src)
+{
+  u8 cur[n];
+  for (u8 i=0; i<n; i++) {
+    cur[i] = i;
+  }
+  for (u8 t=0; t<n; t++) {
+    u8 p = t;
+    while (cur[p] != src[t]) {
+      p++;
+      assert(p < n);
+    }
+    for (; p > t; p--) {
+      udu_swap_adjacent(n, U, D, p - 1);
+      u8 tmp = cur[p];
+      cur[p] = cur[p-1];
+      cur[p-1] = tmp;
+    }
+  }
 }
 
 /* REQUIRES num_sats > 1 */
+/** Change the reference of a UDU factored DD ambiguity covariance.
+ * The new reference is moved to the last state element, where the change
+ * of reference, see rebase_covariance_sigma(), only alters the last column
+ * of U. The result is then reordered to the new basis. Both steps keep the
+ * factorization so this is \f$ O(n^2) \f$ when, as usual, the bases only
+ * differ by the position of the two references.
+ *
+ * \param state_cov_U The unit upper triangular U, packed as
+ *                    nkf_t::state_cov_U, updated in place.
+ * \param state_cov_D The diagonal D, updated in place.
+ * \param num_sats    The number of satellites, including the reference.
+ * \param old_sids    The satellites of the current basis, reference first.
+ * \param new_sids    The satellites of the new basis, reference first.
+ */
 void rebase_covariance_udu(double *state_cov_U, double *state_cov_D, u8 num_sats, const gnss_signal_t *old_sids, const gnss_signal_t *new_sids)
 {
   assert(num_sats > 1);
   u8 state_dim = num_sats - 1;
 
-  double state_cov[state_dim * state_dim];
-  matrix_reconstruct_udu(state_dim, state_cov_U, state_cov_D, state_cov);
-  rebase_covariance_sigma(state_cov, num_sats, old_sids, new_sids);
-  matrix_udu(state_dim, state_cov, state_cov_U, state_cov_D);
+  if (sid_is_equal(old_sids[0], new_sids[0])) {
+    /* Nothing needs to be done; same basis. */
+    return;
+  }
+
+  s32 r = find_index_of_signal(num_sats-1, new_sids[0], &old_sids[1]);
+  assert(r != -1);
+
+  for (u8 k=r; k+1<state_dim; k++) {
+    udu_swap_adjacent(state_dim, state_cov_U, state_cov_D, k);
+  }
+  /* With x = U e and x_r = e_r last, x'_k = x_k - x_r and
+   * x'_r = -x_r = -e_r. Flipping the sign of e_r keeps U unit triangular. */
+  u8 last = state_dim - 1;
+  double *u = U_COL(state_cov_U, last);
+  for (u8 k=0; k<last; k++) {
+    u[k] = 1 - u[k];
+  }
+
+  /* The old reference is now last, the others keep their old order. */
+  u8 src[state_dim];
+  rebase_src_ndxs(num_sats, old_sids, new_sids, r, src);
+  for (u8 i=0; i<state_dim; i++) {
+    if (src[i] == r) {
+      src[i] = last;
+    } else if (src[i] > r) {
+      src[i]--;
+    }
+  }
+  udu_permute(state_dim, state_cov_U, state_cov_D, src);
 }
 
 
@@ -795,35 +1101,78 @@ void rebase_nkf(nkf_t *kf, u8 num_sats, const gnss_signal_t *old_sids, const gns
 {
   assert(num_sats > 1);
   rebase_mean_N(kf->state_mean, num_sats, old_sids, new_sids);
-  rebase_covariance_udu(kf->state_cov_U, kf->state_cov_D, num_sats, old_sids, new_sids);
+  rebase_covariance_udu(kf->state_cov_U, kf->state_cov_D, num_sats,
+                        old_sids, new_sids);
 }
 
-void nkf_state_projection(nkf_t *kf,
-                                    u8 num_old_non_ref_sats,
-                                    u8 num_new_non_ref_sats,
-                                    u8 *ndx_of_new_sat_in_old)
+/** Remove sats from the Kalman Filter.
+ * The dropped elements are moved to the front of the state, where they can
+ * be marginalized out of the UDU factorization by removing their rows and
+ * columns, since no other element depends on their innovations.
+ *
+ * \param kf                    The KF struct to be updated
+ * \param num_old_non_ref_sats  The old number of DDs
+ * \param num_new_non_ref_sats  The new number of DDs
+ * \param ndx_of_new_sat_in_old The index in the old state of each element
+ *                              of the new state.
+ * \return 0 on success, -1 if the dimensions or indices do not describe a
+ *         projection, in which case the filter is left unchanged.
+ */
+s8 nkf_state_projection(nkf_t *kf,
+                        u8 num_old_non_ref_sats,
+                        u8 num_new_non_ref_sats,
+                        u8 *ndx_of_new_sat_in_old)
 {
   u8 old_state_dim = num_old_non_ref_sats;
-  double old_cov[old_state_dim * old_state_dim];
-  matrix_reconstruct_udu(old_state_dim, kf->state_cov_U, kf->state_cov_D, old_cov);
-
   u8 new_state_dim = num_new_non_ref_sats;
-  double new_cov[new_state_dim * new_state_dim];
-  double new_mean[new_state_dim];
+  if (new_state_dim > old_state_dim) {
+    return -1;
+  }
+  u8 num_dropped = old_state_dim - new_state_dim;
+  if (old_state_dim == 0) {
+    /* Nothing to project from an empty state. */
+    return 0;
+  }
 
-  for (u8 i=0; i<num_new_non_ref_sats; i++) {
+  /* Check that the indices are in range and distinct before using them. */
+  bool kept[old_state_dim];
+  memset(kept, 0, sizeof(kept));
+  for (u8 i=0; i<new_state_dim; i++) {
     u8 ndxi = ndx_of_new_sat_in_old[i];
+    if (ndxi >= old_state_dim || kept[ndxi]) {
+      return -1;
+    }
+    kept[ndxi] = true;
+  }
+
+  u8 src[old_state_dim];
+  double new_mean[new_state_dim];
+  for (u8 i=0; i<new_state_dim; i++) {
+    u8 ndxi = ndx_of_new_sat_in_old[i];
+    src[num_dropped + i] = ndxi;
     new_mean[i] = kf->state_mean[ndxi];
-    for (u8 j=0; j<num_new_non_ref_sats; j++) {
-      u8 ndxj = ndx_of_new_sat_in_old[j];
-      new_cov[i*new_state_dim + j] = old_cov[ndxi*old_state_dim + ndxj];
+  }
+  u8 d = 0;
+  for (u8 i=0; i<old_state_dim; i++) {
+    if (!kept[i]) {
+      src[d++] = i;
     }
   }
 
-  /* Put it all back into the kf. */
+  udu_permute(old_state_dim, kf->state_cov_U, kf->state_cov_D, src);
+
+  /* Drop the leading rows and columns. Each column moves towards the start
+   * of the packed U, so this can be done in place in order. */
+  for (u8 j=1; j<new_state_dim; j++) {
+    memmove(U_COL(kf->state_cov_U, j),
+            &U_COL(kf->state_cov_U, j + num_dropped)[num_dropped],
+            j * sizeof(double));
+  }
+  memmove(kf->state_cov_D, &kf->state_cov_D[num_dropped],
+          new_state_dim * sizeof(double));
   memcpy(kf->state_mean, new_mean, new_state_dim * sizeof(double));
-  matrix_udu(new_state_dim, new_cov, kf->state_cov_U, kf->state_cov_D);
   /* NOTE: IT DOESN'T UPDATE THE OBSERVATION OR TRANSITION MATRICES, JUST THE STATE. */
+  return 0;
 }
 
 /** Add new sats to the Kalman Filter
@@ -832,6 +1181,10 @@ void nkf_state_projection(nkf_t *kf,
  * in Z and making initial estimates for the state of the Y elements
  * of Z. Here, X is the space of old satellite DDs, and Y is new sats.
  *
+ * The new elements are independent of the old, so they are appended to the
+ * UDU factorization and then moved into place. The packed columns of U
+ * don't depend on the dimension, so appending only adds zero columns.
+ *
  * \param kf                    The KF struct to be updated
  * \param num_old_non_ref_sats  The old number of DDs (dimension of X)
  * \param num_new_non_ref_sats  The new number of DDs (dimension of Z)
@@ -854,30 +1207,38 @@ void nkf_state_inclusion(nkf_t *kf,
                          double int_init_var)
 {
   u8 old_state_dim = num_old_non_ref_sats;
-  double old_cov[old_state_dim * old_state_dim];
-  matrix_reconstruct_udu(old_state_dim, kf->state_cov_U, kf->state_cov_D, old_cov);
-
   u8 new_state_dim = num_new_non_ref_sats;
-  double new_cov[new_state_dim * new_state_dim];
-  memset(new_cov, 0, new_state_dim * new_state_dim * sizeof(double));
-  double new_mean[new_state_dim];
-  /* Initialize the ambiguity means/vars, including estimates for new sats. */
-  memcpy(new_mean, init_amb_est, new_state_dim * sizeof(double));
-  for (u8 i=0; i<num_new_non_ref_sats; i++) {
-    new_cov[i*new_state_dim + i] = int_init_var;
+  assert(new_state_dim >= old_state_dim);
+  if (new_state_dim == 0) {
+    return;
   }
 
-  /* Overwrite the ambiguity means/covars for the sats we were already tracking
-   */
-  for (u8 i=0; i<num_old_non_ref_sats; i++) {
+  /* Initialize the ambiguity means, including estimates for new sats, and
+   * find where each new element currently is, old elements first. */
+  double new_mean[new_state_dim];
+  memcpy(new_mean, init_amb_est, new_state_dim * sizeof(double));
+  s16 old_ndx[new_state_dim];
+  memset(old_ndx, -1, sizeof(old_ndx));
+  for (u8 i=0; i<old_state_dim; i++) {
     u8 ndxi = ndx_of_old_sat_in_new[i];
     new_mean[ndxi] = kf->state_mean[i];
-    for (u8 j=0;j<num_old_non_ref_sats; j++) {
-      u8 ndxj = ndx_of_old_sat_in_new[j];
-      new_cov[ndxi*new_state_dim + ndxj] = old_cov[i*old_state_dim + j];
-    }
+    old_ndx[ndxi] = i;
+  }
+  u8 src[new_state_dim];
+  u8 appended = old_state_dim;
+  for (u8 i=0; i<new_state_dim; i++) {
+    src[i] = old_ndx[i] >= 0 ? old_ndx[i] : appended++;
   }
-  matrix_udu(new_state_dim, new_cov, kf->state_cov_U, kf->state_cov_D);
+  assert(appended == new_state_dim);
+
+  /* Widen U, the new elements are independent with variance
+   * int_init_var. */
+  for (u8 i=old_state_dim; i<new_state_dim; i++) {
+    memset(U_COL(kf->state_cov_U, i), 0, i * sizeof(double));
+    kf->state_cov_D[i] = int_init_var;
+  }
+
+  udu_permute(new_state_dim, kf->state_cov_U, kf->state_cov_D, src);
   memcpy(kf->state_mean, new_mean, new_state_dim * sizeof(double));
 }
 
@@ -11,6 +11,7 @@
  */
 
 #include <assert.h>
+#include <math.h>
 #include <clapack.h>
 #include <inttypes.h>
 #include <cblas.h>
@@ -29,6 +30,7 @@
 #include <libswiftnav/printing_utils.h>
 #include <libswiftnav/filter_utils.h>
 #include <libswiftnav/sats_management.h>
+#include <libswiftnav/small_matrix.h>
 
 #define RAW_PHASE_BIAS_VAR 0
 #define DECORRELATED_PHASE_BIAS_VAR 0
@@ -46,20 +48,123 @@ static void matrix_multiply_z_t(u32 n, u32 m, u32 p, const z_t *a,
 /** \defgroup ambiguity_test Integer Ambiguity Resolution
  * Integer ambiguity resolution using bayesian hypothesis testing.
  * \{ */
-void create_empty_ambiguity_test(ambiguity_test_t *amb_test)
+
+/** Initialize an empty ambiguity test with its own hypothesis pool.
+ *
+ * Ambiguity tests created with create_empty_ambiguity_test() all share one
+ * statically allocated pool, so only one of them can be in use at a time.
+ * This binds the test to a caller supplied pool instead.
+ *
+ * \param amb_test Ambiguity test to initialize
+ * \param pool Pool to hold the hypotheses, initialized here
+ * \param pool_buff Working area for the pool, at least
+ *                  `AMBIGUITY_TEST_POOL_BUFF_SIZE` bytes
+ */
+void init_ambiguity_test(ambiguity_test_t *amb_test, memory_pool_t *pool,
+                         void *pool_buff)
 {
-  static u8 pool_buff[MAX_HYPOTHESES*(sizeof(hypothesis_t) + sizeof(void *))];
-  static memory_pool_t pool;
-  amb_test->pool = &pool;
-  memory_pool_init(amb_test->pool, MAX_HYPOTHESES, sizeof(hypothesis_t), pool_buff);
+  init_ambiguity_test_arena(amb_test, pool, MAX_HYPOTHESES,
+                            AMBIGUITY_OVERFLOW_DEFER,
+                            pool_buff, AMBIGUITY_TEST_POOL_BUFF_SIZE);
+}
+
+/** Initialize an empty ambiguity test with a runtime hypothesis capacity.
+ *
+ * The hypothesis pool and, for `AMBIGUITY_OVERFLOW_TOP_K`, the working area
+ * used to rank candidate hypotheses are taken from a caller supplied arena.
+ * The capacity is kept when the test is reset with reset_ambiguity_test().
+ *
+ * With `AMBIGUITY_OVERFLOW_TOP_K`, if even the fewest satellites that can be
+ * added need more hypotheses than fit, only the most likely are kept. They
+ * are ranked by their current log likelihood plus the log prior of the
+ * float filter in the decorrelated space. As the existing hypotheses stay in
+ * the pool while the new ones are generated, at most `max_hyps` minus the
+ * number of existing hypotheses are kept.
+ *
+ * With `AMBIGUITY_OVERFLOW_BEST_FIRST` all the addible satellites are added
+ * at once. Candidates for them are searched in order of prior likelihood,
+ * up to an equal share of the pool per existing hypothesis, and those
+ * consistent with each hypothesis are added.
+ *
+ * \param amb_test Ambiguity test to initialize
+ * \param pool Pool to hold the hypotheses, initialized here
+ * \param max_hyps Maximum number of hypotheses
+ * \param overflow_policy Policy when added satellites overflow the pool
+ * \param arena Working area, at least
+ *              `AMBIGUITY_TEST_ARENA_SIZE(max_hyps, overflow_policy)` bytes
+ * \param arena_size Size of the working area in bytes
+ * \return 0 on success, -1 if `max_hyps` is zero or the arena is too small
+ */
+s8 init_ambiguity_test_arena(ambiguity_test_t *amb_test, memory_pool_t *pool,
+                             u32 max_hyps,
+                             ambiguity_overflow_policy_t overflow_policy,
+                             void *arena, size_t arena_size)
+{
+  if (max_hyps == 0 ||
+      arena_size < AMBIGUITY_TEST_ARENA_SIZE(max_hyps, overflow_policy)) {
+    return -1;
+  }
+
+  amb_test->pool = pool;
+  memory_pool_init(amb_test->pool, max_hyps, sizeof(hypothesis_t), arena);
+  amb_test->index.slots = NULL;
+  amb_test->index.valid = 0;
+
+  amb_test->overflow_policy = overflow_policy;
+  amb_test->prune_scores = NULL;
+  if (overflow_policy == AMBIGUITY_OVERFLOW_TOP_K) {
+    amb_test->prune_scores =
+      (float *)((u8 *)arena + AMBIGUITY_TEST_POOL_SIZE(max_hyps));
+  }
 
   amb_test->sats.num_sats = 0;
   amb_test->amb_check.initialized = 0;
+  amb_test->ll_offset = 0;
+
+  return 0;
 }
-void create_ambiguity_test(ambiguity_test_t *amb_test)
+
+/** Enable a hash index on the ambiguity vectors of an ambiguity test.
+ *
+ * ambiguity_test_pool_contains(), ambiguity_test_pool_ll() and
+ * ambiguity_test_pool_prob() then look hypotheses up in the index rather
+ * than searching the whole pool. The index is updated in place as
+ * test_ambiguities() removes hypotheses and by ambiguity_test_unpack(). After
+ * any other change to the pool, e.g. adding or removing satellites, it is
+ * rebuilt in one pass over the pool by the first lookup.
+ *
+ * \param amb_test Ambiguity test to index, must already have a pool
+ * \param buff Working area for the index, preferably
+ *             `AMBIGUITY_TEST_INDEX_SIZE(n)` bytes for a pool of `n`
+ *             hypotheses
+ * \param buff_size Size of the working area in bytes, must hold more slots
+ *                  than the pool has elements
+ * \return 0 on success, -1 if the working area is too small
+ */
+s8 ambiguity_test_enable_index(ambiguity_test_t *amb_test, void *buff,
+                               size_t buff_size)
 {
-  create_empty_ambiguity_test(amb_test);
+  assert(amb_test->pool != NULL);
+  u32 n_slots = buff_size / sizeof(hypothesis_t *);
+  if (n_slots <= memory_pool_n_elements(amb_test->pool)) {
+    return -1;
+  }
+  amb_test->index.slots = (hypothesis_t **)buff;
+  amb_test->index.n_slots = n_slots;
+  amb_test->index.valid = 0;
+  return 0;
+}
 
+void create_empty_ambiguity_test(ambiguity_test_t *amb_test)
+{
+  static u8 pool_buff[AMBIGUITY_TEST_POOL_BUFF_SIZE];
+  static memory_pool_t pool;
+  init_ambiguity_test(amb_test, &pool, pool_buff);
+}
+
+/** Add the single hypothesis with no satellites to an empty pool. */
+static void add_empty_hypothesis(ambiguity_test_t *amb_test)
+{
   /* Initialize pool with single element with num_dds = 0, i.e.
    * zero length N vector, i.e. no satellites. When we take the
    * product of this single element with the set of new satellites
@@ -69,6 +174,32 @@ void create_ambiguity_test(ambiguity_test_t *amb_test)
   empty_element->ll = 0;
 }
 
+void create_ambiguity_test(ambiguity_test_t *amb_test)
+{
+  create_empty_ambiguity_test(amb_test);
+  add_empty_hypothesis(amb_test);
+}
+
+/** Start an ambiguity test over, keeping the pool it is bound to.
+ *
+ * Equivalent to create_ambiguity_test() but for tests set up with
+ * init_ambiguity_test().
+ *
+ * \param amb_test Ambiguity test to reset, must already have a pool
+ */
+void reset_ambiguity_test(ambiguity_test_t *amb_test)
+{
+  assert(amb_test->pool != NULL);
+  memory_pool_t *pool = amb_test->pool;
+  memory_pool_init(pool, pool->n_elements, pool->element_size, pool->pool);
+  amb_test->index.valid = 0;
+
+  amb_test->sats.num_sats = 0;
+  amb_test->amb_check.initialized = 0;
+  amb_test->ll_offset = 0;
+  add_empty_hypothesis(amb_test);
+}
+
 void destroy_ambiguity_test(ambiguity_test_t *amb_test)
 {
   memory_pool_destroy(amb_test->pool);
@@ -94,6 +225,120 @@ s8 get_single_hypothesis(ambiguity_test_t *amb_test, s32 *hyp_N)
   return -1;
 }
 
+/* FNV-1a hash of an ambiguity vector. */
+static u32 hash_ambs(u8 num_dds, const s32 *N)
+{
+  u32 h = 2166136261u;
+  for (u8 i = 0; i < num_dds; i++) {
+    u32 v = (u32)N[i];
+    for (u8 b = 0; b < 4; b++) {
+      h ^= (v >> (8*b)) & 0xFF;
+      h *= 16777619u;
+    }
+  }
+  return h;
+}
+
+static void index_insert(hypothesis_index_t *index, hypothesis_t *hyp)
+{
+  u32 i = hash_ambs(index->num_dds, hyp->N) % index->n_slots;
+  while (index->slots[i]) {
+    i = (i + 1) % index->n_slots;
+  }
+  index->slots[i] = hyp;
+}
+
+/* Remove a hypothesis from the index, moving back the later entries of its
+ * cluster that would otherwise no longer be reachable from their hash. */
+static void index_remove(hypothesis_index_t *index, const hypothesis_t *hyp)
+{
+  u32 n = index->n_slots;
+  u32 i = hash_ambs(index->num_dds, hyp->N) % n;
+  while (index->slots[i] != hyp) {
+    if (!index->slots[i]) {
+      return;
+    }
+    i = (i + 1) % n;
+  }
+
+  u32 j = i;
+  while (1) {
+    index->slots[i] = NULL;
+    u32 k;
+    do {
+      j = (j + 1) % n;
+      if (!index->slots[j]) {
+        return;
+      }
+      k = hash_ambs(index->num_dds, index->slots[j]->N) % n;
+      /* Entries hashing cyclically in (i, j] are still found past the hole. */
+    } while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+    index->slots[i] = index->slots[j];
+    i = j;
+  }
+}
+
+static void fold_index_insert(void *x, element_t *elem)
+{
+  hypothesis_index_t *index = (hypothesis_index_t *) x;
+  hypothesis_t *hyp = (hypothesis_t *) elem;
+
+  index_insert(index, hyp);
+  index->prob_sum += exp(hyp->ll);
+}
+
+/* Whether the hash index of an ambiguity test is enabled and up to date with
+ * the pool, so it can be updated along with it. */
+static bool index_in_sync(ambiguity_test_t *amb_test)
+{
+  hypothesis_index_t *index = &amb_test->index;
+  return index->slots && index->valid &&
+         index->num_dds == CLAMP_DIFF(amb_test->sats.num_sats, 1) &&
+         index->generation == amb_test->pool->generation;
+}
+
+/* Empty the hash index, for vectors of `num_dds` ambiguities. */
+static void index_clear(hypothesis_index_t *index, u8 num_dds)
+{
+  memset(index->slots, 0, index->n_slots * sizeof(hypothesis_t *));
+  index->num_dds = num_dds;
+  index->prob_sum = 0;
+  index->valid = 1;
+}
+
+/* Get the hash index of an ambiguity test. The index is kept up to date by
+ * test_ambiguities() and ambiguity_test_unpack(), it is only rebuilt here
+ * after the pool has been changed some other way, e.g. satellites were
+ * added or removed. Returns NULL if the index isn't enabled. */
+static hypothesis_index_t *current_index(ambiguity_test_t *amb_test)
+{
+  hypothesis_index_t *index = &amb_test->index;
+  if (!index->slots) {
+    return NULL;
+  }
+
+  if (!index_in_sync(amb_test)) {
+    index_clear(index, CLAMP_DIFF(amb_test->sats.num_sats, 1));
+    memory_pool_fold(amb_test->pool, index, &fold_index_insert);
+    index->generation = amb_test->pool->generation;
+  }
+  return index;
+}
+
+static hypothesis_t *index_lookup(const hypothesis_index_t *index,
+                                  const s32 *N)
+{
+  u32 i = hash_ambs(index->num_dds, N) % index->n_slots;
+  /* There are more slots than hypotheses so an empty one is always found. */
+  while (index->slots[i]) {
+    if (memcmp(index->slots[i]->N, N, index->num_dds * sizeof(s32)) == 0) {
+      return index->slots[i];
+    }
+    i = (i + 1) % index->n_slots;
+  }
+  return NULL;
+}
+
 /** A struct to be used as the x in a memory pool fold, checking set membership.
  * Used in fold_contains().
  */
@@ -139,6 +384,10 @@ u8 ambiguity_test_pool_contains(ambiguity_test_t *amb_test, double *ambs)
     acc.N[i] = lround(ambs[i]);
   }
   acc.found = 0;
+  hypothesis_index_t *index = current_index(amb_test);
+  if (index) {
+    return index_lookup(index, acc.N) != NULL;
+  }
   memory_pool_fold(amb_test->pool, (void *) &acc, &fold_contains);
   return acc.found;
 }
@@ -189,12 +438,18 @@ double ambiguity_test_pool_ll(ambiguity_test_t *amb_test, u8 num_ambs, double *a
   fold_ll_t acc;
   acc.num_dds = amb_test->sats.num_sats-1;
   acc.ll = 1;
+  acc.found = 0;
   assert(acc.num_dds == num_ambs);
   for (u8 i=0; i<acc.num_dds; i++) {
     acc.N[i] = lround(ambs[i]);
   }
+  hypothesis_index_t *index = current_index(amb_test);
+  if (index) {
+    hypothesis_t *hyp = index_lookup(index, acc.N);
+    return hyp ? hyp->ll - amb_test->ll_offset : acc.ll;
+  }
   memory_pool_fold(amb_test->pool, (void *) &acc, &fold_ll);
-  return acc.ll;
+  return acc.found ? acc.ll - amb_test->ll_offset : acc.ll;
 }
 
 /** A memory pool fold method to add probabilities.
@@ -224,12 +479,21 @@ double ambiguity_test_pool_prob(ambiguity_test_t *amb_test, u8 num_ambs, double
   fold_ll_t acc;
   acc.num_dds = amb_test->sats.num_sats-1;
   acc.ll = 1;
+  acc.found = 0;
   assert(acc.num_dds == num_ambs);
   for (u8 i=0; i<acc.num_dds; i++) {
     acc.N[i] = lround(ambs[i]);
   }
+  hypothesis_index_t *index = current_index(amb_test);
+  if (index) {
+    hypothesis_t *hyp = index_lookup(index, acc.N);
+    if (!hyp) {
+      return -1;
+    }
+    return exp(hyp->ll) / index->prob_sum;
+  }
   memory_pool_fold(amb_test->pool, (void *) &acc, &fold_ll);
-  if (acc.ll > 0) {
+  if (!acc.found) {
     return -1;
   }
   double prob_sum = 0;
@@ -367,58 +631,26 @@ u32 ambiguity_test_n_hypotheses(ambiguity_test_t *amb_test)
   return memory_pool_n_allocated(amb_test->pool);
 }
 
-/** A memory pool filter to do most everything related to the estimation algorithm.
- * To be used by update_and_get_max_ll() and filter_and_renormalize().
+/** A struct to be used in a memory pool map checking unanimous ambiguities.
+ * Used in _check_unanimous().
  */
 typedef struct {
   u8 num_dds;                                 /**< Number of ambiguities. */
-  double r_vec[2*MAX_CHANNELS-5];             /**< Transformed measurement to check hypotheses against. */
-  double max_ll;                              /**< The greatest log likelihood in the pool so far. */
-  residual_mtxs_t *res_mtxs;                  /**< Matrices necessary for testing hypotheses. */
   unanimous_amb_check_t *unanimous_amb_check; /**< A struct to check which int ambs are agreed upon among all hyps. */
 } hyp_filter_t;
 
-/** A mapAccum styled function to update the hypothesis log-likelihoods and find the greatest LL.
- * Simultaneously performs a map, doing a Bayesian update of the log likelihoods
- * of each hypothesis, while performing a fold on those updated log likelihoods
- * to find the likelihood of the MLE hypothesis.
- *
- * If a single observation was sufficiently unlikely to come from this hypothesis, we reject
- * the hypothesis. (In addition to the accumulated relative likelihood that is filtered upon later).
- *
- * To be given to memory_pool_fold().
- *
- * \param x     Points to a hyp_filter_t containing the accumulator and everything needed for the map.
- * \param elem  The hypothesis to be mapAccum'd.
- */
-static s8 update_and_get_max_ll(void *x_, element_t *elem) {
-  hyp_filter_t *x = (hyp_filter_t *) x_;
-  hypothesis_t *hyp = (hypothesis_t *) elem;
-  double hypothesis_N[x->num_dds];
-
-  for (u8 i=0; i < x->num_dds; i++) {
-    hypothesis_N[i] = hyp->N[i];
-  }
-  double q = get_quadratic_term(x->res_mtxs, x->num_dds, hypothesis_N, x->r_vec);
-  hyp->ll += q;
-  x->max_ll = MAX(x->max_ll, hyp->ll);
-  return (abs(q) < SINGLE_OBS_CHISQ_THRESHOLD);
-  /* Doesn't appear to need a dependence on d.o.f. to be effective.
-   * We should revisit SINGLE_OBS_CHISQ_THRESHOLD when our noise model is tighter. */
-}
-
 /** Keeps track of which integer ambiguities are uninimously agreed upon in the pool.
  * \param num_dds   The number of DDs in each hypothesis. (Used to initialize amb_check).
  * \param hyp       The hypothesis to be checked against.
  * \param amb_check Keeps track of which ambs are still unanimous and their values.
  */
-static void check_unanimous_ambs(u8 num_dds, hypothesis_t *hyp,
+static void check_unanimous_ambs(u8 num_dds, const s32 *N,
                                  unanimous_amb_check_t *amb_check)
 {
   if (amb_check->initialized) {
     u8 j = 0; // index in newly constructed amb_check matches
     for (u8 i = 0; i < amb_check->num_matching_ndxs; i++) {
-      if (amb_check->ambs[i] == hyp->N[amb_check->matching_ndxs[i]]) {
+      if (amb_check->ambs[i] == N[amb_check->matching_ndxs[i]]) {
         if (i != j) { //  j <= i necessarily
           amb_check->matching_ndxs[j] = amb_check->matching_ndxs[i];
           amb_check->ambs[j] = amb_check->ambs[i];
@@ -433,47 +665,190 @@ static void check_unanimous_ambs(u8 num_dds, hypothesis_t *hyp,
     for (u8 i=0; i < num_dds; i++) {
       amb_check->matching_ndxs[i] = i;
     }
-    memcpy(amb_check->ambs, hyp->N, num_dds * sizeof(s32));
+    memcpy(amb_check->ambs, N, num_dds * sizeof(s32));
   }
 }
 
-/** A combination fold/map/filter to renormalize the log likelihoods and remove unlikely hyps.
+/** Number of hypotheses whose likelihoods are evaluated together. */
+#define HYP_BATCH_SIZE 32
+
+/** State for evaluating the hypothesis likelihood updates in batches.
+ * See update_and_filter(). */
+typedef struct {
+  u8 num_dds;                                 /**< Number of ambiguities. */
+  const double *r_vec;                        /**< Transformed measurement to check hypotheses against. */
+  const residual_mtxs_t *res_mtxs;            /**< Matrices necessary for testing hypotheses. */
+  bool chol_ok;                               /**< `chol` holds a valid factor. */
+  double chol[(2*MAX_CHANNELS-5) * (2*MAX_CHANNELS-5)]; /**< Lower Cholesky factor L of half_res_cov_inv = L L^T. */
+  double ll_offset;                           /**< Log likelihood the hypotheses are normalized by. */
+  double max_ll;                              /**< The greatest log likelihood in the pool so far. */
+  u8 count;                                   /**< Number of hypotheses in the current batch. */
+  hypothesis_t *hyps[HYP_BATCH_SIZE];         /**< Hypotheses in the current batch. */
+  u8 *keep;                                   /**< Set to whether each of them is kept. */
+  unanimous_amb_check_t *amb_check;           /**< If set, updated with the hypotheses kept. */
+  hypothesis_index_t *index;                  /**< If set, the hypotheses dropped are removed from it. */
+  double prob_sum;                            /**< Sum of exp(ll) over the hypotheses kept so far. */
+  double N[HYP_BATCH_SIZE * (MAX_CHANNELS-1)];  /**< Their ambiguity vectors, one per row. */
+  double R[HYP_BATCH_SIZE * (2*MAX_CHANNELS-5)]; /**< Their residuals, one per row. */
+} hyp_batch_t;
+
+/** Evaluate the likelihood update of a batch of hypotheses.
+ *
+ * For each hypothesis N the residual is
+ * \f[
+ *   r = r_{vec} - \begin{bmatrix} Q N \\ N \end{bmatrix}
+ * \f]
+ * where Q is the null space projector, so for the whole batch the projected
+ * part is a single matrix product. With the Cholesky factor
+ * \f$ L L^T = \Sigma^{-1}/2 \f$ the quadratic term of get_quadratic_term()
+ * is then \f$ -\|L^T r\|^2 \f$, one triangular multiply for the batch.
  *
- * The log likelihood of the hypotheses are filtered against a threshold.
- * Those hypotheses that make the cut are (1) normalized such that the MLE has
- * value 0, making them logs of the probability ratio against the MLE hyp,
- * and (2) checked to see if any of their integer ambiguities are unanimous
- * amongst all hypotheses in the test pool.
+ * The log likelihoods are normalized by `ll_offset`, the greatest log
+ * likelihood of the previous update, as they are updated. Hypotheses are
+ * then dropped if they fall below a threshold relative to it, or if they fail
+ * the single observation test. As the threshold doesn't depend on this
+ * update's greatest log likelihood, which is only known after the whole pool
+ * has been updated, whether each hypothesis is kept is known here. Those kept
+ * are checked for unanimous ambiguities, those dropped are removed from the
+ * hash index.
  *
  * The thresholding is done before the normalization for both numerical
  * stability, and so that hypotheses which are just REALLY BAD are removed,
  * even if they are the best we have. This is a kinda arbitrary choice of how
  * to do things. Maybe we should see if it has practical implications?
+ */
+static void flush_hyp_batch(hyp_batch_t *b)
+{
+  const u8 m = b->count;
+  const u8 nd = b->num_dds;
+  const u8 ns = b->res_mtxs->null_space_dim;
+  const u32 rd = b->res_mtxs->res_dim;
+
+  if (m == 0) {
+    return;
+  }
+
+  double q[m];
+  if (b->chol_ok) {
+    for (u8 k = 0; k < m; k++) {
+      double *R = &b->R[k * rd];
+      memcpy(R, b->r_vec, ns * sizeof(double));
+      for (u8 i = 0; i < nd; i++) {
+        R[ns + i] = b->r_vec[ns + i] - b->N[k * nd + i];
+      }
+    }
+    if (ns > 0) {
+      cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                  m, ns, nd,
+                  -1, b->N, nd,
+                  b->res_mtxs->null_projector, nd,
+                  1, b->R, rd);
+    }
+    cblas_dtrmm(CblasRowMajor, CblasRight, CblasLower, CblasNoTrans,
+                CblasNonUnit, m, rd,
+                1, b->chol, rd,
+                b->R, rd);
+    for (u8 k = 0; k < m; k++) {
+      q[k] = -vector_dot(rd, &b->R[k * rd], &b->R[k * rd]);
+    }
+  } else {
+    for (u8 k = 0; k < m; k++) {
+      q[k] = get_quadratic_term((residual_mtxs_t *)b->res_mtxs, nd,
+                                &b->N[k * nd], (double *)b->r_vec);
+    }
+  }
+
+  for (u8 k = 0; k < m; k++) {
+    hypothesis_t *hyp = b->hyps[k];
+    hyp->ll = hyp->ll - b->ll_offset + q[k];
+    b->max_ll = MAX(b->max_ll, hyp->ll);
+    /* Doesn't appear to need a dependence on d.o.f. to be effective.
+     * We should revisit SINGLE_OBS_CHISQ_THRESHOLD when our noise model is tighter. */
+    if (!(fabs(q[k]) < SINGLE_OBS_CHISQ_THRESHOLD)) {
+      hyp->ll = -INFINITY;
+    }
+    b->keep[k] = (hyp->ll > LOG_PROB_RAT_THRESHOLD);
+    if (b->keep[k]) {
+      b->prob_sum += exp(hyp->ll);
+      if (b->amb_check) {
+        check_unanimous_ambs(nd, hyp->N, b->amb_check);
+      }
+    } else if (b->index) {
+      index_remove(b->index, hyp);
+    }
+  }
+  b->count = 0;
+}
+
+/** Start a batched likelihood update, see flush_hyp_batch(). */
+static void init_hyp_batch(hyp_batch_t *b, const residual_mtxs_t *res_mtxs,
+                           u8 num_dds, const double *r_vec)
+{
+  b->num_dds = num_dds;
+  b->r_vec = r_vec;
+  b->res_mtxs = res_mtxs;
+  b->max_ll = -1e20; // TODO get the first element, or use this as threshold to restart test
+  b->ll_offset = 0;
+  b->count = 0;
+  b->amb_check = NULL;
+  b->index = NULL;
+  b->prob_sum = 0;
+
+  /* Factor half_res_cov_inv = L L^T. */
+  u32 rd = res_mtxs->res_dim;
+  memcpy(b->chol, res_mtxs->half_res_cov_inv, rd * rd * sizeof(double));
+  b->chol_ok = rd > 0 && small_kernels(rd)->cholesky(rd, b->chol) == 0;
+}
+
+/** A filter to update the hypothesis log-likelihoods, find the greatest LL
+ * and remove unlikely hypotheses in a single pass.
+ *
+ * Simultaneously performs a map, doing a Bayesian update of the log
+ * likelihoods of each hypothesis, a fold on those updated log likelihoods to
+ * find the likelihood of the MLE hypothesis, and a filter against the
+ * threshold, see flush_hyp_batch().
+ *
+ * The hypotheses of each batch from the pool are evaluated together in
+ * batches of `HYP_BATCH_SIZE` by flush_hyp_batch().
  *
- * This function is used by memory_pool_filter().
+ * To be given to memory_pool_filter_batch().
  *
- * \param arg     The accumulator/map/filter information
- * \param elem    The hypothesis to be mapped/filtered/folded against.
- * \return        Whether or not this hypothesis made the cut.
+ * \param arg   Points to a hyp_batch_t containing the accumulator and everything needed for the update.
+ * \param n     The number of hypotheses.
+ * \param elems The hypotheses to be updated.
+ * \param keep  Set to whether each hypothesis is kept.
  */
-static s8 filter_and_renormalize(void *arg, element_t *elem) {
-  hypothesis_t *hyp = (hypothesis_t *) elem;
+static void update_and_filter(void *arg, u32 n, element_t **elems, u8 *keep)
+{
+  hyp_batch_t *b = (hyp_batch_t *) arg;
 
-  u8 keep_it = (hyp->ll > LOG_PROB_RAT_THRESHOLD);
-  if (keep_it) {
-    hyp->ll -= ((hyp_filter_t *) arg)->max_ll;
+  for (u32 j = 0; j < n; j++) {
+    hypothesis_t *hyp = (hypothesis_t *) elems[j];
+    if (b->count == 0) {
+      b->keep = &keep[j];
+    }
+    for (u8 i = 0; i < b->num_dds; i++) {
+      b->N[b->count * b->num_dds + i] = hyp->N[i];
+    }
+    b->hyps[b->count++] = hyp;
+    /* Whether to keep them must be known before returning. */
+    if (b->count == HYP_BATCH_SIZE || j == n - 1) {
+      flush_hyp_batch(b);
+    }
   }
-  return keep_it;
 }
 
 static void _check_unanimous(void *arg, element_t *elem)
 {
   hypothesis_t *hyp = (hypothesis_t *) elem;
 
-  check_unanimous_ambs(((hyp_filter_t *) arg)->num_dds, hyp,
+  check_unanimous_ambs(((hyp_filter_t *) arg)->num_dds, hyp->N,
                        ((hyp_filter_t *) arg)->unanimous_amb_check);
 }
 
+/* Updates the unanimous ambiguities of the hypothesis pool. Nothing is done
+ * if they are already up to date with the pool, e.g. after test_ambiguities().
+ */
 void update_unanimous_ambiguities(ambiguity_test_t *amb_test)
 {
   hyp_filter_t x;
@@ -481,31 +856,51 @@ void update_unanimous_ambiguities(ambiguity_test_t *amb_test)
     amb_test->amb_check.num_matching_ndxs = 0;
     return;
   }
+  if (amb_test->amb_check.initialized &&
+      amb_test->amb_check.generation == amb_test->pool->generation) {
+    return;
+  }
   x.num_dds = amb_test->sats.num_sats-1;
   x.unanimous_amb_check = &amb_test->amb_check;
   x.unanimous_amb_check->initialized = 0;
 
   memory_pool_map(amb_test->pool, (void *) &x, &_check_unanimous);
+  amb_test->amb_check.generation = amb_test->pool->generation;
 }
 
 /* Updates the IAR hypothesis pool log likelihood ratios and filters them.
  *  It assumes that the observations are structured to match the amb_test sats.
- *  INVALIDATES unanimous ambiguities
+ *  The likelihoods are updated, the unlikely hypotheses removed and the
+ *  unanimous ambiguities of those kept found in a single pass over the pool.
+ *  The hash index, if enabled and up to date, is updated in place.
+ *
+ *  Normalizing the log likelihoods by the greatest one would take a second
+ *  pass. Instead it is recorded in `ll_offset` and the log likelihoods are
+ *  normalized as they are next updated.
  */
 void test_ambiguities(ambiguity_test_t *amb_test, double *dd_measurements)
 {
   DEBUG_ENTRY();
 
-  hyp_filter_t x;
-  x.num_dds = amb_test->sats.num_sats-1;
-  assign_r_vec(&amb_test->res_mtxs, x.num_dds, dd_measurements, x.r_vec);
-  x.max_ll = -1e20; // TODO get the first element, or use this as threshold to restart test
-  x.res_mtxs = &amb_test->res_mtxs;
-  x.unanimous_amb_check = &amb_test->amb_check;
-  x.unanimous_amb_check->initialized = 0;
+  u8 num_dds = amb_test->sats.num_sats-1;
+  double r_vec[2*MAX_CHANNELS-5];
+  assign_r_vec(&amb_test->res_mtxs, num_dds, dd_measurements, r_vec);
+  amb_test->amb_check.initialized = 0;
 
-  memory_pool_filter(amb_test->pool, (void *) &x, &update_and_get_max_ll);
-  memory_pool_filter(amb_test->pool, (void *) &x, &filter_and_renormalize);
+  hyp_batch_t b;
+  init_hyp_batch(&b, &amb_test->res_mtxs, num_dds, r_vec);
+  b.ll_offset = amb_test->ll_offset;
+  b.amb_check = &amb_test->amb_check;
+  /* Rather than being rebuilt after the pool changes, an index that is up to
+   * date is updated along with the pool. */
+  b.index = index_in_sync(amb_test) ? &amb_test->index : NULL;
+  memory_pool_filter_batch(amb_test->pool, (void *) &b, &update_and_filter);
+  amb_test->ll_offset = b.max_ll;
+  if (b.index) {
+    b.index->prob_sum = b.prob_sum;
+    b.index->generation = amb_test->pool->generation;
+  }
+  amb_test->amb_check.generation = amb_test->pool->generation;
   if (memory_pool_empty(amb_test->pool)) {
     log_debug("Ambiguity pool empty");
     /* Initialize pool with single element with num_dds = 0, i.e.
@@ -515,17 +910,169 @@ void test_ambiguities(ambiguity_test_t *amb_test, double *dd_measurements)
     hypothesis_t *empty_element = (hypothesis_t *)memory_pool_add(amb_test->pool);
     /* Start with ll = 0, just for the sake of argument. */
     empty_element->ll = 0;
+    amb_test->ll_offset = 0;
     amb_test->sats.num_sats = 0;
     amb_test->amb_check.initialized = 0;
+    if (b.index) {
+      index_clear(b.index, 0);
+      index_insert(b.index, empty_element);
+      b.index->prob_sum = 1;
+      b.index->generation = amb_test->pool->generation;
+    }
   }
   if (DEBUG) {
-    memory_pool_map(amb_test->pool, &x.num_dds, &print_hyp);
-    printf("num_unanimous_ndxs=%u\n", x.unanimous_amb_check->num_matching_ndxs);
+    memory_pool_map(amb_test->pool, &num_dds, &print_hyp);
+    printf("num_unanimous_ndxs=%u\n", amb_test->amb_check.num_matching_ndxs);
   }
 
   DEBUG_EXIT();
 }
 
+/** Initialize an empty compact hypothesis set.
+ *
+ * The log likelihoods are stored at the start of `buff` followed by the
+ * ambiguity deltas, so `buff` must be suitably aligned for a float.
+ *
+ * \param pack      Compact hypothesis set to initialize.
+ * \param buff      Working area, see `AMBIGUITY_TEST_PACK_SIZE`.
+ * \param buff_size Size of `buff` in bytes.
+ */
+void init_hypothesis_pack(hypothesis_pack_t *pack, void *buff, size_t buff_size)
+{
+  pack->num_dds = 0;
+  pack->n_hyps = 0;
+  pack->max_hyps = buff_size / AMBIGUITY_TEST_PACK_SIZE(1);
+  pack->ll = (float *)buff;
+  pack->deltas = (s16 *)&pack->ll[pack->max_hyps];
+}
+
+typedef struct {
+  u8 num_dds;
+  s32 min[MAX_CHANNELS-1];
+  s32 max[MAX_CHANNELS-1];
+} amb_range_t;
+
+static void fold_amb_range(void *arg, element_t *elem)
+{
+  amb_range_t *r = (amb_range_t *) arg;
+  hypothesis_t *hyp = (hypothesis_t *) elem;
+  for (u8 i = 0; i < r->num_dds; i++) {
+    r->min[i] = MIN(r->min[i], hyp->N[i]);
+    r->max[i] = MAX(r->max[i], hyp->N[i]);
+  }
+}
+
+typedef struct {
+  hypothesis_pack_t *pack;
+  double ll_offset;
+} pack_state_t;
+
+static void pack_hypothesis(void *arg, element_t *elem)
+{
+  pack_state_t *p = (pack_state_t *) arg;
+  hypothesis_pack_t *pack = p->pack;
+  hypothesis_t *hyp = (hypothesis_t *) elem;
+  s16 *d = &pack->deltas[pack->n_hyps * pack->num_dds];
+  for (u8 i = 0; i < pack->num_dds; i++) {
+    d[i] = hyp->N[i] - pack->base[i];
+  }
+  pack->ll[pack->n_hyps++] = hyp->ll - p->ll_offset;
+}
+
+/** Encode the hypotheses of an ambiguity test in compact form.
+ *
+ * Each ambiguity is stored as a 16 bit offset from a base vector shared by
+ * the whole set, chosen at the middle of the range of each ambiguity in the
+ * pool, and the normalized log likelihoods are kept in a separate array. The
+ * pool is unchanged.
+ *
+ * The compact form is only a serialization format, e.g. for saving the
+ * hypotheses or sending them elsewhere. It is restored with
+ * ambiguity_test_unpack() before the hypotheses are tested again.
+ *
+ * \param amb_test Ambiguity test to encode.
+ * \param pack     Compact hypothesis set, see init_hypothesis_pack().
+ * \return 0 on success,
+ *         -1 if the hypotheses don't fit in `pack` or an ambiguity spans
+ *         more than 16 bits across the pool
+ */
+s8 ambiguity_test_pack(ambiguity_test_t *amb_test, hypothesis_pack_t *pack)
+{
+  u8 num_dds = CLAMP_DIFF(amb_test->sats.num_sats, 1);
+  if (ambiguity_test_n_hypotheses(amb_test) > pack->max_hyps) {
+    return -1;
+  }
+
+  amb_range_t r = {.num_dds = num_dds};
+  for (u8 i = 0; i < num_dds; i++) {
+    r.min[i] = INT32_MAX;
+    r.max[i] = INT32_MIN;
+  }
+  memory_pool_fold(amb_test->pool, &r, &fold_amb_range);
+
+  s32 base[MAX_CHANNELS-1];
+  for (u8 i = 0; i < num_dds; i++) {
+    if ((s64)r.max[i] - r.min[i] > UINT16_MAX) {
+      return -1;
+    }
+    base[i] = r.min[i] + ((s64)r.max[i] - r.min[i] + 1) / 2;
+  }
+
+  pack->num_dds = num_dds;
+  pack->n_hyps = 0;
+  memcpy(pack->base, base, num_dds * sizeof(s32));
+  pack_state_t p = {.pack = pack, .ll_offset = amb_test->ll_offset};
+  memory_pool_fold(amb_test->pool, &p, &pack_hypothesis);
+  return 0;
+}
+
+/** Replace the hypotheses of an ambiguity test with a compact set.
+ *
+ * The satellites of the ambiguity test must be those the set was encoded
+ * with by ambiguity_test_pack().
+ *
+ * \param amb_test Ambiguity test to restore into.
+ * \param pack     Compact hypothesis set.
+ * \return 0 on success,
+ *         -1 if the hypotheses don't fit in the pool, which is then empty
+ */
+s8 ambiguity_test_unpack(ambiguity_test_t *amb_test,
+                         const hypothesis_pack_t *pack)
+{
+  assert(pack->num_dds == CLAMP_DIFF(amb_test->sats.num_sats, 1));
+
+  hypothesis_index_t *index = amb_test->index.slots ? &amb_test->index : NULL;
+  memory_pool_clear(amb_test->pool);
+  amb_test->amb_check.initialized = 0;
+  amb_test->ll_offset = 0;
+  if (index) {
+    index_clear(index, pack->num_dds);
+  }
+  for (u32 k = 0; k < pack->n_hyps; k++) {
+    hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test->pool);
+    if (hyp == NULL) {
+      memory_pool_clear(amb_test->pool);
+      if (index) {
+        index->valid = 0;
+      }
+      return -1;
+    }
+    const s16 *d = &pack->deltas[k * pack->num_dds];
+    for (u8 i = 0; i < pack->num_dds; i++) {
+      hyp->N[i] = pack->base[i] + d[i];
+    }
+    hyp->ll = pack->ll[k];
+    if (index) {
+      index_insert(index, hyp);
+      index->prob_sum += exp(hyp->ll);
+    }
+  }
+  if (index) {
+    index->generation = amb_test->pool->generation;
+  }
+  return 0;
+}
+
 /* This says whether we can use the ambiguity_test to resolve a position in 3-space.
  */
 u8 ambiguity_iar_can_solve(ambiguity_test_t *amb_test)
@@ -612,41 +1159,84 @@ s8 sats_match(const ambiguity_test_t *amb_test, const u8 num_sdiffs, const sdiff
   return 1;
 }
 
+/* A reference change as an integer map of the ambiguity vectors, built once
+ * per rebase. With the old ambiguities extended by a zero,
+ *
+ *   N_new[i] = N_ext[src[i]] - N_ext[ref_ndx]
+ *
+ * i.e. a permutation followed by subtracting the column of the new
+ * reference. The old reference has no old ambiguity and maps from the zero. */
 typedef struct {
-  u8 num_sats;
-  gnss_signal_t old_sids[MAX_CHANNELS];
-  gnss_signal_t new_sids[MAX_CHANNELS];
-} rebase_prns_t;
+  u8 num_dds;
+  u8 ref_ndx;                /* Index of the new reference in the old dds. */
+  u8 src[MAX_CHANNELS-1];    /* Index of each new dd in the old dds. */
+} rebase_map_t;
 
-static void rebase_hypothesis(void *arg, element_t *elem) //TODO make it so it doesn't have to do all these lookups every time
+static void make_rebase_map(u8 num_sats, const gnss_signal_t *old_sids,
+                            const gnss_signal_t *new_sids, rebase_map_t *m)
 {
-  rebase_prns_t *sids = (rebase_prns_t *) arg;
-  u8 num_sats = sids->num_sats;
-  gnss_signal_t *old_sids = sids->old_sids;
-  gnss_signal_t *new_sids = sids->new_sids;
+  u8 num_dds = num_sats - 1;
+  m->num_dds = num_dds;
 
+  s32 index_of_new_ref_in_old = find_index_of_signal(num_dds, new_sids[0], &old_sids[1]);
+  assert(index_of_new_ref_in_old != -1);
+  m->ref_ndx = index_of_new_ref_in_old;
+
+  for (u8 i=0; i<num_dds; i++) {
+    if (sid_is_equal(new_sids[1+i], old_sids[0])) {
+      m->src[i] = num_dds;
+    } else {
+      s32 index_of_this_sat_in_old_basis = find_index_of_signal(num_dds, new_sids[1+i], &old_sids[1]);
+      assert(index_of_this_sat_in_old_basis != -1);
+      m->src[i] = index_of_this_sat_in_old_basis;
+    }
+  }
+}
+
+static void rebase_hypothesis(void *arg, element_t *elem)
+{
+  const rebase_map_t *m = (const rebase_map_t *) arg;
   hypothesis_t *hypothesis = (hypothesis_t *)elem;
 
-  gnss_signal_t old_ref = old_sids[0];
-  gnss_signal_t new_ref = new_sids[0];
+  s32 ext[MAX_CHANNELS];
+  memcpy(ext, hypothesis->N, m->num_dds * sizeof(s32));
+  ext[m->num_dds] = 0;
 
-  s32 new_N[num_sats-1];
-  s32 index_of_new_ref_in_old = find_index_of_signal(num_sats-1, new_ref, &old_sids[1]);
-  assert(index_of_new_ref_in_old != -1);
+  s32 ref = ext[m->ref_ndx];
+  for (u8 i=0; i<m->num_dds; i++) {
+    hypothesis->N[i] = ext[m->src[i]] - ref;
+  }
+}
 
-  s32 val_for_new_ref_in_old_basis = hypothesis->N[index_of_new_ref_in_old];
-  for (u8 i=0; i<num_sats-1; i++) {
-    gnss_signal_t new_sid = new_sids[1+i];
-    if (sid_is_equal(new_sid, old_ref)) {
-      new_N[i] = - val_for_new_ref_in_old_basis;
-    }
-    else {
-      s32 index_of_this_sat_in_old_basis = find_index_of_signal(num_sats-1, new_sid, &old_sids[1]);
-      assert(index_of_this_sat_in_old_basis != -1);
-      new_N[i] = hypothesis->N[index_of_this_sat_in_old_basis] - val_for_new_ref_in_old_basis;
+/* Apply a reference change to the unanimous ambiguities. A new dd is
+ * unanimous if both old dds it is formed from are. */
+static void rebase_amb_check(const rebase_map_t *m, unanimous_amb_check_t *c)
+{
+  if (!c->initialized) {
+    return;
+  }
+
+  u8 known[MAX_CHANNELS];
+  s32 ext[MAX_CHANNELS];
+  memset(known, 0, sizeof(known));
+  for (u8 k=0; k<c->num_matching_ndxs; k++) {
+    known[c->matching_ndxs[k]] = 1;
+    ext[c->matching_ndxs[k]] = c->ambs[k];
+  }
+  known[m->num_dds] = 1;
+  ext[m->num_dds] = 0;
+
+  u8 j = 0;
+  if (known[m->ref_ndx]) {
+    for (u8 i=0; i<m->num_dds; i++) {
+      if (known[m->src[i]]) {
+        c->matching_ndxs[j] = i;
+        c->ambs[j] = ext[m->src[i]] - ext[m->ref_ndx];
+        j++;
+      }
     }
   }
-  memcpy(hypothesis->N, new_N, (num_sats-1) * sizeof(s32));
+  c->num_matching_ndxs = j;
 }
 
 /** Update an ambiguity test's reference satellite.
@@ -676,16 +1266,16 @@ u8 ambiguity_update_reference(ambiguity_test_t *amb_test, const u8 num_sdiffs, c
     log_debug("updating iar reference sat");
     changed_ref = 1;
     if (sats_management_code == NEW_REF_START_OVER) {
-      create_ambiguity_test(amb_test);
+      reset_ambiguity_test(amb_test);
     }
     else {
       gnss_signal_t new_sids[amb_test->sats.num_sats];
       memcpy(new_sids, amb_test->sats.sids, amb_test->sats.num_sats * sizeof(gnss_signal_t));
 
-      rebase_prns_t sids = {.num_sats = amb_test->sats.num_sats};
-      memcpy(sids.old_sids, old_sids, amb_test->sats.num_sats * sizeof(gnss_signal_t));
-      memcpy(sids.new_sids, new_sids, amb_test->sats.num_sats * sizeof(gnss_signal_t));
-      memory_pool_map(amb_test->pool, &sids, &rebase_hypothesis);
+      rebase_map_t m;
+      make_rebase_map(amb_test->sats.num_sats, old_sids, new_sids, &m);
+      memory_pool_map(amb_test->pool, &m, &rebase_hypothesis);
+      rebase_amb_check(&m, &amb_test->amb_check);
     }
   }
 
@@ -993,7 +1583,8 @@ static s32 add_sats(ambiguity_test_t *amb_test,
   s.x = x;
   s.Z_new_inv = x->Z2_inv;
   remap_sids(amb_test, ref_sid, x->new_dim, added_sids, &s);
-  s32 count = memory_pool_product_generator(amb_test->pool, &s, MAX_HYPOTHESES, sizeof(s),
+  s32 count = memory_pool_product_generator(amb_test->pool, &s,
+                  memory_pool_n_elements(amb_test->pool), sizeof(s),
                   &intersection_init,
                   &intersection_generate_next_hypothesis1,
                   &intersection_hypothesis_prod);
@@ -1004,6 +1595,496 @@ static s32 add_sats(ambiguity_test_t *amb_test,
   return num_hyps;
 }
 
+/* Bounded min-heap holding the scores of the best candidate hypotheses. */
+typedef struct {
+  float *scores;
+  u32 size;
+  u32 capacity;
+} score_heap_t;
+
+static void score_heap_push(score_heap_t *h, float score)
+{
+  if (h->size < h->capacity) {
+    /* Sift up from a new leaf. */
+    u32 i = h->size++;
+    while (i > 0 && h->scores[(i - 1) / 2] > score) {
+      h->scores[i] = h->scores[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    h->scores[i] = score;
+  } else if (h->capacity > 0 && score > h->scores[0]) {
+    /* Replace the worst score and sift down. */
+    u32 i = 0;
+    while (1) {
+      u32 c = 2*i + 1;
+      if (c >= h->size) {
+        break;
+      }
+      if (c + 1 < h->size && h->scores[c + 1] < h->scores[c]) {
+        c++;
+      }
+      if (h->scores[c] >= score) {
+        break;
+      }
+      h->scores[i] = h->scores[c];
+      i = c;
+    }
+    h->scores[i] = score;
+  }
+}
+
+/* Mean and variance of the float ambiguities in the decorrelated space of
+ * the intersection box, i.e. of Z1 * N. */
+static void decor_moments(u8 state_dim, u8 full_dim, const double *N_cov,
+                          const double *N_mean, const z_t *Z1,
+                          double *decor_mean, double *decor_var)
+{
+  for (u8 i = 0; i < full_dim; i++) {
+    decor_mean[i] = 0;
+    decor_var[i] = 0;
+    for (u8 j = 0; j < full_dim; j++) {
+      decor_mean[i] += Z1[i*full_dim + j] * N_mean[j];
+      for (u8 k = 0; k < full_dim; k++) {
+        decor_var[i] += Z1[i*full_dim + j] * N_cov[j*state_dim + k] *
+                        Z1[i*full_dim + k];
+      }
+    }
+  }
+}
+
+/* Log likelihood of the hypothesis at the current point of the intersection
+ * iteration, its parent's likelihood plus the float filter prior. */
+static float candidate_score(const intersection_count_t *x,
+                             const double *decor_mean, const double *decor_var,
+                             float parent_ll)
+{
+  u8 full_dim = x->old_dim + x->new_dim;
+  double q = 0;
+  for (u8 i = 0; i < full_dim; i++) {
+    if (decor_var[i] > 0) {
+      double d = x->zimage[i] - decor_mean[i];
+      q += d * d / decor_var[i];
+    }
+  }
+  return parent_ll - 0.5 * q;
+}
+
+typedef struct {
+  intersection_count_t *x;
+  const double *decor_mean;
+  const double *decor_var;
+  score_heap_t heap;
+} rank_candidates_t;
+
+static void fold_rank_candidates(void *arg, element_t *elem)
+{
+  rank_candidates_t *r = (rank_candidates_t *) arg;
+  intersection_count_t *x = r->x;
+  hypothesis_t *hyp = (hypothesis_t *)elem;
+  u8 full_dim = x->old_dim + x->new_dim;
+
+  init_intersection_count_vector(x, hyp);
+
+  do {
+    if (inside(full_dim, x->zimage, x->box_lower_bounds, x->box_upper_bounds)) {
+      score_heap_push(&r->heap, candidate_score(x, r->decor_mean, r->decor_var,
+                                                hyp->ll));
+    }
+  } while (0 != increment_matrix_product(
+                  x->new_dim, x->counter,
+                  full_dim, x->Z, x->zimage,
+                  x->itr_lower_bounds, x->itr_upper_bounds));
+}
+
+typedef struct {
+  /* Must be first, the intersection generator functions are shared. */
+  generate_hypothesis_state_t2 g;
+  const double *decor_mean;
+  const double *decor_var;
+  float threshold;
+  /* Candidates scoring exactly `threshold` that can still be kept. */
+  u32 *n_ties;
+  float parent_ll;
+} pruned_generator_t;
+
+/* Advance from a valid point to the next point that is kept. */
+static s8 pruned_skip(pruned_generator_t *p)
+{
+  do {
+    float score = candidate_score(p->g.x, p->decor_mean, p->decor_var,
+                                  p->parent_ll);
+    if (score > p->threshold) {
+      return 1;
+    }
+    if (score == p->threshold && *p->n_ties > 0) {
+      (*p->n_ties)--;
+      return 1;
+    }
+  } while (intersection_generate_next_hypothesis1(&p->g, 0));
+  return 0;
+}
+
+static s8 pruned_init(void *x, element_t *elem)
+{
+  pruned_generator_t *p = (pruned_generator_t *) x;
+  p->parent_ll = ((hypothesis_t *)elem)->ll;
+  if (!intersection_init(&p->g, elem)) {
+    return 0;
+  }
+  return pruned_skip(p);
+}
+
+static s8 pruned_next(void *x, u32 n)
+{
+  pruned_generator_t *p = (pruned_generator_t *) x;
+  if (!intersection_generate_next_hypothesis1(&p->g, n)) {
+    return 0;
+  }
+  return pruned_skip(p);
+}
+
+/* As add_sats() but only the most likely hypotheses that fit in the pool are
+ * generated, see init_ambiguity_test_arena(). The candidates are enumerated
+ * twice, first to find the score of the least likely one kept and then to
+ * generate those kept. Returns the new number of hypotheses, or -1 if the
+ * existing hypotheses leave no room and nothing was changed. */
+static s32 add_sats_top_k(ambiguity_test_t *amb_test,
+                          gnss_signal_t ref_sid, gnss_signal_t *added_sids,
+                          intersection_count_t *x, u8 state_dim,
+                          const double *N_cov_ordered,
+                          const double *N_mean_ordered)
+{
+  assert(amb_test->prune_scores != NULL);
+  memory_pool_t *pool = amb_test->pool;
+  u32 n_parents = memory_pool_n_allocated(pool);
+  u32 max_num_hyps = memory_pool_n_elements(pool);
+  if (n_parents >= max_num_hyps) {
+    return -1;
+  }
+
+  u8 full_dim = x->old_dim + x->new_dim;
+  double decor_mean[full_dim];
+  double decor_var[full_dim];
+  decor_moments(state_dim, full_dim, N_cov_ordered, N_mean_ordered, x->Z1,
+                decor_mean, decor_var);
+
+  rank_candidates_t r = {
+    .x = x,
+    .decor_mean = decor_mean,
+    .decor_var = decor_var,
+    .heap = {
+      .scores = amb_test->prune_scores,
+      .size = 0,
+      .capacity = max_num_hyps - n_parents
+    }
+  };
+  memory_pool_fold(pool, &r, &fold_rank_candidates);
+
+  pruned_generator_t p;
+  p.g.x = x;
+  p.g.Z_new_inv = x->Z2_inv;
+  p.decor_mean = decor_mean;
+  p.decor_var = decor_var;
+  u32 n_ties = 0;
+  p.n_ties = &n_ties;
+  if (r.heap.size < r.heap.capacity) {
+    p.threshold = -INFINITY;
+  } else {
+    p.threshold = r.heap.scores[0];
+    for (u32 i = 0; i < r.heap.size; i++) {
+      if (r.heap.scores[i] == p.threshold) {
+        n_ties++;
+      }
+    }
+  }
+
+  remap_sids(amb_test, ref_sid, x->new_dim, added_sids, &p.g);
+  memory_pool_product_generator(pool, &p, max_num_hyps, sizeof(p),
+                                &pruned_init, &pruned_next,
+                                &intersection_hypothesis_prod);
+  s32 num_hyps = memory_pool_n_allocated(pool);
+  log_info("IAR: kept %"PRId32" most likely hypotheses", num_hyps);
+  log_info("add_sats. num sats: %i", amb_test->sats.num_sats);
+  return num_hyps;
+}
+
+
+/** Most candidates for the new satellites generated by add_sats_best_first()
+ * for each hypothesis. */
+#define BEST_FIRST_MAX_CANDIDATES 256
+/** Probability mass of the candidates for the new satellites given each
+ * hypothesis after which add_sats_best_first() stops, see
+ * best_first_search(). */
+#define BEST_FIRST_PROB_MASS (1 - 1e-6)
+/** Most times best_first_search() doubles its search radius. */
+#define BEST_FIRST_MAX_ROUNDS 16
+
+/* The distribution of the new dds given the old ones, with the old dds
+ * first in the ordered float solution. With its Cholesky factor
+ * R = [R_oo 0; R_no R_nn] the new dds given old dds N_o have mean
+ * mean_n + R_no * R_oo^-1 * (N_o - mean_o) and covariance R_nn * R_nn^T,
+ * which is the same for every hypothesis and so is only reduced once. */
+typedef struct {
+  u8 old_dim;
+  u8 new_dim;
+  const double *mean;  /* Ordered float mean, old_dim + new_dim. */
+  const double *R;     /* Cholesky factor of the ordered float covariance. */
+  /* LAMBDA factors of the covariance of the new dds given the old ones, see
+   * lambda_factor(). */
+  const double *L;
+  const double *D;
+  const double *Z;
+  const double *Zi;
+  /* Log of the normalization of the Gaussian density of the new dds given
+   * the old, (2 pi)^(new_dim/2) * sqrt(det(R_nn * R_nn^T)). */
+  double log_norm;
+  u32 budget;
+  double *F;           /* Work, new_dim by budget. */
+  double *s;           /* Work, budget. */
+} best_first_cond_t;
+
+/* exp(r/2) * P(X > r) for X chi square with n degrees of freedom, from the
+ * closed forms of the upper incomplete gamma function at integer and half
+ * integer orders. */
+static double chi2_scaled_tail(u8 n, double r)
+{
+  double x = r / 2;
+  double sum = 0;
+  double t;
+  u8 k;
+  if (n % 2 == 0) {
+    t = 1;
+    k = 0;
+  } else {
+    /* exp(x) * erfc(sqrt(x)) tends to 1 / sqrt(pi * x). */
+    sum = x < 700 ? exp(x) * erfc(sqrt(x)) : 1 / sqrt(M_PI * x);
+    t = 2 * sqrt(x / M_PI);
+    k = 1;
+  }
+  for (; 2 * k < n; k++) {
+    sum += t;
+    t *= x / (k + (n % 2 ? 0.5 : 1));
+  }
+  return sum;
+}
+
+/* Find the candidates for the new dds given the old dds of a hypothesis,
+ * most likely first, into cands. The search radius is doubled until the
+ * budget is reached or the candidates found cover BEST_FIRST_PROB_MASS of
+ * the mass. The candidates outside the radius, one per unit volume as the
+ * reduction is unimodular, are given the mass of the Gaussian density
+ * outside it. Returns the number of candidates. */
+static u32 best_first_search(best_first_cond_t *c, const s32 *parent_N,
+                             z_t *cands)
+{
+  u8 old_dim = c->old_dim;
+  u8 new_dim = c->new_dim;
+  u8 full_dim = old_dim + new_dim;
+
+  /* w = R_oo^-1 * (N_o - mean_o), a = mean_n + R_no * w. */
+  double w[old_dim + 1];
+  for (u8 i = 0; i < old_dim; i++) {
+    w[i] = parent_N[i] - c->mean[i];
+    for (u8 k = 0; k < i; k++) {
+      w[i] -= c->R[i*full_dim + k] * w[k];
+    }
+    w[i] /= c->R[i*full_dim + i];
+  }
+  double a[new_dim];
+  for (u8 i = 0; i < new_dim; i++) {
+    a[i] = c->mean[old_dim + i];
+    for (u8 k = 0; k < old_dim; k++) {
+      a[i] += c->R[(old_dim + i)*full_dim + k] * w[k];
+    }
+  }
+
+  double log_tol = log((1 - BEST_FIRST_PROB_MASS) / BEST_FIRST_PROB_MASS);
+  double r = new_dim;
+  s32 n_cands = 0;
+  for (u8 round = 0; round < BEST_FIRST_MAX_ROUNDS; round++, r *= 2) {
+    s32 nn = lambda_search(new_dim, c->budget, c->L, c->D, c->Z, c->Zi, a, r,
+                           c->F, c->s);
+    if (nn < 0) {
+      /* Too large a search, keep the candidates of the last radius. */
+      break;
+    }
+    n_cands = nn;
+    if ((u32)n_cands == c->budget) {
+      break;
+    }
+    if (n_cands == 0) {
+      continue;
+    }
+    /* Masses relative to the most likely candidate. */
+    double mass = 0;
+    for (s32 k = 0; k < n_cands; k++) {
+      mass += exp(-0.5 * (c->s[k] - c->s[0]));
+    }
+    double log_tail = c->log_norm + log(chi2_scaled_tail(new_dim, r))
+                      - 0.5 * (r - c->s[0]);
+    if (log_tail <= log(mass) + log_tol) {
+      break;
+    }
+  }
+  for (s32 k = 0; k < n_cands * new_dim; k++) {
+    cands[k] = lround(c->F[k]);
+  }
+  return n_cands;
+}
+
+typedef struct {
+  /* Must be first, the intersection generator functions are shared. */
+  generate_hypothesis_state_t2 g;
+  best_first_cond_t *c;
+  z_t *cands;         /* Candidates for the new dds, most likely first. */
+  u32 n_cands;
+  u32 i;              /* Index of the current candidate. */
+  s32 parent_N[MAX_CHANNELS-1];
+} best_first_generator_t;
+
+/* Advance to the first candidate from the current one that is consistent
+ * with the float solution, i.e. lies inside the joint box. */
+static s8 best_first_skip(best_first_generator_t *p)
+{
+  intersection_count_t *x = p->g.x;
+  u8 full_dim = x->old_dim + x->new_dim;
+  z_t v0[full_dim];
+  for (u8 i = 0; i < x->old_dim; i++) {
+    v0[i] = p->parent_N[i];
+  }
+  for (; p->i < p->n_cands; p->i++) {
+    memcpy(x->counter, &p->cands[p->i * x->new_dim], x->new_dim * sizeof(z_t));
+    memcpy(v0 + x->old_dim, x->counter, x->new_dim * sizeof(z_t));
+    matrix_multiply_z_t(full_dim, full_dim, 1, x->Z1, v0, x->zimage);
+    if (inside(full_dim, x->zimage, x->box_lower_bounds, x->box_upper_bounds)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static s8 best_first_init(void *x, element_t *elem)
+{
+  best_first_generator_t *p = (best_first_generator_t *) x;
+  memcpy(p->parent_N, ((hypothesis_t *)elem)->N,
+         p->g.x->old_dim * sizeof(s32));
+  p->n_cands = best_first_search(p->c, p->parent_N, p->cands);
+  p->i = 0;
+  return best_first_skip(p);
+}
+
+static s8 best_first_next(void *x, u32 n)
+{
+  (void) n;
+  best_first_generator_t *p = (best_first_generator_t *) x;
+  p->i++;
+  return best_first_skip(p);
+}
+
+/* As add_sats() but rather than enumerating the whole box of new satellite
+ * ambiguities, each hypothesis is extended with the candidates for all the
+ * addible dds in order of their likelihood given the hypothesis, see
+ * best_first_search(). The search for each hypothesis stops at its share
+ * of the free pool or once the candidates cover BEST_FIRST_PROB_MASS of the
+ * mass, and the candidates outside the joint box of the float solution are
+ * dropped.
+ * Returns the new number of hypotheses, or -1 if nothing was changed. */
+static s32 add_sats_best_first(ambiguity_test_t *amb_test,
+                               gnss_signal_t ref_sid, gnss_signal_t *added_sids,
+                               intersection_count_t *x, u8 state_dim,
+                               const double *N_cov_ordered,
+                               const double *N_mean_ordered)
+{
+  memory_pool_t *pool = amb_test->pool;
+  u32 n_parents = memory_pool_n_allocated(pool);
+  u32 max_num_hyps = memory_pool_n_elements(pool);
+  u8 old_dim = x->old_dim;
+  u8 new_dim = x->new_dim;
+  u8 full_dim = old_dim + new_dim;
+  assert(full_dim == state_dim);
+
+  if (n_parents >= max_num_hyps) {
+    return -1;
+  }
+  /* The existing hypotheses stay in the pool while the new ones are
+   * generated. */
+  u32 budget = MIN((max_num_hyps - n_parents) / n_parents,
+                   BEST_FIRST_MAX_CANDIDATES);
+  if (budget == 0) {
+    return -1;
+  }
+
+  /* Factor the float covariance once for all the hypotheses. */
+  double R[full_dim * full_dim];
+  memcpy(R, N_cov_ordered, sizeof(R));
+  if (small_kernels(full_dim)->cholesky(full_dim, R) != 0) {
+    return -1;
+  }
+  double cond_cov[new_dim * new_dim];
+  double log_det = 0;
+  for (u8 i = 0; i < new_dim; i++) {
+    const double *R_i = &R[(old_dim + i)*full_dim + old_dim];
+    log_det += 2 * log(R_i[i]);
+    for (u8 j = 0; j <= i; j++) {
+      const double *R_j = &R[(old_dim + j)*full_dim + old_dim];
+      double v = 0;
+      for (u8 k = 0; k <= j; k++) {
+        v += R_i[k] * R_j[k];
+      }
+      cond_cov[i*new_dim + j] = cond_cov[j*new_dim + i] = v;
+    }
+  }
+  double L[new_dim * new_dim];
+  double D[new_dim];
+  double Z[new_dim * new_dim];
+  double Zi[new_dim * new_dim];
+  if (lambda_factor(new_dim, cond_cov, L, D, Z, Zi) != 0) {
+    return -1;
+  }
+  double F[new_dim * budget];
+  double s[budget];
+  z_t cands[new_dim * budget];
+  best_first_cond_t c = {
+    .old_dim = old_dim,
+    .new_dim = new_dim,
+    .mean = N_mean_ordered,
+    .R = R,
+    .L = L,
+    .D = D,
+    .Z = Z,
+    .Zi = Zi,
+    .log_norm = 0.5 * (new_dim * log(2 * M_PI) + log_det),
+    .budget = budget,
+    .F = F,
+    .s = s
+  };
+
+  /* Joint box the extended hypotheses must lie in. */
+  float_to_decor(N_cov_ordered, N_mean_ordered, state_dim, full_dim,
+                 x->box_lower_bounds, x->box_upper_bounds, x->Z1, x->Z1_inv);
+
+  /* Candidates are already new dd values, no transform back. */
+  for (u8 i = 0; i < new_dim; i++) {
+    for (u8 j = 0; j < new_dim; j++) {
+      x->Z2_inv[i*new_dim + j] = (i == j);
+    }
+  }
+
+  best_first_generator_t p;
+  p.g.x = x;
+  p.g.Z_new_inv = x->Z2_inv;
+  p.c = &c;
+  p.cands = cands;
+  remap_sids(amb_test, ref_sid, new_dim, added_sids, &p.g);
+  memory_pool_product_generator(pool, &p, max_num_hyps, sizeof(p),
+                                &best_first_init, &best_first_next,
+                                &intersection_hypothesis_prod);
+  s32 num_hyps = memory_pool_n_allocated(pool);
+  log_info("IAR: updates to %"PRId32" from %"PRIu32" hypotheses",
+           num_hyps, n_parents);
+  log_info("add_sats. num sats: %i", amb_test->sats.num_sats);
+  return num_hyps;
+}
 
 /*
  * The satellite inclusion algorithm considers three important vector spaces:
@@ -1030,7 +2111,11 @@ static s32 add_sats(ambiguity_test_t *amb_test,
  *  If too many hypotheses result to fit in memory, we repeat the calculation
  *  using fewer new sats. If it is impossible to add a sufficient number of
  *  sats to make progress towards an RTK solution (< 4 double differences
- *  total) we return without adding any.
+ *  total) we return without adding any, unless the overflow policy is to keep
+ *  the most likely hypotheses.
+ *
+ *  Returns 1 if the hypotheses fit, 2 if they were enumerated but don't fit
+ *  and 0 if there are too many to enumerate.
  */
 static u8 inclusion_loop_body(
        u8 num_dds_to_add,
@@ -1086,6 +2171,7 @@ static u8 inclusion_loop_body(
       /* The hypotheses generated for these double-differences fit. */
       return 1;
     }
+    return 2;
   }
 
   /* Can't add sats for this value of num_dds_to_add. */
@@ -1230,6 +2316,18 @@ u8 ambiguity_sat_inclusion(ambiguity_test_t *amb_test, const u8 num_dds_in_inter
   x.Z1_inv = Z1_inv;
   x.Z2_inv = Z2_inv;
 
+  if (amb_test->overflow_policy == AMBIGUITY_OVERFLOW_BEST_FIRST) {
+    s32 num_hyps = add_sats_best_first(amb_test, ref_sid, new_dd_sids, &x,
+                                       state_dim, N_cov_ordered, N_mean_ordered);
+    if (num_hyps < 0) {
+      return 0;
+    } else if (num_hyps == 0) {
+      return 2;
+    } else {
+      return 1;
+    }
+  }
+
   u32 full_size = 0;
 
   /* Check to see if min_dds_to_add will not fit. If so, don't bother
@@ -1238,7 +2336,19 @@ u8 ambiguity_sat_inclusion(ambiguity_test_t *amb_test, const u8 num_dds_in_inter
       min_dds_to_add, amb_test->pool, state_dim, num_addible_dds,
       N_cov_ordered, N_mean_ordered, addible_float_cov, addible_float_mean,
       &x, &full_size);
-  if (fits == 0) {
+  if (fits == 2 && amb_test->overflow_policy == AMBIGUITY_OVERFLOW_TOP_K) {
+    /* Even the fewest sats overflow the pool, keep the most likely. */
+    s32 num_hyps = add_sats_top_k(amb_test, ref_sid, new_dd_sids, &x,
+                                  state_dim, N_cov_ordered, N_mean_ordered);
+    if (num_hyps < 0) {
+      return 0;
+    } else if (num_hyps == 0) {
+      return 2;
+    } else {
+      return 1;
+    }
+  }
+  if (fits != 1) {
     return 0;
   }
 
@@ -1484,7 +2594,7 @@ u8 ambiguity_update_sats(ambiguity_test_t *amb_test, const u8 num_sdiffs,
   DEBUG_ENTRY();
 
   if (num_sdiffs < 2) {
-    create_ambiguity_test(amb_test);
+    reset_ambiguity_test(amb_test);
     log_debug("< 2 sdiffs, starting over");
     DEBUG_EXIT();
     return 0; // I chose 0 because it doesn't lead to anything dynamic
@@ -1502,14 +2612,14 @@ u8 ambiguity_update_sats(ambiguity_test_t *amb_test, const u8 num_sdiffs,
      changed_sats=1;
     }
   } else {
-    create_ambiguity_test(amb_test);//we don't have what we need
+    reset_ambiguity_test(amb_test);//we don't have what we need
   }
 
   u8 intersection_ndxs[num_sdiffs];
   u8 num_dds_in_intersection = find_indices_of_intersection_sats(amb_test, num_sdiffs, sdiffs_with_ref_first, intersection_ndxs);
   /* Reset the ambiguity test if we have no sats in common with the last step */
   if (amb_test->sats.num_sats > 1 && num_dds_in_intersection == 0) {
-    create_ambiguity_test(amb_test);
+    reset_ambiguity_test(amb_test);
   }
 
   /* Project out and lost satellites if there were any. */
@@ -1521,7 +2631,7 @@ u8 ambiguity_update_sats(ambiguity_test_t *amb_test, const u8 num_sdiffs,
     u8 incl = ambiguity_sat_inclusion(amb_test, num_dds_in_intersection,
                 float_sats, float_mean, float_cov_U, float_cov_D);
     if (incl == 2) {
-      create_ambiguity_test(amb_test);
+      reset_ambiguity_test(amb_test);
       changed_sats = 1;
     } else if (incl == 1) {
       changed_sats = 1;
@@ -1709,6 +2819,7 @@ void add_sats_old(ambiguity_test_t *amb_test,
     hypothesis_t *empty_element = (hypothesis_t *)memory_pool_add(amb_test->pool); // only in init
     /* Start with ll = 0, just for the sake of argument. */
     empty_element->ll = 0; // only in init
+    amb_test->ll_offset = 0;
   }
 
   log_info("IAR: %"PRIu32" hypotheses before inclusion", memory_pool_n_allocated(amb_test->pool));
@@ -1770,19 +2881,16 @@ void assign_residual_covariance_inverse(u8 num_dds, double *obs_cov, double *q,
               0, r_cov_inv, res_dim); //beta, double *C, int ldc
   // MAT_PRINTF(r_cov_inv, res_dim, res_dim);
 
-  // dpotrf_(char *uplo, __CLPK_integer *n, __CLPK_doublereal *a, __CLPK_integer *
-  //       lda, __CLPK_integer *info)
   //dpotri_(char *uplo, __CLPK_integer *n, __CLPK_doublereal *a, __CLPK_integer *
   //        lda, __CLPK_integer *info)
-  char uplo = 'L'; //actually this makes it upper. the lapack stuff is all column major, but we're good since we're operiating on symmetric matrices
-  integer info;
-  dpotrf_(&uplo, &res_dim, r_cov_inv, &res_dim, &info);
-  // printf("info: %i\n", (int) info);
+  small_kernels(res_dim)->cholesky(res_dim, r_cov_inv);
   // MAT_PRINTF(r_cov_inv, res_dim, res_dim);
+  char uplo = 'U'; //actually this makes it lower. the lapack stuff is all column major, so the row major L L^T is U^T U to it
+  integer info;
   dpotri_(&uplo, &res_dim, r_cov_inv, &res_dim, &info);
   for (u8 i=0; i < res_dim; i++) {
     for (u8 j=0; j < i; j++) {
-      r_cov_inv[i*res_dim + j] = r_cov_inv[j*res_dim + i];
+      r_cov_inv[j*res_dim + i] = r_cov_inv[i*res_dim + j];
     }
   }
   // printf("info: %i\n", (int) info);
@@ -1824,11 +2932,9 @@ double get_quadratic_term(residual_mtxs_t *res_mtxs, u8 num_dds, double *hypothe
   }
   // VEC_PRINTF(r, res_mtxs->res_dim);
   double half_sig_dot_r[res_mtxs->res_dim];
-  cblas_dsymv(CblasRowMajor, CblasUpper,
-                 res_mtxs->res_dim,
-                 1, res_mtxs->half_res_cov_inv, res_mtxs->res_dim,
-                 r, 1,
-                 0, half_sig_dot_r, 1);
+  small_kernels(res_mtxs->res_dim)->symv(res_mtxs->res_dim,
+                                         res_mtxs->half_res_cov_inv,
+                                         r, half_sig_dot_r);
   // VEC_PRINTF(half_sig_dot_r, res_mtxs->res_dim);
   double quad_term = 0;
   for (u32 i=0; i<res_mtxs->res_dim; i++) {
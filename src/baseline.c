@@ -22,8 +22,10 @@
 #include <libswiftnav/baseline.h>
 #include <libswiftnav/amb_kf.h>
 #include <libswiftnav/linear_algebra.h>
+#include <libswiftnav/raim.h>
 #include <libswiftnav/filter_utils.h>
 #include <libswiftnav/set.h>
+#include <libswiftnav/small_matrix.h>
 #include <libswiftnav/sats_management.h> /* choose_reference_sat */
 
 /** \defgroup baseline Baseline calculations
@@ -181,6 +183,62 @@ void amb_from_baseline(u8 num_dds, const double *DE, const double *dd_obs,
  *    We also need to determine if this is even worth the extra effort.
  */
 
+/* Solves the least squares problem of lesq_solution_float() with DGELSY.
+ * The solution is returned in the first 3 elements of phase_ranges. */
+static s8 lesq_solution_dgelsy(integer num_dds, const double *DE,
+                               double *phase_ranges)
+{
+  double DET[num_dds * 3];
+  matrix_transpose(num_dds, 3, DE, DET);
+
+  s32 ldb = (s32) MAX(num_dds,3);
+  integer jpvt[3] = {0, 0, 0};
+  double rcond = 1e-12;
+  s32 rank;
+  s32 info;
+  s32 three = 3;
+  s32 one = 1;
+
+  /* From LAPACK DGELSY documentation:
+   * The unblocked strategy requires that:
+   *   LWORK >= MAX( MN+3*N+1, 2*MN+NRHS )
+   *   where MN = MIN( M, N )
+   *
+   * Therefore:
+   *   M >= 3, N = 3, NRHS = 1
+   *   MN = 3
+   *   LWORK >= 13
+   */
+  s32 lwork = 13;
+  double work[lwork];
+
+  /* DGELSY solves:
+   *   argmin || A.x - B ||
+   * under the l2 norm, where
+   *   A <- DE
+   *   B <- phase_ranges = dd_obs - N
+   *   M <- num_dds
+   *   N <- 3
+   *   NRHS <- 1
+   *
+   * the baseline result x is returned in the first 3 elements of phase_ranges.
+   */
+  dgelsy_(&num_dds, &three, &one, /* M, N, NRHS. */
+          DET, &num_dds,          /* A, LDA. */
+          phase_ranges, &ldb,     /* B, LDB. */
+          jpvt, &rcond,           /* JPVT, RCOND. */
+          &rank,                  /* RANK. */
+          work, &lwork,           /* WORK, LWORK. */
+          &info);                 /* INFO. */
+
+  if (info != 0) {
+    log_error("dgelsy returned error %"PRId32"", info);
+    return -1;
+  }
+
+  return 0;
+}
+
 /** Calculate least squares baseline solution from a set of double difference
  * carrier phase observations and carrier phase ambiguities.
  *
@@ -251,81 +309,32 @@ s8 lesq_solution_float(u8 num_dds_u8, const double *dd_obs, const double *N,
   }
 
   integer num_dds = num_dds_u8;
-  double DET[num_dds * 3];
-  matrix_transpose(num_dds, 3, DE, DET);
-
   double phase_ranges[MAX(num_dds,3)];
   for (u8 i=0; i< num_dds; i++) {
     phase_ranges[i] = dd_obs[i] - N[i];
   }
 
-  s32 ldb = (s32) MAX(num_dds,3);
-  integer jpvt[3] = {0, 0, 0};
-  double rcond = 1e-12;
-  s32 rank;
-  s32 info;
-  s32 three = 3;
-  s32 one = 1;
-
-  /* From LAPACK DGELSY documentation:
-   * The unblocked strategy requires that:
-   *   LWORK >= MAX( MN+3*N+1, 2*MN+NRHS )
-   *   where MN = MIN( M, N )
-   *
-   * Therefore:
-   *   M >= 3, N = 3, NRHS = 1
-   *   MN = 3
-   *   LWORK >= 13
-   */
-  s32 lwork = 13;
-  double work[lwork];
-
-  /* DGELSY solves:
-   *   argmin || A.x - B ||
-   * under the l2 norm, where
-   *   A <- DE
-   *   B <- phase_ranges = dd_obs - N
-   *   M <- num_dds
-   *   N <- 3
-   *   NRHS <- 1
-   *
-   * the baseline result x is returned in the first 3 elements of phase_ranges.
-   */
-  dgelsy_(&num_dds, &three, &one, /* M, N, NRHS. */
-          DET, &num_dds,          /* A, LDA. */
-          phase_ranges, &ldb,     /* B, LDB. */
-          jpvt, &rcond,           /* JPVT, RCOND. */
-          &rank,                  /* RANK. */
-          work, &lwork,           /* WORK, LWORK. */
-          &info);                 /* INFO. */
-
-  if (info != 0) {
-    log_error("dgelsy returned error %"PRId32"", info);
+  /* The dimension specialized solver handles the full rank problems, DGELSY
+   * is only needed for its minimum norm solution of rank deficient ones. */
+  double x[3];
+  if (small_kernels(num_dds_u8)->lesq3(num_dds_u8, DE, phase_ranges, x) == 0) {
+    memcpy(phase_ranges, x, sizeof(x));
+  } else if (lesq_solution_dgelsy(num_dds, DE, phase_ranges) < 0) {
     return -2;
   }
 
-  assert(num_dds == num_dds_u8);
-
   b[0] = phase_ranges[0] * GPS_L1_LAMBDA_NO_VAC;
   b[1] = phase_ranges[1] * GPS_L1_LAMBDA_NO_VAC;
   b[2] = phase_ranges[2] * GPS_L1_LAMBDA_NO_VAC;
 
   if (resid) {
-    /* Calculate Least Squares Residuals */
-
-    /* resid <= dd_obs - N
-     * alpha <= - 1.0 / GPS_L1_LAMBDA_NO_VAC
-     * beta <= 1.0
-     * resid <= beta * resid + alpha * (DE . b)
-     */
+    /* Calculate Least Squares Residuals
+     * resid <= dd_obs - N - (DE . b) / GPS_L1_LAMBDA_NO_VAC */
+    double DEb[num_dds];
+    small_kernels(3)->gemv(num_dds, 3, DE, b, DEb);
     for (u8 i=0; i<num_dds; i++) {
-      resid[i] = dd_obs[i] - N[i];
+      resid[i] = dd_obs[i] - N[i] - DEb[i] / GPS_L1_LAMBDA_NO_VAC;
     }
-    cblas_dgemv(
-      CblasRowMajor, CblasNoTrans, num_dds, 3,
-      -1.0 / GPS_L1_LAMBDA_NO_VAC, DE, 3, b, 1,
-      1.0, resid, 1
-    );
   }
 
   return 0;
@@ -408,7 +417,7 @@ static bool chi_test(double threshold, u8 num_dds,
  *    -`0`: solution with all dd's ok
  *
  *   -`-1`: < 3 dds
- *   -`-2`: dgelsy  error (see lesq_solution_float)
+ *   -`-2`: dgelsy  error (see lesq_solution_float) or singular geometry
  *   -`-3`: raim check failed, repair failed, ref satellite was bad
  *   -`-4`: raim check failed, not enough sats for repair
  *   -`-5`: raim check failed, repair failed, more than one acceptable solution
@@ -462,16 +471,30 @@ s8 lesq_solve_raim(u8 num_dds_u8, const double *dd_obs,
     return -4;
   }
 
+  /* Residuals of every subset with one dd dropped, from a single
+   * factorization of the full set normal matrix. Solving in cycles gives
+   * residuals in the same units as lesq_solution_float. */
+  double y[num_dds];
+  for (u8 i = 0; i < num_dds; i++) {
+    y[i] = dd_obs[i] - N[i];
+  }
+  double x[3];
+  raim_subset_t subsets[num_dds];
+  if (raim_leave_one_out(num_dds, 3, DE, y, x, NULL, subsets) < 0) {
+    if (n_used) {
+      *n_used = 0;
+    }
+    return -2;
+  }
+
   u8 num_passing = 0;
   u8 bad_sat = -1;
-  u8 new_dds = num_dds - 1;
+  double sigma = sqrt(DEFAULT_PHASE_VAR_KF);
 
   for (u8 i = 0; i < num_dds; i++) {
-    if (0 == lesq_without_i(i, num_dds, dd_obs, N, DE, b, residuals)) {
-      if (chi_test(raim_threshold, new_dds, residuals, &residual)) {
-        num_passing++;
-        bad_sat = i;
-      }
+    if (subsets[i].valid && subsets[i].residual / sigma < raim_threshold) {
+      num_passing++;
+      bad_sat = i;
     }
   }
 
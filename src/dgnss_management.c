@@ -13,6 +13,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stddef.h>
 
 #include <libswiftnav/logging.h>
 #include <libswiftnav/amb_kf.h>
@@ -22,12 +23,19 @@
 #include <libswiftnav/linear_algebra.h>
 #include <libswiftnav/filter_utils.h>
 #include <libswiftnav/ambiguity_test.h>
+#include <libswiftnav/lambda.h>
 
-nkf_t nkf;
-sats_management_t sats_management;
-ambiguity_test_t ambiguity_test;
-
-dgnss_settings_t dgnss_settings = {
+/** \defgroup dgnss_management DGNSS management
+ * Float and integer ambiguity resolution of a single baseline.
+ *
+ * All state of the baseline filters is held in a ::dgnss_ctx_t. The
+ * `dgnss_ctx_*` functions operate on a caller owned context so that any
+ * number of baselines can be processed independently, e.g. one context per
+ * rover, each used from at most one thread at a time. The remaining
+ * functions operate on a single default context.
+ * \{ */
+
+static const dgnss_settings_t default_settings = {
   .phase_var_test = DEFAULT_PHASE_VAR_TEST,
   .code_var_test = DEFAULT_CODE_VAR_TEST,
   .phase_var_kf = DEFAULT_PHASE_VAR_KF,
@@ -35,20 +43,71 @@ dgnss_settings_t dgnss_settings = {
   .amb_drift_var = DEFAULT_AMB_DRIFT_VAR,
   .amb_init_var = DEFAULT_AMB_INIT_VAR,
   .new_int_var = DEFAULT_NEW_INT_VAR,
+  .partial_fix = false,
+  .par_success_rate = DEFAULT_PAR_SUCCESS_RATE,
+  .par_ratio = DEFAULT_PAR_RATIO,
 };
 
-void dgnss_set_settings(double phase_var_test, double code_var_test,
-                        double phase_var_kf, double code_var_kf,
-                        double amb_drift_var, double amb_init_var,
-                        double new_int_var)
+/** Initialize a DGNSS context.
+ *
+ * Sets the default settings and empties the filters. The context holds
+ * pointers into itself so it must not be copied or moved once initialized.
+ *
+ * \param ctx Context to initialize
+ */
+void dgnss_ctx_init(dgnss_ctx_t *ctx)
 {
-  dgnss_settings.phase_var_test = phase_var_test;
-  dgnss_settings.code_var_test  = code_var_test;
-  dgnss_settings.phase_var_kf   = phase_var_kf;
-  dgnss_settings.code_var_kf    = code_var_kf;
-  dgnss_settings.amb_drift_var  = amb_drift_var;
-  dgnss_settings.amb_init_var   = amb_init_var;
-  dgnss_settings.new_int_var    = new_int_var;
+  memset(ctx, 0, offsetof(dgnss_ctx_t, hyp_pool_buff));
+  ctx->settings = default_settings;
+  init_ambiguity_test(&ctx->ambiguity_test, &ctx->hyp_pool,
+                      ctx->hyp_pool_buff);
+}
+
+/** Default context used by the functions without a context argument. */
+static dgnss_ctx_t *default_ctx(void)
+{
+  static dgnss_ctx_t ctx;
+  static bool initialized = false;
+  if (!initialized) {
+    dgnss_ctx_init(&ctx);
+    initialized = true;
+  }
+  return &ctx;
+}
+
+void dgnss_ctx_set_settings(dgnss_ctx_t *ctx,
+                            double phase_var_test, double code_var_test,
+                            double phase_var_kf, double code_var_kf,
+                            double amb_drift_var, double amb_init_var,
+                            double new_int_var)
+{
+  ctx->settings.phase_var_test = phase_var_test;
+  ctx->settings.code_var_test  = code_var_test;
+  ctx->settings.phase_var_kf   = phase_var_kf;
+  ctx->settings.code_var_kf    = code_var_kf;
+  ctx->settings.amb_drift_var  = amb_drift_var;
+  ctx->settings.amb_init_var   = amb_init_var;
+  ctx->settings.new_int_var    = new_int_var;
+}
+
+/** Configure partial ambiguity resolution.
+ *
+ * While IAR has not resolved the ambiguities,
+ * dgnss_ctx_update_ambiguity_state() fixes the largest subset of the float
+ * filter ambiguities that passes both thresholds, see lambda_partial().
+ *
+ * \param ctx Context to configure
+ * \param enable Whether to fix a subset of the ambiguities
+ * \param success_rate Minimum bootstrapped success rate of the subset
+ * \param ratio Minimum ratio of the second best to the best squared distance
+ *              of the subset
+ */
+void dgnss_ctx_set_partial_fix(dgnss_ctx_t *ctx, bool enable,
+                               double success_rate, double ratio)
+{
+  ctx->settings.partial_fix      = enable;
+  ctx->settings.par_success_rate = success_rate;
+  ctx->settings.par_ratio        = ratio;
 }
 
 void make_measurements(u8 num_double_diffs, const sdiff_t *sdiffs, double *raw_measurements)
@@ -65,10 +124,10 @@ void make_measurements(u8 num_double_diffs, const sdiff_t *sdiffs, double *raw_m
   DEBUG_EXIT();
 }
 
-static bool sids_match(const gnss_signal_t *old_non_ref_sids, u16 num_non_ref_sdiffs,
+static bool sids_match(const dgnss_ctx_t *ctx, const gnss_signal_t *old_non_ref_sids, u16 num_non_ref_sdiffs,
                        const sdiff_t *non_ref_sdiffs)
 {
-  if (sats_management.num_sats-1 != num_non_ref_sdiffs) {
+  if (ctx->sats_management.num_sats-1 != num_non_ref_sdiffs) {
     /* lengths don't match */
     return false;
   }
@@ -105,14 +164,15 @@ static u8 dgnss_intersect_sats(u8 num_old_sids, const gnss_signal_t *old_sids,
   return n;
 }
 
-void dgnss_init(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3])
+void dgnss_ctx_init_filters(dgnss_ctx_t *ctx, u8 num_sats, sdiff_t *sdiffs,
+                            double receiver_ecef[3])
 {
   DEBUG_ENTRY();
 
   sdiff_t corrected_sdiffs[num_sats];
-  init_sats_management(&sats_management, num_sats, sdiffs, corrected_sdiffs);
+  init_sats_management(&ctx->sats_management, num_sats, sdiffs, corrected_sdiffs);
 
-  create_ambiguity_test(&ambiguity_test);
+  reset_ambiguity_test(&ctx->ambiguity_test);
 
   if (num_sats <= 1) {
     DEBUG_EXIT();
@@ -123,25 +183,28 @@ void dgnss_init(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3])
   make_measurements(num_sats-1, corrected_sdiffs, dd_measurements);
 
   set_nkf(
-    &nkf,
-    dgnss_settings.amb_drift_var,
-    dgnss_settings.phase_var_kf, dgnss_settings.code_var_kf,
-    dgnss_settings.amb_init_var,
+    &ctx->nkf,
+    ctx->settings.amb_drift_var,
+    ctx->settings.phase_var_kf, ctx->settings.code_var_kf,
+    ctx->settings.amb_init_var,
     num_sats, corrected_sdiffs, dd_measurements, receiver_ecef
   );
 
   DEBUG_EXIT();
 }
 
-void dgnss_rebase_ref(u8 num_sdiffs, sdiff_t *sdiffs, double receiver_ecef[3], gnss_signal_t old_sids[MAX_CHANNELS], sdiff_t *corrected_sdiffs)
+void dgnss_ctx_rebase_ref(dgnss_ctx_t *ctx, u8 num_sdiffs, sdiff_t *sdiffs,
+                          double receiver_ecef[3],
+                          gnss_signal_t old_sids[MAX_CHANNELS],
+                          sdiff_t *corrected_sdiffs)
 {
   (void)receiver_ecef;
   /* all the ref sat stuff */
-  s8 sats_management_code = rebase_sats_management(&sats_management, num_sdiffs, sdiffs, corrected_sdiffs);
+  s8 sats_management_code = rebase_sats_management(&ctx->sats_management, num_sdiffs, sdiffs, corrected_sdiffs);
   if (sats_management_code == NEW_REF_START_OVER) {
     log_info("Unable to rebase to new ref, resetting filters and starting over");
-    dgnss_init(num_sdiffs, sdiffs, receiver_ecef);
-    memcpy(old_sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
+    dgnss_ctx_init_filters(ctx, num_sdiffs, sdiffs, receiver_ecef);
+    memcpy(old_sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
     if (num_sdiffs >= 1) {
       copy_sdiffs_put_ref_first(old_sids[0], num_sdiffs, sdiffs, corrected_sdiffs);
     }
@@ -150,7 +213,7 @@ void dgnss_rebase_ref(u8 num_sdiffs, sdiff_t *sdiffs, double receiver_ecef[3], g
   }
   else if (sats_management_code == NEW_REF) {
     /* do everything related to changing the reference sat here */
-    rebase_nkf(&nkf, sats_management.num_sats, &old_sids[0], &sats_management.sids[0]);
+    rebase_nkf(&ctx->nkf, ctx->sats_management.num_sats, &old_sids[0], &ctx->sats_management.sids[0]);
   }
 }
 
@@ -185,7 +248,7 @@ static void dgnss_simple_amb_meas(const u8 num_sdiffs,
   }
 }
 
-static void dgnss_update_sats(u8 num_sdiffs, double receiver_ecef[3],
+static void dgnss_update_sats(dgnss_ctx_t *ctx, u8 num_sdiffs, double receiver_ecef[3],
                               sdiff_t *sdiffs_with_ref_first,
                               double *dd_measurements)
 {
@@ -196,49 +259,55 @@ static void dgnss_update_sats(u8 num_sdiffs, double receiver_ecef[3],
   sdiffs_to_sids(num_sdiffs, sdiffs_with_ref_first, new_sids);
 
   gnss_signal_t old_sids[MAX_CHANNELS];
-  memcpy(old_sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
+  memcpy(old_sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
 
-  if (!sids_match(&old_sids[1], num_sdiffs-1, &sdiffs_with_ref_first[1])) {
-    u8 ndx_of_intersection_in_old[sats_management.num_sats];
-    u8 ndx_of_intersection_in_new[sats_management.num_sats];
+  if (!sids_match(ctx, &old_sids[1], num_sdiffs-1, &sdiffs_with_ref_first[1])) {
+    u8 ndx_of_intersection_in_old[ctx->sats_management.num_sats];
+    u8 ndx_of_intersection_in_new[ctx->sats_management.num_sats];
     ndx_of_intersection_in_old[0] = 0;
     ndx_of_intersection_in_new[0] = 0;
     u8 num_intersection_sats = dgnss_intersect_sats(
-        sats_management.num_sats-1, &old_sids[1],
+        ctx->sats_management.num_sats-1, &old_sids[1],
         num_sdiffs-1, &sdiffs_with_ref_first[1],
         &ndx_of_intersection_in_old[1],
         &ndx_of_intersection_in_new[1]) + 1;
 
     set_nkf_matrices(
-      &nkf,
-      dgnss_settings.phase_var_kf, dgnss_settings.code_var_kf,
+      &ctx->nkf,
+      ctx->settings.phase_var_kf, ctx->settings.code_var_kf,
       num_sdiffs, sdiffs_with_ref_first, receiver_ecef
     );
 
-    if (num_intersection_sats < sats_management.num_sats) { /* we lost sats */
-      nkf_state_projection(&nkf,
-                           sats_management.num_sats-1,
-                           num_intersection_sats-1,
-                           &ndx_of_intersection_in_old[1]);
+    if (num_intersection_sats < ctx->sats_management.num_sats) { /* we lost sats */
+      if (nkf_state_projection(&ctx->nkf,
+                               ctx->sats_management.num_sats-1,
+                               num_intersection_sats-1,
+                               &ndx_of_intersection_in_old[1])) {
+        log_warn("dgnss_update_sats: bad projection, resetting filters");
+        dgnss_ctx_init_filters(ctx, num_sdiffs, sdiffs_with_ref_first,
+                               receiver_ecef);
+        DEBUG_EXIT();
+        return;
+      }
     }
     if (num_intersection_sats < num_sdiffs) { /* we gained sats */
       double simple_estimates[num_sdiffs-1];
       dgnss_simple_amb_meas(num_sdiffs, sdiffs_with_ref_first,
                             simple_estimates);
-      nkf_state_inclusion(&nkf,
+      nkf_state_inclusion(&ctx->nkf,
                           num_intersection_sats-1,
                           num_sdiffs-1,
                           &ndx_of_intersection_in_new[1],
                           simple_estimates,
-                          dgnss_settings.new_int_var);
+                          ctx->settings.new_int_var);
     }
 
-    update_sats_sats_management(&sats_management, num_sdiffs-1, &sdiffs_with_ref_first[1]);
+    update_sats_sats_management(&ctx->sats_management, num_sdiffs-1, &sdiffs_with_ref_first[1]);
   }
   else {
     set_nkf_matrices(
-      &nkf,
-      dgnss_settings.phase_var_kf, dgnss_settings.code_var_kf,
+      &ctx->nkf,
+      ctx->settings.phase_var_kf, ctx->settings.code_var_kf,
       num_sdiffs, sdiffs_with_ref_first, receiver_ecef
     );
   }
@@ -246,8 +315,29 @@ static void dgnss_update_sats(u8 num_sdiffs, double receiver_ecef[3],
   DEBUG_EXIT();
 }
 
-void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3],
-                  bool disable_raim, double raim_threshold)
+/* Update the sats of the ambiguity test from the float filter, see
+ * ambiguity_update_sats(). The dense U the inclusion of new sats reads is
+ * only unpacked when the sats changed, otherwise U isn't read. */
+static u8 update_amb_test_sats(dgnss_ctx_t *ctx, u8 num_sats, sdiff_t *sdiffs,
+                               u8 is_bad_measurement)
+{
+  u32 state_dim = ctx->nkf.state_dim;
+  if (state_dim == 0 || sats_match(&ctx->ambiguity_test, num_sats, sdiffs)) {
+    return ambiguity_update_sats(&ctx->ambiguity_test, num_sats, sdiffs,
+                                 &ctx->sats_management, ctx->nkf.state_mean,
+                                 NULL, ctx->nkf.state_cov_D,
+                                 is_bad_measurement);
+  }
+  double U[state_dim * state_dim];
+  nkf_unpack_U(&ctx->nkf, U);
+  return ambiguity_update_sats(&ctx->ambiguity_test, num_sats, sdiffs,
+                               &ctx->sats_management, ctx->nkf.state_mean,
+                               U, ctx->nkf.state_cov_D, is_bad_measurement);
+}
+
+void dgnss_ctx_update(dgnss_ctx_t *ctx, u8 num_sats, sdiff_t *sdiffs,
+                      double receiver_ecef[3],
+                      bool disable_raim, double raim_threshold)
 {
   DEBUG_ENTRY();
   log_debug("dgnss_update");
@@ -268,40 +358,40 @@ void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3],
   }
 
   if (num_sats <= 1) {
-    sats_management.num_sats = num_sats;
+    ctx->sats_management.num_sats = num_sats;
     if (num_sats == 1) {
-      sats_management.sids[0] = sdiffs[0].sid;
+      ctx->sats_management.sids[0] = sdiffs[0].sid;
     }
-    create_ambiguity_test(&ambiguity_test);
+    reset_ambiguity_test(&ctx->ambiguity_test);
     DEBUG_EXIT();
     return;
   }
 
-  if (sats_management.num_sats <= 1) {
-    dgnss_init(num_sats, sdiffs, receiver_ecef);
+  if (ctx->sats_management.num_sats <= 1) {
+    dgnss_ctx_init_filters(ctx, num_sats, sdiffs, receiver_ecef);
   }
 
   sdiff_t sdiffs_with_ref_first[num_sats];
 
   gnss_signal_t old_sids[MAX_CHANNELS];
-  memcpy(old_sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
+  memcpy(old_sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
 
   /* rebase globals to a new reference sat
    * (permutes sdiffs_with_ref_first accordingly) */
-  dgnss_rebase_ref(num_sats, sdiffs, receiver_ecef, old_sids, sdiffs_with_ref_first);
+  dgnss_ctx_rebase_ref(ctx, num_sats, sdiffs, receiver_ecef, old_sids, sdiffs_with_ref_first);
 
   double dd_measurements[2*(num_sats-1)];
   make_measurements(num_sats-1, sdiffs_with_ref_first, dd_measurements);
 
   /* all the added/dropped sat stuff */
-  dgnss_update_sats(num_sats, receiver_ecef, sdiffs_with_ref_first, dd_measurements);
+  dgnss_update_sats(ctx, num_sats, receiver_ecef, sdiffs_with_ref_first, dd_measurements);
 
   /* Unless the KF says otherwise, DONT TRUST THE MEASUREMENTS */
   u8 is_bad_measurement = true;
   double ref_ecef[3];
   if (num_sats >= 5) {
     double b2[3];
-    s8 code = least_squares_solve_b_external_ambs(nkf.state_dim, nkf.state_mean,
+    s8 code = least_squares_solve_b_external_ambs(ctx->nkf.state_dim, ctx->nkf.state_mean,
         sdiffs_with_ref_first, dd_measurements, receiver_ecef, b2,
         disable_raim, raim_threshold);
 
@@ -315,63 +405,89 @@ void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3],
 
     /* TODO: make a common DE and use it instead. */
 
-    set_nkf_matrices(&nkf,
-                     dgnss_settings.phase_var_kf, dgnss_settings.code_var_kf,
-                     sats_management.num_sats, sdiffs_with_ref_first, ref_ecef);
+    set_nkf_matrices(&ctx->nkf,
+                     ctx->settings.phase_var_kf, ctx->settings.code_var_kf,
+                     ctx->sats_management.num_sats, sdiffs_with_ref_first, ref_ecef);
 
-    is_bad_measurement = nkf_update(&nkf, dd_measurements);
+    is_bad_measurement = nkf_update(&ctx->nkf, dd_measurements);
   }
 
-  u8 changed_sats = ambiguity_update_sats(&ambiguity_test, num_sats, sdiffs,
-                                          &sats_management, nkf.state_mean,
-                                          nkf.state_cov_U, nkf.state_cov_D,
-                                          is_bad_measurement);
+  u8 changed_sats = update_amb_test_sats(ctx, num_sats, sdiffs,
+                                         is_bad_measurement);
 
   if (!is_bad_measurement) {
     update_ambiguity_test(ref_ecef,
-                          dgnss_settings.phase_var_test,
-                          dgnss_settings.code_var_test,
-                          &ambiguity_test, nkf.state_dim,
+                          ctx->settings.phase_var_test,
+                          ctx->settings.code_var_test,
+                          &ctx->ambiguity_test, ctx->nkf.state_dim,
                           sdiffs, changed_sats);
   }
 
-  update_unanimous_ambiguities(&ambiguity_test);
+  update_unanimous_ambiguities(&ctx->ambiguity_test);
 
   DEBUG_EXIT();
 }
 
-u32 dgnss_iar_num_hyps(void)
+u32 dgnss_ctx_iar_num_hyps(dgnss_ctx_t *ctx)
 {
-  if (ambiguity_test.pool == NULL) {
+  if (ctx->ambiguity_test.pool == NULL) {
     return 0;
   } else {
-    return ambiguity_test_n_hypotheses(&ambiguity_test);
+    return ambiguity_test_n_hypotheses(&ctx->ambiguity_test);
   }
 }
 
-u32 dgnss_iar_num_sats(void)
+u32 dgnss_ctx_iar_num_sats(const dgnss_ctx_t *ctx)
 {
-  return ambiguity_test.sats.num_sats;
+  return ctx->ambiguity_test.sats.num_sats;
 }
 
-s8 dgnss_iar_get_single_hyp(double *dhyp)
+s8 dgnss_ctx_iar_get_single_hyp(dgnss_ctx_t *ctx, double *dhyp)
 {
-  u8 num_dds = ambiguity_test.sats.num_sats;
+  u8 num_dds = ctx->ambiguity_test.sats.num_sats;
   s32 hyp[num_dds];
-  s8 ret = get_single_hypothesis(&ambiguity_test, hyp);
+  s8 ret = get_single_hypothesis(&ctx->ambiguity_test, hyp);
   for (u8 i=0; i<num_dds; i++) {
     dhyp[i] = hyp[i];
   }
   return ret;
 }
 
+/* Fix a subset of the float filter ambiguities, see
+ * dgnss_ctx_set_partial_fix(). Returns the number fixed. */
+static u8 partial_fix_ambs(const dgnss_ctx_t *ctx, ambiguities_t *fixed_ambs)
+{
+  u8 num_dds = ctx->nkf.state_dim;
+  double cov[num_dds * num_dds];
+  double F[num_dds];
+  bool fixed[num_dds];
+
+  nkf_get_cov(&ctx->nkf, cov);
+  if (lambda_partial(num_dds, ctx->nkf.state_mean, cov,
+                     ctx->settings.par_success_rate, ctx->settings.par_ratio,
+                     F, fixed) <= 0) {
+    return 0;
+  }
+
+  u8 n = 0;
+  fixed_ambs->sids[0] = ctx->sats_management.sids[0];
+  for (u8 i=0; i < num_dds; i++) {
+    if (fixed[i]) {
+      fixed_ambs->sids[n + 1] = ctx->sats_management.sids[i + 1];
+      fixed_ambs->ambs[n++] = F[i];
+    }
+  }
+  return n;
+}
+
 /* Update ambiguity states from filter states.
  * Updates the set of fixed and float ambiguities using the current filter
- * state.
+ * state. If IAR is unresolved and partial fixing is enabled the fixed
+ * ambiguities are the subset of the float ones that can be fixed.
  *
  * \param s Pointer to ambiguity state structure
  */
-void dgnss_update_ambiguity_state(ambiguity_state_t *s)
+void dgnss_ctx_update_ambiguity_state(dgnss_ctx_t *ctx, ambiguity_state_t *s)
 {
   log_debug("dgnss_update_ambiguity_state");
   log_debug("============================");
@@ -386,28 +502,30 @@ void dgnss_update_ambiguity_state(ambiguity_state_t *s)
   }
 
   /* Float filter */
-  /* NOTE: if sats_management.num_sats <= 1 the filter is not updated and
-   * nkf.state_dim may not match. */
-  if (sats_management.num_sats > 1) {
-    assert(sats_management.num_sats == nkf.state_dim+1);
-    s->float_ambs.n = nkf.state_dim;
-    memcpy(s->float_ambs.sids, sats_management.sids,
-           (nkf.state_dim+1) * sizeof(gnss_signal_t));
-    memcpy(s->float_ambs.ambs, nkf.state_mean,
-           nkf.state_dim * sizeof(double));
+  /* NOTE: if ctx->sats_management.num_sats <= 1 the filter is not updated and
+   * ctx->nkf.state_dim may not match. */
+  if (ctx->sats_management.num_sats > 1) {
+    assert(ctx->sats_management.num_sats == ctx->nkf.state_dim+1);
+    s->float_ambs.n = ctx->nkf.state_dim;
+    memcpy(s->float_ambs.sids, ctx->sats_management.sids,
+           (ctx->nkf.state_dim+1) * sizeof(gnss_signal_t));
+    memcpy(s->float_ambs.ambs, ctx->nkf.state_mean,
+           ctx->nkf.state_dim * sizeof(double));
   } else {
     s->float_ambs.n = 0;
   }
 
   /* Fixed filter */
-  if (ambiguity_iar_can_solve(&ambiguity_test)) {
-    s->fixed_ambs.n = ambiguity_test.amb_check.num_matching_ndxs;
-    s->fixed_ambs.sids[0] = ambiguity_test.sats.sids[0];
+  if (ambiguity_iar_can_solve(&ctx->ambiguity_test)) {
+    s->fixed_ambs.n = ctx->ambiguity_test.amb_check.num_matching_ndxs;
+    s->fixed_ambs.sids[0] = ctx->ambiguity_test.sats.sids[0];
     for (u8 i=0; i < s->fixed_ambs.n; i++) {
-      s->fixed_ambs.sids[i + 1] = ambiguity_test.sats.sids[1 +
-          ambiguity_test.amb_check.matching_ndxs[i]];
-      s->fixed_ambs.ambs[i] = ambiguity_test.amb_check.ambs[i];
+      s->fixed_ambs.sids[i + 1] = ctx->ambiguity_test.sats.sids[1 +
+          ctx->ambiguity_test.amb_check.matching_ndxs[i]];
+      s->fixed_ambs.ambs[i] = ctx->ambiguity_test.amb_check.ambs[i];
     }
+  } else if (ctx->settings.partial_fix && s->float_ambs.n > 0) {
+    s->fixed_ambs.n = partial_fix_ambs(ctx, &s->fixed_ambs);
   } else {
     s->fixed_ambs.n = 0;
   }
@@ -507,13 +625,14 @@ s8 dgnss_baseline(u8 num_sdiffs, const sdiff_t *sdiffs,
   return ret;
 }
 
-void dgnss_reset_iar()
+void dgnss_ctx_reset_iar(dgnss_ctx_t *ctx)
 {
-  create_ambiguity_test(&ambiguity_test);
+  reset_ambiguity_test(&ctx->ambiguity_test);
 }
 
-void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
-                               double receiver_ecef[3], double b[3])
+void dgnss_ctx_init_known_baseline(dgnss_ctx_t *ctx, u8 num_sats,
+                                   sdiff_t *sdiffs, double receiver_ecef[3],
+                                   double b[3])
 {
   double ref_ecef[3];
   vector_add_sc(3, receiver_ecef, b, 0.5, ref_ecef);
@@ -521,10 +640,10 @@ void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
   sdiff_t corrected_sdiffs[num_sats];
 
   gnss_signal_t old_sids[MAX_CHANNELS];
-  memcpy(old_sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
+  memcpy(old_sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
   /* rebase globals to a new reference sat
    * (permutes corrected_sdiffs accordingly) */
-  dgnss_rebase_ref(num_sats, sdiffs, ref_ecef, old_sids, corrected_sdiffs);
+  dgnss_ctx_rebase_ref(ctx, num_sats, sdiffs, ref_ecef, old_sids, corrected_sdiffs);
 
   double dds[2*(num_sats-1)];
   make_measurements(num_sats-1, corrected_sdiffs, dds);
@@ -532,10 +651,10 @@ void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
   double DE[(num_sats-1)*3];
   assign_de_mtx(num_sats, corrected_sdiffs, ref_ecef, DE);
 
-  dgnss_reset_iar();
+  dgnss_ctx_reset_iar(ctx);
 
-  memcpy(&ambiguity_test.sats, &sats_management, sizeof(sats_management));
-  hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(ambiguity_test.pool);
+  memcpy(&ctx->ambiguity_test.sats, &ctx->sats_management, sizeof(ctx->sats_management));
+  hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(ctx->ambiguity_test.pool);
   hyp->ll = 0;
   amb_from_baseline(num_sats-1, DE, dds, b, hyp->N);
 
@@ -547,17 +666,17 @@ void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
       u8 i_ = i+num_dds;
       u8 j_ = j+num_dds;
       if (i==j) {
-        obs_cov[i*2*num_dds + j] = dgnss_settings.phase_var_test * 2;
-        obs_cov[i_*2*num_dds + j_] = dgnss_settings.code_var_test * 2;
+        obs_cov[i*2*num_dds + j] = ctx->settings.phase_var_test * 2;
+        obs_cov[i_*2*num_dds + j_] = ctx->settings.code_var_test * 2;
       }
       else {
-        obs_cov[i*2*num_dds + j] = dgnss_settings.phase_var_test;
-        obs_cov[i_*2*num_dds + j_] = dgnss_settings.code_var_test;
+        obs_cov[i*2*num_dds + j] = ctx->settings.phase_var_test;
+        obs_cov[i_*2*num_dds + j_] = ctx->settings.code_var_test;
       }
     }
   }
 
-  init_residual_matrices(&ambiguity_test.res_mtxs, num_sats-1, DE, obs_cov);
+  init_residual_matrices(&ctx->ambiguity_test.res_mtxs, num_sats-1, DE, obs_cov);
 }
 
 static void measure_b(u8 state_dim, const double *state_mean,
@@ -586,7 +705,7 @@ static void measure_b(u8 state_dim, const double *state_mean,
 }
 
 
-void measure_b_with_external_ambs(u8 state_dim, const double *state_mean,
+void dgnss_ctx_measure_b_with_external_ambs(dgnss_ctx_t *ctx, u8 state_dim, const double *state_mean,
                                   u8 num_sdiffs, sdiff_t *sdiffs,
                                   const double receiver_ecef[3], double *b)
 {
@@ -594,7 +713,7 @@ void measure_b_with_external_ambs(u8 state_dim, const double *state_mean,
 
   sdiff_t sdiffs_with_ref_first[num_sdiffs];
   /* We require the sats updating has already been done with these sdiffs */
-  gnss_signal_t ref_sid = sats_management.sids[0];
+  gnss_signal_t ref_sid = ctx->sats_management.sids[0];
   copy_sdiffs_put_ref_first(ref_sid, num_sdiffs, sdiffs, sdiffs_with_ref_first);
 
   measure_b(state_dim, state_mean, num_sdiffs, sdiffs_with_ref_first, receiver_ecef, b);
@@ -602,23 +721,24 @@ void measure_b_with_external_ambs(u8 state_dim, const double *state_mean,
   DEBUG_EXIT();
 }
 
-void measure_amb_kf_b(u8 num_sdiffs, sdiff_t *sdiffs,
+void dgnss_ctx_measure_amb_kf_b(dgnss_ctx_t *ctx, u8 num_sdiffs, sdiff_t *sdiffs,
                       const double receiver_ecef[3], double *b)
 {
   DEBUG_ENTRY();
 
   sdiff_t sdiffs_with_ref_first[num_sdiffs];
   /* We require the sats updating has already been done with these sdiffs */
-  gnss_signal_t ref_sid = sats_management.sids[0];
+  gnss_signal_t ref_sid = ctx->sats_management.sids[0];
   copy_sdiffs_put_ref_first(ref_sid, num_sdiffs, sdiffs, sdiffs_with_ref_first);
 
-  measure_b( nkf.state_dim, nkf.state_mean,
+  measure_b( ctx->nkf.state_dim, ctx->nkf.state_mean,
       num_sdiffs, sdiffs_with_ref_first, receiver_ecef, b);
 
   DEBUG_EXIT();
 }
 
-void measure_iar_b_with_external_ambs(double *state_mean,
+void dgnss_ctx_measure_iar_b_with_external_ambs(dgnss_ctx_t *ctx,
+                                                double *state_mean,
                                       u8 num_sdiffs, sdiff_t *sdiffs,
                                       double receiver_ecef[3],
                                       double *b)
@@ -626,9 +746,9 @@ void measure_iar_b_with_external_ambs(double *state_mean,
   DEBUG_ENTRY();
 
   sdiff_t sdiffs_with_ref_first[num_sdiffs];
-  match_sdiffs_to_sats_man(&ambiguity_test.sats, num_sdiffs, sdiffs, sdiffs_with_ref_first);
+  match_sdiffs_to_sats_man(&ctx->ambiguity_test.sats, num_sdiffs, sdiffs, sdiffs_with_ref_first);
 
-  measure_b(CLAMP_DIFF(ambiguity_test.sats.num_sats, 1), state_mean,
+  measure_b(CLAMP_DIFF(ctx->ambiguity_test.sats.num_sats, 1), state_mean,
       num_sdiffs, sdiffs_with_ref_first, receiver_ecef, b);
 
   DEBUG_EXIT();
@@ -683,89 +803,248 @@ static u8 get_de_and_phase(sats_management_t *sats_man,
   return num_sats;
 }
 
-u8 get_amb_kf_de_and_phase(u8 num_sdiffs, sdiff_t *sdiffs,
+u8 dgnss_ctx_get_amb_kf_de_and_phase(dgnss_ctx_t *ctx, u8 num_sdiffs, sdiff_t *sdiffs,
                            double ref_ecef[3],
                            double *de, double *phase)
 {
-  return get_de_and_phase(&sats_management,
+  return get_de_and_phase(&ctx->sats_management,
                           num_sdiffs, sdiffs,
                           ref_ecef,
                           de, phase);
 }
 
-u8 get_iar_de_and_phase(u8 num_sdiffs, sdiff_t *sdiffs,
+u8 dgnss_ctx_get_iar_de_and_phase(dgnss_ctx_t *ctx, u8 num_sdiffs, sdiff_t *sdiffs,
                         double ref_ecef[3],
                         double *de, double *phase)
 {
-  return get_de_and_phase(&ambiguity_test.sats,
+  return get_de_and_phase(&ctx->ambiguity_test.sats,
                           num_sdiffs, sdiffs,
                           ref_ecef,
                           de, phase);
 }
 
-u8 get_amb_kf_mean(double *ambs)
+u8 dgnss_ctx_get_amb_kf_mean(const dgnss_ctx_t *ctx, double *ambs)
 {
-  u8 num_dds = CLAMP_DIFF(sats_management.num_sats, 1);
-  memcpy(ambs, nkf.state_mean, num_dds * sizeof(double));
+  u8 num_dds = CLAMP_DIFF(ctx->sats_management.num_sats, 1);
+  memcpy(ambs, ctx->nkf.state_mean, num_dds * sizeof(double));
   return num_dds;
 }
 
-u8 get_amb_kf_cov(double *cov)
+u8 dgnss_ctx_get_amb_kf_cov(const dgnss_ctx_t *ctx, double *cov)
 {
-  u8 num_dds = CLAMP_DIFF(sats_management.num_sats, 1);
-  matrix_reconstruct_udu(num_dds, nkf.state_cov_U, nkf.state_cov_D, cov);
+  u8 num_dds = CLAMP_DIFF(ctx->sats_management.num_sats, 1);
+  if (num_dds > 0) {
+    nkf_get_cov(&ctx->nkf, cov);
+  }
   return num_dds;
 }
 
+u8 dgnss_ctx_get_amb_kf_sids(const dgnss_ctx_t *ctx, gnss_signal_t *sids)
+{
+  memcpy(sids, ctx->sats_management.sids, ctx->sats_management.num_sats * sizeof(gnss_signal_t));
+  return ctx->sats_management.num_sats;
+}
+
+u8 dgnss_ctx_get_amb_test_sids(const dgnss_ctx_t *ctx, gnss_signal_t *sids)
+{
+  memcpy(sids, ctx->ambiguity_test.sats.sids, ctx->ambiguity_test.sats.num_sats * sizeof(gnss_signal_t));
+  return ctx->ambiguity_test.sats.num_sats;
+}
+
+s8 dgnss_ctx_iar_resolved(dgnss_ctx_t *ctx)
+{
+  return ambiguity_iar_can_solve(&ctx->ambiguity_test);
+}
+
+u8 dgnss_ctx_iar_pool_contains(dgnss_ctx_t *ctx, double *ambs)
+{
+  return ambiguity_test_pool_contains(&ctx->ambiguity_test, ambs);
+}
+
+double dgnss_ctx_iar_pool_ll(dgnss_ctx_t *ctx, u8 num_ambs, double *ambs)
+{
+  return ambiguity_test_pool_ll(&ctx->ambiguity_test, num_ambs, ambs);
+}
+
+double dgnss_ctx_iar_pool_prob(dgnss_ctx_t *ctx, u8 num_ambs, double *ambs)
+{
+  return ambiguity_test_pool_prob(&ctx->ambiguity_test, num_ambs, ambs);
+}
+
+u8 dgnss_ctx_iar_MLE_ambs(dgnss_ctx_t *ctx, s32 *ambs)
+{
+  ambiguity_test_MLE_ambs(&ctx->ambiguity_test, ambs);
+  return CLAMP_DIFF(ctx->ambiguity_test.sats.num_sats, 1);
+}
+
+/* Default context wrappers. */
+
+void dgnss_set_settings(double phase_var_test, double code_var_test,
+                        double phase_var_kf, double code_var_kf,
+                        double amb_drift_var, double amb_init_var,
+                        double new_int_var)
+{
+  dgnss_ctx_set_settings(default_ctx(), phase_var_test, code_var_test,
+                         phase_var_kf, code_var_kf,
+                         amb_drift_var, amb_init_var, new_int_var);
+}
+
+void dgnss_set_partial_fix(bool enable, double success_rate, double ratio)
+{
+  dgnss_ctx_set_partial_fix(default_ctx(), enable, success_rate, ratio);
+}
+
+void dgnss_init(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3])
+{
+  dgnss_ctx_init_filters(default_ctx(), num_sats, sdiffs, receiver_ecef);
+}
+
+void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef[3],
+                  bool disable_raim, double raim_threshold)
+{
+  dgnss_ctx_update(default_ctx(), num_sats, sdiffs, receiver_ecef,
+                   disable_raim, raim_threshold);
+}
+
+void dgnss_rebase_ref(u8 num_sdiffs, sdiff_t *sdiffs, double receiver_ecef[3],
+                      gnss_signal_t old_sids[MAX_CHANNELS],
+                      sdiff_t *corrected_sdiffs)
+{
+  dgnss_ctx_rebase_ref(default_ctx(), num_sdiffs, sdiffs, receiver_ecef,
+                       old_sids, corrected_sdiffs);
+}
+
+u32 dgnss_iar_num_hyps(void)
+{
+  return dgnss_ctx_iar_num_hyps(default_ctx());
+}
+
+u32 dgnss_iar_num_sats(void)
+{
+  return dgnss_ctx_iar_num_sats(default_ctx());
+}
+
+s8 dgnss_iar_get_single_hyp(double *dhyp)
+{
+  return dgnss_ctx_iar_get_single_hyp(default_ctx(), dhyp);
+}
+
+void dgnss_update_ambiguity_state(ambiguity_state_t *s)
+{
+  dgnss_ctx_update_ambiguity_state(default_ctx(), s);
+}
+
+void dgnss_reset_iar()
+{
+  dgnss_ctx_reset_iar(default_ctx());
+}
+
+void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
+                               double receiver_ecef[3], double b[3])
+{
+  dgnss_ctx_init_known_baseline(default_ctx(), num_sats, sdiffs,
+                                receiver_ecef, b);
+}
+
+void measure_b_with_external_ambs(u8 state_dim, const double *state_mean,
+                                  u8 num_sdiffs, sdiff_t *sdiffs,
+                                  const double receiver_ecef[3], double *b)
+{
+  dgnss_ctx_measure_b_with_external_ambs(default_ctx(), state_dim, state_mean,
+                                         num_sdiffs, sdiffs, receiver_ecef, b);
+}
+
+void measure_amb_kf_b(u8 num_sdiffs, sdiff_t *sdiffs,
+                      const double receiver_ecef[3], double *b)
+{
+  dgnss_ctx_measure_amb_kf_b(default_ctx(), num_sdiffs, sdiffs,
+                             receiver_ecef, b);
+}
+
+void measure_iar_b_with_external_ambs(double *state_mean,
+                                      u8 num_sdiffs, sdiff_t *sdiffs,
+                                      double receiver_ecef[3],
+                                      double *b)
+{
+  dgnss_ctx_measure_iar_b_with_external_ambs(default_ctx(), state_mean,
+                                             num_sdiffs, sdiffs,
+                                             receiver_ecef, b);
+}
+
+u8 get_amb_kf_de_and_phase(u8 num_sdiffs, sdiff_t *sdiffs,
+                           double ref_ecef[3],
+                           double *de, double *phase)
+{
+  return dgnss_ctx_get_amb_kf_de_and_phase(default_ctx(), num_sdiffs, sdiffs,
+                                           ref_ecef, de, phase);
+}
+
+u8 get_iar_de_and_phase(u8 num_sdiffs, sdiff_t *sdiffs,
+                        double ref_ecef[3],
+                        double *de, double *phase)
+{
+  return dgnss_ctx_get_iar_de_and_phase(default_ctx(), num_sdiffs, sdiffs,
+                                        ref_ecef, de, phase);
+}
+
+u8 get_amb_kf_mean(double *ambs)
+{
+  return dgnss_ctx_get_amb_kf_mean(default_ctx(), ambs);
+}
+
+u8 get_amb_kf_cov(double *cov)
+{
+  return dgnss_ctx_get_amb_kf_cov(default_ctx(), cov);
+}
+
 u8 get_amb_kf_sids(gnss_signal_t *sids)
 {
-  memcpy(sids, sats_management.sids, sats_management.num_sats * sizeof(gnss_signal_t));
-  return sats_management.num_sats;
+  return dgnss_ctx_get_amb_kf_sids(default_ctx(), sids);
 }
 
 u8 get_amb_test_sids(gnss_signal_t *sids)
 {
-  memcpy(sids, ambiguity_test.sats.sids, ambiguity_test.sats.num_sats * sizeof(gnss_signal_t));
-  return ambiguity_test.sats.num_sats;
+  return dgnss_ctx_get_amb_test_sids(default_ctx(), sids);
 }
 
 s8 dgnss_iar_resolved()
 {
-  return ambiguity_iar_can_solve(&ambiguity_test);
+  return dgnss_ctx_iar_resolved(default_ctx());
 }
 
 u8 dgnss_iar_pool_contains(double *ambs)
 {
-  return ambiguity_test_pool_contains(&ambiguity_test, ambs);
+  return dgnss_ctx_iar_pool_contains(default_ctx(), ambs);
 }
 
 double dgnss_iar_pool_ll(u8 num_ambs, double *ambs)
 {
-  return ambiguity_test_pool_ll(&ambiguity_test, num_ambs, ambs);
+  return dgnss_ctx_iar_pool_ll(default_ctx(), num_ambs, ambs);
 }
 
 double dgnss_iar_pool_prob(u8 num_ambs, double *ambs)
 {
-  return ambiguity_test_pool_prob(&ambiguity_test, num_ambs, ambs);
+  return dgnss_ctx_iar_pool_prob(default_ctx(), num_ambs, ambs);
 }
 
 u8 dgnss_iar_MLE_ambs(s32 *ambs)
 {
-  ambiguity_test_MLE_ambs(&ambiguity_test, ambs);
-  return CLAMP_DIFF(ambiguity_test.sats.num_sats, 1);
+  return dgnss_ctx_iar_MLE_ambs(default_ctx(), ambs);
 }
 
 nkf_t* get_dgnss_nkf(void)
 {
-  return &nkf;
+  return &default_ctx()->nkf;
 }
 
 sats_management_t* get_sats_management(void)
 {
-  return &sats_management;
+  return &default_ctx()->sats_management;
 }
 
 ambiguity_test_t* get_ambiguity_test(void)
 {
-  return &ambiguity_test;
+  return &default_ctx()->ambiguity_test;
 }
+
+/** \} */
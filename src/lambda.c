@@ -9,6 +9,8 @@
 *         1995
 *     [2] X.-W.Chang, X.Yang, T.Zhou, MLAMBDA: A modified LAMBDA method for
 *         integer least-squares estimation, J.Geodesy, Vol.79, 552-565, 2005
+*     [3] P.J.G.Teunissen, An optimality property of the integer least-squares
+*         estimator, J.Geodesy, Vol.73, 587-593, 1999
 *
 * version : $Revision: 1.1 $ $Date: 2008/07/17 21:48:06 $
 * history : 2007/01/13 1.0 new
@@ -16,8 +18,6 @@
 
 #include <string.h>
 #include <math.h>
-#include <cblas.h>
-#include <clapack.h>
 
 #include <libswiftnav/linear_algebra.h>
 #include <libswiftnav/amb_kf.h>
@@ -58,18 +58,21 @@ static int LD(int n, const double *Q, double *L, double *D)
     }
     return info;
 }
-/* integer gauss transformation ----------------------------------------------*/
-static void gauss(int n, double *L, double *Z, int i, int j)
+/* integer gauss transformation ----------------------------------------------
+* Z=Z*G with G=I-mu*e_i*e_j', and Zi=Z'^-1 (if not NULL) updated by G'^-1 ----*/
+static void gauss(int n, double *L, double *Z, double *Zi, int i, int j)
 {
     int k,mu;
 
     if ((mu=(int)ROUND(L[i+j*n]))!=0) {
         for (k=i;k<n;k++) L[k+n*j]-=(double)mu*L[k+i*n];
         for (k=0;k<n;k++) Z[k+n*j]-=(double)mu*Z[k+i*n];
+        if (Zi) for (k=0;k<n;k++) Zi[k+n*i]+=(double)mu*Zi[k+j*n];
     }
 }
 /* permutations --------------------------------------------------------------*/
-static void perm(int n, double *L, double *D, int j, double del, double *Z)
+static void perm(int n, double *L, double *D, int j, double del, double *Z,
+                 double *Zi)
 {
     int k;
     double eta,lam,a0,a1;
@@ -85,30 +88,35 @@ static void perm(int n, double *L, double *D, int j, double del, double *Z)
     L[j+1+j*n]=lam;
     for (k=j+2;k<n;k++) SWAP(L[k+j*n],L[k+(j+1)*n]);
     for (k=0;k<n;k++) SWAP(Z[k+j*n],Z[k+(j+1)*n]);
+    if (Zi) for (k=0;k<n;k++) SWAP(Zi[k+j*n],Zi[k+(j+1)*n]);
 }
 /* lambda reduction (z=Z'*a, Qz=Z'*Q*Z=L'*diag(D)*L) (ref.[1]) ---------------*/
-static void reduction(int n, double *L, double *D, double *Z)
+static void reduction(int n, double *L, double *D, double *Z, double *Zi)
 {
     int i,j,k;
     double del;
 
     j=n-2; k=n-2;
     while (j>=0) {
-        if (j<=k) for (i=j+1;i<n;i++) gauss(n,L,Z,i,j);
+        if (j<=k) for (i=j+1;i<n;i++) gauss(n,L,Z,Zi,i,j);
         del=D[j]+L[j+1+j*n]*L[j+1+j*n]*D[j+1];
         if (del+1E-6<D[j+1]) { /* compared considering numerical error */
-            perm(n,L,D,j,del,Z);
+            perm(n,L,D,j,del,Z,Zi);
             k=j; j=n-2;
         }
         else j--;
     }
 }
-/* modified lambda (mlambda) search (ref. [2]) -------------------------------*/
-static int search(int n, int m, const double *L, const double *D,
-                  const double *zs, double *zn, double *s)
+/* modified lambda (mlambda) search (ref. [2]) --------------------------------
+* search the subtree of z(0:top-1) below the fixed z(top:n-1)=zt(top:n-1), top=n
+* for the whole tree. the nn candidates already in zn,s are kept and merged
+* with those found, so subtrees can be searched one after another ------------*/
+static int search_tree(int n, int m, const double *L, const double *D,
+                       const double *zs, double *zn, double *s, int *nn,
+                       double maxdist, int top, const double *zt)
 {
-    int i,j,k,c,nn=0,imax=0;
-    double newdist,maxdist=1E99,y;
+    int i,j,k,c,imax=0;
+    double newdist,y;
     double S[n*n];
     double dist[n];
     double zb[n];
@@ -116,9 +124,12 @@ static int search(int n, int m, const double *L, const double *D,
     double step[n];
     memset(S, 0, sizeof(double)*n*n);
 
+    for (i=0;i<*nn;i++) if (s[imax]<s[i]) imax=i;
+    if (*nn>=m&&s[imax]<maxdist) maxdist=s[imax];
+
     k=n-1; dist[k]=0.0;
     zb[k]=zs[k];
-    z[k]=ROUND(zb[k]); y=zb[k]-z[k]; step[k]=SGN(y);
+    z[k]=k>=top?zt[k]:ROUND(zb[k]); y=zb[k]-z[k]; step[k]=SGN(y);
     for (c=0;c<LOOPMAX;c++) {
         newdist=dist[k]+y*y/D[k];
         if (newdist<maxdist) {
@@ -127,13 +138,13 @@ static int search(int n, int m, const double *L, const double *D,
                 for (i=0;i<=k;i++)
                     S[k+i*n]=S[k+1+i*n]+(z[k+1]-zb[k+1])*L[k+1+i*n];
                 zb[k]=zs[k]+S[k+k*n];
-                z[k]=ROUND(zb[k]); y=zb[k]-z[k]; step[k]=SGN(y);
+                z[k]=k>=top?zt[k]:ROUND(zb[k]); y=zb[k]-z[k]; step[k]=SGN(y);
             }
             else {
-                if (nn<m) {
-                    if (nn==0||newdist>s[imax]) imax=nn;
-                    for (i=0;i<n;i++) zn[i+nn*n]=z[i];
-                    s[nn++]=newdist;
+                if (*nn<m) {
+                    if (*nn==0||newdist>s[imax]) imax=*nn;
+                    for (i=0;i<n;i++) zn[i+*nn*n]=z[i];
+                    s[(*nn)++]=newdist;
                 }
                 else {
                     if (newdist<s[imax]) {
@@ -147,15 +158,15 @@ static int search(int n, int m, const double *L, const double *D,
             }
         }
         else {
-            if (k==n-1) break;
+            if (k+1>=top) break;
             else {
                 k++;
                 z[k]+=step[k]; y=zb[k]-z[k]; step[k]=-step[k]-SGN(step[k]);
             }
         }
     }
-    for (i=0;i<m-1;i++) { /* sort by s */
-        for (j=i+1;j<m;j++) {
+    for (i=0;i<*nn-1;i++) { /* sort by s */
+        for (j=i+1;j<*nn;j++) {
             if (s[i]<s[j]) continue;
             SWAP(s[i],s[j]);
             for (k=0;k<n;k++) SWAP(zn[k+i*n],zn[k+j*n]);
@@ -166,8 +177,166 @@ static int search(int n, int m, const double *L, const double *D,
         log_error("LAMBDA search loop count overflow");
         return -1;
     }
+    if (*nn<m) return -2; /* fewer than m candidates within the radius */
     return 0;
 }
+static int search(int n, int m, const double *L, const double *D,
+                  const double *zs, double *zn, double *s, double maxdist)
+{
+    int nn=0;
+
+    return search_tree(n,m,L,D,zs,zn,s,&nn,maxdist,n,NULL);
+}
+/* shared search bound ---------------------------------------------------------
+* the tasks of lambda_solution_parallel() read and tighten one bound. where 8
+* byte atomics are lock free it is updated with atomic builtins, otherwise
+* each task only tightens the bound of its own subtrees ----------------------*/
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE)&&__GCC_ATOMIC_LLONG_LOCK_FREE==2
+static double bound_load(double *bound)
+{
+    double d;
+
+    __atomic_load(bound,&d,__ATOMIC_RELAXED);
+    return d;
+}
+static void bound_min(double *bound, double d)
+{
+    double cur=bound_load(bound);
+
+    while (d<cur&&!__atomic_compare_exchange(bound,&cur,&d,false,
+                                             __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED));
+}
+#else
+static double bound_load(double *bound)
+{
+    return *bound;
+}
+static void bound_min(double *bound, double d)
+{
+    (void)bound; (void)d;
+}
+#endif
+/* enumeration of the prefixes of the search tree -------------------------------
+* enumerate the prefixes z(b:n-1) in the order of search(), within a bound that
+* may shrink between calls. the state is kept in the iterator so that the
+* enumeration can be resumed after the subtrees below the prefixes found so far
+* have been searched ---------------------------------------------------------*/
+typedef struct {
+    int n,b,k,c,pending,done;
+    const double *D,*L,*zs;
+    double *S,*dist,*zb,*z,*step; /* work (n x n),(n),(n),(n),(n) */
+    double y;
+} prefix_iter_t;
+
+static void prefix_init(prefix_iter_t *it, int n, int b, const double *L,
+                        const double *D, const double *zs, double *S,
+                        double *dist, double *zb, double *z, double *step)
+{
+    int k=n-1;
+
+    it->n=n; it->b=b; it->k=k; it->c=0; it->pending=0; it->done=0;
+    it->L=L; it->D=D; it->zs=zs;
+    it->S=S; it->dist=dist; it->zb=zb; it->z=z; it->step=step;
+    memset(S,0,sizeof(double)*n*n);
+    dist[k]=0.0;
+    zb[k]=zs[k];
+    z[k]=ROUND(zb[k]); it->y=zb[k]-z[k]; step[k]=SGN(it->y);
+}
+/* next prefix within maxdist --------------------------------------------------
+* return : 1:prefix in it->z(b:n-1), 0:no more prefixes, -1:loop count overflow
+*-----------------------------------------------------------------------------*/
+static int prefix_next(prefix_iter_t *it, double maxdist)
+{
+    int i,n=it->n,b=it->b,k=it->k;
+    double newdist,y=it->y;
+    const double *L=it->L,*D=it->D,*zs=it->zs;
+    double *S=it->S,*dist=it->dist,*zb=it->zb,*z=it->z,*step=it->step;
+
+    if (it->done) return 0;
+    if (it->pending) { /* move on from the last prefix returned */
+        z[b]+=step[b]; y=zb[b]-z[b]; step[b]=-step[b]-SGN(step[b]);
+        it->pending=0;
+    }
+    for (;it->c<LOOPMAX;it->c++) {
+        newdist=dist[k]+y*y/D[k];
+        if (newdist<maxdist) {
+            if (k!=b) {
+                dist[--k]=newdist;
+                for (i=0;i<=k;i++)
+                    S[k+i*n]=S[k+1+i*n]+(z[k+1]-zb[k+1])*L[k+1+i*n];
+                zb[k]=zs[k]+S[k+k*n];
+                z[k]=ROUND(zb[k]); y=zb[k]-z[k]; step[k]=SGN(y);
+            }
+            else {
+                it->c++; it->k=k; it->y=y; it->pending=1;
+                return 1;
+            }
+        }
+        else {
+            if (k==n-1) {
+                it->done=1;
+                return 0;
+            }
+            k++;
+            z[k]+=step[k]; y=zb[k]-z[k]; step[k]=-step[k]-SGN(step[k]);
+        }
+    }
+    log_error("LAMBDA search loop count overflow");
+    return -1;
+}
+/* largest of the distances of a full set of candidates, or maxdist ----------*/
+static double cand_bound(int m, int nn, const double *s, double maxdist)
+{
+    int i;
+
+    if (nn<m) return maxdist;
+    for (i=1,maxdist=s[0];i<nn;i++) if (maxdist<s[i]) maxdist=s[i];
+    return maxdist;
+}
+/* mlambda search split at the top levels of the tree --------------------------
+* search the subtrees below every prefix z(n-levels:n-1) in turn with
+* search_tree(). the subtrees are visited in the same order and with the same
+* bound as the whole tree search, so the candidates are the same, but each
+* subtree has its own LOOPMAX count ------------------------------------------*/
+static int search_split(int n, int m, int levels, const double *L,
+                        const double *D, const double *zs, double *zn,
+                        double *s, double maxdist)
+{
+    int info,nn=0;
+    prefix_iter_t it;
+
+    if (levels<=0||levels>=n) return search(n,m,L,D,zs,zn,s,maxdist);
+    double S[n*n];
+    double dist[n];
+    double zb[n];
+    double z[n];
+    double step[n];
+
+    prefix_init(&it,n,n-levels,L,D,zs,S,dist,zb,z,step);
+    while ((info=prefix_next(&it,maxdist))>0) {
+        if (search_tree(n,m,L,D,zs,zn,s,&nn,maxdist,it.b,z)==-1) return -1;
+        maxdist=cand_bound(m,nn,s,maxdist);
+    }
+    if (info) return info;
+    if (nn<m) return -2; /* fewer than m candidates within the radius */
+    return 0;
+}
+/* squared distance of an integer vector (Qz=L'*diag(D)*L) ---------------------
+* (zs-z)'*Qz^-1*(zs-z), as accumulated by search() ---------------------------*/
+static double ld_dist(int n, const double *L, const double *D,
+                      const double *zs, const double *z)
+{
+    int i,j;
+    double u[n],dist=0.0;
+
+    for (i=n-1;i>=0;i--) {
+        u[i]=zs[i]-z[i];
+        for (j=i+1;j<n;j++) u[i]-=L[j+i*n]*u[j];
+        dist+=u[i]*u[i]/D[i];
+    }
+    return dist;
+}
 
 /* lambda reduction transformation ------------------------------
 * integer least-square estimation. reduction is performed by lambda (ref.[1]),
@@ -198,57 +367,54 @@ int lambda_reduction(int n, const double *Q, double *Z)
     /* LD factorization */
     if (!(info=LD(n,Q,L,D))) {
         /* lambda reduction */
-        reduction(n,L,D,Z);
+        reduction(n,L,D,Z,NULL);
     }
 
     return info;
 }
 
-/* multiply matrix (wrapper of blas dgemm) -------------------------------------
-* multiply matrix by matrix (C=alpha*A*B+beta*C)
-* args   : char   *tr       I  transpose flags ("N":normal,"T":transpose)
-*          int    n,k,m     I  size of (transposed) matrix A,B
-*          double alpha     I  alpha
-*          double *A,*B     I  (transposed) matrix A (n x m), B (m x k)
-*          double beta      I  beta
-*          double *C        IO matrix C (n x k)
-* return : none
-*-----------------------------------------------------------------------------*/
-static void matmul(const char *tr, integer n, integer k, integer m, double alpha,
-                   const double *A, const double *B, double beta, double *C)
+/* identity matrix -----------------------------------------------------------*/
+static void eye(int n, double *A)
 {
-    integer lda=tr[0]=='T'?m:n,ldb=tr[1]=='T'?k:m;
+    int i;
 
-    dgemm_((char *)tr,(char *)tr+1,&n,&k,&m,&alpha,(double *)A,&lda,(double *)B,
-           &ldb,&beta,C,&n);
+    memset(A,0,sizeof(double)*n*n);
+    for (i=0;i<n;i++) A[i+i*n]=1.0;
 }
-
-/* solve linear equation -------------------------------------------------------
-* solve linear equation (X=A\Y or X=A'\Y)
-* args   : char   *tr       I   transpose flag ("N":normal,"T":transpose)
-*          double *A        I   input matrix A (n x n)
-*          double *Y        I   input matrix Y (n x m)
-*          int    n,m       I   size of matrix A,Y
-*          double *X        O   X=A\Y or X=A'\Y (n x m)
-* return : status (0:ok,0>:error)
-* notes  : matirix stored by column-major order (fortran convention)
-*          X can be same as Y
+/* multiply matrix -------------------------------------------------------------
+* multiply matrix by matrix (C=A*B or C=A'*B)
+* args   : char   *tr       I  transpose flag of A ("N":normal,"T":transpose)
+*          int    n,k,m     I  size of (transposed) matrix A (n x m), B (m x k)
+*          double *A,*B     I  (transposed) matrix A, matrix B
+*          double *C        O  matrix C (n x k)
+* return : none
+* notes  : matrix stored by column-major order (fortran convention)
+*          the loops run down columns of A, B and C, A'*B is column dot
+*          products
 *-----------------------------------------------------------------------------*/
-static int solve(const char *tr, const double *A, const double *Y, integer n,
-                 integer m, double *X)
+static void matmul(const char *tr, int n, int k, int m, const double *A,
+                   const double *B, double *C)
 {
-    double B[n*n];
-    integer info;
-    integer ipiv[n];
-
-    memcpy(B, A, sizeof(double)*n*n);
-    memcpy(X, Y, sizeof(double)*n*m);
-    dgetrf_(&n,&n,B,&n,ipiv,&info);
-    if (!info) dgetrs_((char *)tr,&n,&m,B,&n,ipiv,X,&n,&info);
-    return info;
+    int i,j,l;
+    double d;
+
+    for (j=0;j<k;j++) {
+        if (tr[0]=='T') {
+            for (i=0;i<n;i++) {
+                for (l=0,d=0.0;l<m;l++) d+=A[l+i*m]*B[l+j*m];
+                C[i+j*n]=d;
+            }
+        }
+        else {
+            for (i=0;i<n;i++) C[i+j*n]=0.0;
+            for (l=0;l<m;l++) {
+                if ((d=B[l+j*m])==0.0) continue;
+                for (i=0;i<n;i++) C[i+j*n]+=A[i+l*n]*d;
+            }
+        }
+    }
 }
 
-
 /* lambda/mlambda integer least-square estimation ------------------------------
 * integer least-square estimation. reduction is performed by lambda (ref.[1]),
 * and search by mlambda (ref.[2]).
@@ -263,6 +429,23 @@ static int solve(const char *tr, const double *A, const double *Y, integer n,
 *-----------------------------------------------------------------------------*/
 int lambda_solution(int n, int m, const double *a, const double *Q, double *F,
                   double *s)
+{
+    return lambda_solution_split(n,m,0,a,Q,F,s);
+}
+
+/* lambda/mlambda integer least-square estimation with split search ------------
+* as lambda_solution(), with the search split into the subtrees below the top
+* levels of the search tree. every subtree is allowed LOOPMAX loops, so large
+* problems can be solved where the single search would overflow. see
+* lambda_solution_parallel() to search the subtrees on several workers.
+* args   : int    levels I  number of top levels to split at, 0:no split
+*          (others as lambda_solution())
+* return : status (0:ok,other:error)
+* notes  : the solution is the same as lambda_solution() where that succeeds.
+*          matrix stored by column-major order (fortran convension)
+*-----------------------------------------------------------------------------*/
+int lambda_solution_split(int n, int m, int levels, const double *a,
+                          const double *Q, double *F, double *s)
 {
     int info;
 
@@ -270,29 +453,441 @@ int lambda_solution(int n, int m, const double *a, const double *Q, double *F,
     double L[n*n];
     double D[n];
     double Z[n*n];
+    double Zi[n*n];
     double z[n];
     double E[n*m];
 
     /* L = zeros(n,n) */
     memset(L, 0, sizeof(double)*n*n);
 
-    /* Z = eye(n) */
-    memset(Z, 0, sizeof(double)*n*n);
-    for (int i=0; i<n; i++)
-      Z[i+n*i] = 1;
+    /* Z = Zi = eye(n) */
+    eye(n,Z);
+    eye(n,Zi);
 
     /* LD factorization */
     if (!(info=LD(n,Q,L,D))) {
 
         /* lambda reduction */
-        reduction(n,L,D,Z);
-        matmul("TN",n,1,n,1.0,Z,a,0.0,z); /* z=Z'*a */
+        reduction(n,L,D,Z,Zi);
+        matmul("T",n,1,n,Z,a,z); /* z=Z'*a */
 
         /* mlambda search */
-        if (!(info=search(n,m,L,D,z,E,s))) {
+        if (!(info=search_split(n,m,levels,L,D,z,E,s,1E99))) {
 
-            info=solve("T",Z,E,n,m,F); /* F=Z'\E */
+            matmul("N",n,m,n,Zi,E,F); /* F=Z'\E=Zi*E */
         }
     }
     return info;
 }
+
+/* lambda factorization and reduction -----------------------------------------
+* LD factorization and lambda reduction of a covariance matrix, kept for
+* several searches with the same covariance, see lambda_search().
+* args   : int    n      I  number of float parameters
+*          double *Q     I  covariance matrix of float parameters (n x n)
+*          double *L,*D  O  LD factors of the reduced covariance,
+*                           Qz=Z'*Q*Z=L'*diag(D)*L (n x n),(n x 1)
+*          double *Z     O  reduction transformation, z=Z'*a (n x n)
+*          double *Zi    O  inverse of the transpose of Z (n x n)
+* return : status (0:ok,other:error)
+* notes  : matrix stored by column-major order (fortran convension)
+*-----------------------------------------------------------------------------*/
+int lambda_factor(int n, const double *Q, double *L, double *D, double *Z,
+                  double *Zi)
+{
+    int info;
+
+    if (n<=0) return -1;
+
+    /* Z = Zi = eye(n) */
+    eye(n,Z);
+    eye(n,Zi);
+
+    /* LD factorization and lambda reduction */
+    if ((info=LD(n,Q,L,D))) return info;
+    reduction(n,L,D,Z,Zi);
+    return 0;
+}
+
+/* mlambda search within a radius ----------------------------------------------
+* integer vectors within a squared distance of the float parameters, closest
+* first, with the factors of their covariance from lambda_factor(). all of
+* them are found if there are fewer than m, so the radius can be grown until
+* enough of them are.
+* args   : int    n      I  number of float parameters
+*          int    m      I  most number of fixed solutions
+*          double *L,*D,*Z,*Zi I factors of the covariance, see lambda_factor()
+*          double *a     I  float parameters (n x 1)
+*          double maxdist I squared distance bound of the search
+*          double *F     O  fixed solutions (n x m)
+*          double *s     O  sum of squared residulas of fixed solutions (1 x m)
+* return : number of fixed solutions (-1:error)
+* notes  : F and s are unchanged on error.
+*          matrix stored by column-major order (fortran convension)
+*-----------------------------------------------------------------------------*/
+int lambda_search(int n, int m, const double *L, const double *D,
+                  const double *Z, const double *Zi, const double *a,
+                  double maxdist, double *F, double *s)
+{
+    int nn=0;
+
+    if (n<=0||m<=0) return -1;
+    double z[n];
+    double E[n*m];
+    double sn[m];
+
+    matmul("T",n,1,n,Z,a,z); /* z=Z'*a */
+
+    /* mlambda search */
+    if (search_tree(n,m,L,D,z,E,sn,&nn,maxdist,n,NULL)==-1) return -1;
+
+    matmul("N",n,nn,n,Zi,E,F); /* F=Z'\E=Zi*E */
+    memcpy(s,sn,sizeof(double)*nn);
+    return nn;
+}
+
+/* search job of lambda_solution_parallel() ----------------------------------*/
+#define LAMBDA_BATCH 64             /* prefixes searched per executor run */
+
+typedef struct {
+    int n,m,b,ntasks,nprefix;
+    const double *L,*D,*zs;
+    const double *prefix; /* prefixes z(b:n-1) of the batch (levels x nprefix) */
+    double bound;         /* search bound shared by the tasks */
+    double *zn,*s;        /* candidates of each task (n x m x ntasks) */
+    int *nn,*info;        /* number of candidates and status of each task */
+} lambda_job_t;
+
+static void search_task(void *arg, u32 t)
+{
+    lambda_job_t *job=(lambda_job_t *)arg;
+    int j,n=job->n,m=job->m,b=job->b;
+    double *zn=job->zn+t*n*m,*s=job->s+t*m;
+    double z[n];
+
+    job->info[t]=0;
+    for (j=(int)t;j<job->nprefix;j+=job->ntasks) {
+        memcpy(z+b,job->prefix+j*(n-b),sizeof(double)*(n-b));
+        if (search_tree(n,m,job->L,job->D,job->zs,zn,s,&job->nn[t],
+                        bound_load(&job->bound),b,z)==-1) {
+            job->info[t]=-1;
+            return;
+        }
+        if (job->nn[t]>=m) bound_min(&job->bound,cand_bound(m,job->nn[t],s,0));
+    }
+}
+
+/* lambda/mlambda integer least-square estimation on an executor ---------------
+* as lambda_solution_split(), with the subtrees below the top levels searched
+* by the tasks of an executor. the subtree below the prefix of the rounded
+* solution is searched first to bound the search. the caller then enumerates
+* the other prefixes once, in batches of LAMBDA_BATCH, and the tasks search the
+* subtrees below the prefixes of each batch into their own candidate buffers.
+* the bound is shared by the tasks and is tightened between batches, so later
+* batches enumerate fewer prefixes. the candidates of all the tasks are merged
+* and sorted at the end.
+* args   : executor_t *ex I executor to run the tasks, NULL to search inline
+*                           as one task
+*          int    levels I  number of top levels to split at (1 to n-1),
+*                           otherwise as lambda_solution()
+*          (others as lambda_solution())
+* return : status (0:ok,other:error)
+* notes  : the solution is the same as lambda_solution() where that succeeds.
+*          at most LAMBDA_MAX_TASKS tasks are run at a time, whatever the
+*          number of workers of the executor.
+*          within a batch the bound is shared with atomic builtins where 8 byte
+*          atomics are lock free, otherwise each task only prunes with its own
+*          candidates.
+*          matrix stored by column-major order (fortran convension)
+*-----------------------------------------------------------------------------*/
+int lambda_solution_parallel(const executor_t *ex, int n, int m,
+                             int levels, const double *a, const double *Q,
+                             double *F, double *s)
+{
+    int i,j,k,b,r,np,info,nt,nparts,nn0=0;
+    lambda_job_t job;
+    prefix_iter_t it;
+
+    if (n<=0||m<=0) return -1;
+    if (levels<=0||levels>=n) return lambda_solution(n,m,a,Q,F,s);
+    nparts=(ex&&ex->n_workers>0)?(int)MIN(ex->n_workers,LAMBDA_MAX_TASKS):1;
+    double L[n*n];
+    double D[n];
+    double Z[n*n];
+    double Zi[n*n];
+    double z[n];
+    double zt[n];
+    double zb[n];
+    double E[n*m];
+    double zn[n*m*(nparts+1)];
+    double sn[m*(nparts+1)];
+    double prefix[levels*LAMBDA_BATCH];
+    double S[n*n];
+    double dist[n];
+    double zp[n];
+    double step[n];
+    int nn[nparts];
+    int infos[nparts];
+
+    /* Z = Zi = eye(n) */
+    eye(n,Z);
+    eye(n,Zi);
+
+    /* LD factorization and lambda reduction */
+    if ((info=LD(n,Q,L,D))) return info;
+    reduction(n,L,D,Z,Zi);
+    matmul("T",n,1,n,Z,a,z); /* z=Z'*a */
+
+    /* subtree of the rounded prefix, the first visited by search() */
+    b=n-levels;
+    for (k=n-1;k>=b;k--) {
+        for (j=n-1,zb[k]=z[k];j>k;j--) zb[k]+=(zt[j]-zb[j])*L[j+k*n];
+        zt[k]=ROUND(zb[k]);
+    }
+    double *zn0=zn+nparts*n*m,*s0=sn+nparts*m;
+    if ((info=search_tree(n,m,L,D,z,zn0,s0,&nn0,1E99,b,zt))==-1) return info;
+
+    job.n=n; job.m=m; job.b=b;
+    job.L=L; job.D=D; job.zs=z; job.prefix=prefix;
+    job.bound=cand_bound(m,nn0,s0,1E99);
+    job.zn=zn; job.s=sn; job.nn=nn; job.info=infos;
+    for (i=0;i<nparts;i++) nn[i]=0;
+
+    /* enumerate the other prefixes in batches and search below them */
+    prefix_init(&it,n,b,L,D,z,S,dist,zb,zp,step);
+    for (r=1;r>0;) {
+        for (np=0;np<LAMBDA_BATCH&&(r=prefix_next(&it,job.bound))>0;) {
+            for (i=b;i<n;i++) if (zp[i]!=zt[i]) break;
+            if (i==n) continue; /* already searched */
+            memcpy(prefix+np++*levels,zp+b,sizeof(double)*levels);
+        }
+        if (r<0) return r;
+        if (np==0) continue;
+        job.nprefix=np;
+        job.ntasks=MIN(nparts,np);
+        if (ex) ex->run(ex->ctx,(u32)job.ntasks,&search_task,&job);
+        else search_task(&job,0);
+        for (i=0;i<job.ntasks;i++) {
+            if (infos[i]==-1) return -1;
+            job.bound=MIN(job.bound,cand_bound(m,nn[i],sn+i*m,job.bound));
+        }
+    }
+
+    /* merge the candidates of the tasks and the first subtree */
+    for (i=0,nt=0;i<=nparts;i++) {
+        int ni=i<nparts?nn[i]:nn0;
+        for (j=0;j<ni;j++,nt++) {
+            sn[nt]=sn[j+i*m];
+            memmove(zn+nt*n,zn+(j+i*m)*n,sizeof(double)*n);
+        }
+    }
+    for (i=0;i<nt-1&&i<m;i++) { /* sort by s */
+        for (j=i+1;j<nt;j++) {
+            if (sn[i]<sn[j]) continue;
+            SWAP(sn[i],sn[j]);
+            for (k=0;k<n;k++) SWAP(zn[k+i*n],zn[k+j*n]);
+        }
+    }
+    if (nt<m) return -2; /* fewer than m candidates within the radius */
+    memcpy(E,zn,sizeof(double)*n*m);
+    memcpy(s,sn,sizeof(double)*m);
+
+    matmul("N",n,m,n,Zi,E,F); /* F=Z'\E=Zi*E */
+    return 0;
+}
+
+/* initialize warm start state -------------------------------------------------
+* args   : lambda_warm_t *w O  state for lambda_solution_warm()
+* return : none
+* notes  : also used to discard the state when the parameters change meaning
+*-----------------------------------------------------------------------------*/
+void lambda_warm_init(lambda_warm_t *w)
+{
+    w->n=0;
+    w->has_fix=false;
+}
+
+/* warm started lambda/mlambda integer least-square estimation -----------------
+* as lambda_solution(), keeping the reduction transformation Z and the best
+* fixed solution between calls. Q is first transformed by the previous Z, so
+* reduction() only does the swaps needed for the change in Q, and for m=1 the
+* distance of the previous fix bounds the initial search radius.
+* args   : lambda_warm_t *w IO state from the previous call
+*          (others as lambda_solution())
+* return : status (0:ok,other:error)
+* notes  : any previous state gives the same solution as lambda_solution(),
+*          only the cost depends on how close it is to the current problem.
+*          matrix stored by column-major order (fortran convension)
+*-----------------------------------------------------------------------------*/
+int lambda_solution_warm(lambda_warm_t *w, int n, int m, const double *a,
+                         const double *Q, double *F, double *s)
+{
+    int i,info,warm;
+    double radius=1E99;
+
+    if (n<=0||m<=0||n>LAMBDA_WARM_MAX_DIM) return -1;
+    double L[n*n];
+    double D[n];
+    double Z[n*n];
+    double Zi[n*n];
+    double Qz[n*n];
+    double QZ[n*n];
+    double z[n];
+    double zf[n];
+    double E[n*m];
+
+    warm=w->n==n;
+    if (warm) {
+        memcpy(Z,w->Z,sizeof(double)*n*n);
+        memcpy(Zi,w->Zi,sizeof(double)*n*n);
+    }
+    else {
+        eye(n,Z);
+        eye(n,Zi);
+    }
+    w->n=0; /* invalid until this call succeeds */
+
+    /* Qz=Z'*Q*Z in the previous reduced basis */
+    matmul("N",n,n,n,Q,Z,QZ);
+    matmul("T",n,n,n,Z,QZ,Qz);
+    if ((info=LD(n,Qz,L,D))) return info;
+
+    /* lambda reduction, continued from the previous Z */
+    reduction(n,L,D,Z,Zi);
+    matmul("T",n,1,n,Z,a,z); /* z=Z'*a */
+
+    /* the previous fix is a candidate, its distance bounds the best one */
+    if (warm&&w->has_fix&&m==1) {
+        matmul("T",n,1,n,Z,w->fix,zf);
+        radius=ld_dist(n,L,D,z,zf)*(1.0+1E-9)+1E-12;
+    }
+
+    /* mlambda search */
+    info=search(n,m,L,D,z,E,s,radius);
+    if (info==-2&&radius<1E99) info=search(n,m,L,D,z,E,s,1E99);
+    if (info) return info;
+
+    matmul("N",n,m,n,Zi,E,F); /* F=Z'\E=Zi*E */
+
+    w->n=n;
+    memcpy(w->Z,Z,sizeof(double)*n*n);
+    memcpy(w->Zi,Zi,sizeof(double)*n*n);
+    for (i=0;i<n;i++) w->fix[i]=ROUND(F[i]);
+    w->has_fix=true;
+    return 0;
+}
+
+/* bootstrapped success rate --------------------------------------------------
+* success rate of fixing the ambiguities by bootstrapping after the lambda
+* reduction (ref.[3]), a lower bound of the success rate of the integer
+* least-square estimate.
+* args   : int    n      I  number of float parameters
+*          double *Q     I  covariance matrix of float parameters (n x n)
+* return : success rate (0>:error)
+* notes  : matrix stored by column-major order (fortran convension)
+*-----------------------------------------------------------------------------*/
+double lambda_success_rate(int n, const double *Q)
+{
+    int i;
+    double p=1.0;
+
+    if (n<=0) return -1.0;
+    double L[n*n];
+    double D[n];
+    double Z[n*n];
+    double Zi[n*n];
+
+    eye(n,Z);
+    eye(n,Zi);
+    if (LD(n,Q,L,D)) return -1.0;
+    reduction(n,L,D,Z,Zi);
+    for (i=0;i<n;i++) p*=erf(1.0/(2.0*sqrt(2.0*D[i])));
+    return p;
+}
+/* partial lambda integer least-square estimation ------------------------------
+* fix the largest subset of the decorrelated ambiguities z=Z'*a that passes the
+* success rate and ratio tests. the leading elements of z have the largest
+* conditional variances D, so they are dropped one at a time. the trailing
+* block of the LD factorization of Qz is the factorization of the covariance of
+* the trailing elements, so the reduction is done once and each subset only
+* needs a search.
+* args   : int    n      I  number of float parameters
+*          double *a     I  float parameters (n x 1)
+*          double *Q     I  covariance matrix of float parameters (n x n)
+*          double p0     I  minimum bootstrapped success rate of the subset
+*                           (ref.[3]), 0:no test
+*          double ratio  I  minimum ratio of the second best to the best
+*                           squared distance of the subset, 0:no test
+*          double *F     O  fixed solution (n x 1), the float value where not
+*                           fixed
+*          bool   *fixed O  whether each parameter is fixed (n x 1)
+* return : number of fixed parameters (0>:error)
+* notes  : a parameter is only fixed if it is an integer combination of the
+*          fixed elements of z.
+*          matrix stored by column-major order (fortran convension)
+*-----------------------------------------------------------------------------*/
+int lambda_partial(int n, const double *a, const double *Q, double p0,
+                   double ratio, double *F, bool *fixed)
+{
+    int i,j,k,l,nf=0,info;
+    double s[2];
+
+    if (n<=0) return -1;
+    double L[n*n];
+    double D[n];
+    double Z[n*n];
+    double Zi[n*n];
+    double z[n];
+    double zf[n];
+    double P[n];
+
+    for (i=0;i<n;i++) {
+        F[i]=a[i];
+        fixed[i]=false;
+    }
+
+    /* Z = Zi = eye(n) */
+    eye(n,Z);
+    eye(n,Zi);
+
+    /* LD factorization and lambda reduction, once */
+    if ((info=LD(n,Q,L,D))) return info;
+    reduction(n,L,D,Z,Zi);
+    matmul("T",n,1,n,Z,a,z); /* z=Z'*a */
+
+    /* P[k] = success rate of fixing z(k:n-1) by bootstrapping */
+    for (k=n-1;k>=0;k--) {
+        P[k]=erf(1.0/(2.0*sqrt(2.0*D[k])))*(k<n-1?P[k+1]:1.0);
+    }
+
+    for (k=0;k<n;k++) {
+        if (P[k]<p0) continue;
+        l=n-k;
+        double Lk[l*l];
+        double E[l*2];
+        for (j=0;j<l;j++) for (i=0;i<l;i++) Lk[i+j*l]=L[k+i+(k+j)*n];
+
+        /* mlambda search of the subset, two best for the ratio test */
+        if ((info=search(l,2,Lk,D+k,z+k,E,s,1E99))) {
+            if (info!=-2) return info;
+            continue;
+        }
+        if (s[1]<ratio*s[0]) continue;
+
+        for (i=0;i<k;i++) zf[i]=0.0;
+        for (i=k;i<n;i++) zf[i]=E[i-k];
+        break;
+    }
+    if (k>=n) return 0;
+
+    /* a=Zi*z, a(i) is fixed if it does not depend on the float z(0:k-1) */
+    for (i=0;i<n;i++) {
+        for (j=0;j<k;j++) if (Zi[i+j*n]!=0.0) break;
+        if (j<k) continue;
+        F[i]=0.0;
+        for (j=k;j<n;j++) F[i]+=Zi[i+j*n]*zf[j];
+        fixed[i]=true;
+        nf++;
+    }
+    return nf;
+}
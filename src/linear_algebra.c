@@ -10,6 +10,7 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#include <assert.h>
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
@@ -781,6 +782,56 @@ void matrix_reconstruct_udu(const u32 n, const double *U, const double *D, doubl
 }
 
 
+/** Rank one update of a \f$U D U^{T}\f$ decomposition.
+ *
+ * Updates \f$U\f$ and \f$D\f$ in place such that
+ * \f$ U' D' U'^{T} = U D U^{T} + c a a^{T} \f$ without reconstructing the
+ * matrix. This is the Agee-Turner algorithm, see section 10.2.2 of
+ * Gibbs [1], and takes \f$O(n^2)\f$ operations. Trailing zeros of \f$a\f$
+ * are skipped, so adding to a single diagonal element \f$i\f$ only touches
+ * the leading \f$i+1\f$ columns.
+ *
+ * References:
+ *   -# Gibbs, Bruce P. "Advanced Kalman Filtering, Least-Squares, and Modeling."
+ *      John C. Wiley & Sons, Inc., 2011.
+ *
+ * \param n The size of the matrix.
+ * \param U Pointer to the upper unit triangular matrix, updated in place.
+ * \param D Pointer to the diagonal vector, updated in place.
+ * \param c The non-negative scale of the update.
+ * \param a Pointer to the update vector, length `n`.
+ */
+void matrix_udu_rank_one(u32 n, double *U, double *D, double c,
+                         const double *a)
+{
+  assert(c >= 0);
+  u32 m = n;
+  while (m > 0 && a[m-1] == 0) {
+    m--;
+  }
+  if (m == 0 || c == 0) {
+    return;
+  }
+
+  double v[m];
+  memcpy(v, a, m * sizeof(double));
+  for (u32 j = m - 1; j > 0; j--) {
+    double s = v[j];
+    double d = D[j] + c * s * s;
+    if (d > 0) {
+      double b = c / d;
+      double beta = s * b;
+      c = b * D[j];
+      for (u32 i = 0; i < j; i++) {
+        v[i] -= s * U[i*n + j];
+        U[i*n + j] += beta * v[i];
+      }
+    }
+    D[j] = d;
+  }
+  D[0] += c * v[0] * v[0];
+}
+
 /** Add a matrix to a scaled matrix.
  *  Add two matrices: \f$ C := A + \gamma B \f$, where \f$ A \f$, \f$
  *  B \f$ and \f$C\f$ are matrices on \f$\mathbb{R}^{n \times m}\f$
@@ -26,6 +26,16 @@ inline static node_t *get_node_n(memory_pool_t *pool, node_t *head, u32 n)
   return (node_t *)((u8 *)head + calc_node_size(pool->element_size) * n);
 }
 
+inline static element_t *get_elem_n(memory_pool_t *pool, u32 n)
+{
+  return (element_t *)pool->pool + pool->element_size * n;
+}
+
+inline static u8 is_array(memory_pool_t *pool)
+{
+  return pool->layout == MEMORY_POOL_ARRAY;
+}
+
 /** \defgroup memory_pool Functional Memory Pool
  * Simple fixed size memory pool collection supporting functional operations.
  *
@@ -39,6 +49,19 @@ inline static node_t *get_node_n(memory_pool_t *pool, node_t *head, u32 n)
  * Allocation and deallocation from the pool are guaranteed constant time and
  * map and fold are O(N).
  *
+ * A pool can alternatively be created with an array layout by
+ * memory_pool_new_array() or memory_pool_init_array(). The same functional
+ * API is supported but the allocated elements are kept packed at the start of
+ * the buffer without a per-element header. Iteration is then a linear stride
+ * through memory, filter compacts the surviving elements in place and sort
+ * permutes the array itself. The order in which elements are visited differs
+ * between the two layouts and should not be relied upon other than after a
+ * sort.
+ *
+ * Map, fold and filter also have parallel variants which split the collection
+ * across the workers of a caller supplied ::executor_t, the
+ * library itself doesn't create any threads.
+ *
  * \{ */
 
 /** Create a new memory pool.
@@ -110,6 +133,9 @@ s8 memory_pool_init(memory_pool_t *new_pool, u32 n_elements,
 
   new_pool->n_elements = n_elements;
   new_pool->element_size = element_size;
+  new_pool->layout = MEMORY_POOL_LIST;
+  new_pool->n_allocated = 0;
+  new_pool->generation = 0;
 
   /* Setup memory pool buffer area */
   new_pool->pool = (node_t *)buff;
@@ -136,6 +162,77 @@ s8 memory_pool_init(memory_pool_t *new_pool, u32 n_elements,
   return 0;
 }
 
+/** Create a new memory pool with an array layout.
+ * As memory_pool_new() but the elements are stored contiguously with no
+ * per-element overhead, the total space used for the pool will be:
+ *
+ * ~~~
+ * n_elements * element_size
+ * ~~~
+ *
+ * Remember to free the pool with memory_pool_destroy().
+ *
+ * \param n_elements Number of elements that the pool can hold
+ * \param element_size Size in bytes of the user payload elements
+ * \returns Pointer to a new ::memory_pool_t or NULL upon a malloc() failure
+ */
+memory_pool_t *memory_pool_new_array(u32 n_elements, size_t element_size)
+{
+  memory_pool_t *new_pool = malloc(sizeof(memory_pool_t));
+  if (!new_pool) {
+    return NULL;
+  }
+
+  void *buff = malloc(element_size * n_elements);
+  if (!buff) {
+    free(new_pool);
+    return NULL;
+  }
+
+  memory_pool_init_array(new_pool, n_elements, element_size, buff);
+
+  return new_pool;
+}
+
+/** Initialise a new memory pool with an array layout.
+ * As memory_pool_init() but the elements are stored contiguously with no
+ * per-element overhead, `buff` must hold at least:
+ *
+ * ~~~
+ * n_elements * element_size
+ * ~~~
+ *
+ * \param new_pool Pointer to a memory pool to initialise
+ * \param n_elements Number of elements that the pool can hold
+ * \param element_size Size in bytes of the user payload elements
+ * \param buff Pointer to a buffer to use as the memory pool working area
+ * \returns `0` on success, `<0` on failure.
+ */
+s8 memory_pool_init_array(memory_pool_t *new_pool, u32 n_elements,
+                          size_t element_size, void *buff)
+{
+  if (!new_pool) {
+    return -1;
+  }
+
+  new_pool->n_elements = n_elements;
+  new_pool->element_size = element_size;
+  new_pool->layout = MEMORY_POOL_ARRAY;
+  new_pool->n_allocated = 0;
+  new_pool->generation = 0;
+
+  new_pool->pool = (node_t *)buff;
+  if (!new_pool->pool) {
+    return -2;
+  }
+
+  /* The lists are unused with the array layout. */
+  new_pool->free_nodes_head = NULL;
+  new_pool->allocated_nodes_head = NULL;
+
+  return 0;
+}
+
 /** Destroy a memory pool.
  * Cleans up and frees the memory associated with the pool. This must only be
  * called on memory pools allocated with memory_pool_new().
@@ -150,13 +247,17 @@ void memory_pool_destroy(memory_pool_t *pool)
 
 /** Calculates the number of free (unallocated) elements remaining in the
  * collection.
- * This operation is O(N) in the number of free elements.
+ * This operation is O(N) in the number of free elements, or O(1) for the
+ * array layout.
  *
  * \param pool Pointer to a memory pool
  * \returns Number of free elements or `< 0` on an error.
  */
 s32 memory_pool_n_free(memory_pool_t *pool)
 {
+  if (is_array(pool))
+    return pool->n_elements - pool->n_allocated;
+
   u32 count = 0;
 
   node_t *p = pool->free_nodes_head;
@@ -174,13 +275,17 @@ s32 memory_pool_n_free(memory_pool_t *pool)
 }
 
 /** Calculates the number of elements already allocated in the collection.
- * This operation is O(N) in the number of allocated elements.
+ * This operation is O(N) in the number of allocated elements, or O(1) for the
+ * array layout.
  *
  * \param pool Pointer to a memory pool
  * \returns Number of allocated elements or `< 0` on an error.
  */
 s32 memory_pool_n_allocated(memory_pool_t *pool)
 {
+  if (is_array(pool))
+    return pool->n_allocated;
+
   u32 count = 0;
 
   node_t *p = pool->allocated_nodes_head;
@@ -205,6 +310,9 @@ s32 memory_pool_n_allocated(memory_pool_t *pool)
  */
 u8 memory_pool_empty(memory_pool_t *pool)
 {
+  if (is_array(pool))
+    return (pool->n_allocated == 0);
+
   return (pool->allocated_nodes_head == NULL);
 }
 
@@ -228,6 +336,11 @@ u32 memory_pool_n_elements(memory_pool_t *pool)
  */
 s32 memory_pool_to_array(memory_pool_t *pool, void *array)
 {
+  if (is_array(pool)) {
+    memcpy(array, pool->pool, pool->n_allocated * pool->element_size);
+    return pool->n_allocated;
+  }
+
   u32 count = 0;
 
   node_t *p = pool->allocated_nodes_head;
@@ -254,6 +367,15 @@ s32 memory_pool_to_array(memory_pool_t *pool, void *array)
  */
 element_t *memory_pool_add(memory_pool_t *pool)
 {
+  pool->generation++;
+
+  if (is_array(pool)) {
+    /* Append to the end of the packed elements. */
+    if (pool->n_allocated >= pool->n_elements)
+      return NULL;
+    return get_elem_n(pool, pool->n_allocated++);
+  }
+
   /* Take the head of the list of free nodes, insert it as the head of the
    * allocated nodes and return a pointer to the node's element. */
 
@@ -280,6 +402,14 @@ element_t *memory_pool_add(memory_pool_t *pool)
  */
 s32 memory_pool_map(memory_pool_t *pool, void *arg, void (*f)(void *arg, element_t *elem))
 {
+  pool->generation++;
+
+  if (is_array(pool)) {
+    for (u32 i = 0; i < pool->n_allocated; i++)
+      (*f)(arg, get_elem_n(pool, i));
+    return pool->n_allocated;
+  }
+
   u32 count = 0;
 
   node_t *p = pool->allocated_nodes_head;
@@ -310,6 +440,12 @@ s32 memory_pool_map(memory_pool_t *pool, void *arg, void (*f)(void *arg, element
 s32 memory_pool_fold(memory_pool_t *pool, void *x0,
                      void (*f)(void *x, element_t *elem))
 {
+  if (is_array(pool)) {
+    for (u32 i = 0; i < pool->n_allocated; i++)
+      (*f)(x0, get_elem_n(pool, i));
+    return pool->n_allocated;
+  }
+
   u32 count = 0;
 
   node_t *p = pool->allocated_nodes_head;
@@ -340,9 +476,16 @@ s32 memory_pool_fold(memory_pool_t *pool, void *x0,
 double memory_pool_dfold(memory_pool_t *pool, double x0,
                          double (*f)(double x, element_t *elem))
 {
-  u32 count = 0;
   double x = x0;
 
+  if (is_array(pool)) {
+    for (u32 i = 0; i < pool->n_allocated; i++)
+      x = (*f)(x, get_elem_n(pool, i));
+    return x;
+  }
+
+  u32 count = 0;
+
   node_t *p = pool->allocated_nodes_head;
   while (p && count <= pool->n_elements) {
     x = (*f)(x, p->elem);
@@ -366,9 +509,16 @@ double memory_pool_dfold(memory_pool_t *pool, double x0,
 float memory_pool_ffold(memory_pool_t *pool, float x0,
                         float (*f)(float x, element_t *elem))
 {
-  u32 count = 0;
   float x = x0;
 
+  if (is_array(pool)) {
+    for (u32 i = 0; i < pool->n_allocated; i++)
+      x = (*f)(x, get_elem_n(pool, i));
+    return x;
+  }
+
+  u32 count = 0;
+
   node_t *p = pool->allocated_nodes_head;
   while (p && count <= pool->n_elements) {
     x = (*f)(x, p->elem);
@@ -392,9 +542,16 @@ float memory_pool_ffold(memory_pool_t *pool, float x0,
 s32 memory_pool_ifold(memory_pool_t *pool, s32 x0,
                       s32 (*f)(s32 x, element_t *elem))
 {
-  u32 count = 0;
   s32 x = x0;
 
+  if (is_array(pool)) {
+    for (u32 i = 0; i < pool->n_allocated; i++)
+      x = (*f)(x, get_elem_n(pool, i));
+    return x;
+  }
+
+  u32 count = 0;
+
   node_t *p = pool->allocated_nodes_head;
   while (p && count <= pool->n_elements) {
     x = (*f)(x, p->elem);
@@ -416,6 +573,23 @@ s32 memory_pool_ifold(memory_pool_t *pool, s32 x0,
  */
 s32 memory_pool_filter(memory_pool_t *pool, void *arg, s8 (*f)(void *arg, element_t *elem))
 {
+  pool->generation++;
+
+  if (is_array(pool)) {
+    /* Compact the kept elements towards the start of the array. */
+    u32 n_kept = 0;
+    for (u32 i = 0; i < pool->n_allocated; i++) {
+      element_t *elem = get_elem_n(pool, i);
+      if ((*f)(arg, elem)) {
+        if (n_kept != i)
+          memcpy(get_elem_n(pool, n_kept), elem, pool->element_size);
+        n_kept++;
+      }
+    }
+    pool->n_allocated = n_kept;
+    return n_kept;
+  }
+
   u32 count = 0;
 
   /* Construct a fake 'previous' node for the head of the list, this eliminates
@@ -456,13 +630,91 @@ s32 memory_pool_filter(memory_pool_t *pool, void *arg, s8 (*f)(void *arg, elemen
   return count;
 }
 
+/* Number of elements memory_pool_filter_batch() evaluates together, this
+ * bounds its stack use independent of the size of the pool. */
+#define FILTER_CHUNK_SIZE 128
+
+typedef struct {
+  memory_pool_t *pool;
+  void *arg;
+  void (*f)(void *arg, u32 n, element_t **elems, u8 *keep);
+  u32 i;        /* Index of the next element visited by the filter. */
+  u32 pos;      /* Position of that element in the current batch. */
+  u32 n;        /* Number of elements in the current batch. */
+  element_t *elems[FILTER_CHUNK_SIZE];
+  u8 keep[FILTER_CHUNK_SIZE];
+} filter_chunk_t;
+
+/* Filter function for memory_pool_filter(), which visits the elements in
+ * order and only moves or unlinks an element after it has been visited. So
+ * when `elem` is visited it and the elements after it are all still in place,
+ * and the next batch of them can be evaluated together. */
+static s8 filter_chunk_keep(void *arg, element_t *elem)
+{
+  filter_chunk_t *c = (filter_chunk_t *)arg;
+
+  if (c->pos == c->n) {
+    c->n = 0;
+    if (is_array(c->pool)) {
+      while (c->n < FILTER_CHUNK_SIZE && c->i + c->n < c->pool->n_allocated) {
+        c->elems[c->n] = get_elem_n(c->pool, c->i + c->n);
+        c->n++;
+      }
+    } else {
+      node_t *p = (node_t *)(elem - offsetof(node_t, elem));
+      while (p && c->n < FILTER_CHUNK_SIZE) {
+        c->elems[c->n++] = p->elem;
+        p = p->hdr.next;
+      }
+    }
+    c->pos = 0;
+    c->f(c->arg, c->n, c->elems, c->keep);
+  }
+
+  c->i++;
+  return c->keep[c->pos++];
+}
+
+/** Filter elements in the collection a batch at a time.
+ * As memory_pool_filter() but the filter function is given up to 128
+ * consecutive elements at once, in order, and sets whether to keep each of
+ * them. This lets it evaluate the elements of a batch together, e.g. with
+ * matrix operations. The resulting collection is identical to that from
+ * memory_pool_filter() with the same decisions.
+ *
+ * \param pool Pointer to a memory pool
+ * \param arg Arbitrary argument passed through to the function f
+ * \param f Pointer to a function that takes `n` elements and sets `keep[j]`
+ *          to `0` to discard element `j` or `!=0` to keep it.
+ * \return Number of elements in the filtered collection or `< 0` on an error.
+ */
+s32 memory_pool_filter_batch(memory_pool_t *pool, void *arg,
+                             void (*f)(void *arg, u32 n, element_t **elems,
+                                       u8 *keep))
+{
+  filter_chunk_t c = {
+    .pool = pool,
+    .arg = arg,
+    .f = f,
+  };
+  return memory_pool_filter(pool, &c, &filter_chunk_keep);
+}
+
 /** Remove all elements from the collection and return them all back to the pool.
- * This function is O(n) in the number of currently allocated nodes.
+ * This function is O(n) in the number of currently allocated nodes, or O(1)
+ * for the array layout.
  *
  * \param pool Pointer to a memory pool
  */
 s32 memory_pool_clear(memory_pool_t *pool)
 {
+  pool->generation++;
+
+  if (is_array(pool)) {
+    pool->n_allocated = 0;
+    return 0;
+  }
+
   u32 count = 0;
   node_t *p = pool->allocated_nodes_head;
 
@@ -490,10 +742,181 @@ s32 memory_pool_clear(memory_pool_t *pool)
   return 0;
 }
 
+/* The array layout can't be sorted by relinking nodes, instead the packed
+ * elements are permuted in place with a stable merge sort that needs no
+ * scratch space. Blocks of ARRAY_SORT_BLOCK elements are insertion sorted and
+ * then merged with the SymMerge algorithm from P. Kim and A. Kutzner, "Stable
+ * Minimum Storage Merging by Symmetric Comparisons", 2004. This takes
+ * O(N log N) comparisons and O(N log^2 N) element swaps. */
+
+#define ARRAY_SORT_BLOCK 20
+
+typedef struct {
+  memory_pool_t *pool;
+  void *arg;
+  s32 (*cmp)(void *arg, element_t *a, element_t *b);
+} array_sort_t;
+
+/* True if element `i` must be placed before element `j`, matching the
+ * tie-breaking of the linked list sort. */
+static u8 array_less(array_sort_t *s, u32 i, u32 j)
+{
+  return s->cmp(s->arg, get_elem_n(s->pool, j), get_elem_n(s->pool, i)) > 0;
+}
+
+static void array_swap(memory_pool_t *pool, u32 i, u32 j)
+{
+  u8 *a = get_elem_n(pool, i);
+  u8 *b = get_elem_n(pool, j);
+  u8 tmp[64];
+  for (size_t k = 0; k < pool->element_size; k += sizeof(tmp)) {
+    size_t n = MIN(sizeof(tmp), pool->element_size - k);
+    memcpy(tmp, a + k, n);
+    memcpy(a + k, b + k, n);
+    memcpy(b + k, tmp, n);
+  }
+}
+
+static void array_swap_range(memory_pool_t *pool, u32 a, u32 b, u32 n)
+{
+  for (u32 i = 0; i < n; i++) {
+    array_swap(pool, a + i, b + i);
+  }
+}
+
+/* Rotate the elements in [a, b) so that element m moves to position a. */
+static void array_rotate(memory_pool_t *pool, u32 a, u32 m, u32 b)
+{
+  u32 i = m - a;
+  u32 j = b - m;
+  while (i != j) {
+    if (i > j) {
+      array_swap_range(pool, m - i, m, j);
+      i -= j;
+    } else {
+      array_swap_range(pool, m - i, m + j - i, i);
+      j -= i;
+    }
+  }
+  array_swap_range(pool, m - i, m, i);
+}
+
+static void array_insertion_sort(array_sort_t *s, u32 a, u32 b)
+{
+  for (u32 i = a + 1; i < b; i++) {
+    for (u32 j = i; j > a && array_less(s, j, j - 1); j--) {
+      array_swap(s->pool, j, j - 1);
+    }
+  }
+}
+
+/* Merge the sorted runs [a, m) and [m, b). */
+static void array_sym_merge(array_sort_t *s, u32 a, u32 m, u32 b)
+{
+  if (m - a == 1) {
+    /* Insert the single element at a into [m, b). */
+    u32 i = m;
+    u32 j = b;
+    while (i < j) {
+      u32 h = (i + j) / 2;
+      if (array_less(s, h, a)) {
+        i = h + 1;
+      } else {
+        j = h;
+      }
+    }
+    for (u32 k = a; k + 1 < i; k++) {
+      array_swap(s->pool, k, k + 1);
+    }
+    return;
+  }
+  if (b - m == 1) {
+    /* Insert the single element at m into [a, m). */
+    u32 i = a;
+    u32 j = m;
+    while (i < j) {
+      u32 h = (i + j) / 2;
+      if (!array_less(s, m, h)) {
+        i = h + 1;
+      } else {
+        j = h;
+      }
+    }
+    for (u32 k = m; k > i; k--) {
+      array_swap(s->pool, k, k - 1);
+    }
+    return;
+  }
+
+  u32 mid = (a + b) / 2;
+  u32 n = mid + m;
+  u32 start, r;
+  if (m > mid) {
+    start = n - b;
+    r = mid;
+  } else {
+    start = a;
+    r = m;
+  }
+  u32 p = n - 1;
+  while (start < r) {
+    u32 c = (start + r) / 2;
+    if (!array_less(s, p - c, c)) {
+      start = c + 1;
+    } else {
+      r = c;
+    }
+  }
+  u32 end = n - start;
+
+  if (start < m && m < end) {
+    array_rotate(s->pool, start, m, end);
+  }
+  if (a < start && start < mid) {
+    array_sym_merge(s, a, start, mid);
+  }
+  if (mid < end && end < b) {
+    array_sym_merge(s, mid, end, b);
+  }
+}
+
+static void array_sort(memory_pool_t *pool, void *arg,
+                       s32 (*cmp)(void *arg, element_t *a, element_t *b))
+{
+  array_sort_t s = {.pool = pool, .arg = arg, .cmp = cmp};
+  u32 n = pool->n_allocated;
+
+  u32 block = ARRAY_SORT_BLOCK;
+  u32 a = 0;
+  u32 b = block;
+  while (b <= n) {
+    array_insertion_sort(&s, a, b);
+    a = b;
+    b += block;
+  }
+  array_insertion_sort(&s, a, n);
+
+  while (block < n) {
+    a = 0;
+    b = 2 * block;
+    while (b <= n) {
+      array_sym_merge(&s, a, a + block, b);
+      a = b;
+      b += 2 * block;
+    }
+    if (a + block < n) {
+      array_sym_merge(&s, a, a + block, n);
+    }
+    block *= 2;
+  }
+}
+
 /** Sort the elements in a collection.
  * This is implemented as a merge sort on a linked list and has O(N log N) time
  * complexity and O(1) space complexity. The implementation is stable and has
  * no pathological cases. The worst-case running time is still O(N log N).
+ * Pools with the array layout are instead sorted in place by a stable merge
+ * sort with O(1) space complexity and O(N log^2 N) worst-case running time.
  *
  * Ordering is defined by a comparison function `cmp` which takes two elements
  * `a` and `b` and returns `>0` if `a` should be placed before `b`, `<0` if `b`
@@ -538,6 +961,13 @@ s32 memory_pool_clear(memory_pool_t *pool)
 void memory_pool_sort(memory_pool_t *pool, void *arg,
                       s32 (*cmp)(void *arg, element_t *a, element_t *b))
 {
+  pool->generation++;
+
+  if (is_array(pool)) {
+    array_sort(pool, arg, cmp);
+    return;
+  }
+
   /* If collection is empty, return immediately. */
   if (!pool->allocated_nodes_head)
     return;
@@ -609,6 +1039,46 @@ void memory_pool_sort(memory_pool_t *pool, void *arg,
   }
 }
 
+static void array_group_by(memory_pool_t *pool, void *arg,
+                           s32 (*cmp)(void *arg, element_t *a, element_t *b),
+                           void *x0, size_t x_size,
+                           void (*agg)(element_t *new, void *x, u32 n, element_t *elem))
+{
+  array_sort(pool, arg, cmp);
+
+  u8 x_work[x_size];
+  /* The aggregate can't be built in the array as it may alias the first
+   * element of its group, use a working element with the same alignment as
+   * the elements of a linked list pool. */
+  double new_elem[(pool->element_size + sizeof(double) - 1) / sizeof(double)];
+
+  u32 n_groups = 0;
+  u32 i = 0;
+  while (i < pool->n_allocated) {
+    u32 group_count = 0;
+    u32 group_head = i;
+
+    if (x_size)
+      memcpy(x_work, x0, x_size);
+
+    memcpy(new_elem, get_elem_n(pool, i), pool->element_size);
+
+    do {
+      agg((element_t *)new_elem, (void *)x_work, group_count,
+          get_elem_n(pool, i));
+      group_count++;
+      i++;
+    } while (i < pool->n_allocated &&
+             cmp(arg, get_elem_n(pool, group_head), get_elem_n(pool, i)) == 0);
+
+    /* Groups are written back in order, never ahead of the unread elements. */
+    memcpy(get_elem_n(pool, n_groups), new_elem, pool->element_size);
+    n_groups++;
+  }
+
+  pool->n_allocated = n_groups;
+}
+
 /** Perform a groupby type reduction on a collection.
  * A groupby reduction consists of two steps:
  *
@@ -649,6 +1119,13 @@ void memory_pool_group_by(memory_pool_t *pool, void *arg,
                           void *x0, size_t x_size,
                           void (*agg)(element_t *new, void *x, u32 n, element_t *elem))
 {
+  pool->generation++;
+
+  if (is_array(pool)) {
+    array_group_by(pool, arg, cmp, x0, x_size, agg);
+    return;
+  }
+
   /* If collection is empty, return immediately. */
   if (!pool->allocated_nodes_head)
     return;
@@ -703,6 +1180,78 @@ void memory_pool_group_by(memory_pool_t *pool, void *arg,
   }
 }
 
+/* For the array layout the products are built in the same buffer as the
+ * original elements. The originals are first moved to the end of the buffer
+ * and products are added from the start, so an original is only overwritten
+ * once all of its products have been made and the pool runs out of space at
+ * exactly the same point as with the linked list layout. Returns the index of
+ * the first original element. */
+static u32 array_product_start(memory_pool_t *pool)
+{
+  u32 n_old = pool->n_allocated;
+  u32 old_start = pool->n_elements - n_old;
+  memmove(get_elem_n(pool, old_start), pool->pool,
+          n_old * pool->element_size);
+  pool->n_allocated = 0;
+  return old_start;
+}
+
+static s32 array_product(memory_pool_t *pool, void *xs, u32 n_xs, size_t x_size,
+                         void (*prod)(element_t *new, void *x, u32 n_xs, u32 n, element_t *elem))
+{
+  u32 old_start = array_product_start(pool);
+
+  for (u32 j = old_start; j < pool->n_elements; j++) {
+    element_t *elem = get_elem_n(pool, j);
+    for (u32 i=0; i<n_xs; i++) {
+      if (pool->n_allocated >= j) {
+        /* Pool is full. */
+        return -2;
+      }
+      element_t *new = get_elem_n(pool, pool->n_allocated++);
+      memcpy(new, elem, pool->element_size);
+      prod(new, ((u8 *)xs + i*x_size), n_xs, i, elem);
+    }
+  }
+
+  return pool->n_allocated;
+}
+
+static s32 array_product_generator(memory_pool_t *pool, void *x0, u32 max_xs, size_t x_size,
+                                   s8 (*init)(void *x, element_t *elem),
+                                   s8 (*next)(void *x, u32 n),
+                                   void (*prod)(element_t *new, void *x, u32 n, element_t *elem))
+{
+  u32 old_start = array_product_start(pool);
+
+  u8 x_work[x_size];
+  for (u32 j = old_start; j < pool->n_elements; j++) {
+    element_t *elem = get_elem_n(pool, j);
+    memcpy(x_work, x0, x_size);
+
+    if (!init(x_work, elem))
+      continue;
+
+    u32 x_count = 0;
+    do {
+      if (x_count > max_xs) {
+        /* Exceded maximum number of generator iterations. */
+        return -3;
+      }
+      if (pool->n_allocated >= j) {
+        /* Pool is full. */
+        return -2;
+      }
+      element_t *new = get_elem_n(pool, pool->n_allocated++);
+      memcpy(new, elem, pool->element_size);
+      prod(new, x_work, x_count, elem);
+      x_count++;
+    } while (next(x_work, x_count));
+  }
+
+  return pool->n_allocated;
+}
+
 /** Cartesian product of a memory pool collection with an array.
  * For each pair of an element in the original collection and an item in the
  * array `xs`, a new element is created in the updated collection formed by the
@@ -724,6 +1273,11 @@ void memory_pool_group_by(memory_pool_t *pool, void *arg,
 s32 memory_pool_product(memory_pool_t *pool, void *xs, u32 n_xs, size_t x_size,
                         void (*prod)(element_t *new, void *x, u32 n_xs, u32 n, element_t *elem))
 {
+  pool->generation++;
+
+  if (is_array(pool))
+    return array_product(pool, xs, n_xs, x_size, prod);
+
   /* Save the head of the original list and reset the pool head where the
    * product data will be added. */
   node_t *old_head = pool->allocated_nodes_head;
@@ -770,6 +1324,11 @@ s32 memory_pool_product_generator(memory_pool_t *pool, void *x0, u32 max_xs, siz
                                   s8 (*next)(void *x, u32 n),
                                   void (*prod)(element_t *new, void *x, u32 n, element_t *elem))
 {
+  pool->generation++;
+
+  if (is_array(pool))
+    return array_product_generator(pool, x0, max_xs, x_size, init, next, prod);
+
   /* Save the head of the original list and reset the pool head where the
    * product data will be added. */
   node_t *old_head = pool->allocated_nodes_head;
@@ -825,4 +1384,247 @@ s32 memory_pool_product_generator(memory_pool_t *pool, void *x0, u32 max_xs, siz
   return count;
 }
 
+/* The parallel operations split the collection into one part of consecutive
+ * elements per worker. Partitioning only depends on the number of allocated
+ * elements and workers, so results are deterministic for a fixed number of
+ * workers. */
+
+typedef struct {
+  node_t *head; /* First node of the part, linked list layout only. */
+  u32 start;    /* Index of the first element of the part. */
+  u32 count;
+} pool_part_t;
+
+typedef struct parallel_job {
+  memory_pool_t *pool;
+  const pool_part_t *parts;
+  void (*visit)(struct parallel_job *job, u32 part, u32 i, element_t *elem);
+} parallel_job_t;
+
+static u32 n_parts(const executor_t *ex)
+{
+  return (ex && ex->n_workers > 0) ? ex->n_workers : 1;
+}
+
+static void run_part(void *job_, u32 k)
+{
+  parallel_job_t *job = (parallel_job_t *)job_;
+  const pool_part_t *part = &job->parts[k];
+
+  node_t *p = part->head;
+  for (u32 i = 0; i < part->count; i++) {
+    element_t *elem;
+    if (is_array(job->pool)) {
+      elem = get_elem_n(job->pool, part->start + i);
+    } else {
+      elem = p->elem;
+      p = p->hdr.next;
+    }
+    job->visit(job, k, part->start + i, elem);
+  }
+}
+
+/* Partition the collection and visit every element, returns the number of
+ * elements visited or `< 0` on an error. */
+static s32 run_parallel(memory_pool_t *pool, const executor_t *ex,
+                        parallel_job_t *job)
+{
+  s32 n = memory_pool_n_allocated(pool);
+  if (n < 0)
+    return n;
+
+  u32 n_p = n_parts(ex);
+  pool_part_t parts[n_p];
+  node_t *p = pool->allocated_nodes_head;
+  u32 start = 0;
+  for (u32 k = 0; k < n_p; k++) {
+    /* Spread the remainder over the first parts. */
+    u32 count = n / n_p + (k < n % n_p ? 1 : 0);
+    parts[k].head = p;
+    parts[k].start = start;
+    parts[k].count = count;
+    if (!is_array(pool)) {
+      for (u32 i = 0; i < count; i++)
+        p = p->hdr.next;
+    }
+    start += count;
+  }
+
+  job->pool = pool;
+  job->parts = parts;
+  if (ex) {
+    ex->run(ex->ctx, n_p, &run_part, job);
+  } else {
+    run_part(job, 0);
+  }
+
+  return n;
+}
+
+typedef struct {
+  parallel_job_t job;
+  void *arg;
+  void (*f)(void *arg, element_t *elem);
+} map_job_t;
+
+static void map_visit(parallel_job_t *job, u32 part, u32 i, element_t *elem)
+{
+  (void)part; (void)i;
+  map_job_t *m = (map_job_t *)job;
+  m->f(m->arg, elem);
+}
+
+/** Map a function across all elements of the collection using several
+ * workers.
+ * As memory_pool_map() but the collection is split into `ex->n_workers`
+ * parts which are handed to the executor. `f` may be called concurrently for
+ * different elements.
+ *
+ * \param pool Pointer to a memory pool
+ * \param ex Executor to run the parts on, or NULL to run sequentially
+ * \param arg Arbitrary argument passed through to the function f
+ * \param f Pointer to a function that does an in-place update of an element.
+ * \return Number of elements mapped across or `< 0` on an error.
+ */
+s32 memory_pool_map_parallel(memory_pool_t *pool,
+                             const executor_t *ex, void *arg,
+                             void (*f)(void *arg, element_t *elem))
+{
+  map_job_t m = {.job = {.visit = &map_visit}, .arg = arg, .f = f};
+  pool->generation++;
+  return run_parallel(pool, ex, &m.job);
+}
+
+typedef struct {
+  parallel_job_t job;
+  u8 *xs;
+  size_t x_stride;
+  void (*f)(void *x, element_t *elem);
+} fold_job_t;
+
+static void fold_visit(parallel_job_t *job, u32 part, u32 i, element_t *elem)
+{
+  (void)i;
+  fold_job_t *fj = (fold_job_t *)job;
+  fj->f(fj->xs + part * fj->x_stride, elem);
+}
+
+/** Calculate a fold reduction on the collection using several workers.
+ * Each part of the collection is folded by `f` into its own accumulator,
+ * initialized as a copy of `x0`, and the part accumulators are then merged
+ * in order by `combine`. For the result not to depend on the number of
+ * workers `combine` must be associative and `x0` must be an identity of
+ * `combine`, e.g. zero for a sum.
+ *
+ * \param pool Pointer to a memory pool
+ * \param ex Executor to run the parts on, or NULL to run sequentially
+ * \param x0 Pointer to an initial accumulator state, updated with the result
+ * \param x_size The size in bytes of the accumulator state
+ * \param f Pointer to a function that does an in-place update of an
+ *          accumulator state given an element and optionally updates that
+ *          element in-place.
+ * \param combine Pointer to a function that merges accumulator `y` into
+ *                accumulator `x` in-place.
+ * \return Number of elements folded or `< 0` on an error.
+ */
+s32 memory_pool_fold_parallel(memory_pool_t *pool,
+                              const executor_t *ex,
+                              void *x0, size_t x_size,
+                              void (*f)(void *x, element_t *elem),
+                              void (*combine)(void *x, const void *y))
+{
+  u32 n_p = n_parts(ex);
+
+  /* Working accumulators, aligned the same as pool elements. */
+  size_t x_words = (x_size + sizeof(double) - 1) / sizeof(double);
+  double xs[n_p * x_words + 1];
+  fold_job_t fj = {
+    .job = {.visit = &fold_visit},
+    .xs = (u8 *)xs,
+    .x_stride = x_words * sizeof(double),
+    .f = f
+  };
+  for (u32 k = 0; k < n_p; k++) {
+    memcpy(fj.xs + k * fj.x_stride, x0, x_size);
+  }
+
+  s32 n = run_parallel(pool, ex, &fj.job);
+  if (n < 0)
+    return n;
+
+  memcpy(x0, fj.xs, x_size);
+  for (u32 k = 1; k < n_p; k++) {
+    combine(x0, fj.xs + k * fj.x_stride);
+  }
+
+  return n;
+}
+
+/* Filter function for memory_pool_filter_parallel(), evaluating the filter
+ * function for a batch of elements on the executor. */
+typedef struct {
+  const executor_t *ex;
+  void *arg;
+  s8 (*f)(void *arg, element_t *elem);
+  u32 n;        /* Number of elements in the current batch. */
+  u32 n_tasks;  /* Number of executor tasks the batch is split into. */
+  element_t **elems;
+  u8 *keep;
+} filter_parallel_t;
+
+static void filter_parallel_task(void *arg, u32 k)
+{
+  filter_parallel_t *c = (filter_parallel_t *)arg;
+  /* Spread the remainder over the first tasks, as for run_parallel(). */
+  u32 start = k * (c->n / c->n_tasks) + (k < c->n % c->n_tasks ?
+                                         k : c->n % c->n_tasks);
+  u32 count = c->n / c->n_tasks + (k < c->n % c->n_tasks ? 1 : 0);
+  for (u32 j = start; j < start + count; j++) {
+    c->keep[j] = c->f(c->arg, c->elems[j]) ? 1 : 0;
+  }
+}
+
+static void filter_parallel_batch(void *arg, u32 n, element_t **elems,
+                                  u8 *keep)
+{
+  filter_parallel_t *c = (filter_parallel_t *)arg;
+  u32 n_p = n_parts(c->ex);
+  c->n = n;
+  c->n_tasks = n_p < n ? n_p : n;
+  c->elems = elems;
+  c->keep = keep;
+  if (c->ex) {
+    c->ex->run(c->ex->ctx, c->n_tasks, &filter_parallel_task, c);
+  } else {
+    filter_parallel_task(c, 0);
+  }
+}
+
+/** Filter elements in the collection using several workers.
+ * The elements are evaluated in batches as for memory_pool_filter_batch().
+ * Within a batch the filter function is evaluated for all the elements in
+ * parallel as for memory_pool_map_parallel(), then they are compacted
+ * sequentially before the next batch. Stack use does not depend on the size
+ * of the pool. The resulting collection is identical to that from
+ * memory_pool_filter().
+ *
+ * \param pool Pointer to a memory pool
+ * \param ex Executor to run the parts on, or NULL to run sequentially
+ * \param arg Arbitrary argument passed through to the function f
+ * \param f Pointer to a function that takes an element and returns `0` to
+ *          discard that element or `!=0` to keep that element.
+ * \return Number of elements in the filtered collection or `< 0` on an error.
+ */
+s32 memory_pool_filter_parallel(memory_pool_t *pool,
+                                const executor_t *ex, void *arg,
+                                s8 (*f)(void *arg, element_t *elem))
+{
+  filter_parallel_t c = {
+    .ex = ex,
+    .arg = arg,
+    .f = f,
+  };
+  return memory_pool_filter_batch(pool, &c, &filter_parallel_batch);
+}
+
 /** \} */
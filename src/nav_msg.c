@@ -220,6 +220,37 @@ static u8 nav_parity(u32 *word)
   return 0;
 }
 
+/* Decode the pages of subframe 4 that we use.
+ *
+ * \param words Words 3 through 10 of subframe 4, parity checked
+ * \param l2c_cpbl Set to the L2C capability if this is page 25
+ * \param l2c_upd Set to true if `l2c_cpbl` was updated
+ * \param iono Set to the ionospheric parameters if this is page 18
+ * \param iono_upd Set to true if `iono` was updated
+ */
+static void decode_subframe4(const u32 words[8],
+                             u32 *l2c_cpbl, bool *l2c_upd,
+                             ionosphere_t *iono, bool *iono_upd)
+{
+  /* check Word 3 bits 2..7 (63..69) for Page ID, see IS-200H, pg. 84 */
+  u8 page_id = words[3-3] >> (30-8) & 0x3f;
+
+  /* Page 25 has ID 63 and contains the SV config bits in words 3-8,
+   * see IS-200H, pg. 109-110 */
+  if (page_id == 63) {
+    decode_l2c_capability(words, l2c_cpbl);
+    *l2c_upd = true;
+  }
+
+  /* Page 18 has ID 56 and contains the iono data,
+   * see IS-200H, pg. 109-110 */
+  if (page_id == 56) {
+    /* decode ionospheric correction data */
+    decode_iono_parameters(words, iono);
+    *iono_upd = true;
+  }
+}
+
 bool subframe_ready(nav_msg_t *n) {
   return (n->subframe_start_index != 0);
 }
@@ -292,24 +323,10 @@ s8 process_subframe(nav_msg_t *n, gnss_signal_t sid,
     }
 
     if (4 == sf_id) { /* parse Subframe 4 */
-       /*  get words 3-8 from 25th page (SV config
-       *  bits) */
-
-      /* check Word 3 bits 2..7 (63..69) for Page ID, see IS-200H, pg. 84
-       * Page 25 has ID 63, see IS-200H, pg. 109-110 */
-      if ((n->frame_words[3][3-3] >> (30-8) & 0x3f) == 63) {
-        decode_l2c_capability(n->frame_words[3], &(data->gps_l2c_sv_capability));
-        data->gps_l2c_sv_capability_upd_flag = true;
-      }
-
-     /* check Word 3 bits 2..7 (63..69) for Page ID 18,
-      * which contains iono data
-      * Page 18 has ID 56, see IS-200H, pg. 109-110 */
-      if ((n->frame_words[3][3-3] >> (30-8) & 0x3f) == 56) {
-       /* decode ionospheric correction data */
-        decode_iono_parameters(n->frame_words[3], &data->iono);
-        data->iono_corr_upd_flag = true;
-      }
+      decode_subframe4(n->frame_words[3],
+                       &data->gps_l2c_sv_capability,
+                       &data->gps_l2c_sv_capability_upd_flag,
+                       &data->iono, &data->iono_corr_upd_flag);
 
       /* Got all of subframes 1 to 4 */
       n->next_subframe_id = 1; /* Make sure we start again next time */
@@ -324,3 +341,275 @@ s8 process_subframe(nav_msg_t *n, gnss_signal_t sid,
   return 0;
 
 }
+
+/** Initialize a bulk navigation data store.
+ *
+ * \param s Store to initialize
+ */
+void nav_store_init(gps_l1ca_nav_store_t *s)
+{
+  memset(s, 0, sizeof(gps_l1ca_nav_store_t));
+  for (u8 i = 0; i < NUM_SATS_GPS; i++) {
+    s->next_subframe_id[i] = 1;
+  }
+}
+
+/* Decode `subframes[order[i]]` for `i` in `[0, n)`, or `subframes[i]` if
+ * `order` is NULL, see decode_subframes(). If `eph_ndx` is not NULL the index
+ * in `subframes` of the subframe completing each output ephemeris is written
+ * to it. */
+static u32 decode_subframes_list(gps_l1ca_nav_store_t *s,
+                                 const gps_l1ca_subframe_t *subframes,
+                                 const u32 *order, u32 n,
+                                 ephemeris_t *eph_out, u32 *eph_ndx,
+                                 u32 max_eph_out)
+{
+  assert(s != NULL);
+  assert(subframes != NULL || n == 0);
+
+  u32 n_eph_out = 0;
+
+  for (u32 i = 0; i < n; i++) {
+    u32 ndx = order != NULL ? order[i] : i;
+    const gps_l1ca_subframe_t *sf = &subframes[ndx];
+
+    if (!sid_valid(sf->sid) ||
+        sid_to_constellation(sf->sid) != CONSTELLATION_GPS) {
+      continue;
+    }
+    u16 sat = sf->sid.sat - GPS_FIRST_PRN;
+
+    /* Check parity of the HOW and words 3..10 before touching the store. */
+    u32 words[GPS_L1CA_SUBFRAME_WORDS - 1];
+    bool parity_ok = true;
+    for (u8 w = 0; w < GPS_L1CA_SUBFRAME_WORDS - 1 && parity_ok; w++) {
+      words[w] = sf->words[w + 1];
+      parity_ok = (nav_parity(&words[w]) == 0);
+    }
+    if (!parity_ok) {
+      s->n_parity_errors++;
+      s->next_subframe_id[sat] = 1;
+      continue;
+    }
+
+    u8 sf_id = words[0] >> 8 & 0x07;
+
+    if (sf_id == 4) {
+      decode_subframe4(&words[1], &s->gps_l2c_sv_capability,
+                       &s->l2c_capability_valid,
+                       &s->iono, &s->iono_valid);
+      continue;
+    }
+
+    if (sf_id < 1 || sf_id > 3) {
+      continue;
+    }
+
+    /* Subframe 1 always starts a new ephemeris. */
+    if (sf_id == 1) {
+      s->next_subframe_id[sat] = 1;
+    }
+    if (sf_id != s->next_subframe_id[sat]) {
+      s->next_subframe_id[sat] = 1;
+      continue;
+    }
+
+    memcpy(s->frame_words[sat][sf_id-1], &words[1], 8 * sizeof(u32));
+    s->next_subframe_id[sat]++;
+
+    if (sf_id == 3) {
+      s->next_subframe_id[sat] = 1;
+
+      ephemeris_t e;
+      memset(&e, 0, sizeof(e));
+      e.sid = sf->sid;
+      decode_ephemeris(s->frame_words[sat], &e);
+      if (!e.valid || ephemeris_equal(&e, &s->ephemerides[sat])) {
+        continue;
+      }
+
+      s->ephemerides[sat] = e;
+      if (eph_out != NULL && n_eph_out < max_eph_out) {
+        if (eph_ndx != NULL) {
+          eph_ndx[n_eph_out] = ndx;
+        }
+        eph_out[n_eph_out++] = e;
+      }
+    }
+  }
+
+  return n_eph_out;
+}
+
+/** Decode a batch of raw GPS L1 C/A subframes.
+ *
+ * This is the word-level equivalent of feeding every bit through
+ * nav_msg_update() and process_subframe(), intended for rebuilding
+ * navigation data from logs. Subframes are processed in order and may
+ * interleave any number of satellites. For each satellite subframes 1 to 3
+ * must arrive consecutively for an ephemeris to be decoded, as with
+ * process_subframe(). Subframe 4 pages 18 and 25 update the ionospheric
+ * parameters and L2C capability in the store.
+ *
+ * Every newly decoded valid ephemeris which differs from the one held in the
+ * store for that satellite is also appended to `eph_out`, giving the
+ * ephemeris history of the batch.
+ *
+ * See decode_subframes_parallel() to decode groups of satellites on several
+ * workers.
+ *
+ * \param s Navigation data store, see nav_store_init()
+ * \param subframes Array of raw subframes
+ * \param n_subframes Number of subframes in the array
+ * \param eph_out Array to append new ephemerides to, may be NULL
+ * \param max_eph_out Capacity of `eph_out`
+ * \return Number of ephemerides written to `eph_out`
+ */
+u32 decode_subframes(gps_l1ca_nav_store_t *s,
+                     const gps_l1ca_subframe_t *subframes, u32 n_subframes,
+                     ephemeris_t *eph_out, u32 max_eph_out)
+{
+  return decode_subframes_list(s, subframes, NULL, n_subframes,
+                               eph_out, NULL, max_eph_out);
+}
+
+typedef struct {
+  gps_l1ca_nav_store_t *stores;
+  const gps_l1ca_subframe_t *subframes;
+  const u32 *order;
+  const u32 *bucket;
+  ephemeris_t *eph;
+  u32 *eph_ndx;
+  u32 max_eph_group;
+  u32 *n_eph;
+} decode_job_t;
+
+/* Executor task decoding the subframes of group `k` into `stores[k]` and its
+ * part of the scratch ephemerides. */
+static void decode_task(void *arg, u32 k)
+{
+  decode_job_t *job = arg;
+  u32 off = k * job->max_eph_group;
+  job->n_eph[k] = decode_subframes_list(
+      &job->stores[k], job->subframes, &job->order[job->bucket[k]],
+      job->bucket[k + 1] - job->bucket[k],
+      job->eph != NULL ? &job->eph[off] : NULL, &job->eph_ndx[off],
+      job->max_eph_group);
+}
+
+/** Decode a batch of raw GPS L1 C/A subframes on several workers.
+ *
+ * The satellites are split into `n` groups by PRN, where `n` is
+ * `ex->n_workers`, or 1 if `ex` is NULL. The subframes are first sorted into
+ * their groups, then each group is decoded by one task of the executor into
+ * its own store, so the tasks share no state. The result for each group is
+ * the same as decode_subframes() on `stores[k]` with only the subframes of
+ * that group's satellites, i.e. `stores[k]` holds the ephemerides of the
+ * satellites with `(prn - 1) % n == k`, and the ionospheric parameters and
+ * L2C capability of their subframe 4 pages.
+ *
+ * `eph_out` receives the same ephemerides, in the same order, as
+ * decode_subframes() would give on the whole batch. Each group collects up to
+ * `max_eph_out` ephemerides in `work` and these are merged back into input
+ * order, so nothing is dropped while `eph_out` has room.
+ *
+ * \param ex Executor to run the groups on, or NULL to decode sequentially
+ * \param stores Array of `n` navigation data stores, see nav_store_init()
+ * \param subframes Array of raw subframes
+ * \param n_subframes Number of subframes in the array
+ * \param eph_out Array to append new ephemerides to, may be NULL
+ * \param max_eph_out Capacity of `eph_out`
+ * \param work Working area of at least
+ *             `DECODE_SUBFRAMES_WORK_SIZE(n, n_subframes, max_eph_out)`
+ *             bytes, aligned for `ephemeris_t`
+ * \param work_size Size of `work` in bytes
+ * \return Number of ephemerides written to `eph_out`, or -1 if `work` is too
+ *         small
+ */
+s32 decode_subframes_parallel(const executor_t *ex,
+                              gps_l1ca_nav_store_t *stores,
+                              const gps_l1ca_subframe_t *subframes,
+                              u32 n_subframes,
+                              ephemeris_t *eph_out, u32 max_eph_out,
+                              void *work, size_t work_size)
+{
+  assert(stores != NULL);
+  assert(subframes != NULL || n_subframes == 0);
+
+  u32 n_groups = (ex && ex->n_workers > 0) ? ex->n_workers : 1;
+  u32 max_eph_group = eph_out != NULL ? max_eph_out : 0;
+  if (work == NULL ||
+      work_size < DECODE_SUBFRAMES_WORK_SIZE(n_groups, n_subframes,
+                                             max_eph_group)) {
+    return -1;
+  }
+
+  /* Carve up the working area, the ephemerides first for alignment. */
+  ephemeris_t *eph = work;
+  u32 *eph_ndx = (u32 *)&eph[n_groups * max_eph_group];
+  u32 *order = &eph_ndx[n_groups * max_eph_group];
+  u32 *bucket = &order[n_subframes];
+  u32 *n_eph = &bucket[n_groups + 1];
+
+  /* Stable counting sort of the GPS subframes by group, bucket[k] is the
+   * start of group k in order. */
+  memset(bucket, 0, (n_groups + 1) * sizeof(u32));
+  for (u32 i = 0; i < n_subframes; i++) {
+    gnss_signal_t sid = subframes[i].sid;
+    if (sid_valid(sid) && sid_to_constellation(sid) == CONSTELLATION_GPS) {
+      bucket[(sid.sat - GPS_FIRST_PRN) % n_groups + 1]++;
+    }
+  }
+  for (u32 k = 0; k < n_groups; k++) {
+    bucket[k + 1] += bucket[k];
+    n_eph[k] = bucket[k];
+  }
+  for (u32 i = 0; i < n_subframes; i++) {
+    gnss_signal_t sid = subframes[i].sid;
+    if (sid_valid(sid) && sid_to_constellation(sid) == CONSTELLATION_GPS) {
+      order[n_eph[(sid.sat - GPS_FIRST_PRN) % n_groups]++] = i;
+    }
+  }
+
+  decode_job_t job = {
+    .stores = stores,
+    .subframes = subframes,
+    .order = order,
+    .bucket = bucket,
+    .eph = eph_out != NULL ? eph : NULL,
+    .eph_ndx = eph_ndx,
+    .max_eph_group = max_eph_group,
+    .n_eph = n_eph,
+  };
+
+  if (ex) {
+    ex->run(ex->ctx, n_groups, &decode_task, &job);
+  } else {
+    decode_task(&job, 0);
+  }
+
+  if (eph_out == NULL) {
+    return 0;
+  }
+
+  /* Merge the groups back into input order, reusing bucket as the read
+   * position in each group. */
+  memset(bucket, 0, n_groups * sizeof(u32));
+  u32 n_eph_out = 0;
+  while (n_eph_out < max_eph_out) {
+    u32 best = n_groups;
+    for (u32 k = 0; k < n_groups; k++) {
+      if (bucket[k] < n_eph[k] &&
+          (best == n_groups ||
+           eph_ndx[k * max_eph_group + bucket[k]] <
+           eph_ndx[best * max_eph_group + bucket[best]])) {
+        best = k;
+      }
+    }
+    if (best == n_groups) {
+      break;
+    }
+    eph_out[n_eph_out++] = eph[best * max_eph_group + bucket[best]++];
+  }
+  return n_eph_out;
+}
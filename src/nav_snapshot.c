@@ -0,0 +1,607 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include <libswiftnav/logging.h>
+#include <libswiftnav/edc.h>
+#include <libswiftnav/nav_snapshot.h>
+
+/** \defgroup nav_snapshot Navigation Data Snapshot
+ * Persistence of decoded navigation data for fast warm starts.
+ *
+ * A snapshot is a compact little-endian binary record of the ephemerides,
+ * almanacs, ionospheric parameters and L2C capability known to the receiver.
+ * The layout is:
+ *
+ *     offset  size  field
+ *          0     2  magic "SN"
+ *          2     1  format version (NAV_SNAPSHOT_VERSION)
+ *          3     1  flags (bit 0: iono valid, bit 1: L2C capability valid)
+ *          4     4  total length excluding the CRC
+ *          8     2  number of ephemeris records
+ *         10     2  number of almanac records
+ *         12     4  GPS L2C capability bitmask
+ *         16    64  ionospheric parameters (only if iono valid)
+ *          -     -  ephemeris records
+ *          -     -  almanac records
+ *          -     3  CRC-24Q of all preceding bytes
+ *
+ * Each record starts with the signal identifier, which determines which
+ * constellation specific parameter set follows.
+ * \{ */
+
+#define NAV_SNAPSHOT_MAGIC_0 'S'
+#define NAV_SNAPSHOT_MAGIC_1 'N'
+
+#define NAV_SNAPSHOT_FLAG_IONO 0x01
+#define NAV_SNAPSHOT_FLAG_L2C  0x02
+
+/** Size of the fields common to every ephemeris and almanac record. */
+#define RECORD_COMMON_LEN 23
+#define IONO_LEN (8 * 8)
+
+/** Cursor used to serialize and deserialize a snapshot buffer. */
+typedef struct {
+  u8 *buff;       /**< Buffer to write, NULL when reading. */
+  const u8 *src;  /**< Buffer to read. */
+  u32 len;        /**< Length of the buffer. */
+  u32 pos;        /**< Current byte offset. */
+  bool overrun;   /**< A read went past the end of the buffer. */
+} cursor_t;
+
+static void put_u8(cursor_t *c, u8 v)
+{
+  c->buff[c->pos++] = v;
+}
+
+static void put_u16(cursor_t *c, u16 v)
+{
+  put_u8(c, v & 0xFF);
+  put_u8(c, v >> 8);
+}
+
+static void put_u32(cursor_t *c, u32 v)
+{
+  put_u16(c, v & 0xFFFF);
+  put_u16(c, v >> 16);
+}
+
+static void put_double(cursor_t *c, double v)
+{
+  u64 x;
+  memcpy(&x, &v, sizeof(x));
+  put_u32(c, x & 0xFFFFFFFF);
+  put_u32(c, x >> 32);
+}
+
+static void put_float(cursor_t *c, float v)
+{
+  u32 x;
+  memcpy(&x, &v, sizeof(x));
+  put_u32(c, x);
+}
+
+static void put_doubles(cursor_t *c, const double *v, u8 n)
+{
+  for (u8 i = 0; i < n; i++) {
+    put_double(c, v[i]);
+  }
+}
+
+static u8 get_u8(cursor_t *c)
+{
+  if (c->pos >= c->len) {
+    c->overrun = true;
+    return 0;
+  }
+  return c->src[c->pos++];
+}
+
+static u16 get_u16(cursor_t *c)
+{
+  u16 lo = get_u8(c);
+  return lo | (u16)get_u8(c) << 8;
+}
+
+static u32 get_u32(cursor_t *c)
+{
+  u32 lo = get_u16(c);
+  return lo | (u32)get_u16(c) << 16;
+}
+
+static double get_double(cursor_t *c)
+{
+  u64 x = get_u32(c);
+  x |= (u64)get_u32(c) << 32;
+  double v;
+  memcpy(&v, &x, sizeof(v));
+  return v;
+}
+
+static float get_float(cursor_t *c)
+{
+  u32 x = get_u32(c);
+  float v;
+  memcpy(&v, &x, sizeof(v));
+  return v;
+}
+
+static void get_doubles(cursor_t *c, double *v, u8 n)
+{
+  for (u8 i = 0; i < n; i++) {
+    v[i] = get_double(c);
+  }
+}
+
+/** Length of the constellation specific part of an ephemeris record. */
+static u32 ephemeris_payload_len(constellation_t c)
+{
+  switch (c) {
+  case CONSTELLATION_GPS:  return 19 * 8 + 10 + 2 + 1;
+  case CONSTELLATION_SBAS: return 11 * 8;
+  case CONSTELLATION_GLO:  return 11 * 8;
+  default:                 return 0;
+  }
+}
+
+/** Length of the constellation specific part of an almanac record. */
+static u32 almanac_payload_len(constellation_t c)
+{
+  switch (c) {
+  case CONSTELLATION_GPS:  return 9 * 8;
+  case CONSTELLATION_SBAS: return 9 * 8;
+  case CONSTELLATION_GLO:  return 7 * 8;
+  default:                 return 0;
+  }
+}
+
+static void put_record_common(cursor_t *c, gnss_signal_t sid,
+                              const gps_time_t *t, float ura,
+                              u32 fit_interval, u8 valid, u8 healthy)
+{
+  put_u16(c, sid.sat);
+  put_u8(c, (u8)sid.code);
+  put_double(c, t->tow);
+  put_u16(c, (u16)t->wn);
+  put_float(c, ura);
+  put_u32(c, fit_interval);
+  put_u8(c, valid);
+  put_u8(c, healthy);
+}
+
+static void get_record_common(cursor_t *c, gnss_signal_t *sid,
+                              gps_time_t *t, float *ura,
+                              u32 *fit_interval, u8 *valid, u8 *healthy)
+{
+  sid->sat = get_u16(c);
+  sid->code = (code_t)get_u8(c);
+  t->tow = get_double(c);
+  t->wn = (s16)get_u16(c);
+  *ura = get_float(c);
+  *fit_interval = get_u32(c);
+  *valid = get_u8(c);
+  *healthy = get_u8(c);
+}
+
+static void put_ephemeris(cursor_t *c, const ephemeris_t *e)
+{
+  put_record_common(c, e->sid, &e->toe, e->ura, e->fit_interval,
+                    e->valid, e->healthy);
+
+  switch (sid_to_constellation(e->sid)) {
+  case CONSTELLATION_GPS: {
+    const ephemeris_kepler_t *k = &e->kepler;
+    const double v[19] = {
+      k->tgd, k->crc, k->crs, k->cuc, k->cus, k->cic, k->cis, k->dn, k->m0,
+      k->ecc, k->sqrta, k->omega0, k->omegadot, k->w, k->inc, k->inc_dot,
+      k->af0, k->af1, k->af2
+    };
+    put_doubles(c, v, 19);
+    put_double(c, k->toc.tow);
+    put_u16(c, (u16)k->toc.wn);
+    put_u16(c, k->iodc);
+    put_u8(c, k->iode);
+    break;
+  }
+  case CONSTELLATION_SBAS:
+    put_doubles(c, e->xyz.pos, 3);
+    put_doubles(c, e->xyz.vel, 3);
+    put_doubles(c, e->xyz.acc, 3);
+    put_double(c, e->xyz.a_gf0);
+    put_double(c, e->xyz.a_gf1);
+    break;
+  case CONSTELLATION_GLO:
+    put_double(c, e->glo.gamma);
+    put_double(c, e->glo.tau);
+    put_doubles(c, e->glo.pos, 3);
+    put_doubles(c, e->glo.vel, 3);
+    put_doubles(c, e->glo.acc, 3);
+    break;
+  default:
+    assert(!"Unsupported constellation");
+    break;
+  }
+}
+
+static bool get_ephemeris(cursor_t *c, ephemeris_t *e)
+{
+  memset(e, 0, sizeof(ephemeris_t));
+  get_record_common(c, &e->sid, &e->toe, &e->ura, &e->fit_interval,
+                    &e->valid, &e->healthy);
+  if (!sid_valid(e->sid)) {
+    return false;
+  }
+
+  switch (sid_to_constellation(e->sid)) {
+  case CONSTELLATION_GPS: {
+    ephemeris_kepler_t *k = &e->kepler;
+    double v[19];
+    get_doubles(c, v, 19);
+    k->tgd = v[0];      k->crc = v[1];      k->crs = v[2];
+    k->cuc = v[3];      k->cus = v[4];      k->cic = v[5];
+    k->cis = v[6];      k->dn = v[7];       k->m0 = v[8];
+    k->ecc = v[9];      k->sqrta = v[10];   k->omega0 = v[11];
+    k->omegadot = v[12]; k->w = v[13];      k->inc = v[14];
+    k->inc_dot = v[15]; k->af0 = v[16];     k->af1 = v[17];
+    k->af2 = v[18];
+    k->toc.tow = get_double(c);
+    k->toc.wn = (s16)get_u16(c);
+    k->iodc = get_u16(c);
+    k->iode = get_u8(c);
+    break;
+  }
+  case CONSTELLATION_SBAS:
+    get_doubles(c, e->xyz.pos, 3);
+    get_doubles(c, e->xyz.vel, 3);
+    get_doubles(c, e->xyz.acc, 3);
+    e->xyz.a_gf0 = get_double(c);
+    e->xyz.a_gf1 = get_double(c);
+    break;
+  case CONSTELLATION_GLO:
+    e->glo.gamma = get_double(c);
+    e->glo.tau = get_double(c);
+    get_doubles(c, e->glo.pos, 3);
+    get_doubles(c, e->glo.vel, 3);
+    get_doubles(c, e->glo.acc, 3);
+    break;
+  default:
+    return false;
+  }
+
+  return !c->overrun;
+}
+
+static void put_almanac(cursor_t *c, const almanac_t *a)
+{
+  put_record_common(c, a->sid, &a->toa, a->ura, a->fit_interval,
+                    a->valid, a->healthy);
+
+  switch (sid_to_constellation(a->sid)) {
+  case CONSTELLATION_GPS: {
+    const almanac_kepler_t *k = &a->kepler;
+    const double v[9] = {
+      k->m0, k->ecc, k->sqrta, k->omega0, k->omegadot, k->w, k->inc,
+      k->af0, k->af1
+    };
+    put_doubles(c, v, 9);
+    break;
+  }
+  case CONSTELLATION_SBAS:
+    put_doubles(c, a->xyz.pos, 3);
+    put_doubles(c, a->xyz.vel, 3);
+    put_doubles(c, a->xyz.acc, 3);
+    break;
+  case CONSTELLATION_GLO: {
+    const almanac_glo_t *g = &a->glo;
+    const double v[7] = {
+      g->lambda, g->t_lambda, g->i, g->t, g->t_dot, g->epsilon, g->omega
+    };
+    put_doubles(c, v, 7);
+    break;
+  }
+  default:
+    assert(!"Unsupported constellation");
+    break;
+  }
+}
+
+static bool get_almanac(cursor_t *c, almanac_t *a)
+{
+  memset(a, 0, sizeof(almanac_t));
+  get_record_common(c, &a->sid, &a->toa, &a->ura, &a->fit_interval,
+                    &a->valid, &a->healthy);
+  if (!sid_valid(a->sid)) {
+    return false;
+  }
+
+  switch (sid_to_constellation(a->sid)) {
+  case CONSTELLATION_GPS: {
+    almanac_kepler_t *k = &a->kepler;
+    double v[9];
+    get_doubles(c, v, 9);
+    k->m0 = v[0];       k->ecc = v[1];      k->sqrta = v[2];
+    k->omega0 = v[3];   k->omegadot = v[4]; k->w = v[5];
+    k->inc = v[6];      k->af0 = v[7];      k->af1 = v[8];
+    break;
+  }
+  case CONSTELLATION_SBAS:
+    get_doubles(c, a->xyz.pos, 3);
+    get_doubles(c, a->xyz.vel, 3);
+    get_doubles(c, a->xyz.acc, 3);
+    break;
+  case CONSTELLATION_GLO: {
+    almanac_glo_t *g = &a->glo;
+    double v[7];
+    get_doubles(c, v, 7);
+    g->lambda = v[0];   g->t_lambda = v[1]; g->i = v[2];
+    g->t = v[3];        g->t_dot = v[4];    g->epsilon = v[5];
+    g->omega = v[6];
+    break;
+  }
+  default:
+    return false;
+  }
+
+  return !c->overrun;
+}
+
+/** Number of ephemerides in the state that will be written to a snapshot. */
+static u16 n_saved_ephemerides(const nav_snapshot_t *s)
+{
+  u16 n = 0;
+  for (u16 i = 0; i < s->n_ephemerides; i++) {
+    if (sid_valid(s->ephemerides[i].sid)) {
+      n++;
+    }
+  }
+  return n;
+}
+
+/** Number of almanacs in the state that will be written to a snapshot. */
+static u16 n_saved_almanacs(const nav_snapshot_t *s)
+{
+  u16 n = 0;
+  for (u16 i = 0; i < s->n_almanacs; i++) {
+    if (sid_valid(s->almanacs[i].sid)) {
+      n++;
+    }
+  }
+  return n;
+}
+
+/** Calculate the encoded size of a navigation data snapshot.
+ *
+ * \param s Navigation data state
+ * \return Number of bytes required by nav_snapshot_save(), including the CRC
+ */
+u32 nav_snapshot_size(const nav_snapshot_t *s)
+{
+  assert(s != NULL);
+
+  u32 len = NAV_SNAPSHOT_HEADER_LEN + NAV_SNAPSHOT_CRC_LEN;
+  if (s->iono_valid) {
+    len += IONO_LEN;
+  }
+  for (u16 i = 0; i < s->n_ephemerides; i++) {
+    if (sid_valid(s->ephemerides[i].sid)) {
+      len += RECORD_COMMON_LEN +
+             ephemeris_payload_len(sid_to_constellation(s->ephemerides[i].sid));
+    }
+  }
+  for (u16 i = 0; i < s->n_almanacs; i++) {
+    if (sid_valid(s->almanacs[i].sid)) {
+      len += RECORD_COMMON_LEN +
+             almanac_payload_len(sid_to_constellation(s->almanacs[i].sid));
+    }
+  }
+  return len;
+}
+
+/** Save the navigation data state into a snapshot buffer.
+ *
+ * Records with an invalid signal identifier are skipped. No validity
+ * filtering based on age is performed here, that is done on load when the
+ * current time is known.
+ *
+ * \param s Navigation data state to save
+ * \param buff Buffer to write the snapshot into
+ * \param buff_len Length of `buff` in bytes
+ * \return Number of bytes written on success,
+ *         `NAV_SNAPSHOT_ERR_SHORT` if `buff` is too small
+ */
+s32 nav_snapshot_save(const nav_snapshot_t *s, u8 *buff, u32 buff_len)
+{
+  assert(s != NULL);
+  assert(buff != NULL);
+
+  u32 len = nav_snapshot_size(s);
+  if (len > buff_len) {
+    return NAV_SNAPSHOT_ERR_SHORT;
+  }
+
+  cursor_t c = {.buff = buff, .len = buff_len, .pos = 0};
+
+  put_u8(&c, NAV_SNAPSHOT_MAGIC_0);
+  put_u8(&c, NAV_SNAPSHOT_MAGIC_1);
+  put_u8(&c, NAV_SNAPSHOT_VERSION);
+  put_u8(&c, (s->iono_valid ? NAV_SNAPSHOT_FLAG_IONO : 0) |
+             (s->l2c_capability_valid ? NAV_SNAPSHOT_FLAG_L2C : 0));
+  put_u32(&c, len - NAV_SNAPSHOT_CRC_LEN);
+  put_u16(&c, n_saved_ephemerides(s));
+  put_u16(&c, n_saved_almanacs(s));
+  put_u32(&c, s->gps_l2c_sv_capability);
+
+  if (s->iono_valid) {
+    const ionosphere_t *i = &s->iono;
+    const double v[8] = {i->a0, i->a1, i->a2, i->a3,
+                         i->b0, i->b1, i->b2, i->b3};
+    put_doubles(&c, v, 8);
+  }
+
+  for (u16 i = 0; i < s->n_ephemerides; i++) {
+    if (sid_valid(s->ephemerides[i].sid)) {
+      put_ephemeris(&c, &s->ephemerides[i]);
+    }
+  }
+  for (u16 i = 0; i < s->n_almanacs; i++) {
+    if (sid_valid(s->almanacs[i].sid)) {
+      put_almanac(&c, &s->almanacs[i]);
+    }
+  }
+
+  assert(c.pos == len - NAV_SNAPSHOT_CRC_LEN);
+
+  /* CRC is stored big-endian, the same as in RTCM v3 frames. */
+  u32 crc = crc24q(buff, c.pos, 0);
+  put_u8(&c, (crc >> 16) & 0xFF);
+  put_u8(&c, (crc >> 8) & 0xFF);
+  put_u8(&c, crc & 0xFF);
+
+  return c.pos;
+}
+
+/** Load the navigation data state from a snapshot buffer.
+ *
+ * The snapshot integrity is checked with its CRC-24Q before anything is
+ * decoded. Ephemerides and almanacs which are flagged invalid are dropped and,
+ * if `t` is given, so are those that are not valid at time `t` (see
+ * ephemeris_valid() and almanac_valid()). If more records pass the filter than
+ * fit in the arrays of `s` the remainder are dropped.
+ *
+ * \param buff Buffer containing the snapshot
+ * \param buff_len Length of `buff` in bytes, may be longer than the snapshot
+ * \param t Current GPS time used to filter stale records, or NULL to keep all
+ *          records flagged valid
+ * \param s Navigation data state to restore into. `ephemerides` and
+ *          `almanacs` must point to arrays whose capacity is given in
+ *          `n_ephemerides` and `n_almanacs`.
+ * \return `NAV_SNAPSHOT_OK` on success, otherwise a negative
+ *         `NAV_SNAPSHOT_ERR_*` code in which case `s` is left untouched
+ */
+s8 nav_snapshot_load(const u8 *buff, u32 buff_len, const gps_time_t *t,
+                     nav_snapshot_t *s)
+{
+  assert(buff != NULL);
+  assert(s != NULL);
+
+  if (buff_len < NAV_SNAPSHOT_HEADER_LEN + NAV_SNAPSHOT_CRC_LEN) {
+    return NAV_SNAPSHOT_ERR_SHORT;
+  }
+
+  cursor_t c = {.src = buff, .len = buff_len, .pos = 0};
+
+  if (get_u8(&c) != NAV_SNAPSHOT_MAGIC_0 ||
+      get_u8(&c) != NAV_SNAPSHOT_MAGIC_1) {
+    return NAV_SNAPSHOT_ERR_MAGIC;
+  }
+  if (get_u8(&c) != NAV_SNAPSHOT_VERSION) {
+    return NAV_SNAPSHOT_ERR_VERSION;
+  }
+  u8 flags = get_u8(&c);
+  u32 len = get_u32(&c);
+  if (len < NAV_SNAPSHOT_HEADER_LEN ||
+      len > buff_len - NAV_SNAPSHOT_CRC_LEN) {
+    return NAV_SNAPSHOT_ERR_SHORT;
+  }
+
+  u32 crc = ((u32)buff[len] << 16) | ((u32)buff[len + 1] << 8) | buff[len + 2];
+  if (crc24q(buff, len, 0) != crc) {
+    return NAV_SNAPSHOT_ERR_CRC;
+  }
+
+  /* From here on only read within the CRC protected region. */
+  c.len = len;
+
+  u16 n_eph = get_u16(&c);
+  u16 n_alm = get_u16(&c);
+  u32 l2c = get_u32(&c);
+
+  ionosphere_t iono = {0};
+  if (flags & NAV_SNAPSHOT_FLAG_IONO) {
+    iono.a0 = get_double(&c);
+    iono.a1 = get_double(&c);
+    iono.a2 = get_double(&c);
+    iono.a3 = get_double(&c);
+    iono.b0 = get_double(&c);
+    iono.b1 = get_double(&c);
+    iono.b2 = get_double(&c);
+    iono.b3 = get_double(&c);
+  }
+
+  /* Decode in two passes so that a corrupt record leaves `s` untouched. */
+  u32 records_start = c.pos;
+  for (u8 pass = 0; pass < 2; pass++) {
+    u16 n_eph_kept = 0;
+    u16 n_alm_kept = 0;
+    c.pos = records_start;
+
+    for (u16 i = 0; i < n_eph; i++) {
+      ephemeris_t e;
+      if (!get_ephemeris(&c, &e)) {
+        return NAV_SNAPSHOT_ERR_CORRUPT;
+      }
+      if (!e.valid || (t != NULL && !ephemeris_valid(&e, t))) {
+        continue;
+      }
+      if (n_eph_kept >= s->n_ephemerides) {
+        if (pass == 1) {
+          log_warn_sid(e.sid, "snapshot: no room to restore ephemeris");
+        }
+        continue;
+      }
+      if (pass == 1) {
+        s->ephemerides[n_eph_kept] = e;
+      }
+      n_eph_kept++;
+    }
+
+    for (u16 i = 0; i < n_alm; i++) {
+      almanac_t a;
+      if (!get_almanac(&c, &a)) {
+        return NAV_SNAPSHOT_ERR_CORRUPT;
+      }
+      if (!a.valid || (t != NULL && !almanac_valid(&a, t))) {
+        continue;
+      }
+      if (n_alm_kept >= s->n_almanacs) {
+        if (pass == 1) {
+          log_warn_sid(a.sid, "snapshot: no room to restore almanac");
+        }
+        continue;
+      }
+      if (pass == 1) {
+        s->almanacs[n_alm_kept] = a;
+      }
+      n_alm_kept++;
+    }
+
+    if (c.pos != len) {
+      return NAV_SNAPSHOT_ERR_CORRUPT;
+    }
+
+    if (pass == 1) {
+      s->n_ephemerides = n_eph_kept;
+      s->n_almanacs = n_alm_kept;
+    }
+  }
+
+  s->iono = iono;
+  s->iono_valid = (flags & NAV_SNAPSHOT_FLAG_IONO) != 0;
+  s->gps_l2c_sv_capability = l2c;
+  s->l2c_capability_valid = (flags & NAV_SNAPSHOT_FLAG_L2C) != 0;
+
+  return NAV_SNAPSHOT_OK;
+}
+
+/** \} */
@@ -23,6 +23,7 @@
 #include <libswiftnav/coord_system.h>
 #include <libswiftnav/track.h>
 #include <libswiftnav/pvt.h>
+#include <libswiftnav/raim.h>
 
 static double vel_solve(double rx_vel[],
                         const u8 n_used,
@@ -93,6 +94,74 @@ static void compute_dops(const double H[4][4],
 }
 
 
+/** Compute the observed minus predicted pseudoranges and the geometry
+ * matrix for the current receiver state estimate.
+ *
+ * \param rx_state Receiver state estimate, see calc_PVT()
+ * \param n_used Number of measurements
+ * \param nav_meas Array of pointers to the measurements
+ * \param omp Output observed minus predicted pseudoranges [m]
+ * \param G Output geometry matrix, unit line of sight vectors and a clock
+ *          column of ones
+ */
+static void pvt_geometry(const double rx_state[],
+                         const u8 n_used,
+                         const navigation_measurement_t *nav_meas[n_used],
+                         double omp[n_used],
+                         double G[n_used][4])
+{
+  double tempv[3];
+  double los[3];
+  double xk_new[3];
+
+  for (u8 j = 0; j < n_used; j++) {
+    /* The satellite positions need to be corrected for Earth's rotation during
+     * the signal time of flight. */
+    /* TODO: Explain more about how this corrects for the Sagnac effect. */
+
+    /* Magnitude of range vector converted into an approximate time in secs. */
+    vector_subtract(3, rx_state, nav_meas[j]->sat_pos, tempv);
+    double tau = vector_norm(3, tempv) / GPS_C;
+
+    /* Rotation of Earth during time of flight in radians. */
+    double wEtau = GPS_OMEGAE_DOT * tau;
+
+    /* Apply linearised rotation about Z-axis which will adjust for the
+     * satellite's position at time t-tau. Note the rotation is through
+     * -wEtau because it is the ECEF frame that is rotating with the Earth and
+     * hence in the ECEF frame free falling bodies appear to rotate in the
+     * opposite direction.
+     *
+     * Making a small angle approximation here leads to less than 1mm error in
+     * the satellite position. */
+    xk_new[0] = nav_meas[j]->sat_pos[0] + wEtau * nav_meas[j]->sat_pos[1];
+    xk_new[1] = nav_meas[j]->sat_pos[1] - wEtau * nav_meas[j]->sat_pos[0];
+    xk_new[2] = nav_meas[j]->sat_pos[2];
+
+    /* Line of sight vector. */
+    vector_subtract(3, xk_new, rx_state, los);
+
+    /* Predicted range from satellite position and estimated Rx position. */
+    double p_pred = vector_norm(3, los);
+
+    /* omp means "observed minus predicted" range -- this is E, the
+     * prediction error vector (or innovation vector in Kalman/LS
+     * filtering terms).
+     */
+    omp[j] = nav_meas[j]->pseudorange - p_pred;
+
+    /* Construct a geometry matrix.  Each row (satellite) is
+     * independently normalized into a unit vector. */
+    for (u8 i=0; i<3; i++) {
+      G[j][i] = -los[i] / p_pred;
+    }
+
+    /* Set time covariance to 1. */
+    G[j][3] = 1;
+
+  } /* End of channel loop. */
+}
+
 /** This function is the key to GPS solution, so it's commented
  * liberally.  It does a single step of a multi-dimensional
  * Newton-Raphson solution for the variables X, Y, Z (in ECEF) plus
@@ -125,15 +194,16 @@ static void compute_dops(const double H[4][4],
  *     enough solution.  Solve for the receiver's velocity (with
  *     vel_solve) and do some bookkeeping to pass the solution back
  *     out.
+ *
+ * Steps 1 to 3 are done by pvt_geometry().
  */
 static double pvt_solve(double rx_state[],
                         const u8 n_used,
                         const navigation_measurement_t *nav_meas[n_used],
                         double omp[n_used],
-                        double H[4][4])
+                        double H[4][4],
+                        double X[4][n_used])
 {
-  double p_pred[n_used];
-
   /* G is a geometry matrix tells us how our pseudoranges relate to
    * our state estimates -- it's the Jacobian of d(p_i)/d(x_j) where
    * x_j are x, y, z, Δt. */
@@ -147,11 +217,7 @@ static double pvt_solve(double rx_state[],
 
   /* X is just H * Gtrans -- it maps our pseudoranges onto our
    * Jacobian update */
-  double X[4][n_used];
 
-  double tempv[3];
-  double los[3];
-  double xk_new[3];
   double tempd;
   double correction[4];
 
@@ -159,52 +225,7 @@ static double pvt_solve(double rx_state[],
     correction[j] = 0.0;
   }
 
-  for (u8 j = 0; j < n_used; j++) {
-    /* The satellite positions need to be corrected for Earth's rotation during
-     * the signal time of flight. */
-    /* TODO: Explain more about how this corrects for the Sagnac effect. */
-
-    /* Magnitude of range vector converted into an approximate time in secs. */
-    vector_subtract(3, rx_state, nav_meas[j]->sat_pos, tempv);
-    double tau = vector_norm(3, tempv) / GPS_C;
-
-    /* Rotation of Earth during time of flight in radians. */
-    double wEtau = GPS_OMEGAE_DOT * tau;
-
-    /* Apply linearised rotation about Z-axis which will adjust for the
-     * satellite's position at time t-tau. Note the rotation is through
-     * -wEtau because it is the ECEF frame that is rotating with the Earth and
-     * hence in the ECEF frame free falling bodies appear to rotate in the
-     * opposite direction.
-     *
-     * Making a small angle approximation here leads to less than 1mm error in
-     * the satellite position. */
-    xk_new[0] = nav_meas[j]->sat_pos[0] + wEtau * nav_meas[j]->sat_pos[1];
-    xk_new[1] = nav_meas[j]->sat_pos[1] - wEtau * nav_meas[j]->sat_pos[0];
-    xk_new[2] = nav_meas[j]->sat_pos[2];
-
-    /* Line of sight vector. */
-    vector_subtract(3, xk_new, rx_state, los);
-
-    /* Predicted range from satellite position and estimated Rx position. */
-    p_pred[j] = vector_norm(3, los);
-
-    /* omp means "observed minus predicted" range -- this is E, the
-     * prediction error vector (or innovation vector in Kalman/LS
-     * filtering terms).
-     */
-    omp[j] = nav_meas[j]->pseudorange - p_pred[j];
-
-    /* Construct a geometry matrix.  Each row (satellite) is
-     * independently normalized into a unit vector. */
-    for (u8 i=0; i<3; i++) {
-      G[j][i] = -los[i] / p_pred[j];
-    }
-
-    /* Set time covariance to 1. */
-    G[j][3] = 1;
-
-  } /* End of channel loop. */
+  pvt_geometry(rx_state, n_used, nav_meas, omp, G);
 
   /* Solve for position corrections using batch least-squares.  When
    * all-at-once least-squares estimation for a nonlinear problem is
@@ -303,7 +324,30 @@ static bool residual_test(u8 n_used, double omp[n_used],
   return norm < PVT_RESIDUAL_THRESHOLD;
 }
 
+/** Does the cached least squares map in the context apply to this set of
+ * measurements? */
+static bool pvt_ctx_matches(const pvt_ctx_t *ctx,
+                            const u8 n_used,
+                            const navigation_measurement_t *nav_meas[n_used])
+{
+  if (ctx->n_sids != n_used) {
+    return false;
+  }
+  for (u8 j = 0; j < n_used; j++) {
+    if (!sid_is_equal(ctx->sids[j], nav_meas[j]->sid)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 /** Iterates pvt_solve until it converges or PVT_MAX_ITERATIONS is reached.
+ *
+ * If a context is given and it was last used with the same set of signals,
+ * the first step reuses its least squares map X instead of forming and
+ * inverting G^T G. From a warm start the geometry has barely changed since
+ * the last epoch so this step lands close enough that the following full
+ * Newton-Raphson step converges. On convergence the context map is updated.
  *
  * \return
  *   - `0`: solution converged
@@ -315,17 +359,32 @@ static s8 pvt_iter(double rx_state[],
                    const u8 n_used,
                    const navigation_measurement_t *nav_meas[n_used],
                    double omp[n_used],
-                   double H[4][4])
+                   double H[4][4],
+                   pvt_ctx_t *ctx)
 {
+  double X[4][n_used];
+
   /* Reset state to zero */
   for(u8 i=4; i<8; i++) {
     rx_state[i] = 0;
   }
 
+  if (ctx && pvt_ctx_matches(ctx, n_used, nav_meas)) {
+    double G[n_used][4];
+    pvt_geometry(rx_state, n_used, nav_meas, omp, G);
+    for (u8 i=0; i<4; i++) {
+      double correction = 0;
+      for (u8 j=0; j<n_used; j++) {
+        correction += ctx->X[i][j] * omp[j];
+      }
+      rx_state[i] = (i < 3) ? rx_state[i] + correction : correction;
+    }
+  }
+
   u8 iters;
   /* Newton-Raphson iteration. */
   for (iters=0; iters<PVT_MAX_ITERATIONS; iters++) {
-    if (pvt_solve(rx_state, n_used, nav_meas, omp, H) > 0) {
+    if (pvt_solve(rx_state, n_used, nav_meas, omp, H, X) > 0) {
       break;
     }
   }
@@ -335,13 +394,31 @@ static s8 pvt_iter(double rx_state[],
     rx_state[0] = 0;
     rx_state[1] = 0;
     rx_state[2] = 0;
+    if (ctx) {
+      ctx->n_sids = 0;
+    }
     return -1;
   }
 
+  if (ctx) {
+    for (u8 j=0; j<n_used; j++) {
+      ctx->sids[j] = nav_meas[j]->sid;
+      for (u8 i=0; i<4; i++) {
+        ctx->X[i][j] = X[i][j];
+      }
+    }
+    ctx->n_sids = n_used;
+  }
+
   return 0;
 }
 
 /** See pvt_solve_raim() for parameter meanings.
+ *
+ * The residuals of every subset with one measurement excluded are derived
+ * from a single factorization of the full set geometry, linearized about the
+ * full set solution, by rank-one downdates (see raim_leave_one_out()). Only
+ * the accepted subset is then iterated to a full solution.
  *
  * \return
  *   - `1`: repaired solution, using one fewer observation
@@ -356,7 +433,6 @@ static s8 pvt_repair(double rx_state[],
                      double H[4][4],
                      gnss_signal_t *removed_sid)
 {
-  /* Try solving with n-1 navigation measurements. */
   s8 one_less = n_used - 1;
   s8 bad_sat = -1;
   u8 num_passing = 0;
@@ -366,46 +442,37 @@ static s8 pvt_repair(double rx_state[],
     nav_meas_subset[i] = &nav_meas[i];
   }
 
-  /* Carefully ordered.
-   * Permutes nav measurements so that each one is excluded from one test.
-   */
-  for (s8 drop = one_less; drop >= 0; drop--) {
-    /* Swaps the last omitted value with the one at index `drop'.
-     * On first iteration, does nothing (omits last nav_meas) */
-    const navigation_measurement_t *temp;
-    temp = nav_meas_subset[drop];
-    nav_meas_subset[drop] = nav_meas_subset[one_less];
-    nav_meas_subset[one_less] = temp;
-
-    s8 flag = pvt_iter(rx_state, n_used - 1, nav_meas_subset, omp, H);
-
-    if (flag == -1) {
-      /* Didn't converge. */
-      /* TODO(dsk) this may be unnecessary; use continue instead. */
-      return -1;
-    }
+  /* Linearize about the full set solution. */
+  double G[n_used][4];
+  pvt_geometry(rx_state, n_used, nav_meas_subset, omp, G);
+
+  double dx[4];
+  raim_subset_t subsets[n_used];
+  if (raim_leave_one_out(n_used, 4, &G[0][0], omp, dx, NULL, subsets) < 0) {
+    return -1;
+  }
 
-    if (residual_test(n_used-1, omp, rx_state, 0)) {
+  for (s8 drop = 0; drop < n_used; drop++) {
+    if (subsets[drop].valid &&
+        subsets[drop].residual < PVT_RESIDUAL_THRESHOLD) {
       num_passing++;
       bad_sat = drop;
     }
   }
 
-  if (num_passing == 1) {
-    /* Repair is possible by omitting bad_sat. Recalculate that solution. */
-    for (s8 i = 0; i < n_used; i++) {
-      nav_meas_subset[i] = &nav_meas[i];
-    }
-    nav_meas_subset[bad_sat] = nav_meas_subset[one_less];
-    s8 flag = pvt_iter(rx_state, n_used - 1, nav_meas_subset, omp, H);
-    assert(flag == 0);
-    if (removed_sid) {
-      *removed_sid = nav_meas[bad_sat].sid;
-    }
-    return 1;
-  } else {
+  if (num_passing != 1) {
+    return -1;
+  }
+
+  /* Repair is possible by omitting bad_sat. Calculate that solution. */
+  nav_meas_subset[bad_sat] = nav_meas_subset[one_less];
+  if (pvt_iter(rx_state, n_used - 1, nav_meas_subset, omp, H, NULL) < 0) {
     return -1;
   }
+  if (removed_sid) {
+    *removed_sid = nav_meas[bad_sat].sid;
+  }
+  return 1;
 }
 
 /** Calculate pvt solution, perform RAIM check, attempt to repair if needed.
@@ -418,6 +485,8 @@ static s8 pvt_repair(double rx_state[],
  * \param H see pvt_solve
  * \param removed_sid if not null and repair occurs, returns dropped sid
  * \param residual if not null, return double value of residual
+ * \param ctx if not null, used to reuse the least squares map of the
+ *            previous epoch, see pvt_iter()
  *
  * \return Non-negative values indicate success; see below
  *         For negative values, refer to pvt_err_msg().
@@ -442,7 +511,8 @@ static s8 pvt_solve_raim(double rx_state[],
                          bool disable_raim,
                          double H[4][4],
                          gnss_signal_t *removed_sid,
-                         double residual)
+                         double residual,
+                         pvt_ctx_t *ctx)
 {
   double omp[n_used];
 
@@ -453,7 +523,7 @@ static s8 pvt_solve_raim(double rx_state[],
     nav_meas_ptrs[i] = &nav_meas[i];
   }
 
-  s8 flag = pvt_iter(rx_state, n_used, nav_meas_ptrs, omp, H);
+  s8 flag = pvt_iter(rx_state, n_used, nav_meas_ptrs, omp, H, ctx);
 
   if (flag == -1) {
     /* Iteration didn't converge. Don't attempt to repair; too CPU intensive. */
@@ -491,39 +561,36 @@ const char *pvt_err_msg[] = {
   "Not enough measurements for solution (< 4)",
 };
 
-/** Try to calculate a single point gps solution
+/** Initialize a PVT solver context.
  *
- * \param n_used number of measurments
- * \param nav_meas array of measurements
- * \param disable_raim passing True will omit raim check/repair functionality
- * \param soln output solution struct
- * \param dops output dilution of precision information
- * \return Non-negative values indicate a valid solution.
- *   -  `2`: Solution converged but RAIM unavailable or disabled
- *   -  `1`: Solution converged, failed RAIM but was successfully repaired
- *   -  `0`: Solution converged and verified by RAIM
- *   - `-1`: PDOP is too high to yield a good solution.
- *   - `-2`: Altitude is unreasonable.
- *   - `-3`: Velocity is greater than or equal to 1000 kts.
- *   - `-4`: RAIM check failed and repair was unsuccessful
- *   - `-5`: RAIM check failed and repair was impossible (not enough measurements)
- *   - `-6`: pvt_iter didn't converge
- *   - `-7`: < 4 measurements
+ * \param ctx Context to initialize
  */
-s8 calc_PVT(const u8 n_used,
-            const navigation_measurement_t nav_meas[n_used],
-            bool disable_raim,
-            gnss_solution *soln,
-            dops_t *dops)
+void pvt_ctx_init(pvt_ctx_t *ctx)
 {
-  /* Initial state is the center of the Earth with zero velocity and zero
-   * clock error, if we have some a priori position estimate we could use
-   * that here to speed convergence a little on the first iteration.
-   *
-   *  rx_state format:
+  memset(ctx, 0, sizeof(pvt_ctx_t));
+}
+
+/** Try to calculate a single point gps solution, warm starting from the
+ * previous solution held in a context.
+ *
+ * The previous solution is propagated by its velocity to the time of the
+ * new measurements and used as the initial state estimate, so that usually
+ * only one or two iterations are needed. See calc_PVT() for the remaining
+ * parameters and return values.
+ *
+ * \param ctx Solver context for this receiver, see pvt_ctx_init()
+ */
+s8 calc_PVT_ctx(pvt_ctx_t *ctx,
+                const u8 n_used,
+                const navigation_measurement_t nav_meas[n_used],
+                bool disable_raim,
+                gnss_solution *soln,
+                dops_t *dops)
+{
+  /*  rx_state format:
    *    pos[3], clock error, vel[3], intermediate freq error
    */
-  static double rx_state[8];
+  double *rx_state = ctx->rx_state;
 
   double H[4][4];
 
@@ -534,9 +601,21 @@ s8 calc_PVT(const u8 n_used,
   soln->valid = 0;
   soln->n_used = n_used; // Keep track of number of working channels
 
+  /* Without a previous solution the initial state is wherever the last
+   * attempt left it, initially the center of the Earth. */
+  if (ctx->valid) {
+    double dt = gpsdifftime(&nav_meas[0].tot, &ctx->time);
+    if (fabs(dt) < PVT_WARM_START_MAX_DT) {
+      for (u8 i=0; i<3; i++) {
+        rx_state[i] += rx_state[4+i] * dt;
+      }
+    }
+  }
+  ctx->valid = false;
+
   gnss_signal_t removed_sid;
   s8 raim_flag = pvt_solve_raim(rx_state, n_used, nav_meas, disable_raim,
-                                H, &removed_sid, 0);
+                                H, &removed_sid, 0, ctx);
 
   if (raim_flag < 0) {
     /* Didn't converge or least squares integrity check failed. */
@@ -596,5 +675,166 @@ s8 calc_PVT(const u8 n_used,
 
   soln->valid = 1;
 
+  ctx->time = nav_meas[0].tot;
+  ctx->valid = true;
+
   return raim_flag;
 }
+
+/* Solve epochs `first` to `last - 1` of a batch in order, see
+ * calc_PVT_batch(). */
+static u32 solve_epochs(pvt_ctx_t *ctx, u32 first, u32 last,
+                        const pvt_epoch_t *epochs, bool disable_raim,
+                        gnss_solution *solns, dops_t *dops, s8 *codes)
+{
+  pvt_ctx_t cold;
+  u32 n_valid = 0;
+
+  for (u32 i = first; i < last; i++) {
+    if (!ctx) {
+      pvt_ctx_init(&cold);
+    }
+    s8 code = calc_PVT_ctx(ctx ? ctx : &cold, epochs[i].n_used,
+                           epochs[i].nav_meas, disable_raim,
+                           &solns[i], &dops[i]);
+    if (code < 0) {
+      memset(&solns[i], 0, sizeof(gnss_solution));
+    } else {
+      n_valid++;
+    }
+    if (codes) {
+      codes[i] = code;
+    }
+  }
+
+  return n_valid;
+}
+
+typedef struct {
+  const pvt_ctx_t *ctx;
+  pvt_ctx_t *chunk_ctxs;
+  u32 n_chunks;
+  u32 n_epochs;
+  const pvt_epoch_t *epochs;
+  bool disable_raim;
+  gnss_solution *solns;
+  dops_t *dops;
+  s8 *codes;
+  u32 *n_valid;
+} pvt_batch_job_t;
+
+/* Executor task solving chunk `k` of the batch. */
+static void solve_chunk(void *arg, u32 k)
+{
+  pvt_batch_job_t *job = arg;
+  pvt_ctx_t *ctx = NULL;
+  if (job->ctx) {
+    ctx = &job->chunk_ctxs[k];
+    *ctx = *job->ctx;
+  }
+  u32 first = (u64)job->n_epochs * k / job->n_chunks;
+  u32 last = (u64)job->n_epochs * (k + 1) / job->n_chunks;
+  job->n_valid[k] = solve_epochs(ctx, first, last, job->epochs,
+                                 job->disable_raim, job->solns, job->dops,
+                                 job->codes);
+}
+
+/** Calculate single point solutions for a batch of epochs.
+ *
+ * Intended for post-processing, where many epochs are available at once.
+ * The batch is split into one chunk of consecutive epochs per worker of
+ * `ex`, and each chunk is solved in order by one task. With a context each
+ * chunk starts from its own copy of `ctx` and each solution warm starts the
+ * next in the chunk, see calc_PVT_ctx(). On return `ctx` holds the state
+ * after the last epoch. Without a context each epoch is solved from a cold
+ * start, independently of the others.
+ *
+ * With a NULL executor the batch is solved inline as a single chunk, which
+ * chains the warm start through every epoch.
+ *
+ * \param ex Executor to run the chunks on, or NULL to solve sequentially
+ * \param ctx If not null, solver context chained through each chunk
+ * \param n_epochs Number of epochs
+ * \param epochs Measurements of each epoch
+ * \param disable_raim passing True will omit raim check/repair functionality
+ * \param solns Output solution of each epoch, zeroed if solving failed
+ * \param dops Output dilution of precision of each epoch
+ * \param codes If not null, output calc_PVT() return code of each epoch
+ * \return Number of epochs with a valid solution
+ */
+u32 calc_PVT_batch(const executor_t *ex,
+                   pvt_ctx_t *ctx,
+                   u32 n_epochs,
+                   const pvt_epoch_t epochs[n_epochs],
+                   bool disable_raim,
+                   gnss_solution solns[n_epochs],
+                   dops_t dops[n_epochs],
+                   s8 *codes)
+{
+  u32 n_chunks = (ex && ex->n_workers > 0) ? ex->n_workers : 1;
+  if (n_chunks > n_epochs && n_epochs > 0) {
+    n_chunks = n_epochs;
+  }
+  pvt_ctx_t chunk_ctxs[ctx ? n_chunks : 1];
+  u32 n_valid[n_chunks];
+  pvt_batch_job_t job = {
+    .ctx = ctx,
+    .chunk_ctxs = chunk_ctxs,
+    .n_chunks = n_chunks,
+    .n_epochs = n_epochs,
+    .epochs = epochs,
+    .disable_raim = disable_raim,
+    .solns = solns,
+    .dops = dops,
+    .codes = codes,
+    .n_valid = n_valid,
+  };
+
+  if (ex) {
+    ex->run(ex->ctx, n_chunks, &solve_chunk, &job);
+  } else {
+    solve_chunk(&job, 0);
+  }
+
+  if (ctx) {
+    *ctx = chunk_ctxs[n_chunks - 1];
+  }
+
+  u32 n_valid_total = 0;
+  for (u32 k = 0; k < n_chunks; k++) {
+    n_valid_total += n_valid[k];
+  }
+  return n_valid_total;
+}
+
+/** Try to calculate a single point gps solution
+ *
+ * This uses a single solver context shared by all callers, use
+ * calc_PVT_ctx() with a context per receiver when solving for more than one.
+ *
+ * \param n_used number of measurments
+ * \param nav_meas array of measurements
+ * \param disable_raim passing True will omit raim check/repair functionality
+ * \param soln output solution struct
+ * \param dops output dilution of precision information
+ * \return Non-negative values indicate a valid solution.
+ *   -  `2`: Solution converged but RAIM unavailable or disabled
+ *   -  `1`: Solution converged, failed RAIM but was successfully repaired
+ *   -  `0`: Solution converged and verified by RAIM
+ *   - `-1`: PDOP is too high to yield a good solution.
+ *   - `-2`: Altitude is unreasonable.
+ *   - `-3`: Velocity is greater than or equal to 1000 kts.
+ *   - `-4`: RAIM check failed and repair was unsuccessful
+ *   - `-5`: RAIM check failed and repair was impossible (not enough measurements)
+ *   - `-6`: pvt_iter didn't converge
+ *   - `-7`: < 4 measurements
+ */
+s8 calc_PVT(const u8 n_used,
+            const navigation_measurement_t nav_meas[n_used],
+            bool disable_raim,
+            gnss_solution *soln,
+            dops_t *dops)
+{
+  static pvt_ctx_t ctx;
+  return calc_PVT_ctx(&ctx, n_used, nav_meas, disable_raim, soln, dops);
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <assert.h>
+#include <stddef.h>
+
+#include <libswiftnav/linear_algebra.h>
+#include <libswiftnav/raim.h>
+
+/** \defgroup raim RAIM
+ * Receiver autonomous integrity monitoring for linear least squares.
+ *
+ * Fault detection by exclusion needs the least squares solution and
+ * residuals of every subset of the observations with one observation left
+ * out. Rather than solving each subset from scratch these are all derived
+ * from a single factorization of the normal matrix \f$ N = A^T A \f$.
+ * Removing row \f$ a_i \f$ is a rank-one downdate, by the Sherman-Morrison
+ * formula
+ * \f[
+ *   x_{(i)} = x - \frac{N^{-1} a_i r_i}{1 - h_i}, \qquad
+ *   \|r_{(i)}\|^2 = \|r\|^2 - \frac{r_i^2}{1 - h_i}
+ * \f]
+ * where \f$ r = y - A x \f$ are the full set residuals and
+ * \f$ h_i = a_i^T N^{-1} a_i \f$ is the leverage of observation \f$ i \f$.
+ * \{ */
+
+/** Leverage above which removing an observation makes the problem rank
+ * deficient. */
+#define RAIM_LEVERAGE_LIMIT (1 - 1e-9)
+
+/** Solve a linear least squares problem and all of its leave-one-out
+ * subsets.
+ *
+ * Solves \f$ \min \|y - A x\| \f$ and, for each observation \f$ i \f$, the
+ * same problem with row \f$ i \f$ of \f$ A \f$ and \f$ y \f$ removed, at a
+ * cost of \f$ O(n p^2) \f$ rather than \f$ O(n^2 p^2) \f$.
+ *
+ * \param n_obs Number of observations (rows of A)
+ * \param n_states Number of states (columns of A), at most `RAIM_MAX_STATES`
+ * \param A Observation matrix, `n_obs` by `n_states`, row major
+ * \param y Observation vector, length `n_obs`
+ * \param x Output full set solution, length `n_states`
+ * \param residual If not null, output norm of the full set residuals
+ * \param subsets Output solution with each observation removed,
+ *                length `n_obs`
+ * \return 0 on success,
+ *         -1 if the full set problem is under-determined or singular
+ */
+s8 raim_leave_one_out(u8 n_obs, u8 n_states, const double *A, const double *y,
+                      double *x, double *residual, raim_subset_t *subsets)
+{
+  assert(n_states > 0 && n_states <= RAIM_MAX_STATES);
+  assert(A != NULL);
+  assert(y != NULL);
+  assert(x != NULL);
+  assert(subsets != NULL);
+
+  const u8 p = n_states;
+
+  if (n_obs < p) {
+    return -1;
+  }
+
+  /* Normal matrix and right hand side. */
+  double N[p * p];
+  double Aty[p];
+  for (u8 j = 0; j < p; j++) {
+    Aty[j] = 0;
+    for (u8 k = j; k < p; k++) {
+      double s = 0;
+      for (u8 i = 0; i < n_obs; i++) {
+        s += A[i*p + j] * A[i*p + k];
+      }
+      N[j*p + k] = N[k*p + j] = s;
+    }
+    for (u8 i = 0; i < n_obs; i++) {
+      Aty[j] += A[i*p + j] * y[i];
+    }
+  }
+
+  double Ninv[p * p];
+  if (matrix_inverse(p, N, Ninv) < 0) {
+    return -1;
+  }
+
+  matrix_multiply(p, p, 1, Ninv, Aty, x);
+
+  /* Full set residuals. */
+  double r[n_obs];
+  double sse = 0;
+  for (u8 i = 0; i < n_obs; i++) {
+    r[i] = y[i] - vector_dot(p, &A[i*p], x);
+    sse += r[i] * r[i];
+  }
+  if (residual) {
+    *residual = sqrt(sse);
+  }
+
+  /* Rank-one downdate for each observation. */
+  for (u8 i = 0; i < n_obs; i++) {
+    raim_subset_t *s = &subsets[i];
+    double Na[p];
+    matrix_multiply(p, p, 1, Ninv, &A[i*p], Na);
+    double h = vector_dot(p, &A[i*p], Na);
+
+    if (n_obs <= p || h > RAIM_LEVERAGE_LIMIT) {
+      s->valid = false;
+      s->residual = INFINITY;
+      continue;
+    }
+
+    double k = r[i] / (1 - h);
+    for (u8 j = 0; j < p; j++) {
+      s->x[j] = x[j] - Na[j] * k;
+    }
+    s->residual = sqrt(MAX(sse - r[i] * k, 0));
+    s->valid = true;
+  }
+
+  return 0;
+}
+
+/** Compute the residual vector of a leave-one-out subset solution.
+ *
+ * \param n_obs Number of observations in the full set
+ * \param n_states Number of states
+ * \param A Full set observation matrix, see raim_leave_one_out()
+ * \param y Full set observation vector
+ * \param dropped Index of the removed observation
+ * \param subset Subset solution from raim_leave_one_out()
+ * \param resid Output residuals of the remaining observations, in order,
+ *              length `n_obs - 1`
+ */
+void raim_subset_residuals(u8 n_obs, u8 n_states, const double *A,
+                           const double *y, u8 dropped,
+                           const raim_subset_t *subset, double *resid)
+{
+  assert(dropped < n_obs);
+  u8 k = 0;
+  for (u8 i = 0; i < n_obs; i++) {
+    if (i != dropped) {
+      resid[k++] = y[i] - vector_dot(n_states, &A[i*n_states], subset->x);
+    }
+  }
+}
+
+/** \} */
@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2016 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <libswiftnav/small_matrix.h>
+
+/** \defgroup small_matrix Small Matrix Kernels
+ * Dimension specialized matrix kernels for the DGNSS filters.
+ *
+ * The DGNSS state and observation dimensions are small, at most
+ * `2 * MAX_CHANNELS - 5` for the ambiguity test residuals, where the call
+ * overhead of the reference BLAS is larger than the arithmetic. Each kernel
+ * is written once as an inlined body taking the dimension, and instantiated
+ * with a constant dimension for every n in [`SMALL_KERNELS_MIN_DIM`,
+ * `SMALL_KERNELS_MAX_DIM`] so that the compiler can fully unroll it. small_kernels() dispatches on n, falling back to a
+ * generic instantiation outside that range.
+ * \{ */
+
+/** Tolerance on the ratio of the R diagonals for the rank of a least squares
+ * problem, as the `rcond` used with DGELSY in baseline.c. */
+#define SMALL_LESQ_RCOND 1e-12
+
+#define SMALL_INLINE static inline __attribute__((always_inline))
+
+SMALL_INLINE void trmv_unit_upper_body(u32 n, const double *U, double *x)
+{
+  for (u32 i = 0; i < n; i++) {
+    double s = x[i];
+    for (u32 j = i + 1; j < n; j++) {
+      s += U[i*n + j] * x[j];
+    }
+    x[i] = s;
+  }
+}
+
+SMALL_INLINE void trmv_unit_upper_t_body(u32 n, const double *U, double *x)
+{
+  for (u32 j = n; j-- > 0;) {
+    double s = x[j];
+    for (u32 i = 0; i < j; i++) {
+      s += U[i*n + j] * x[i];
+    }
+    x[j] = s;
+  }
+}
+
+SMALL_INLINE void gemv_body(u32 m, u32 n, const double *A, const double *x,
+                            double *y)
+{
+  for (u32 i = 0; i < m; i++) {
+    double s = 0;
+    for (u32 j = 0; j < n; j++) {
+      s += A[i*n + j] * x[j];
+    }
+    y[i] = s;
+  }
+}
+
+SMALL_INLINE void symv_body(u32 n, const double *S, const double *x,
+                            double *y)
+{
+  for (u32 i = 0; i < n; i++) {
+    double s = 0;
+    for (u32 j = 0; j < i; j++) {
+      s += S[j*n + i] * x[j];
+    }
+    for (u32 j = i; j < n; j++) {
+      s += S[i*n + j] * x[j];
+    }
+    y[i] = s;
+  }
+}
+
+SMALL_INLINE s8 cholesky_body(u32 n, double *A)
+{
+  for (u32 j = 0; j < n; j++) {
+    double s = A[j*n + j];
+    for (u32 k = 0; k < j; k++) {
+      s -= A[j*n + k] * A[j*n + k];
+    }
+    if (!(s > 0)) {
+      return -1;
+    }
+    double l = sqrt(s);
+    A[j*n + j] = l;
+    for (u32 i = j + 1; i < n; i++) {
+      double t = A[i*n + j];
+      for (u32 k = 0; k < j; k++) {
+        t -= A[i*n + k] * A[j*n + k];
+      }
+      A[i*n + j] = t / l;
+      A[j*n + i] = 0;
+    }
+  }
+  return 0;
+}
+
+/* See matrix_udu(). */
+SMALL_INLINE void udu_body(u32 n, double *M, double *U, double *D)
+{
+  for (u32 i = 0; i < n; i++) {
+    for (u32 j = 0; j < n; j++) {
+      U[i*n + j] = (i == j) ? 1 : 0;
+      if (j < i) {
+        M[i*n + j] = 0;
+      }
+    }
+  }
+
+  for (u32 j = n; j >= 2; j--) {
+    D[j-1] = MAX(0, M[(j-1)*n + j-1]);
+    double alpha = D[j-1] > 0 ? 1.0 / D[j-1] : 0.0;
+    for (u32 k = 1; k < j; k++) {
+      double beta = M[(k-1)*n + j-1];
+      U[(k-1)*n + j-1] = alpha * beta;
+      for (u32 kk = 0; kk < k; kk++) {
+        M[kk*n + k-1] -= beta * U[kk*n + j-1];
+      }
+    }
+  }
+  D[0] = MAX(0, M[0]);
+}
+
+/* Householder QR of the n by 3 matrix, then back substitution. */
+SMALL_INLINE s8 lesq3_body(u32 n, const double *A, const double *y,
+                           double x[3])
+{
+  if (n < 3) {
+    return -1;
+  }
+
+  double R[n * 3];
+  double b[n];
+  double diag[3];
+  memcpy(R, A, sizeof(R));
+  memcpy(b, y, sizeof(b));
+
+  for (u32 k = 0; k < 3; k++) {
+    double norm2 = 0;
+    for (u32 i = k; i < n; i++) {
+      norm2 += R[i*3 + k] * R[i*3 + k];
+    }
+    double norm = sqrt(norm2);
+    if (norm == 0 || (k > 0 && norm <= SMALL_LESQ_RCOND * fabs(diag[0]))) {
+      return -1;
+    }
+    diag[k] = R[k*3 + k] > 0 ? -norm : norm;
+
+    /* Householder vector in place of column k. */
+    R[k*3 + k] -= diag[k];
+    double vtv = 0;
+    for (u32 i = k; i < n; i++) {
+      vtv += R[i*3 + k] * R[i*3 + k];
+    }
+
+    for (u32 j = k + 1; j < 3; j++) {
+      double s = 0;
+      for (u32 i = k; i < n; i++) {
+        s += R[i*3 + k] * R[i*3 + j];
+      }
+      s *= 2 / vtv;
+      for (u32 i = k; i < n; i++) {
+        R[i*3 + j] -= s * R[i*3 + k];
+      }
+    }
+    double s = 0;
+    for (u32 i = k; i < n; i++) {
+      s += R[i*3 + k] * b[i];
+    }
+    s *= 2 / vtv;
+    for (u32 i = k; i < n; i++) {
+      b[i] -= s * R[i*3 + k];
+    }
+  }
+
+  x[2] = b[2] / diag[2];
+  x[1] = (b[1] - R[1*3 + 2] * x[2]) / diag[1];
+  x[0] = (b[0] - R[0*3 + 1] * x[1] - R[0*3 + 2] * x[2]) / diag[0];
+  return 0;
+}
+
+/** Instantiates the kernels for dimension `N`, `N` 0 for the generic set. */
+#define SMALL_KERNELS(N)                                                    \
+  static void trmv_unit_upper_##N(u32 n, const double *U, double *x)       \
+  {                                                                         \
+    assert(N == 0 || n == N);                                               \
+    trmv_unit_upper_body(N ? N : n, U, x);                                  \
+  }                                                                         \
+  static void trmv_unit_upper_t_##N(u32 n, const double *U, double *x)     \
+  {                                                                         \
+    assert(N == 0 || n == N);                                               \
+    trmv_unit_upper_t_body(N ? N : n, U, x);                                \
+  }                                                                         \
+  static void gemv_##N(u32 m, u32 n, const double *A, const double *x,     \
+                       double *y)                                           \
+  {                                                                         \
+    assert(N == 0 || n == N);                                               \
+    gemv_body(m, N ? N : n, A, x, y);                                       \
+  }                                                                         \
+  static void symv_##N(u32 n, const double *S, const double *x, double *y) \
+  {                                                                         \
+    assert(N == 0 || n == N);                                               \
+    symv_body(N ? N : n, S, x, y);                                          \
+  }                                                                         \
+  static s8 cholesky_##N(u32 n, double *A)                                  \
+  {                                                                         \
+    assert(N == 0 || n == N);                                               \
+    return cholesky_body(N ? N : n, A);                                     \
+  }                                                                         \
+  static void udu_##N(u32 n, double *M, double *U, double *D)               \
+  {                                                                         \
+    assert(N == 0 || n == N);                                               \
+    udu_body(N ? N : n, M, U, D);                                           \
+  }                                                                         \
+  static s8 lesq3_##N(u32 n, const double *A, const double *y, double x[3]) \
+  {                                                                         \
+    assert(N == 0 || n == N);                                               \
+    return lesq3_body(N ? N : n, A, y, x);                                  \
+  }
+
+#define SMALL_KERNELS_ENTRY(N)                                        \
+  { N, trmv_unit_upper_##N, trmv_unit_upper_t_##N, gemv_##N, symv_##N, \
+    cholesky_##N, udu_##N, lesq3_##N }
+
+SMALL_KERNELS(0)
+SMALL_KERNELS(3)
+#if SMALL_KERNELS_MAX_DIM >= 4
+SMALL_KERNELS(4)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 5
+SMALL_KERNELS(5)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 6
+SMALL_KERNELS(6)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 7
+SMALL_KERNELS(7)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 8
+SMALL_KERNELS(8)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 9
+SMALL_KERNELS(9)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 10
+SMALL_KERNELS(10)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 11
+SMALL_KERNELS(11)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 12
+SMALL_KERNELS(12)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 13
+SMALL_KERNELS(13)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 14
+SMALL_KERNELS(14)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 15
+SMALL_KERNELS(15)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 16
+SMALL_KERNELS(16)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 17
+SMALL_KERNELS(17)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 18
+SMALL_KERNELS(18)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 19
+SMALL_KERNELS(19)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 20
+SMALL_KERNELS(20)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 21
+SMALL_KERNELS(21)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 22
+SMALL_KERNELS(22)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 23
+SMALL_KERNELS(23)
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 24
+SMALL_KERNELS(24)
+#endif
+
+#if SMALL_KERNELS_CAP_DIM > 24
+#error "Kernels are only instantiated up to dimension 24"
+#endif
+
+static const small_kernels_t small_kernels_generic = SMALL_KERNELS_ENTRY(0);
+
+/* The dimensions up to SMALL_KERNELS_MAX_DIM, from the configured
+ * MAX_CHANNELS. */
+static const small_kernels_t
+small_kernels_fixed[SMALL_KERNELS_MAX_DIM - SMALL_KERNELS_MIN_DIM + 1] = {
+  SMALL_KERNELS_ENTRY(3),
+#if SMALL_KERNELS_MAX_DIM >= 4
+  SMALL_KERNELS_ENTRY(4),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 5
+  SMALL_KERNELS_ENTRY(5),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 6
+  SMALL_KERNELS_ENTRY(6),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 7
+  SMALL_KERNELS_ENTRY(7),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 8
+  SMALL_KERNELS_ENTRY(8),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 9
+  SMALL_KERNELS_ENTRY(9),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 10
+  SMALL_KERNELS_ENTRY(10),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 11
+  SMALL_KERNELS_ENTRY(11),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 12
+  SMALL_KERNELS_ENTRY(12),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 13
+  SMALL_KERNELS_ENTRY(13),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 14
+  SMALL_KERNELS_ENTRY(14),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 15
+  SMALL_KERNELS_ENTRY(15),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 16
+  SMALL_KERNELS_ENTRY(16),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 17
+  SMALL_KERNELS_ENTRY(17),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 18
+  SMALL_KERNELS_ENTRY(18),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 19
+  SMALL_KERNELS_ENTRY(19),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 20
+  SMALL_KERNELS_ENTRY(20),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 21
+  SMALL_KERNELS_ENTRY(21),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 22
+  SMALL_KERNELS_ENTRY(22),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 23
+  SMALL_KERNELS_ENTRY(23),
+#endif
+#if SMALL_KERNELS_MAX_DIM >= 24
+  SMALL_KERNELS_ENTRY(24),
+#endif
+};
+
+/** Get the matrix kernels for dimension `n`.
+ *
+ * \param n The dimension, the size of the square matrices and the number of
+ *          columns of the GEMV matrix and rows of the least squares matrix.
+ * \return The kernels specialized for `n`, or the generic kernels if `n` is
+ *         outside [`SMALL_KERNELS_MIN_DIM`, `SMALL_KERNELS_MAX_DIM`].
+ */
+const small_kernels_t *small_kernels(u32 n)
+{
+  if (n < SMALL_KERNELS_MIN_DIM || n > SMALL_KERNELS_MAX_DIM) {
+    return &small_kernels_generic;
+  }
+  return &small_kernels_fixed[n - SMALL_KERNELS_MIN_DIM];
+}
+
+/** \} */
@@ -9,7 +9,7 @@
 
 #include "check_utils.h"
 
-/* Need static method assign_state_rebase_mtx */
+/* Need static methods */
 #include "amb_kf.c"
 
 START_TEST(test_lsq)
@@ -86,7 +86,8 @@ START_TEST(test_sos_innov)
   matrix_eye(2, kf.decor_obs_mtx);
   kf.decor_obs_cov[0] = 1;
   kf.decor_obs_cov[1] = 1;
-  matrix_eye(2, kf.state_cov_U);
+  /* Packed U = I. */
+  memset(kf.state_cov_U, 0, sizeof(kf.state_cov_U));
   kf.state_cov_D[0] = 2;
   kf.state_cov_D[1] = 3;
   kf.state_mean[0] = 1;
@@ -104,8 +105,8 @@ START_TEST(test_sos_innov)
   fail_unless(within_epsilon(get_sos_innov(&kf, obs), 1.0f/3 + 4.0f/4));
   /* Test it with a singular matrix.
      kf.state_cov = {{1,1},{1,1}} */
-  matrix_eye(2, kf.state_cov_U);
-  kf.state_cov_U[1] = 1;
+  /* Packed U, U[0][1] = 1. */
+  kf.state_cov_U[0] = 1;
   kf.state_cov_D[0] = 0;
   kf.state_cov_D[1] = 1;
   memset(kf.decor_obs_cov, 0, 2*sizeof(double));
@@ -121,7 +122,8 @@ START_TEST(test_sos_innov_dims)
   nkf_t kf;
   kf.decor_obs_cov[0] = 1;
   kf.decor_obs_cov[1] = 1;
-  matrix_eye(2, kf.state_cov_U);
+  /* Packed U = I. */
+  memset(kf.state_cov_U, 0, sizeof(kf.state_cov_U));
   kf.state_cov_D[0] = 2;
   kf.state_cov_D[1] = 3;
   kf.state_mean[0] = -1;
@@ -160,7 +162,8 @@ START_TEST(test_outlier)
   matrix_eye(2, kf.decor_obs_mtx);
   kf.decor_obs_cov[0] = 1;
   kf.decor_obs_cov[1] = 1;
-  matrix_eye(2, kf.state_cov_U);
+  /* Packed U = I. */
+  memset(kf.state_cov_U, 0, sizeof(kf.state_cov_U));
   kf.state_cov_D[0] = 2;
   kf.state_cov_D[1] = 3;
   kf.state_mean[0] = 1;
@@ -228,6 +231,146 @@ START_TEST(test_kf_update_noop)
 }
 END_TEST
 
+START_TEST(test_incorporate_obs_sparse)
+{
+  /* Observations with leading zeros are incorporated the same as with the
+   * dense scalar updates. */
+  u8 dim = 7;
+  u8 obs_dim = 2 * dim - 3;
+  for (u32 t=0; t < 100; t++) {
+    nkf_t kf = {.state_dim = dim, .obs_dim = obs_dim};
+    double m[dim * dim];
+    double p[dim * dim];
+    arr_frand(dim * dim, -1, 1, m);
+    double mt[dim * dim];
+    matrix_transpose(dim, dim, m, mt);
+    matrix_multiply(dim, dim, dim, m, mt, p);
+    double U[dim * dim];
+    matrix_udu(dim, p, U, kf.state_cov_D);
+    nkf_pack_U(&kf, U);
+    arr_frand(dim, -10, 10, kf.state_mean);
+    arr_frand(obs_dim * dim, -1, 1, kf.decor_obs_mtx);
+    for (u8 i=0; i < obs_dim; i++) {
+      /* Row i has i - 3 leading zeros, as for the ambiguity rows. */
+      for (s32 j=0; j < (s32)i - 3 && j < dim; j++) {
+        kf.decor_obs_mtx[i*dim + j] = 0;
+      }
+      kf.decor_obs_cov[i] = frand(0.1, 1);
+    }
+    double obs[obs_dim];
+    arr_frand(obs_dim, -10, 10, obs);
+
+    nkf_t kf2 = kf;
+    incorporate_obs(&kf, obs);
+
+    double k_scalar;
+    outlier_check(&kf2, obs, &k_scalar);
+    for (u8 i=0; i < obs_dim; i++) {
+      double *h = &kf2.decor_obs_mtx[dim * i];
+      double f[dim];
+      double g[dim];
+      nkf_unpack_U(&kf2, U);
+      double alpha = compute_innovation_terms(dim, h, kf2.decor_obs_cov[i],
+                                              U, kf2.state_cov_D, f, g);
+      double innov = obs[i] - vector_dot(dim, h, kf2.state_mean);
+      update_kf_state(&kf2, kf2.decor_obs_cov[i], f, g, alpha, k_scalar,
+                      innov);
+    }
+
+    fail_unless(arr_within_epsilon(dim, kf.state_mean, kf2.state_mean));
+    fail_unless(arr_within_epsilon(dim, kf.state_cov_D, kf2.state_cov_D));
+    fail_unless(arr_within_epsilon(dim * (dim - 1) / 2, kf.state_cov_U,
+                                   kf2.state_cov_U));
+  }
+}
+END_TEST
+
+START_TEST(test_diffuse_state)
+{
+  /* The prediction update in UDU form matches adding to the covariance. */
+  u8 dim = 8;
+  nkf_t kf = {.state_dim = dim, .amb_drift_var = 0.3};
+  double M[dim * dim];
+  for (u8 i=0; i<dim; i++) {
+    for (u8 j=0; j<=i; j++) {
+      M[i*dim + j] = M[j*dim + i] = frand(-1, 1);
+    }
+  }
+  double cov[dim * dim];
+  matrix_multiply(dim, dim, dim, M, M, cov);
+  matrix_copy(dim, dim, cov, M);
+  double U[dim * dim];
+  matrix_udu(dim, M, U, kf.state_cov_D);
+  nkf_pack_U(&kf, U);
+
+  diffuse_state(&kf);
+  for (u8 i=0; i<dim; i++) {
+    cov[i*dim + i] += kf.amb_drift_var;
+  }
+  double cov_[dim * dim];
+  nkf_unpack_U(&kf, U);
+  matrix_reconstruct_udu(dim, U, kf.state_cov_D, cov_);
+  for (u32 i=0; i<dim*dim; i++) {
+    fail_unless(fabs(cov[i] - cov_[i]) < 1e-9);
+  }
+
+  /* Drift common to all channels, (I + 1 1^T) var. */
+  double c[dim + 1];
+  double V[(dim + 1) * dim];
+  memset(V, 0, sizeof(V));
+  for (u8 k=0; k<=dim; k++) {
+    c[k] = 0.1;
+    for (u8 i=0; i<dim; i++) {
+      V[k*dim + i] = (k == dim || k == i);
+    }
+  }
+  nkf_add_process_noise(&kf, dim + 1, c, V);
+  for (u8 i=0; i<dim; i++) {
+    for (u8 j=0; j<dim; j++) {
+      cov[i*dim + j] += 0.1 * (1 + (i == j));
+    }
+  }
+  nkf_unpack_U(&kf, U);
+  matrix_reconstruct_udu(dim, U, kf.state_cov_D, cov_);
+  for (u32 i=0; i<dim*dim; i++) {
+    fail_unless(fabs(cov[i] - cov_[i]) < 1e-9);
+  }
+}
+END_TEST
+
+START_TEST(test_decorrelate_packed)
+{
+  seed_rng();
+  for (u32 dim = 1; dim <= MAX_OBS_DIM; dim++) {
+    nkf_t kf = {.obs_dim = dim};
+    double U[dim * dim];
+    double x[dim];
+    double y[dim];
+    matrix_eye(dim, U);
+    for (u32 i=0; i < dim; i++) {
+      for (u32 j=i+1; j < dim; j++) {
+        U[i*dim + j] = frand(-1, 1);
+      }
+      /* Junk below the diagonal must not be stored. */
+      for (u32 j=0; j < i; j++) {
+        U[i*dim + j] = NAN;
+      }
+    }
+    arr_frand(dim, -1, 1, x);
+    pack_decor_mtx(&kf, U);
+    for (u32 i=0; i < dim; i++) {
+      y[i] = x[i];
+      for (u32 j=i+1; j < dim; j++) {
+        y[i] += U[i*dim + j] * x[j];
+      }
+    }
+    decorrelate(&kf, x);
+    fail_unless(arr_within_epsilon(dim, x, y),
+                "Packed decorrelation mismatch for dim %u", dim);
+  }
+}
+END_TEST
+
 START_TEST(test_kf_update)
 {
   /* Test that random full rank KFs coded the slow, but naive way match up with
@@ -263,17 +406,20 @@ START_TEST(test_kf_update)
     matrix_multiply(dim, dim, dim, m, mt, p);
     matrix_transpose(dim, dim, p, p2);
     fail_unless(arr_within_epsilon(dim * dim, p, p2));
-    matrix_udu(dim, p, kf.state_cov_U, kf.state_cov_D);
+    double U[dim * dim];
+    matrix_udu(dim, p, U, kf.state_cov_D);
+    nkf_pack_U(&kf, U);
     matrix_transpose(dim, dim, p2, p);
     memcpy(kf.state_mean, state_mean, dim * sizeof(double));
     /* Compute the factored KF update */
     double alpha = compute_innovation_terms(dim, h, R,
-                                     kf.state_cov_U, kf.state_cov_D,
+                                     U, kf.state_cov_D,
                                      f, g);
     update_kf_state(&kf, R, f, g,
                      alpha, k_scalar,
                      innov);
-    matrix_reconstruct_udu(dim, kf.state_cov_U, kf.state_cov_D, p2);
+    nkf_unpack_U(&kf, U);
+    matrix_reconstruct_udu(dim, U, kf.state_cov_D, p2);
     /* Compute the simple KF update: */
     /* S = H * P * H' + R; */
     matrix_multiply(dim, dim, 1, p, h, ph);
@@ -299,8 +445,245 @@ START_TEST(test_kf_update)
 }
 END_TEST
 
-void assign_state_rebase_mtx(const u8 num_sats, const gnss_signal_t *old_prns,
-                             const gnss_signal_t *new_prns, double *rebase_mtx);
+/* Dense change of reference matrix, the reference for the structured
+ * rebase. REQUIRES num_sats > 1 */
+static void assign_state_rebase_mtx(const u8 num_sats, const gnss_signal_t *old_sids,
+                                    const gnss_signal_t *new_sids, double *rebase_mtx)
+{
+  assert(num_sats > 1);
+  u8 state_dim = num_sats - 1;
+
+  memset(rebase_mtx, 0, state_dim * state_dim * sizeof(double));
+  gnss_signal_t old_ref = old_sids[0];
+  gnss_signal_t new_ref = new_sids[0];
+
+  if (sid_is_equal(old_ref, new_ref)) {
+    /* No rebase needs to occur, return identity. */
+    matrix_eye(state_dim, rebase_mtx);
+    return;
+  }
+
+  s32 index_of_new_ref_in_old = find_index_of_signal(num_sats-1, new_ref, &old_sids[1]);
+  assert(index_of_new_ref_in_old != -1);
+  s32 index_of_old_ref_in_new = find_index_of_signal(num_sats-1, old_ref, &new_sids[1]);
+  assert(index_of_old_ref_in_new != -1);
+
+  for (u8 i=0; i<state_dim; i++) {
+    rebase_mtx[i*state_dim + index_of_new_ref_in_old] = -1;
+    if (i != (u8) index_of_old_ref_in_new) {
+      s32 index_of_this_sat_in_old_basis = find_index_of_signal(num_sats-1, new_sids[i+1], &old_sids[1]);
+      assert(index_of_this_sat_in_old_basis != -1);
+      rebase_mtx[i*state_dim + index_of_this_sat_in_old_basis] = 1;
+    }
+  }
+}
+
+static void random_udu(u32 n, double *U, double *D)
+{
+  matrix_eye(n, U);
+  for (u32 i=0; i<n; i++) {
+    for (u32 j=i+1; j<n; j++) {
+      U[i*n + j] = frand(-1, 1);
+    }
+    D[i] = frand(0.1, 10);
+  }
+}
+
+static void shuffle_sids(u32 n, gnss_signal_t *sids)
+{
+  for (u32 i=n; i-- > 1;) {
+    u32 j = rand() % (i + 1);
+    gnss_signal_t t = sids[i];
+    sids[i] = sids[j];
+    sids[j] = t;
+  }
+}
+
+START_TEST(test_rebase_covariance)
+{
+  seed_rng();
+  for (u32 t=0; t < 200; t++) {
+    u8 num_sats = 2 + rand() % (MAX_STATE_DIM - 1);
+    u8 dim = num_sats - 1;
+    gnss_signal_t old_sids[num_sats];
+    gnss_signal_t new_sids[num_sats];
+    for (u8 i=0; i<num_sats; i++) {
+      old_sids[i] = construct_sid(CODE_GPS_L1CA, i + 1);
+    }
+    shuffle_sids(num_sats, old_sids);
+    memcpy(new_sids, old_sids, sizeof(old_sids));
+    if (t % 2) {
+      /* Usual case, the references trade places. */
+      u8 r = 1 + rand() % dim;
+      new_sids[0] = old_sids[r];
+      new_sids[r] = old_sids[0];
+    } else {
+      shuffle_sids(num_sats, new_sids);
+    }
+
+    double U[dim * dim];
+    double D[dim];
+    double cov[dim * dim];
+    random_udu(dim, U, D);
+    matrix_reconstruct_udu(dim, U, D, cov);
+
+    double T[dim * dim];
+    double TS[dim * dim];
+    double Tt[dim * dim];
+    double expected[dim * dim];
+    assign_state_rebase_mtx(num_sats, old_sids, new_sids, T);
+    matrix_transpose(dim, dim, T, Tt);
+    matrix_multiply(dim, dim, dim, T, cov, TS);
+    matrix_multiply(dim, dim, dim, TS, Tt, expected);
+
+    double sigma[dim * dim];
+    memcpy(sigma, cov, sizeof(cov));
+    rebase_covariance_sigma(sigma, num_sats, old_sids, new_sids);
+    fail_unless(arr_within_epsilon(dim * dim, sigma, expected),
+                "rebase_covariance_sigma mismatch");
+
+    double packed[dim * (dim - 1) / 2 + 1];
+    pack_U(dim, U, dim, packed);
+    rebase_covariance_udu(packed, D, num_sats, old_sids, new_sids);
+    unpack_U(dim, packed, U, dim);
+    for (u8 i=0; i<dim; i++) {
+      fail_unless(D[i] >= 0, "D negative");
+      fail_unless(U[i*dim + i] == 1, "U diagonal element != 1");
+      for (u8 j=0; j<i; j++) {
+        fail_unless(U[i*dim + j] == 0, "U lower triangle element != 0");
+      }
+    }
+    matrix_reconstruct_udu(dim, U, D, cov);
+    fail_unless(arr_within_epsilon(dim * dim, cov, expected),
+                "rebase_covariance_udu mismatch");
+  }
+}
+END_TEST
+
+START_TEST(test_get_cov)
+{
+  seed_rng();
+  for (u32 t=0; t < 50; t++) {
+    u8 dim = 1 + rand() % MAX_STATE_DIM;
+    nkf_t kf;
+    kf.state_dim = dim;
+    double U[dim * dim];
+    random_udu(dim, U, kf.state_cov_D);
+    nkf_pack_U(&kf, U);
+    double expected[dim * dim];
+    double cov[dim * dim];
+    matrix_reconstruct_udu(dim, U, kf.state_cov_D, expected);
+    nkf_get_cov(&kf, cov);
+    fail_unless(arr_within_epsilon(dim * dim, cov, expected),
+                "nkf_get_cov mismatch");
+  }
+}
+END_TEST
+
+START_TEST(test_state_projection_bad_ndxs)
+{
+  /* Out of range or repeated indices are rejected with the filter left as
+   * it was. */
+  u8 big = 4;
+  nkf_t kf;
+  double U[big * big];
+  random_udu(big, U, kf.state_cov_D);
+  pack_U(big, U, big, kf.state_cov_U);
+  arr_frand(big, -10, 10, kf.state_mean);
+  nkf_t kf0 = kf;
+
+  u8 out_of_range[2] = {1, 4};
+  fail_unless(nkf_state_projection(&kf, big, 2, out_of_range) == -1);
+  u8 repeated[2] = {2, 2};
+  fail_unless(nkf_state_projection(&kf, big, 2, repeated) == -1);
+  u8 too_many[5] = {0, 1, 2, 3, 0};
+  fail_unless(nkf_state_projection(&kf, big, 5, too_many) == -1);
+  fail_unless(memcmp(&kf, &kf0, sizeof(kf)) == 0);
+
+  u8 valid[2] = {3, 1};
+  fail_unless(nkf_state_projection(&kf, big, 2, valid) == 0);
+}
+END_TEST
+
+START_TEST(test_state_projection_inclusion)
+{
+  seed_rng();
+  for (u32 t=0; t < 200; t++) {
+    u8 big = 2 + rand() % (MAX_STATE_DIM - 1);
+    u8 small = 1 + rand() % (big - 1);
+    /* Random choice and order of the small state's elements in the big. */
+    u8 ndxs[big];
+    for (u8 i=0; i<big; i++) {
+      ndxs[i] = i;
+    }
+    for (u8 i=big; i-- > 1;) {
+      u8 j = rand() % (i + 1);
+      u8 tmp = ndxs[i];
+      ndxs[i] = ndxs[j];
+      ndxs[j] = tmp;
+    }
+
+    nkf_t kf;
+    double cov[big * big];
+    double cov_[big * big];
+    double U[big * big];
+    random_udu(big, U, kf.state_cov_D);
+    pack_U(big, U, big, kf.state_cov_U);
+    arr_frand(big, -10, 10, kf.state_mean);
+    matrix_reconstruct_udu(big, U, kf.state_cov_D, cov);
+    double mean[big];
+    memcpy(mean, kf.state_mean, sizeof(mean));
+
+    fail_unless(nkf_state_projection(&kf, big, small, ndxs) == 0);
+    unpack_U(small, kf.state_cov_U, U, small);
+    matrix_reconstruct_udu(small, U, kf.state_cov_D, cov_);
+    for (u8 i=0; i<small; i++) {
+      fail_unless(within_epsilon(kf.state_mean[i], mean[ndxs[i]]));
+      for (u8 j=0; j<small; j++) {
+        fail_unless(within_epsilon(cov_[i*small + j],
+                                   cov[ndxs[i]*big + ndxs[j]]),
+                    "Projected covariance mismatch");
+      }
+    }
+
+    /* Put them back, with new elements in the other places. */
+    memcpy(cov, cov_, small * small * sizeof(double));
+    memcpy(mean, kf.state_mean, small * sizeof(double));
+    double init[big];
+    arr_frand(big, -10, 10, init);
+    double var = frand(1, 100);
+    nkf_state_inclusion(&kf, small, big, ndxs, init, var);
+    unpack_U(big, kf.state_cov_U, U, big);
+    matrix_reconstruct_udu(big, U, kf.state_cov_D, cov_);
+    for (u8 i=0; i<big; i++) {
+      s16 oi = -1;
+      for (u8 k=0; k<small; k++) {
+        if (ndxs[k] == i) {
+          oi = k;
+        }
+      }
+      fail_unless(within_epsilon(kf.state_mean[i],
+                                 oi >= 0 ? mean[oi] : init[i]));
+      for (u8 j=0; j<big; j++) {
+        s16 oj = -1;
+        for (u8 k=0; k<small; k++) {
+          if (ndxs[k] == j) {
+            oj = k;
+          }
+        }
+        double expected = 0;
+        if (oi >= 0 && oj >= 0) {
+          expected = cov[oi*small + oj];
+        } else if (i == j) {
+          expected = var;
+        }
+        fail_unless(within_epsilon(cov_[i*big + j], expected),
+                    "Included covariance mismatch");
+      }
+    }
+  }
+}
+END_TEST
 
 START_TEST(test_rebase_state)
 {
@@ -357,7 +740,14 @@ Suite* amb_kf_test_suite(void)
   tcase_add_test(tc_core, test_outlier_dims);
   tcase_add_test(tc_core, test_kf_update_noop);
   tcase_add_test(tc_core, test_kf_update);
+  tcase_add_test(tc_core, test_decorrelate_packed);
+  tcase_add_test(tc_core, test_diffuse_state);
+  tcase_add_test(tc_core, test_incorporate_obs_sparse);
   tcase_add_test(tc_core, test_rebase_state);
+  tcase_add_test(tc_core, test_rebase_covariance);
+  tcase_add_test(tc_core, test_get_cov);
+  tcase_add_test(tc_core, test_state_projection_bad_ndxs);
+  tcase_add_test(tc_core, test_state_projection_inclusion);
   suite_add_tcase(s, tc_core);
 
   return s;
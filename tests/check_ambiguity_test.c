@@ -3,6 +3,7 @@
 #include <math.h>
 
 #include <libswiftnav/linear_algebra.h>
+#include <libswiftnav/constants.h>
 #include <libswiftnav/ambiguity_test.h>
 #include <libswiftnav/printing_utils.h>
 
@@ -139,19 +140,44 @@ START_TEST(test_ambiguity_update_reference)
                        {.sid = {.sat = 4}, .snr = 1}};
   u8 num_sdiffs = 3;
 
+  hypothesis_t *hyps[3];
+  s32 old_N[3][3];
   for (u32 i=0; i<3; i++) {
     hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test.pool);
     fail_unless(hyp != 0, "Null pointer returned by memory_pool_add");
     for (u8 j=0; j<amb_test.sats.num_sats-1; j++) {
       hyp->N[j] = sizerand(5);
     }
+    /* Sats 1 and 4 agree in every hypothesis. */
+    hyp->N[0] = 1;
+    hyp->N[2] = 3;
     hyp->ll = frand(0, 1);
+    hyps[i] = hyp;
+    memcpy(old_N[i], hyp->N, sizeof(old_N[i]));
   }
+  update_unanimous_ambiguities(&amb_test);
 
   sdiff_t sdiffs_with_ref_first[4];
-  ambiguity_update_reference(&amb_test, num_sdiffs, sdiffs, sdiffs_with_ref_first);
+  fail_unless(ambiguity_update_reference(&amb_test, num_sdiffs, sdiffs, sdiffs_with_ref_first));
 
-  /* TODO: Check results of rebase. */
+  /* Sat 4 is the new reference, the dds are now sats 1, 2 and 3. */
+  fail_unless(amb_test.sats.sids[0].sat == 4);
+  for (u32 i=0; i<3; i++) {
+    fail_unless(hyps[i]->N[0] == old_N[i][0] - old_N[i][2]);
+    fail_unless(hyps[i]->N[1] == old_N[i][1] - old_N[i][2]);
+    fail_unless(hyps[i]->N[2] == -old_N[i][2]);
+  }
+
+  /* The rebased unanimous ambiguities match a recomputation. */
+  unanimous_amb_check_t rebased = amb_test.amb_check;
+  update_unanimous_ambiguities(&amb_test);
+  fail_unless(rebased.initialized);
+  fail_unless(rebased.num_matching_ndxs == amb_test.amb_check.num_matching_ndxs);
+  fail_unless(rebased.num_matching_ndxs >= 2);
+  for (u8 k=0; k<rebased.num_matching_ndxs; k++) {
+    fail_unless(rebased.matching_ndxs[k] == amb_test.amb_check.matching_ndxs[k]);
+    fail_unless(rebased.ambs[k] == amb_test.amb_check.ambs[k]);
+  }
 }
 END_TEST
 
@@ -283,6 +309,465 @@ START_TEST(test_amb_sat_inclusion)
 }
 END_TEST
 
+START_TEST(test_amb_sat_inclusion_top_k)
+{
+  /* Four dds with a wide float covariance, too many hypotheses for a small
+   * pool. */
+  u8 dim = 4;
+  double cov[dim * dim];
+  matrix_eye(dim, cov);
+  for (u8 i = 0; i < dim; i++) {
+    cov[i*dim + i] = 0.25;
+  }
+  double u[dim * dim];
+  double d[dim];
+  matrix_udu(dim, cov, u, d);
+  double mean[4] = {1.1, 2.0, -3.2, 4.0};
+
+  sats_management_t float_sats = {.num_sats = dim + 1};
+  for (u8 i = 0; i < dim + 1; i++) {
+    float_sats.sids[i] = construct_sid(CODE_GPS_L1CA, i + 1);
+  }
+
+  u32 max_hyps = 20;
+  memory_pool_t pool;
+  u8 arena[AMBIGUITY_TEST_ARENA_SIZE(20, AMBIGUITY_OVERFLOW_TOP_K)];
+  ambiguity_test_t amb_test;
+
+  fail_unless(init_ambiguity_test_arena(&amb_test, &pool, max_hyps,
+                                        AMBIGUITY_OVERFLOW_TOP_K, arena,
+                                        sizeof(arena) - 1) == -1,
+              "Arena too small should be rejected");
+
+  /* Deferring, nothing is added. */
+  fail_unless(init_ambiguity_test_arena(&amb_test, &pool, max_hyps,
+                                        AMBIGUITY_OVERFLOW_DEFER, arena,
+                                        sizeof(arena)) == 0);
+  reset_ambiguity_test(&amb_test);
+  fail_unless(ambiguity_sat_inclusion(&amb_test, 0, &float_sats,
+                                      mean, u, d) == 0);
+  fail_unless(memory_pool_n_allocated(amb_test.pool) == 1);
+  fail_unless(memory_pool_n_elements(amb_test.pool) == max_hyps,
+              "Reset should keep the pool capacity");
+
+  /* Keeping the most likely, the pool is filled up less the single parent
+   * and the hypothesis nearest the float mean is kept. */
+  fail_unless(init_ambiguity_test_arena(&amb_test, &pool, max_hyps,
+                                        AMBIGUITY_OVERFLOW_TOP_K, arena,
+                                        sizeof(arena)) == 0);
+  reset_ambiguity_test(&amb_test);
+  fail_unless(ambiguity_sat_inclusion(&amb_test, 0, &float_sats,
+                                      mean, u, d) == 1);
+  fail_unless(amb_test.sats.num_sats == dim + 1);
+  fail_unless(memory_pool_n_allocated(amb_test.pool) == (s32)max_hyps - 1,
+              "Expected %d hypotheses, got %d", max_hyps - 1,
+              memory_pool_n_allocated(amb_test.pool));
+  double nearest[4] = {1, 2, -3, 4};
+  fail_unless(ambiguity_test_pool_contains(&amb_test, nearest));
+  double far[4] = {3, 2, -3, 4};
+  fail_unless(!ambiguity_test_pool_contains(&amb_test, far));
+
+  /* Best first, the same most likely hypotheses are found without
+   * enumerating the box. */
+  fail_unless(init_ambiguity_test_arena(&amb_test, &pool, max_hyps,
+                                        AMBIGUITY_OVERFLOW_BEST_FIRST, arena,
+                                        sizeof(arena)) == 0);
+  reset_ambiguity_test(&amb_test);
+  fail_unless(ambiguity_sat_inclusion(&amb_test, 0, &float_sats,
+                                      mean, u, d) == 1);
+  fail_unless(amb_test.sats.num_sats == dim + 1);
+  fail_unless(memory_pool_n_allocated(amb_test.pool) == (s32)max_hyps - 1,
+              "Expected %d hypotheses, got %d", max_hyps - 1,
+              memory_pool_n_allocated(amb_test.pool));
+  fail_unless(ambiguity_test_pool_contains(&amb_test, nearest));
+  fail_unless(!ambiguity_test_pool_contains(&amb_test, far));
+  double next[4] = {1, 2, -4, 4};
+  fail_unless(ambiguity_test_pool_contains(&amb_test, next));
+
+  /* The pool is full, nothing more can be added. */
+  float_sats.num_sats = dim + 2;
+  float_sats.sids[dim + 1] = construct_sid(CODE_GPS_L1CA, dim + 2);
+  double cov5[5 * 5];
+  matrix_eye(5, cov5);
+  double u5[5 * 5];
+  double d5[5];
+  matrix_udu(5, cov5, u5, d5);
+  double mean5[5] = {1.1, 2.0, -3.2, 4.0, 0.3};
+  fail_unless(ambiguity_sat_inclusion(&amb_test, dim, &float_sats,
+                                      mean5, u5, d5) == 0);
+  fail_unless(amb_test.sats.num_sats == dim + 1);
+}
+END_TEST
+
+START_TEST(test_amb_sat_inclusion_best_first)
+{
+  /* One old dd strongly correlated with the first new one. The candidates
+   * for the new dds follow each hypothesis' value of the old dd, so with a
+   * budget of three candidates each hypothesis still gets its most likely
+   * extension, which is far from the most likely new dds on their own. */
+  u8 dim = 4;
+  double cov[16] = {4,   3.9, 0,    0,
+                    3.9, 4,   0,    0,
+                    0,   0,   0.25, 0,
+                    0,   0,   0,    0.25};
+  double u[dim * dim];
+  double d[dim];
+  matrix_udu(dim, cov, u, d);
+  double mean[4] = {1, 0.2, -3.2, 4.0};
+
+  sats_management_t float_sats = {.num_sats = dim + 1};
+  for (u8 i = 0; i < dim + 1; i++) {
+    float_sats.sids[i] = construct_sid(CODE_GPS_L1CA, i + 1);
+  }
+
+  u32 max_hyps = 8;
+  memory_pool_t pool;
+  u8 arena[AMBIGUITY_TEST_ARENA_SIZE(8, AMBIGUITY_OVERFLOW_BEST_FIRST)];
+  ambiguity_test_t amb_test;
+  fail_unless(init_ambiguity_test_arena(&amb_test, &pool, max_hyps,
+                                        AMBIGUITY_OVERFLOW_BEST_FIRST, arena,
+                                        sizeof(arena)) == 0);
+  reset_ambiguity_test(&amb_test);
+  memory_pool_clear(amb_test.pool);
+  amb_test.sats.num_sats = 2;
+  amb_test.sats.sids[0] = float_sats.sids[0];
+  amb_test.sats.sids[1] = float_sats.sids[1];
+  s32 old_N[2] = {-1, 3};
+  for (u8 i = 0; i < 2; i++) {
+    hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test.pool);
+    memset(hyp, 0, sizeof(*hyp));
+    hyp->N[0] = old_N[i];
+  }
+
+  fail_unless(ambiguity_sat_inclusion(&amb_test, 1, &float_sats,
+                                      mean, u, d) == 1);
+  fail_unless(amb_test.sats.num_sats == dim + 1);
+  s32 n_hyps = memory_pool_n_allocated(amb_test.pool);
+  fail_unless(n_hyps > 2 && n_hyps <= (s32)max_hyps);
+
+  /* Given the old dd, the first new dd has mean 0.2 + 0.975 * (N - 1) and
+   * standard deviation 0.44. */
+  double near_low[4] = {-1, -2, -3, 4};
+  double near_high[4] = {3, 2, -3, 4};
+  fail_unless(ambiguity_test_pool_contains(&amb_test, near_low));
+  fail_unless(ambiguity_test_pool_contains(&amb_test, near_high));
+  double swapped_low[4] = {-1, 2, -3, 4};
+  double swapped_high[4] = {3, -2, -3, 4};
+  fail_unless(!ambiguity_test_pool_contains(&amb_test, swapped_low));
+  fail_unless(!ambiguity_test_pool_contains(&amb_test, swapped_high));
+}
+END_TEST
+
+static void set_test_ll(void *arg, element_t *elem)
+{
+  (void)arg;
+  hypothesis_t *hyp = (hypothesis_t *)elem;
+  hyp->ll = -0.5 * (hyp->N[0] * hyp->N[0] + abs(hyp->N[1] - hyp->N[2]));
+}
+
+static s8 drop_even_N0(void *arg, element_t *elem)
+{
+  (void)arg;
+  return ((hypothesis_t *)elem)->N[0] % 2 != 0;
+}
+
+START_TEST(test_pool_index)
+{
+  u8 dim = 4;
+  double cov[dim * dim];
+  matrix_eye(dim, cov);
+  for (u8 i = 0; i < dim; i++) {
+    cov[i*dim + i] = 0.09;
+  }
+  double u[dim * dim];
+  double d[dim];
+  matrix_udu(dim, cov, u, d);
+  double mean[4] = {0.2, 1.0, -1.3, 2.0};
+
+  sats_management_t float_sats = {.num_sats = dim + 1};
+  for (u8 i = 0; i < dim + 1; i++) {
+    float_sats.sids[i] = construct_sid(CODE_GPS_L1CA, i + 1);
+  }
+
+  /* Two identical tests, one indexed. */
+  ambiguity_test_t plain, indexed;
+  memory_pool_t plain_pool, indexed_pool;
+  static u8 plain_buff[AMBIGUITY_TEST_POOL_BUFF_SIZE];
+  static u8 indexed_buff[AMBIGUITY_TEST_POOL_BUFF_SIZE];
+  static u8 index_buff[AMBIGUITY_TEST_INDEX_SIZE(MAX_HYPOTHESES)];
+  init_ambiguity_test(&plain, &plain_pool, plain_buff);
+  init_ambiguity_test(&indexed, &indexed_pool, indexed_buff);
+  fail_unless(ambiguity_test_enable_index(&indexed, index_buff,
+                                          MAX_HYPOTHESES *
+                                          sizeof(hypothesis_t *)) == -1,
+              "Index without spare slots should be rejected");
+  fail_unless(ambiguity_test_enable_index(&indexed, index_buff,
+                                          sizeof(index_buff)) == 0);
+  reset_ambiguity_test(&plain);
+  reset_ambiguity_test(&indexed);
+
+  fail_unless(ambiguity_sat_inclusion(&plain, 0, &float_sats,
+                                      mean, u, d) == 1);
+  fail_unless(ambiguity_sat_inclusion(&indexed, 0, &float_sats,
+                                      mean, u, d) == 1);
+  memory_pool_map(plain.pool, NULL, &set_test_ll);
+  memory_pool_map(indexed.pool, NULL, &set_test_ll);
+
+  for (u8 pass = 0; pass < 2; pass++) {
+    fail_unless(memory_pool_n_allocated(indexed.pool) > 1);
+    /* Query a box around the float mean covering present and absent
+     * hypotheses. */
+    u32 n_found = 0;
+    for (s32 a = -3; a <= 3; a++) {
+      for (s32 b = -1; b <= 3; b++) {
+        double ambs[4] = {a, b, -1, 2};
+        u8 c = ambiguity_test_pool_contains(&indexed, ambs);
+        fail_unless(c == ambiguity_test_pool_contains(&plain, ambs));
+        fail_unless(ambiguity_test_pool_ll(&indexed, 4, ambs) ==
+                    ambiguity_test_pool_ll(&plain, 4, ambs));
+        fail_unless(fabs(ambiguity_test_pool_prob(&indexed, 4, ambs) -
+                         ambiguity_test_pool_prob(&plain, 4, ambs)) < 1e-12);
+        n_found += c;
+      }
+    }
+    fail_unless(n_found > 0);
+
+    /* Changing the pool invalidates the index. */
+    memory_pool_filter(plain.pool, NULL, &drop_even_N0);
+    memory_pool_filter(indexed.pool, NULL, &drop_even_N0);
+  }
+}
+END_TEST
+
+static int cmp_hyp_N(const void *a, const void *b)
+{
+  return memcmp(((const hypothesis_t *)a)->N, ((const hypothesis_t *)b)->N,
+                sizeof(((const hypothesis_t *)a)->N));
+}
+
+START_TEST(test_test_ambiguities)
+{
+  u8 num_dds = 6;
+  double DE[6 * 3] = {
+     0.31, -0.72,  0.12,
+    -0.55,  0.10,  0.33,
+     0.82,  0.40, -0.21,
+    -0.20, -0.91,  0.36,
+     0.05,  0.68,  0.53,
+    -0.77, -0.45,  0.25,
+  };
+  s32 N_true[6] = {10, -3, 7, 22, -15, 4};
+  double b[3] = {1.2, -0.7, 0.4};
+  double noise[12] = {0.01, -0.02, 0.015, 0, -0.01, 0.02,
+                      0.3, -0.2, 0.1, -0.4, 0.25, 0};
+
+  double dd_meas[2 * 6];
+  for (u8 i = 0; i < num_dds; i++) {
+    double range = vector_dot(3, &DE[i * 3], b);
+    dd_meas[i] = N_true[i] + range / GPS_L1_LAMBDA_NO_VAC + noise[i];
+    dd_meas[i + num_dds] = range + noise[i + num_dds];
+  }
+
+  double obs_cov[4 * 6 * 6];
+  memset(obs_cov, 0, sizeof(obs_cov));
+  for (u8 i = 0; i < num_dds; i++) {
+    for (u8 j = 0; j < num_dds; j++) {
+      double k = (i == j) ? 2 : 1;
+      obs_cov[i * 2 * num_dds + j] = DEFAULT_PHASE_VAR_TEST * k;
+      obs_cov[(i + num_dds) * 2 * num_dds + j + num_dds] =
+        DEFAULT_CODE_VAR_TEST * k;
+    }
+  }
+
+  ambiguity_test_t amb_test;
+  create_empty_ambiguity_test(&amb_test);
+  amb_test.sats.num_sats = num_dds + 1;
+  init_residual_matrices(&amb_test.res_mtxs, num_dds, DE, obs_cov);
+
+  /* Perturb the first four ambiguities by -1, 0, 1: 81 hypotheses, more
+   * than two full batches. */
+  u8 n_hyps = 81;
+  hypothesis_t expected[81];
+  double r_vec[2 * MAX_CHANNELS - 5];
+  assign_r_vec(&amb_test.res_mtxs, num_dds, dd_meas, r_vec);
+  double max_ll = -1e20;
+  for (u8 k = 0; k < n_hyps; k++) {
+    hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test.pool);
+    memset(hyp, 0, sizeof(hypothesis_t));
+    memcpy(hyp->N, N_true, sizeof(N_true));
+    u8 p = k;
+    for (u8 i = 0; i < 4; i++) {
+      hyp->N[i] += (s32)(p % 3) - 1;
+      p /= 3;
+    }
+    hyp->ll = -(float)(k % 5);
+    expected[k] = *hyp;
+
+    double N[6];
+    for (u8 i = 0; i < num_dds; i++) {
+      N[i] = hyp->N[i];
+    }
+    double q = get_quadratic_term(&amb_test.res_mtxs, num_dds, N, r_vec);
+    expected[k].ll += q;
+    max_ll = MAX(max_ll, expected[k].ll);
+    if (!(fabs(q) < 20)) {
+      expected[k].ll = -INFINITY;
+    }
+  }
+
+  u8 n_expected = 0;
+  for (u8 k = 0; k < n_hyps; k++) {
+    if (expected[k].ll > -90) {
+      expected[n_expected] = expected[k];
+      expected[n_expected].ll -= max_ll;
+      n_expected++;
+    }
+  }
+  fail_unless(n_expected > 1 && n_expected < n_hyps,
+              "Test should keep some hypotheses, kept %d", n_expected);
+
+  /* Build a hash index so that the test updates it. */
+  static u8 index_buff[AMBIGUITY_TEST_INDEX_SIZE(MAX_HYPOTHESES)];
+  fail_unless(ambiguity_test_enable_index(&amb_test, index_buff,
+                                          sizeof(index_buff)) == 0);
+  double true_ambs[6];
+  for (u8 i = 0; i < num_dds; i++) {
+    true_ambs[i] = N_true[i];
+  }
+  fail_unless(ambiguity_test_pool_contains(&amb_test, true_ambs));
+
+  test_ambiguities(&amb_test, dd_meas);
+
+  hypothesis_t out[81];
+  s32 n_out = memory_pool_to_array(amb_test.pool, out);
+  fail_unless(n_out == n_expected, "Expected %d hypotheses, got %d",
+              n_expected, n_out);
+  qsort(out, n_out, sizeof(hypothesis_t), cmp_hyp_N);
+  qsort(expected, n_expected, sizeof(hypothesis_t), cmp_hyp_N);
+  /* The log likelihoods are normalized by the offset. */
+  fail_unless(fabs(amb_test.ll_offset - max_ll) < 1e-3);
+  for (u8 k = 0; k < n_out; k++) {
+    fail_unless(cmp_hyp_N(&out[k], &expected[k]) == 0);
+    fail_unless(fabs(out[k].ll - amb_test.ll_offset - expected[k].ll) < 1e-3,
+                "Hypothesis %d ll %f, expected %f",
+                k, out[k].ll - amb_test.ll_offset, expected[k].ll);
+    double ambs[6];
+    for (u8 i = 0; i < num_dds; i++) {
+      ambs[i] = out[k].N[i];
+    }
+    fail_unless(fabs(ambiguity_test_pool_ll(&amb_test, num_dds, ambs) -
+                     expected[k].ll) < 1e-3);
+  }
+
+  /* The index was updated in place rather than left to be rebuilt. */
+  fail_unless(amb_test.index.valid &&
+              amb_test.index.generation == amb_test.pool->generation,
+              "Index should be up to date after the test");
+  u8 n_contained = 0;
+  for (u8 k = 0; k < n_hyps; k++) {
+    double ambs[6];
+    u8 p = k;
+    for (u8 i = 0; i < num_dds; i++) {
+      ambs[i] = N_true[i];
+      if (i < 4) {
+        ambs[i] += (s32)(p % 3) - 1;
+        p /= 3;
+      }
+    }
+    n_contained += ambiguity_test_pool_contains(&amb_test, ambs);
+  }
+  fail_unless(n_contained == n_expected,
+              "Index holds %d hypotheses, expected %d",
+              n_contained, n_expected);
+  double prob_sum = 0;
+  for (u8 k = 0; k < n_out; k++) {
+    prob_sum += exp(out[k].ll);
+  }
+  for (u8 k = 0; k < n_out; k++) {
+    double ambs[6];
+    for (u8 i = 0; i < num_dds; i++) {
+      ambs[i] = out[k].N[i];
+    }
+    /* The index sums the likelihoods before they are rounded to float. */
+    double prob = exp(out[k].ll) / prob_sum;
+    fail_unless(fabs(ambiguity_test_pool_prob(&amb_test, num_dds, ambs) -
+                     prob) < 1e-5 * prob);
+  }
+  /* The unanimous ambiguities were found in the same pass, N[4] and N[5]
+   * are never perturbed. */
+  unanimous_amb_check_t fused = amb_test.amb_check;
+  fail_unless(fused.initialized);
+  update_unanimous_ambiguities(&amb_test);
+  fail_unless(memcmp(&fused, &amb_test.amb_check, sizeof(fused)) == 0,
+              "Up to date check shouldn't be recomputed");
+  amb_test.amb_check.initialized = 0;
+  update_unanimous_ambiguities(&amb_test);
+  fail_unless(fused.num_matching_ndxs == amb_test.amb_check.num_matching_ndxs);
+  fail_unless(fused.num_matching_ndxs >= 2);
+  for (u8 k = 0; k < fused.num_matching_ndxs; k++) {
+    fail_unless(fused.matching_ndxs[k] == amb_test.amb_check.matching_ndxs[k]);
+    fail_unless(fused.ambs[k] == amb_test.amb_check.ambs[k]);
+  }
+
+  /* A second update normalizes the log likelihoods by the offset of the
+   * first as it goes. */
+  u8 n_expected2 = 0;
+  max_ll = -1e20;
+  for (u8 k = 0; k < n_expected; k++) {
+    double N[6];
+    for (u8 i = 0; i < num_dds; i++) {
+      N[i] = expected[k].N[i];
+    }
+    double q = get_quadratic_term(&amb_test.res_mtxs, num_dds, N, r_vec);
+    expected[k].ll += q;
+    max_ll = MAX(max_ll, expected[k].ll);
+    if (fabs(q) < 20 && expected[k].ll > -90) {
+      expected[n_expected2++] = expected[k];
+    }
+  }
+  for (u8 k = 0; k < n_expected2; k++) {
+    expected[k].ll -= max_ll;
+  }
+  n_expected = n_expected2;
+  test_ambiguities(&amb_test, dd_meas);
+  n_out = memory_pool_to_array(amb_test.pool, out);
+  fail_unless(n_out == n_expected);
+  qsort(out, n_out, sizeof(hypothesis_t), cmp_hyp_N);
+  for (u8 k = 0; k < n_out; k++) {
+    fail_unless(cmp_hyp_N(&out[k], &expected[k]) == 0);
+    fail_unless(fabs(out[k].ll - amb_test.ll_offset - expected[k].ll) < 1e-3);
+  }
+
+  /* Round trip the tested pool through its compact form. */
+  static float pack_buff[(AMBIGUITY_TEST_PACK_SIZE(81) + sizeof(float) - 1) /
+                         sizeof(float)];
+  hypothesis_pack_t pack;
+  init_hypothesis_pack(&pack, pack_buff, sizeof(pack_buff));
+  fail_unless(pack.max_hyps == n_hyps);
+  fail_unless(ambiguity_test_pack(&amb_test, &pack) == 0);
+  fail_unless(pack.n_hyps == n_expected);
+  fail_unless(ambiguity_test_unpack(&amb_test, &pack) == 0);
+  fail_unless(amb_test.ll_offset == 0);
+  fail_unless(amb_test.index.generation == amb_test.pool->generation);
+  fail_unless(ambiguity_test_pool_contains(&amb_test, true_ambs));
+  n_out = memory_pool_to_array(amb_test.pool, out);
+  fail_unless(n_out == n_expected);
+  qsort(out, n_out, sizeof(hypothesis_t), cmp_hyp_N);
+  for (u8 k = 0; k < n_out; k++) {
+    fail_unless(cmp_hyp_N(&out[k], &expected[k]) == 0);
+    fail_unless(fabs(out[k].ll - expected[k].ll) < 1e-3);
+  }
+
+  /* Ambiguities spanning more than 16 bits can't be packed. */
+  hypothesis_t *far = (hypothesis_t *)memory_pool_add(amb_test.pool);
+  memcpy(far->N, N_true, sizeof(N_true));
+  far->N[5] += 70000;
+  fail_unless(ambiguity_test_pack(&amb_test, &pack) == -1);
+  far->N[5] -= 70000 - 65535;
+  fail_unless(ambiguity_test_pack(&amb_test, &pack) == 0);
+}
+END_TEST
+
 Suite* ambiguity_test_suite(void)
 {
   Suite *s = suite_create("Ambiguity Test");
@@ -296,6 +781,10 @@ Suite* ambiguity_test_suite(void)
   //tcase_add_test(tc_core, test_update_sats_rebase);
   (void) test_update_sats_rebase;
   tcase_add_test(tc_core, test_amb_sat_inclusion);
+  tcase_add_test(tc_core, test_amb_sat_inclusion_top_k);
+  tcase_add_test(tc_core, test_amb_sat_inclusion_best_first);
+  tcase_add_test(tc_core, test_pool_index);
+  tcase_add_test(tc_core, test_test_ambiguities);
   suite_add_tcase(s, tc_core);
 
   return s;
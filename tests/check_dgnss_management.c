@@ -9,43 +9,42 @@
 
 #include "check_utils.h"
 
-extern sats_management_t sats_management;
-extern nkf_t nkf;
-extern ambiguity_test_t ambiguity_test;
+static dgnss_ctx_t ctx;
 
 START_TEST(test_dgnss_update_ambiguity_state_1)
 {
-  sats_management.num_sats = 5;
-  sats_management.sids[0].sat = 1;
-  sats_management.sids[1].sat = 2;
-  sats_management.sids[2].sat = 3;
-  sats_management.sids[3].sat = 4;
-  sats_management.sids[4].sat = 5;
-  nkf.state_dim = 4;
-  nkf.state_mean[0] = 1;
-  nkf.state_mean[1] = 2;
-  nkf.state_mean[2] = 3;
-  nkf.state_mean[3] = 4;
-
-
-  ambiguity_test.amb_check.initialized = 1;
-  ambiguity_test.amb_check.num_matching_ndxs = 4;
-  ambiguity_test.amb_check.matching_ndxs[0] = 0;
-  ambiguity_test.amb_check.matching_ndxs[1] = 2;
-  ambiguity_test.amb_check.matching_ndxs[2] = 3;
-  ambiguity_test.amb_check.matching_ndxs[3] = 5;
-  ambiguity_test.sats.num_sats = 7;
-  ambiguity_test.sats.sids[0].sat = 1;
-  ambiguity_test.sats.sids[1].sat = 2;
-  ambiguity_test.sats.sids[2].sat = 3;
-  ambiguity_test.sats.sids[3].sat = 4;
-  ambiguity_test.sats.sids[4].sat = 5;
-  ambiguity_test.sats.sids[5].sat = 6;
-  ambiguity_test.sats.sids[6].sat = 7;
-  ambiguity_test.amb_check.ambs[0] = 20;
-  ambiguity_test.amb_check.ambs[1] = 21;
-  ambiguity_test.amb_check.ambs[2] = 22;
-  ambiguity_test.amb_check.ambs[3] = 23;
+  dgnss_ctx_init(&ctx);
+  ctx.sats_management.num_sats = 5;
+  ctx.sats_management.sids[0].sat = 1;
+  ctx.sats_management.sids[1].sat = 2;
+  ctx.sats_management.sids[2].sat = 3;
+  ctx.sats_management.sids[3].sat = 4;
+  ctx.sats_management.sids[4].sat = 5;
+  ctx.nkf.state_dim = 4;
+  ctx.nkf.state_mean[0] = 1;
+  ctx.nkf.state_mean[1] = 2;
+  ctx.nkf.state_mean[2] = 3;
+  ctx.nkf.state_mean[3] = 4;
+
+
+  ctx.ambiguity_test.amb_check.initialized = 1;
+  ctx.ambiguity_test.amb_check.num_matching_ndxs = 4;
+  ctx.ambiguity_test.amb_check.matching_ndxs[0] = 0;
+  ctx.ambiguity_test.amb_check.matching_ndxs[1] = 2;
+  ctx.ambiguity_test.amb_check.matching_ndxs[2] = 3;
+  ctx.ambiguity_test.amb_check.matching_ndxs[3] = 5;
+  ctx.ambiguity_test.sats.num_sats = 7;
+  ctx.ambiguity_test.sats.sids[0].sat = 1;
+  ctx.ambiguity_test.sats.sids[1].sat = 2;
+  ctx.ambiguity_test.sats.sids[2].sat = 3;
+  ctx.ambiguity_test.sats.sids[3].sat = 4;
+  ctx.ambiguity_test.sats.sids[4].sat = 5;
+  ctx.ambiguity_test.sats.sids[5].sat = 6;
+  ctx.ambiguity_test.sats.sids[6].sat = 7;
+  ctx.ambiguity_test.amb_check.ambs[0] = 20;
+  ctx.ambiguity_test.amb_check.ambs[1] = 21;
+  ctx.ambiguity_test.amb_check.ambs[2] = 22;
+  ctx.ambiguity_test.amb_check.ambs[3] = 23;
 
   ambiguity_state_t s = {
     .float_ambs = {
@@ -63,7 +62,7 @@ START_TEST(test_dgnss_update_ambiguity_state_1)
   ambiguity_state_t s_out;
   memset(&s_out, 0, sizeof(s_out));
 
-  dgnss_update_ambiguity_state(&s_out);
+  dgnss_ctx_update_ambiguity_state(&ctx, &s_out);
 
   fail_unless(memcmp(&s, &s_out, sizeof(s)) == 0);
 }
@@ -71,74 +70,75 @@ END_TEST
 
 START_TEST(test_dgnss_update_ambiguity_state_2)
 {
-  sats_management.num_sats = 5;
-  sats_management.sids[0].sat = 1;
-  sats_management.sids[1].sat = 2;
-  sats_management.sids[2].sat = 3;
-  sats_management.sids[3].sat = 4;
-  sats_management.sids[4].sat = 5;
-  nkf.state_dim = 4;
-  nkf.state_mean[0] = 1;
-  nkf.state_mean[1] = 2;
-  nkf.state_mean[2] = 3;
-  nkf.state_mean[3] = 4;
-
-
-  ambiguity_test.amb_check.initialized = 1;
-  ambiguity_test.amb_check.num_matching_ndxs = 4;
-  ambiguity_test.amb_check.matching_ndxs[0] = 0;
-  ambiguity_test.amb_check.matching_ndxs[1] = 2;
-  ambiguity_test.amb_check.matching_ndxs[2] = 3;
-  ambiguity_test.amb_check.matching_ndxs[3] = 5;
-  ambiguity_test.sats.num_sats = 7;
-  ambiguity_test.sats.sids[0].sat = 1;
-  ambiguity_test.sats.sids[1].sat = 2;
-  ambiguity_test.sats.sids[2].sat = 3;
-  ambiguity_test.sats.sids[3].sat = 4;
-  ambiguity_test.sats.sids[4].sat = 5;
-  ambiguity_test.sats.sids[5].sat = 6;
-  ambiguity_test.sats.sids[6].sat = 7;
-  ambiguity_test.amb_check.ambs[0] = 20;
-  ambiguity_test.amb_check.ambs[1] = 21;
-  ambiguity_test.amb_check.ambs[2] = 22;
-  ambiguity_test.amb_check.ambs[3] = 23;
+  dgnss_ctx_init(&ctx);
+  ctx.sats_management.num_sats = 5;
+  ctx.sats_management.sids[0].sat = 1;
+  ctx.sats_management.sids[1].sat = 2;
+  ctx.sats_management.sids[2].sat = 3;
+  ctx.sats_management.sids[3].sat = 4;
+  ctx.sats_management.sids[4].sat = 5;
+  ctx.nkf.state_dim = 4;
+  ctx.nkf.state_mean[0] = 1;
+  ctx.nkf.state_mean[1] = 2;
+  ctx.nkf.state_mean[2] = 3;
+  ctx.nkf.state_mean[3] = 4;
+
+
+  ctx.ambiguity_test.amb_check.initialized = 1;
+  ctx.ambiguity_test.amb_check.num_matching_ndxs = 4;
+  ctx.ambiguity_test.amb_check.matching_ndxs[0] = 0;
+  ctx.ambiguity_test.amb_check.matching_ndxs[1] = 2;
+  ctx.ambiguity_test.amb_check.matching_ndxs[2] = 3;
+  ctx.ambiguity_test.amb_check.matching_ndxs[3] = 5;
+  ctx.ambiguity_test.sats.num_sats = 7;
+  ctx.ambiguity_test.sats.sids[0].sat = 1;
+  ctx.ambiguity_test.sats.sids[1].sat = 2;
+  ctx.ambiguity_test.sats.sids[2].sat = 3;
+  ctx.ambiguity_test.sats.sids[3].sat = 4;
+  ctx.ambiguity_test.sats.sids[4].sat = 5;
+  ctx.ambiguity_test.sats.sids[5].sat = 6;
+  ctx.ambiguity_test.sats.sids[6].sat = 7;
+  ctx.ambiguity_test.amb_check.ambs[0] = 20;
+  ctx.ambiguity_test.amb_check.ambs[1] = 21;
+  ctx.ambiguity_test.amb_check.ambs[2] = 22;
+  ctx.ambiguity_test.amb_check.ambs[3] = 23;
 
   ambiguity_state_t s_out;
 
   /* No fixed solution. */
 
   /* Uninitialized. */
-  ambiguity_test.amb_check.initialized = 0;
-  dgnss_update_ambiguity_state(&s_out);
+  ctx.ambiguity_test.amb_check.initialized = 0;
+  dgnss_ctx_update_ambiguity_state(&ctx, &s_out);
   fail_unless(s_out.fixed_ambs.n == 0);
 
   /* Too few sats. */
-  ambiguity_test.amb_check.initialized = 1;
-  ambiguity_test.amb_check.num_matching_ndxs = 0;
-  dgnss_update_ambiguity_state(&s_out);
+  ctx.ambiguity_test.amb_check.initialized = 1;
+  ctx.ambiguity_test.amb_check.num_matching_ndxs = 0;
+  dgnss_ctx_update_ambiguity_state(&ctx, &s_out);
   fail_unless(s_out.fixed_ambs.n == 0);
 
-  ambiguity_test.amb_check.initialized = 1;
-  ambiguity_test.amb_check.num_matching_ndxs = 4;
+  ctx.ambiguity_test.amb_check.initialized = 1;
+  ctx.ambiguity_test.amb_check.num_matching_ndxs = 4;
 
   /* No float solution. */
 
   /* Too few sats. */
-  sats_management.num_sats = 0;
-  nkf.state_dim = 0;
-  dgnss_update_ambiguity_state(&s_out);
+  ctx.sats_management.num_sats = 0;
+  ctx.nkf.state_dim = 0;
+  dgnss_ctx_update_ambiguity_state(&ctx, &s_out);
   fail_unless(s_out.float_ambs.n == 0);
 
-  sats_management.num_sats = 1;
-  nkf.state_dim = 0;
-  dgnss_update_ambiguity_state(&s_out);
+  ctx.sats_management.num_sats = 1;
+  ctx.nkf.state_dim = 0;
+  dgnss_ctx_update_ambiguity_state(&ctx, &s_out);
   fail_unless(s_out.float_ambs.n == 0);
 
   /* Ensure we check num_sats first as state_dim may not be valid if num_sats
    * is too low. */
-  sats_management.num_sats = 1;
-  nkf.state_dim = 22;
-  dgnss_update_ambiguity_state(&s_out);
+  ctx.sats_management.num_sats = 1;
+  ctx.nkf.state_dim = 22;
+  dgnss_ctx_update_ambiguity_state(&ctx, &s_out);
   fail_unless(s_out.float_ambs.n == 0);
 }
 END_TEST
@@ -242,6 +242,81 @@ START_TEST(test_dgnss_baseline_1)
 }
 END_TEST
 
+START_TEST(test_dgnss_ctx_independent)
+{
+  static dgnss_ctx_t ctx_a, ctx_b;
+  dgnss_ctx_init(&ctx_a);
+  dgnss_ctx_init(&ctx_b);
+  fail_unless(dgnss_ctx_iar_num_hyps(&ctx_a) == 0);
+
+  u8 num_sats_default = get_sats_management()->num_sats;
+
+  dgnss_ctx_set_settings(&ctx_b, 1, 2, 3, 4, 5, 6, 7);
+  dgnss_ctx_init_filters(&ctx_a, num_sdiffs, sdiffs, ref_ecef);
+  dgnss_ctx_init_filters(&ctx_b, 3, sdiffs, ref_ecef);
+
+  fail_unless(ctx_a.sats_management.num_sats == num_sdiffs);
+  fail_unless(ctx_a.nkf.state_dim == (u32)(num_sdiffs - 1));
+  fail_unless(ctx_b.sats_management.num_sats == 3);
+  fail_unless(ctx_b.nkf.state_dim == 2);
+  fail_unless(ctx_a.settings.phase_var_kf == DEFAULT_PHASE_VAR_KF);
+  fail_unless(ctx_b.settings.phase_var_kf == 3);
+
+  /* Each context has its own hypothesis pool. */
+  fail_unless(ctx_a.ambiguity_test.pool != ctx_b.ambiguity_test.pool);
+  fail_unless(dgnss_ctx_iar_num_hyps(&ctx_a) == 1);
+  fail_unless(dgnss_ctx_iar_num_hyps(&ctx_b) == 1);
+  memory_pool_add(ctx_b.ambiguity_test.pool);
+  fail_unless(dgnss_ctx_iar_num_hyps(&ctx_a) == 1);
+  fail_unless(dgnss_ctx_iar_num_hyps(&ctx_b) == 2);
+  dgnss_ctx_reset_iar(&ctx_b);
+  fail_unless(dgnss_ctx_iar_num_hyps(&ctx_b) == 1);
+
+  /* The default context is untouched. */
+  fail_unless(get_sats_management()->num_sats == num_sats_default);
+}
+END_TEST
+
+START_TEST(test_dgnss_update_ambiguity_state_partial)
+{
+  dgnss_ctx_init(&ctx);
+  ctx.sats_management.num_sats = 5;
+  for (u8 i=0; i < 5; i++) {
+    ctx.sats_management.sids[i].sat = i + 1;
+  }
+  /* Independent ambiguities, the first and third well determined. */
+  double mean[4] = {1.02, 2.3, 2.99, 4.7};
+  double D[4] = {1e-4, 10, 1e-4, 10};
+  ctx.nkf.state_dim = 4;
+  memcpy(ctx.nkf.state_mean, mean, sizeof(mean));
+  memcpy(ctx.nkf.state_cov_D, D, sizeof(D));
+  memset(ctx.nkf.state_cov_U, 0, sizeof(ctx.nkf.state_cov_U));
+
+  ambiguity_state_t s;
+  memset(&s, 0, sizeof(s));
+
+  /* Disabled by default. */
+  dgnss_ctx_update_ambiguity_state(&ctx, &s);
+  fail_unless(s.float_ambs.n == 4);
+  fail_unless(s.fixed_ambs.n == 0);
+
+  dgnss_ctx_set_partial_fix(&ctx, true, DEFAULT_PAR_SUCCESS_RATE,
+                            DEFAULT_PAR_RATIO);
+  dgnss_ctx_update_ambiguity_state(&ctx, &s);
+  fail_unless(s.fixed_ambs.n == 2, "Fixed %u ambiguities", s.fixed_ambs.n);
+  fail_unless(s.fixed_ambs.sids[0].sat == 1);
+  fail_unless(s.fixed_ambs.sids[1].sat == 2);
+  fail_unless(s.fixed_ambs.sids[2].sat == 4);
+  fail_unless(s.fixed_ambs.ambs[0] == 1);
+  fail_unless(s.fixed_ambs.ambs[1] == 3);
+
+  /* Nothing passes an unreachable success rate. */
+  dgnss_ctx_set_partial_fix(&ctx, true, 1.1, DEFAULT_PAR_RATIO);
+  dgnss_ctx_update_ambiguity_state(&ctx, &s);
+  fail_unless(s.fixed_ambs.n == 0);
+}
+END_TEST
+
 Suite* dgnss_management_test_suite(void)
 {
   Suite *s = suite_create("DGNSS Management");
@@ -249,12 +324,14 @@ Suite* dgnss_management_test_suite(void)
   TCase *tc_amb_state = tcase_create("Ambiguity State");
   tcase_add_test(tc_amb_state, test_dgnss_update_ambiguity_state_1);
   tcase_add_test(tc_amb_state, test_dgnss_update_ambiguity_state_2);
+  tcase_add_test(tc_amb_state, test_dgnss_update_ambiguity_state_partial);
   suite_add_tcase(s, tc_amb_state);
 
   TCase *tc_baseline = tcase_create("Baseline");
   tcase_add_checked_fixture (tc_baseline, check_dgnss_baseline_setup,
                                           check_dgnss_baseline_teardown);
   tcase_add_test(tc_baseline, test_dgnss_baseline_1);
+  tcase_add_test(tc_baseline, test_dgnss_ctx_independent);
   suite_add_tcase(s, tc_baseline);
 
   return s;
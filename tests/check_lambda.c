@@ -0,0 +1,374 @@
+#include <math.h>
+#include <string.h>
+#include <check.h>
+
+#include <libswiftnav/lambda.h>
+
+#include "check_utils.h"
+
+#define LAMBDA_N 8
+#define LAMBDA_EPOCHS 50
+
+/* Random symmetric positive definite, correlated covariance, column major. */
+static void random_cov(u32 n, double *Q)
+{
+  double A[n * n];
+  arr_frand(n * n, -1, 1, A);
+  for (u32 i = 0; i < n; i++) {
+    for (u32 j = 0; j < n; j++) {
+      Q[i + j*n] = (i == j) ? 0.01 : 0;
+      for (u32 k = 0; k < n; k++) {
+        Q[i + j*n] += A[i*n + k] * A[j*n + k];
+      }
+    }
+  }
+}
+
+/* Run warm started LAMBDA over a slowly changing problem, checking it always
+ * matches the cold start. */
+static void check_warm_sequence(u32 m)
+{
+  u32 n = LAMBDA_N;
+  double Q[n * n];
+  double dQ[n * n];
+  double a[n];
+  random_cov(n, Q);
+  arr_frand(n, -100, 100, a);
+
+  lambda_warm_t w;
+  lambda_warm_init(&w);
+
+  for (u32 t = 0; t < LAMBDA_EPOCHS; t++) {
+    /* Small symmetric perturbation keeping Q positive definite. */
+    random_cov(n, dQ);
+    for (u32 i = 0; i < n * n; i++) {
+      Q[i] = 0.98 * Q[i] + 0.02 * dQ[i];
+    }
+    for (u32 i = 0; i < n; i++) {
+      a[i] += frand(-0.1, 0.1);
+    }
+
+    double F[n * m];
+    double s[m];
+    double F_warm[n * m];
+    double s_warm[m];
+    fail_unless(lambda_solution(n, m, a, Q, F, s) == 0);
+    fail_unless(lambda_solution_warm(&w, n, m, a, Q, F_warm, s_warm) == 0,
+                "Warm start failed at epoch %u", t);
+    fail_unless(w.n == (int)n);
+
+    for (u32 k = 0; k < m; k++) {
+      fail_unless(fabs(s[k] - s_warm[k]) < 1e-6 * MAX(1, s[k]),
+                  "Distance mismatch at epoch %u, %g != %g",
+                  t, s[k], s_warm[k]);
+    }
+    /* The best solution is unique almost surely. */
+    for (u32 i = 0; i < n; i++) {
+      fail_unless(round(F[i]) == round(F_warm[i]),
+                  "Fix mismatch at epoch %u", t);
+    }
+  }
+}
+
+START_TEST(test_lambda_warm)
+{
+  seed_rng();
+  check_warm_sequence(1);
+  check_warm_sequence(3);
+}
+END_TEST
+
+START_TEST(test_lambda_warm_dims)
+{
+  seed_rng();
+  lambda_warm_t w;
+  lambda_warm_init(&w);
+
+  /* A change of dimension starts cold. The search of these random problems
+   * exceeds LOOPMAX well before the largest MAX_CHANNELS allows. */
+  for (u32 n = 1; n <= MIN(LAMBDA_WARM_MAX_DIM, 2 * LAMBDA_N); n++) {
+    double Q[n * n];
+    double a[n];
+    double F[n];
+    double F_cold[n];
+    double s, s_cold;
+    random_cov(n, Q);
+    arr_frand(n, -10, 10, a);
+    fail_unless(lambda_solution_warm(&w, n, 1, a, Q, F, &s) == 0,
+                "Warm start failed for n = %u", n);
+    fail_unless(w.n == (int)n && w.has_fix);
+    fail_unless(lambda_solution(n, 1, a, Q, F_cold, &s_cold) == 0);
+    fail_unless(within_epsilon(s, s_cold));
+  }
+
+  double Q[1] = {1};
+  double a[1] = {0};
+  double F[1];
+  double s;
+  fail_unless(lambda_solution_warm(&w, 0, 1, a, Q, F, &s) == -1);
+  fail_unless(lambda_solution_warm(&w, LAMBDA_WARM_MAX_DIM + 1, 1,
+                                   a, Q, F, &s) == -1);
+}
+END_TEST
+
+/* Splitting the search only changes the loop budget, not the solution. */
+START_TEST(test_lambda_split)
+{
+  seed_rng();
+  for (u32 t = 0; t < 100; t++) {
+    u32 n = 2 + t % 15;
+    u32 m = 1 + t % 3;
+    double Q[n * n];
+    double a[n];
+    double F[n * m];
+    double s[m];
+    random_cov(n, Q);
+    arr_frand(n, -10, 10, a);
+    if (lambda_solution(n, m, a, Q, F, s) != 0) {
+      continue;
+    }
+
+    for (u32 levels = 1; levels <= n; levels++) {
+      double F_split[n * m];
+      double s_split[m];
+      fail_unless(lambda_solution_split(n, m, levels, a, Q,
+                                        F_split, s_split) == 0,
+                  "Split search failed for n = %u, levels = %u", n, levels);
+      for (u32 k = 0; k < m; k++) {
+        fail_unless(s_split[k] == s[k],
+                    "Distance mismatch for n = %u, levels = %u, %g != %g",
+                    n, levels, s_split[k], s[k]);
+      }
+      fail_unless(memcmp(F_split, F, sizeof(F)) == 0,
+                  "Fix mismatch for n = %u, levels = %u", n, levels);
+    }
+  }
+}
+END_TEST
+
+/* The search within a radius finds the same closest solutions, and all of
+ * those within the radius when there are fewer than asked for. */
+START_TEST(test_lambda_search)
+{
+  seed_rng();
+  for (u32 t = 0; t < 100; t++) {
+    u32 n = 1 + t % 10;
+    u32 m = 8;
+    double Q[n * n];
+    double a[n];
+    double F[n * m];
+    double s[m];
+    random_cov(n, Q);
+    arr_frand(n, -10, 10, a);
+    if (lambda_solution(n, m, a, Q, F, s) != 0) {
+      continue;
+    }
+
+    double L[n * n];
+    double D[n];
+    double Z[n * n];
+    double Zi[n * n];
+    fail_unless(lambda_factor(n, Q, L, D, Z, Zi) == 0);
+
+    double F_r[n * m];
+    double s_r[m];
+    fail_unless(lambda_search(n, m, L, D, Z, Zi, a, 1E99, F_r, s_r) == (int)m);
+    for (u32 k = 0; k < m; k++) {
+      fail_unless(fabs(s_r[k] - s[k]) < 1e-9 * MAX(1, s[k]),
+                  "Distance mismatch for n = %u, %g != %g", n, s_r[k], s[k]);
+    }
+    for (u32 i = 0; i < n; i++) {
+      fail_unless(round(F_r[i]) == round(F[i]), "Fix mismatch for n = %u", n);
+    }
+
+    /* Within a radius between the third and fourth solutions. */
+    if (s[3] - s[2] < 1e-6 * MAX(1, s[3])) {
+      continue;
+    }
+    double r = (s[2] + s[3]) / 2;
+    fail_unless(lambda_search(n, m, L, D, Z, Zi, a, r, F_r, s_r) == 3,
+                "Expected 3 solutions within the radius for n = %u", n);
+    for (u32 k = 0; k < 3; k++) {
+      fail_unless(fabs(s_r[k] - s[k]) < 1e-9 * MAX(1, s[k]));
+    }
+    fail_unless(lambda_search(n, m, L, D, Z, Zi, a, s[0] / 2, F_r, s_r) == 0);
+  }
+}
+END_TEST
+
+/* Executor running the tasks sequentially in reverse order and counting
+ * them. */
+typedef struct {
+  u32 n_runs;
+  u32 max_tasks;
+} run_stats_t;
+
+static void run_reversed(void *ctx, u32 n_tasks,
+                         void (*task)(void *arg, u32 i), void *arg)
+{
+  run_stats_t *stats = (run_stats_t *)ctx;
+  for (u32 i = n_tasks; i > 0; i--) {
+    task(arg, i - 1);
+  }
+  stats->n_runs++;
+  stats->max_tasks = MAX(stats->max_tasks, n_tasks);
+}
+
+START_TEST(test_lambda_parallel)
+{
+  seed_rng();
+  for (u32 t = 0; t < 100; t++) {
+    u32 n = 2 + t % 15;
+    u32 m = 1 + t % 3;
+    double Q[n * n];
+    double a[n];
+    double F[n * m];
+    double s[m];
+    random_cov(n, Q);
+    arr_frand(n, -10, 10, a);
+    if (lambda_solution(n, m, a, Q, F, s) != 0) {
+      continue;
+    }
+
+    u32 workers[] = {0, 1, 2, 3, 4, 1000};
+    for (u32 w = 0; w < sizeof(workers) / sizeof(workers[0]); w++) {
+      u32 n_workers = workers[w];
+      run_stats_t stats = {0, 0};
+      executor_t ex = {
+        .n_workers = n_workers,
+        .ctx = &stats,
+        .run = &run_reversed
+      };
+      for (u32 levels = 1; levels < n; levels++) {
+        double F_par[n * m];
+        double s_par[m];
+        fail_unless(lambda_solution_parallel(n_workers ? &ex : NULL,
+                                             n, m, levels, a, Q,
+                                             F_par, s_par) == 0,
+                    "Parallel search failed for n = %u, levels = %u, "
+                    "%u workers", n, levels, n_workers);
+        for (u32 k = 0; k < m; k++) {
+          fail_unless(s_par[k] == s[k],
+                      "Distance mismatch for n = %u, levels = %u, %g != %g",
+                      n, levels, s_par[k], s[k]);
+        }
+        fail_unless(memcmp(F_par, F, sizeof(F)) == 0,
+                    "Fix mismatch for n = %u, levels = %u, %u workers",
+                    n, levels, n_workers);
+      }
+      /* The task count is capped, whatever the number of workers. */
+      fail_unless(stats.max_tasks <= MIN(n_workers, LAMBDA_MAX_TASKS),
+                  "Ran %u tasks with %u workers", stats.max_tasks,
+                  n_workers);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_lambda_success_rate)
+{
+  /* Uncorrelated ambiguities, bootstrapping is rounding each one. */
+  double var[3] = {0.01, 0.09, 0.04};
+  double Q[9] = {0};
+  double p = 1;
+  for (u32 i = 0; i < 3; i++) {
+    Q[i * 3 + i] = var[i];
+    p *= erf(1 / (2 * sqrt(2 * var[i])));
+  }
+  double rate = lambda_success_rate(3, Q);
+  fail_unless(fabs(rate - p) < 1e-12, "Success rate %f, expected %f",
+              rate, p);
+
+  /* A tighter float solution is more likely to fix. */
+  for (u32 i = 0; i < 3; i++) {
+    Q[i * 3 + i] *= 0.25;
+  }
+  fail_unless(lambda_success_rate(3, Q) > rate);
+  fail_unless(lambda_success_rate(0, Q) < 0);
+}
+END_TEST
+
+/* Correlated covariance scaled so that every ambiguity can be fixed. */
+START_TEST(test_lambda_partial_full)
+{
+  seed_rng();
+  u32 n = LAMBDA_N;
+  double Q[n * n];
+  double a[n];
+  double F[n];
+  double F_full[n * 2];
+  double s[2];
+  bool fixed[n];
+  random_cov(n, Q);
+  for (u32 i = 0; i < n * n; i++) {
+    Q[i] *= 1e-4;
+  }
+  for (u32 i = 0; i < n; i++) {
+    a[i] = round(frand(-100, 100)) + frand(-0.01, 0.01);
+  }
+
+  int nf = lambda_partial(n, a, Q, 0.999, 3, F, fixed);
+  fail_unless(nf == (int)n, "Fixed %d ambiguities", nf);
+  fail_unless(lambda_solution(n, 2, a, Q, F_full, s) == 0);
+  for (u32 i = 0; i < n; i++) {
+    fail_unless(fixed[i]);
+    fail_unless(F[i] == round(F_full[i]), "Fix mismatch for %u", i);
+    fail_unless(F[i] == round(a[i]));
+  }
+
+  /* Unreachable thresholds fix nothing. */
+  fail_unless(lambda_partial(n, a, Q, 1.1, 3, F, fixed) == 0);
+  fail_unless(lambda_partial(n, a, Q, 0.999, 1e99, F, fixed) == 0);
+  for (u32 i = 0; i < n; i++) {
+    fail_unless(!fixed[i] && F[i] == a[i]);
+  }
+
+  fail_unless(lambda_partial(0, a, Q, 0.999, 3, F, fixed) == -1);
+}
+END_TEST
+
+/* Only the well determined ambiguities are fixed. */
+START_TEST(test_lambda_partial_subset)
+{
+  seed_rng();
+  u32 n = LAMBDA_N;
+  double Q[n * n];
+  double a[n];
+  double F[n];
+  bool fixed[n];
+  bool good[n];
+
+  memset(Q, 0, sizeof(Q));
+  for (u32 i = 0; i < n; i++) {
+    good[i] = i % 3 == 0;
+    Q[i + i*n] = good[i] ? 1e-4 : 10;
+    a[i] = round(frand(-100, 100)) + (good[i] ? frand(-0.01, 0.01)
+                                              : frand(-0.5, 0.5));
+  }
+
+  int nf = lambda_partial(n, a, Q, 0.999, 3, F, fixed);
+  fail_unless(nf == 3, "Fixed %d ambiguities", nf);
+  for (u32 i = 0; i < n; i++) {
+    fail_unless(fixed[i] == good[i], "Wrong subset at %u", i);
+    fail_unless(F[i] == (good[i] ? round(a[i]) : a[i]));
+  }
+}
+END_TEST
+
+Suite* lambda_suite(void)
+{
+  Suite *s = suite_create("LAMBDA");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_lambda_warm);
+  tcase_add_test(tc_core, test_lambda_warm_dims);
+  tcase_add_test(tc_core, test_lambda_split);
+  tcase_add_test(tc_core, test_lambda_search);
+  tcase_add_test(tc_core, test_lambda_parallel);
+  tcase_add_test(tc_core, test_lambda_success_rate);
+  tcase_add_test(tc_core, test_lambda_partial_full);
+  tcase_add_test(tc_core, test_lambda_partial_subset);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
@@ -337,6 +337,57 @@ START_TEST(test_matrix_reconstruct_udu)
 }
 END_TEST
 
+START_TEST(test_matrix_udu_rank_one)
+{
+  seed_rng();
+  for (u32 t = 0; t < LINALG_NUM; t++) {
+    u32 n = sizerand(MSIZE_MAX);
+    double U[n][n];
+    double D[n];
+    double a[n];
+    matrix_eye(n, (double *)U);
+    for (u32 i=0; i<n; i++) {
+      for (u32 j=i+1; j<n; j++) {
+        U[i][j] = frand(-1, 1);
+      }
+      D[i] = frand(0, 10);
+      a[i] = frand(-1, 1);
+    }
+    /* Trailing zeros and zero pivots are skipped. */
+    a[n-1] = 0;
+    D[n / 2] = 0;
+    double c = frand(0, 10);
+
+    double M[n][n];
+    matrix_reconstruct_udu(n, (double *)U, D, (double *)M);
+    for (u32 i=0; i<n; i++) {
+      for (u32 j=0; j<n; j++) {
+        M[i][j] += c * a[i] * a[j];
+      }
+    }
+
+    matrix_udu_rank_one(n, (double *)U, D, c, a);
+
+    for (u32 i=0; i<n; i++) {
+      fail_unless(D[i] >= 0, "D[%u] negative", i);
+      fail_unless(U[i][i] == 1, "U diagonal element != 1");
+      for (u32 j=0; j<i; j++) {
+        fail_unless(U[i][j] == 0, "U lower triangle element != 0");
+      }
+    }
+    double M_[n][n];
+    matrix_reconstruct_udu(n, (double *)U, D, (double *)M_);
+    for (u32 i=0; i<n; i++) {
+      for (u32 j=0; j<n; j++) {
+        fail_unless(fabs(M[i][j] - M_[i][j]) < LINALG_TOL * 1e3,
+          "updated result != direct update, delta[%d][%d] = %g",
+          i, j, fabs(M[i][j] - M_[i][j]));
+      }
+    }
+  }
+}
+END_TEST
+
 START_TEST(test_matrix_add_sc) {
   u32 i, j, t;
 
@@ -799,6 +850,7 @@ Suite* linear_algebra_suite(void) {
   tcase_add_test(tc_core, test_matrix_eye);
   tcase_add_test(tc_core, test_matrix_triu);
   tcase_add_test(tc_core, test_matrix_reconstruct_udu);
+  tcase_add_test(tc_core, test_matrix_udu_rank_one);
   tcase_add_test(tc_core, test_matrix_udu_1);
   tcase_add_test(tc_core, test_matrix_udu_2);
   tcase_add_test(tc_core, test_matrix_udu_3);
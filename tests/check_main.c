@@ -39,6 +39,11 @@ int main(void)
   srunner_add_suite(sr, troposphere_suite());
   srunner_add_suite(sr, correlator_suite());
   srunner_add_suite(sr, counter_checker_suite());
+  srunner_add_suite(sr, nav_snapshot_suite());
+  srunner_add_suite(sr, nav_msg_suite());
+  srunner_add_suite(sr, raim_suite());
+  srunner_add_suite(sr, small_matrix_suite());
+  srunner_add_suite(sr, lambda_suite());
 
   srunner_set_fork_status(sr, CK_NOFORK);
   srunner_run_all(sr, CK_NORMAL);
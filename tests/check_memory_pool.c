@@ -12,13 +12,14 @@ memory_pool_t *test_pool_seq;
 memory_pool_t *test_pool_random;
 memory_pool_t *test_pool_empty;
 
-void setup()
+static void setup_pools(memory_pool_t *(*pool_new)(u32 n_elements,
+                                                    size_t element_size))
 {
   /* Seed the random number generator with a specific seed for our test. */
   srandom(1);
 
   /* Create a new pool and fill it with a sequence of ints. */
-  test_pool_seq = memory_pool_new(50, sizeof(s32));
+  test_pool_seq = pool_new(50, sizeof(s32));
 
   s32 *x;
   for (u32 i=0; i<22; i++) {
@@ -27,7 +28,7 @@ void setup()
     *x = i;
   }
   /* Create a new pool and fill it entirely with random numbers. */
-  test_pool_random = memory_pool_new(20, sizeof(s32));
+  test_pool_random = pool_new(20, sizeof(s32));
 
   for (u32 i=0; i<20; i++) {
     x = (s32 *)memory_pool_add(test_pool_random);
@@ -36,7 +37,17 @@ void setup()
   }
 
   /* Create a new pool and leave it empty. */
-  test_pool_empty = memory_pool_new(50, sizeof(s32));
+  test_pool_empty = pool_new(50, sizeof(s32));
+}
+
+void setup()
+{
+  setup_pools(&memory_pool_new);
+}
+
+static void setup_array(void)
+{
+  setup_pools(&memory_pool_new_array);
 }
 
 void teardown()
@@ -88,6 +99,7 @@ float fsum(float x, element_t *elem)
 START_TEST(test_simple_folds)
 {
   s32 sum;
+  u32 generation = test_pool_seq->generation;
 
   sum = memory_pool_ifold(test_pool_seq, 0, &isum);
   fail_unless(sum == 231,
@@ -104,6 +116,9 @@ START_TEST(test_simple_folds)
   sum = (s32)memory_pool_ffold(test_pool_seq, 22, &fsum);
   fail_unless(sum == 253,
       "Fold failed for fsum function, expected 253, got %d", sum);
+
+  fail_unless(test_pool_seq->generation == generation,
+      "Folds shouldn't change the pool generation");
 }
 END_TEST
 
@@ -673,6 +688,363 @@ START_TEST(test_prod_generator)
 }
 END_TEST
 
+START_TEST(test_array_order)
+{
+  /* Elements of an array layout pool are visited in the order added. */
+  s32 xs[22];
+  s32 test_xs[22];
+  for (u32 i=0; i<22; i++)
+    test_xs[i] = i;
+
+  memory_pool_to_array(test_pool_seq, xs);
+  fail_unless(memcmp(xs, test_xs, sizeof(xs)) == 0,
+      "Output of memory_pool_to_array does not match test data");
+
+  /* Filter compacts the kept elements, preserving their order. */
+  s32 test_xs_evens[11] = {
+    0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20
+  };
+  fail_unless(memory_pool_filter(test_pool_seq, NULL, &even) == 11,
+      "Filtered length does not match");
+  memory_pool_to_array(test_pool_seq, xs);
+  fail_unless(memcmp(xs, test_xs_evens, sizeof(test_xs_evens)) == 0,
+      "Output of filter operation does not match test data");
+
+  /* Freed space is reused. */
+  for (u32 i=0; i<39; i++)
+    fail_unless(memory_pool_add(test_pool_seq) != 0,
+        "Null pointer returned by memory_pool_add");
+  fail_unless(memory_pool_add(test_pool_seq) == 0,
+      "Adding to a full pool should return a NULL pointer.");
+  memory_pool_clear(test_pool_seq);
+
+  /* Groups are in sorted order. */
+  for (u32 i=0; i<22; i++)
+    *(s32 *)memory_pool_add(test_pool_seq) = i;
+  s32 test_xs_reduced[2] = {110, 121};
+  memory_pool_group_by(test_pool_seq, 0, &group_evens, 0, 0, &agg_sum_s32s);
+  fail_unless(memory_pool_n_allocated(test_pool_seq) == 2,
+      "Reduced length does not match");
+  memory_pool_to_array(test_pool_seq, xs);
+  fail_unless(memcmp(xs, test_xs_reduced, sizeof(test_xs_reduced)) == 0,
+      "Output of groupby operation does not match test data");
+}
+END_TEST
+
+/* Executor running the tasks in reverse order, the results should not depend
+ * on the order in which parts are processed. */
+static void run_reversed(void *ctx, u32 n_tasks,
+                         void (*task)(void *arg, u32 i), void *arg)
+{
+  u32 *n_runs = (u32 *)ctx;
+  for (u32 i = n_tasks; i > 0; i--) {
+    task(arg, i - 1);
+    (*n_runs)++;
+  }
+}
+
+void s32_sum(void *x, element_t *elem)
+{
+  *(s32 *)x += *(s32 *)elem;
+}
+
+void s32_combine_sum(void *x, const void *y)
+{
+  *(s32 *)x += *(const s32 *)y;
+}
+
+void min_max_combine(void *x_, const void *y_)
+{
+  min_max_t *x = (min_max_t *)x_;
+  const min_max_t *y = (const min_max_t *)y_;
+  x->min = MIN(x->min, y->min);
+  x->max = MAX(x->max, y->max);
+}
+
+START_TEST(test_parallel)
+{
+  u32 n_workers[] = {1, 3, 7, 64};
+
+  for (u32 k=0; k<sizeof(n_workers)/sizeof(n_workers[0]); k++) {
+    u32 n_runs = 0;
+    executor_t ex = {
+      .n_workers = n_workers[k],
+      .ctx = &n_runs,
+      .run = &run_reversed
+    };
+
+    s32 sum = 0;
+    fail_unless(memory_pool_fold_parallel(test_pool_seq, &ex, &sum, sizeof(s32),
+                                          &s32_sum, &s32_combine_sum) == 22,
+        "Folded length does not match");
+    fail_unless(sum == 231,
+        "Parallel fold failed, expected 231, got %d", sum);
+    fail_unless(n_runs == n_workers[k],
+        "Expected %d tasks, got %d", n_workers[k], n_runs);
+
+    min_max_t mm = { .min = 1000, .max = -1000 };
+    memory_pool_fold_parallel(test_pool_random, &ex, &mm, sizeof(mm),
+                              &min_max_finder, &min_max_combine);
+    min_max_t mm_seq = { .min = 1000, .max = -1000 };
+    memory_pool_fold(test_pool_random, &mm_seq, &min_max_finder);
+    fail_unless(mm.min == mm_seq.min && mm.max == mm_seq.max,
+        "Parallel fold does not match sequential fold");
+
+    sum = 0;
+    fail_unless(memory_pool_fold_parallel(test_pool_empty, &ex, &sum,
+                                          sizeof(s32), &s32_sum,
+                                          &s32_combine_sum) == 0,
+        "Folded length does not match");
+    fail_unless(sum == 0, "Fold of an empty pool should be x0");
+  }
+
+  /* Map and filter give the same collection as the sequential versions. */
+  s32 xs_seq[22], xs[22];
+  memory_pool_map(test_pool_seq, NULL, &times_two);
+  memory_pool_filter(test_pool_seq, NULL, &less_than_12);
+  s32 n_seq = memory_pool_to_array(test_pool_seq, xs_seq);
+
+  memory_pool_clear(test_pool_seq);
+  for (u32 i=0; i<22; i++)
+    *(s32 *)memory_pool_add(test_pool_seq) = i;
+
+  u32 n_runs = 0;
+  executor_t ex = {.n_workers = 5, .ctx = &n_runs,
+                               .run = &run_reversed};
+  fail_unless(memory_pool_map_parallel(test_pool_seq, &ex, NULL,
+                                       &times_two) == 22,
+      "Mapped length does not match");
+  fail_unless(memory_pool_filter_parallel(test_pool_seq, &ex, NULL,
+                                          &less_than_12) == n_seq,
+      "Filtered length does not match");
+  memory_pool_to_array(test_pool_seq, xs);
+  fail_unless(memcmp(xs, xs_seq, n_seq * sizeof(s32)) == 0,
+      "Output of parallel filter does not match sequential filter");
+
+  /* No executor runs sequentially. */
+  fail_unless(memory_pool_filter_parallel(test_pool_seq, NULL, NULL,
+                                          &even) == n_seq,
+      "Filtered length does not match");
+}
+END_TEST
+
+static s8 sparse_keep(void *arg, element_t *elem)
+{
+  u32 *n_calls = (u32 *)arg;
+  (*n_calls)++;
+  s32 x = *(s32 *)elem;
+  return x % 3 != 0 && x % 7 != 2;
+}
+
+START_TEST(test_filter_parallel_chunks)
+{
+  /* Pools spanning several rounds of the parallel filter, in both layouts,
+   * filter the same as sequentially and visit every element once. */
+  const u32 n = 1000;
+  for (u8 layout = 0; layout < 2; layout++) {
+    memory_pool_t *seq = layout ? memory_pool_new_array(n, sizeof(s32))
+                                : memory_pool_new(n, sizeof(s32));
+    memory_pool_t *par = layout ? memory_pool_new_array(n, sizeof(s32))
+                                : memory_pool_new(n, sizeof(s32));
+    for (u32 i = 0; i < n; i++) {
+      *(s32 *)memory_pool_add(seq) = i;
+      *(s32 *)memory_pool_add(par) = i;
+    }
+
+    u32 n_calls_seq = 0;
+    s32 n_seq = memory_pool_filter(seq, &n_calls_seq, &sparse_keep);
+
+    u32 n_runs = 0;
+    executor_t ex = {.n_workers = 3, .ctx = &n_runs, .run = &run_reversed};
+    u32 n_calls = 0;
+    fail_unless(memory_pool_filter_parallel(par, &ex, &n_calls,
+                                            &sparse_keep) == n_seq,
+        "Filtered length does not match");
+    fail_unless(n_calls == n, "Expected %d calls, got %d", n, n_calls);
+
+    s32 xs_seq[n], xs[n];
+    memory_pool_to_array(seq, xs_seq);
+    memory_pool_to_array(par, xs);
+    fail_unless(memcmp(xs, xs_seq, n_seq * sizeof(s32)) == 0,
+        "Output of parallel filter does not match sequential filter");
+
+    memory_pool_destroy(seq);
+    memory_pool_destroy(par);
+  }
+}
+END_TEST
+
+typedef struct {
+  u32 n_seen;
+  u32 n_batches;
+  s32 seen[1000];
+} batch_record_t;
+
+static void sparse_keep_batch(void *arg, u32 n, element_t **elems, u8 *keep)
+{
+  batch_record_t *r = (batch_record_t *)arg;
+  fail_unless(n > 0 && n <= 128, "Unexpected batch size %d", n);
+  r->n_batches++;
+  for (u32 j = 0; j < n; j++) {
+    s32 x = *(s32 *)elems[j];
+    r->seen[r->n_seen++] = x;
+    keep[j] = x % 3 != 0 && x % 7 != 2;
+  }
+}
+
+START_TEST(test_filter_batch)
+{
+  /* The batches visit every element once, in order, and filter the same as
+   * memory_pool_filter(). */
+  const u32 n = 1000;
+  for (u8 layout = 0; layout < 2; layout++) {
+    memory_pool_t *seq = layout ? memory_pool_new_array(n, sizeof(s32))
+                                : memory_pool_new(n, sizeof(s32));
+    memory_pool_t *bat = layout ? memory_pool_new_array(n, sizeof(s32))
+                                : memory_pool_new(n, sizeof(s32));
+    for (u32 i = 0; i < n; i++) {
+      *(s32 *)memory_pool_add(seq) = i;
+      *(s32 *)memory_pool_add(bat) = i;
+    }
+
+    s32 xs_in[n];
+    memory_pool_to_array(bat, xs_in);
+
+    u32 n_calls_seq = 0;
+    s32 n_seq = memory_pool_filter(seq, &n_calls_seq, &sparse_keep);
+
+    static batch_record_t r;
+    r.n_seen = 0;
+    r.n_batches = 0;
+    fail_unless(memory_pool_filter_batch(bat, &r, &sparse_keep_batch) == n_seq,
+        "Filtered length does not match");
+    fail_unless(r.n_seen == n, "Expected %d elements, got %d", n, r.n_seen);
+    fail_unless(r.n_batches == (n + 127) / 128,
+        "Expected %d batches, got %d", (n + 127) / 128, r.n_batches);
+    fail_unless(memcmp(r.seen, xs_in, n * sizeof(s32)) == 0,
+        "Batches should visit the elements in order");
+
+    s32 xs_seq[n], xs[n];
+    memory_pool_to_array(seq, xs_seq);
+    memory_pool_to_array(bat, xs);
+    fail_unless(memcmp(xs, xs_seq, n_seq * sizeof(s32)) == 0,
+        "Output of batch filter does not match sequential filter");
+
+    memory_pool_destroy(seq);
+    memory_pool_destroy(bat);
+  }
+}
+END_TEST
+
+typedef struct {
+  s32 key;
+  s32 order;
+} keyed_t;
+
+s32 cmp_keys(void *arg, element_t *a_, element_t *b_)
+{
+  (void)arg;
+  keyed_t *a = (keyed_t *)a_;
+  keyed_t *b = (keyed_t *)b_;
+
+  return a->key - b->key;
+}
+
+START_TEST(test_array_sort_stable)
+{
+  /* Sizes around and across the insertion sorted block size. */
+  u32 sizes[] = {2, 19, 20, 21, 40, 77, 500};
+
+  for (u32 k=0; k<sizeof(sizes)/sizeof(sizes[0]); k++) {
+    u32 n = sizes[k];
+    memory_pool_t *pool = memory_pool_new_array(n, sizeof(keyed_t));
+
+    for (u32 i=0; i<n; i++) {
+      keyed_t *x = (keyed_t *)memory_pool_add(pool);
+      x->key = sizerand(8);
+      x->order = i;
+    }
+
+    memory_pool_sort(pool, 0, &cmp_keys);
+
+    keyed_t xs[n];
+    fail_unless(memory_pool_to_array(pool, xs) == (s32)n,
+        "Sorted length does not match");
+    for (u32 i=1; i<n; i++) {
+      fail_unless(xs[i-1].key <= xs[i].key,
+          "Array not sorted at %d (n = %d)", i, n);
+      fail_unless(xs[i-1].key < xs[i].key || xs[i-1].order < xs[i].order,
+          "Array sort not stable at %d (n = %d)", i, n);
+    }
+
+    memory_pool_destroy(pool);
+  }
+}
+END_TEST
+
+START_TEST(test_array_prod)
+{
+  /* The array layout runs out of space at the same point as the list
+   * layout. */
+  for (u32 n_elements=3; n_elements<16; n_elements++) {
+    memory_pool_t *list_pool = memory_pool_new(n_elements, sizeof(hypothesis_t));
+    memory_pool_t *array_pool = memory_pool_new_array(n_elements,
+                                                      sizeof(hypothesis_t));
+
+    for (u32 i=0; i<3; i++) {
+      hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(list_pool);
+      hyp->len = 1;
+      hyp->N[0] = i;
+      hyp->p = 1;
+      memcpy(memory_pool_add(array_pool), hyp, sizeof(hypothesis_t));
+    }
+
+    u8 new_N_vals[4] = {7, 8, 9, 10};
+    s32 list_ret = memory_pool_product(list_pool, new_N_vals, 4, sizeof(u8),
+                                       &prod_N);
+    s32 array_ret = memory_pool_product(array_pool, new_N_vals, 4, sizeof(u8),
+                                        &prod_N);
+    fail_unless(list_ret == array_ret,
+        "Product returned %d for the list layout and %d for the array layout",
+        list_ret, array_ret);
+
+    if (array_ret >= 0) {
+      fail_unless(array_ret == 12, "Product length does not match");
+
+      /* Each original element paired with each new value, in order. */
+      hypothesis_t hyps[12];
+      memory_pool_to_array(array_pool, hyps);
+      for (u32 i=0; i<12; i++) {
+        fail_unless(hyps[i].len == 2 &&
+                    hyps[i].N[0] == i / 4 &&
+                    hyps[i].N[1] == new_N_vals[i % 4],
+                    "Output of product operation does not match test data");
+      }
+
+      test_gen_state_t test_gen_state = {
+        .val = 0,
+        .n_vals = 3,
+        .i = 0
+      };
+      list_ret = memory_pool_product_generator(list_pool, &test_gen_state, 100,
+                                               sizeof(test_gen_state_t),
+                                               &test_init, &test_next,
+                                               &prod_N_gen);
+      array_ret = memory_pool_product_generator(array_pool, &test_gen_state, 100,
+                                                sizeof(test_gen_state_t),
+                                                &test_init, &test_next,
+                                                &prod_N_gen);
+      fail_unless(list_ret == array_ret,
+          "Generator returned %d for the list layout and %d for the array layout",
+          list_ret, array_ret);
+    }
+
+    memory_pool_destroy(list_pool);
+    memory_pool_destroy(array_pool);
+  }
+}
+END_TEST
+
 Suite* memory_pool_suite(void)
 {
   Suite *s = suite_create("Memory Pools");
@@ -697,7 +1069,26 @@ Suite* memory_pool_suite(void)
   tcase_add_test(tc_core, test_groupby_2);
   tcase_add_test(tc_core, test_prod);
   tcase_add_test(tc_core, test_prod_generator);
+  tcase_add_test(tc_core, test_parallel);
+  tcase_add_test(tc_core, test_filter_parallel_chunks);
+  tcase_add_test(tc_core, test_filter_batch);
   suite_add_tcase(s, tc_core);
 
+  TCase *tc_array = tcase_create("Array");
+  tcase_add_checked_fixture (tc_array, setup_array, teardown);
+  tcase_add_test(tc_array, test_simple_folds);
+  tcase_add_test(tc_array, test_general_fold);
+  tcase_add_test(tc_array, test_full);
+  tcase_add_test(tc_array, test_n_free);
+  tcase_add_test(tc_array, test_n_allocated);
+  tcase_add_test(tc_array, test_empty);
+  tcase_add_test(tc_array, test_clear);
+  tcase_add_test(tc_array, test_sort);
+  tcase_add_test(tc_array, test_parallel);
+  tcase_add_test(tc_array, test_array_order);
+  tcase_add_test(tc_array, test_array_sort_stable);
+  tcase_add_test(tc_array, test_array_prod);
+  suite_add_tcase(s, tc_array);
+
   return s;
 }
@@ -0,0 +1,302 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libswiftnav/bits.h>
+#include <libswiftnav/nav_msg.h>
+
+/* Parity masks for D25..D30, see ICD-GPS-200E Table 20-XIV. */
+static const u32 parity_masks[6] = {
+  0xBB1F34A0, 0x5D8F9A50, 0xAEC7CD08, 0x5763E684, 0x6BB1F342, 0x8B7A89C1
+};
+
+/* Encode 24 data bits into a transmitted word with parity, given the last two
+ * bits of the previous word. */
+static u32 encode_word(u32 data, u32 prev)
+{
+  u32 w = (prev & 3) << 30 | (data & 0xFFFFFF) << 6;
+  for (u8 i = 0; i < 6; i++) {
+    if (parity(w & parity_masks[i])) {
+      w |= 1 << (5 - i);
+    }
+  }
+  if (w & 1 << 30) {
+    w ^= 0x3FFFFFC0;
+  }
+  return w;
+}
+
+/* Executor running the tasks sequentially in reverse order and counting
+ * them. */
+static void run_reversed(void *ctx, u32 n_tasks,
+                         void (*task)(void *arg, u32 i), void *arg)
+{
+  u32 *n_runs = (u32 *)ctx;
+  for (u32 i = n_tasks; i > 0; i--) {
+    task(arg, i - 1);
+    (*n_runs)++;
+  }
+}
+
+/* Build a subframe with the given subframe id and data bits for words 3..10.
+ * Returns the decoded (data bits in 30 LSBs) version of words 3..10. */
+static void build_subframe(gps_l1ca_subframe_t *sf, u16 prn, u8 sf_id,
+                           const u32 data[8], u32 frame_words[8])
+{
+  sf->sid = construct_sid(CODE_GPS_L1CA, prn);
+  sf->words[0] = encode_word(0x8B0000, 0);
+  sf->words[1] = encode_word((u32)sf_id << 2, sf->words[0]);
+  for (u8 w = 0; w < 8; w++) {
+    sf->words[w + 2] = encode_word(data[w], sf->words[w + 1]);
+    if (frame_words) {
+      frame_words[w] = data[w] << 6;
+    }
+  }
+}
+
+/* Subframes 1 to 3 with matching IODC / IODE. */
+static void build_ephemeris(gps_l1ca_subframe_t sf[3], u16 prn, u8 iode,
+                            u32 frame_words[4][8])
+{
+  u32 sf1[8] = {0};
+  u32 sf2[8] = {0};
+  u32 sf3[8] = {0};
+
+  /* WN 852 (mod 1024), IODC MSBs 0 */
+  sf1[0] = 852 << 14;
+  /* IODC LSBs, t_oc */
+  sf1[5] = (u32)iode << 16 | 0x1C2;
+  sf1[6] = 0x123456;
+  /* IODE, crs */
+  sf2[0] = (u32)iode << 16 | 0x0ABC;
+  /* sqrta */
+  sf2[5] = 0xA1;
+  sf2[6] = 0x0D8E34;
+  /* t_oe */
+  sf2[7] = 0x1C2 << 8;
+  /* omega0, inc */
+  sf3[0] = 0x00012;
+  sf3[1] = 0x345678;
+  sf3[3] = 0x28AA11;
+  /* IODE */
+  sf3[7] = (u32)iode << 16;
+
+  build_subframe(&sf[0], prn, 1, sf1, frame_words[0]);
+  build_subframe(&sf[1], prn, 2, sf2, frame_words[1]);
+  build_subframe(&sf[2], prn, 3, sf3, frame_words[2]);
+}
+
+START_TEST(test_decode_subframes)
+{
+  gps_l1ca_nav_store_t *s = malloc(sizeof(gps_l1ca_nav_store_t));
+  nav_store_init(s);
+
+  gps_l1ca_subframe_t sf[12];
+  u32 fw_a[4][8], fw_b[4][8], fw_c[4][8];
+
+  /* Interleave two satellites, then a new ephemeris for the first. */
+  build_ephemeris(&sf[0], 3, 10, fw_a);
+  build_ephemeris(&sf[3], 17, 20, fw_b);
+  gps_l1ca_subframe_t tmp[6];
+  memcpy(tmp, sf, sizeof(tmp));
+  for (u8 i = 0; i < 3; i++) {
+    sf[2*i] = tmp[i];
+    sf[2*i + 1] = tmp[i + 3];
+  }
+  build_ephemeris(&sf[6], 3, 11, fw_c);
+  /* Repeat of the same ephemeris doesn't produce a new output. */
+  build_ephemeris(&sf[9], 17, 20, fw_b);
+
+  ephemeris_t out[4];
+  u32 n = decode_subframes(s, sf, 12, out, 4);
+  fail_unless(n == 3, "Expected 3 ephemerides, got %d", n);
+
+  ephemeris_t e;
+  memset(&e, 0, sizeof(e));
+  e.sid = construct_sid(CODE_GPS_L1CA, 3);
+  decode_ephemeris(fw_a, &e);
+  fail_unless(e.valid);
+  fail_unless(ephemeris_equal(&e, &out[0]));
+
+  e.sid = construct_sid(CODE_GPS_L1CA, 17);
+  decode_ephemeris(fw_b, &e);
+  fail_unless(ephemeris_equal(&e, &out[1]));
+  fail_unless(ephemeris_equal(&e, &s->ephemerides[17 - 1]));
+
+  e.sid = construct_sid(CODE_GPS_L1CA, 3);
+  decode_ephemeris(fw_c, &e);
+  fail_unless(ephemeris_equal(&e, &out[2]));
+  fail_unless(ephemeris_equal(&e, &s->ephemerides[3 - 1]));
+  fail_unless(out[2].kepler.iode == 11);
+
+  fail_unless(s->n_parity_errors == 0);
+  fail_unless(!s->iono_valid);
+  fail_unless(!s->l2c_capability_valid);
+
+  free(s);
+}
+END_TEST
+
+START_TEST(test_decode_subframes_parity)
+{
+  gps_l1ca_nav_store_t *s = malloc(sizeof(gps_l1ca_nav_store_t));
+  nav_store_init(s);
+
+  gps_l1ca_subframe_t sf[3];
+  u32 fw[4][8];
+  build_ephemeris(sf, 5, 33, fw);
+
+  /* Corrupt a bit in subframe 2, the ephemeris must not be decoded. */
+  sf[1].words[6] ^= 1 << 12;
+  ephemeris_t out[1];
+  fail_unless(decode_subframes(s, sf, 3, out, 1) == 0);
+  fail_unless(s->n_parity_errors == 1);
+  fail_unless(!s->ephemerides[5 - 1].valid);
+
+  /* Fixed, the ephemeris decodes. */
+  sf[1].words[6] ^= 1 << 12;
+  fail_unless(decode_subframes(s, sf, 3, out, 1) == 1);
+  fail_unless(out[0].valid);
+
+  /* Out of order subframes are ignored. */
+  nav_store_init(s);
+  gps_l1ca_subframe_t swapped[3] = {sf[0], sf[2], sf[1]};
+  fail_unless(decode_subframes(s, swapped, 3, NULL, 0) == 0);
+  fail_unless(!s->ephemerides[5 - 1].valid);
+
+  free(s);
+}
+END_TEST
+
+START_TEST(test_decode_subframes_sf4)
+{
+  gps_l1ca_nav_store_t *s = malloc(sizeof(gps_l1ca_nav_store_t));
+  nav_store_init(s);
+
+  /* 4th SF real data at 11-May-2016, see check_ionosphere.c */
+  u32 iono_words[8] = {0x1e0300c9, 0x7fff8c24, 0x23fbdc2, 0, 0, 0, 0, 0};
+  u32 data[8];
+  for (u8 i = 0; i < 8; i++) {
+    data[i] = iono_words[i] >> 6 & 0xFFFFFF;
+  }
+
+  gps_l1ca_subframe_t sf[2];
+  u32 fw[8];
+  build_subframe(&sf[0], 9, 4, data, fw);
+
+  /* Page 25 (ID 63), all SVs L2C capable. */
+  u32 l2c[8] = {0x3F << 16 | 0x2222,
+                0x222222, 0x222222, 0x222222, 0x222222, 0x222200, 0, 0};
+  build_subframe(&sf[1], 9, 4, l2c, NULL);
+
+  fail_unless(decode_subframes(s, sf, 2, NULL, 0) == 0);
+  fail_unless(s->iono_valid);
+  fail_unless(s->l2c_capability_valid);
+
+  ionosphere_t iono;
+  decode_iono_parameters(fw, &iono);
+  fail_unless(memcmp(&iono, &s->iono, sizeof(iono)) == 0);
+  fail_unless(s->gps_l2c_sv_capability == 0xFFFFFFFF,
+              "L2C capability 0x%08x", s->gps_l2c_sv_capability);
+
+  free(s);
+}
+END_TEST
+
+START_TEST(test_decode_subframes_parallel)
+{
+  const u32 n_workers = 3;
+  gps_l1ca_nav_store_t *serial = malloc(sizeof(gps_l1ca_nav_store_t));
+  gps_l1ca_nav_store_t *stores =
+    malloc(n_workers * sizeof(gps_l1ca_nav_store_t));
+
+  /* PRN 3 is in group 2, PRNs 5 and 17 in group 1, group 0 is empty. */
+  gps_l1ca_subframe_t sf[12];
+  u32 fw[4][8];
+  build_ephemeris(&sf[0], 3, 10, fw);
+  build_ephemeris(&sf[3], 17, 20, fw);
+  build_ephemeris(&sf[6], 5, 30, fw);
+  build_ephemeris(&sf[9], 3, 11, fw);
+
+  nav_store_init(serial);
+  ephemeris_t out_serial[4];
+  fail_unless(decode_subframes(serial, sf, 12, out_serial, 4) == 4);
+
+  /* Enough working area for the capacities used below. */
+  size_t work_size = DECODE_SUBFRAMES_WORK_SIZE(n_workers, 12, 6);
+  void *work = malloc(work_size);
+
+  /* No executor decodes everything into the first store. */
+  ephemeris_t out[6];
+  nav_store_init(&stores[0]);
+  fail_unless(decode_subframes_parallel(NULL, stores, sf, 12, out, 6,
+                                        work, work_size) == 4);
+  for (u8 i = 0; i < 4; i++) {
+    fail_unless(ephemeris_equal(&out[i], &out_serial[i]));
+  }
+  fail_unless(memcmp(&stores[0], serial, sizeof(*serial)) == 0);
+
+  u32 n_runs = 0;
+  executor_t ex = {
+    .n_workers = n_workers,
+    .ctx = &n_runs,
+    .run = &run_reversed
+  };
+  for (u32 k = 0; k < n_workers; k++) {
+    nav_store_init(&stores[k]);
+  }
+  s32 n = decode_subframes_parallel(&ex, stores, sf, 12, out, 6,
+                                    work, work_size);
+  fail_unless(n == 4, "Expected 4 ephemerides, got %d", n);
+  fail_unless(n_runs == n_workers);
+
+  /* Same ephemerides in the same order as the serial decode. */
+  for (u8 i = 0; i < 4; i++) {
+    fail_unless(ephemeris_equal(&out[i], &out_serial[i]),
+                "Ephemeris %d out of order", i);
+  }
+
+  for (u16 sat = 0; sat < NUM_SATS_GPS; sat++) {
+    gps_l1ca_nav_store_t *s = &stores[sat % n_workers];
+    fail_unless(ephemeris_equal(&s->ephemerides[sat],
+                                &serial->ephemerides[sat]),
+                "Ephemeris mismatch for sat %d", sat);
+    fail_unless(memcmp(s->frame_words[sat], serial->frame_words[sat],
+                       sizeof(serial->frame_words[sat])) == 0);
+  }
+
+  /* A short output keeps the first ephemerides, even when most of them come
+   * from one group. */
+  for (u32 k = 0; k < n_workers; k++) {
+    nav_store_init(&stores[k]);
+  }
+  n = decode_subframes_parallel(&ex, stores, sf, 12, out, 3,
+                                work, work_size);
+  fail_unless(n == 3, "Expected 3 ephemerides, got %d", n);
+  for (u8 i = 0; i < 3; i++) {
+    fail_unless(ephemeris_equal(&out[i], &out_serial[i]));
+  }
+
+  /* Too small a working area is rejected. */
+  fail_unless(decode_subframes_parallel(&ex, stores, sf, 12, out, 6,
+                                        work, work_size - 1) == -1);
+
+  free(work);
+  free(stores);
+  free(serial);
+}
+END_TEST
+
+Suite* nav_msg_suite(void)
+{
+  Suite *s = suite_create("Nav message");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_decode_subframes);
+  tcase_add_test(tc_core, test_decode_subframes_parity);
+  tcase_add_test(tc_core, test_decode_subframes_sf4);
+  tcase_add_test(tc_core, test_decode_subframes_parallel);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
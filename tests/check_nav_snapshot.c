@@ -0,0 +1,175 @@
+#include <check.h>
+#include <string.h>
+
+#include <libswiftnav/nav_snapshot.h>
+
+static void fill_snapshot(nav_snapshot_t *s, ephemeris_t *e, almanac_t *a)
+{
+  memset(e, 0, 3 * sizeof(ephemeris_t));
+  memset(a, 0, 2 * sizeof(almanac_t));
+
+  e[0].sid = construct_sid(CODE_GPS_L1CA, 5);
+  e[0].toe = (gps_time_t){.wn = 1876, .tow = 7200};
+  e[0].ura = 2.0;
+  e[0].fit_interval = 4 * 3600;
+  e[0].valid = 1;
+  e[0].healthy = 1;
+  e[0].kepler.sqrta = 5153.7;
+  e[0].kepler.ecc = 0.01;
+  e[0].kepler.af2 = -1e-20;
+  e[0].kepler.toc = e[0].toe;
+  e[0].kepler.iodc = 300;
+  e[0].kepler.iode = 44;
+
+  e[1].sid = construct_sid(CODE_GLO_L1CA, 3);
+  e[1].toe = (gps_time_t){.wn = 1876, .tow = 7000};
+  e[1].fit_interval = 1800;
+  e[1].valid = 1;
+  e[1].glo.gamma = 1e-12;
+  e[1].glo.pos[2] = 19e6;
+  e[1].glo.acc[0] = 3e-6;
+
+  /* Stale SBAS ephemeris, should be filtered on load. */
+  e[2].sid = construct_sid(CODE_SBAS_L1CA, 125);
+  e[2].toe = (gps_time_t){.wn = 1875, .tow = 7200};
+  e[2].fit_interval = 240;
+  e[2].valid = 1;
+  e[2].xyz.pos[0] = 4e7;
+
+  a[0].sid = construct_sid(CODE_GPS_L1CA, 7);
+  a[0].toa = (gps_time_t){.wn = 1876, .tow = 0};
+  a[0].fit_interval = 6 * 24 * 3600;
+  a[0].valid = 1;
+  a[0].kepler.inc = 0.3;
+
+  /* Invalid almanac, should be filtered on load. */
+  a[1].sid = construct_sid(CODE_GLO_L1CA, 9);
+  a[1].toa = (gps_time_t){.wn = 1876, .tow = 0};
+  a[1].fit_interval = 6 * 24 * 3600;
+  a[1].glo.epsilon = 0.001;
+
+  memset(s, 0, sizeof(*s));
+  s->ephemerides = e;
+  s->n_ephemerides = 3;
+  s->almanacs = a;
+  s->n_almanacs = 2;
+  s->iono = (ionosphere_t){.a0 = 1e-8, .a3 = -2e-7, .b0 = 9e4, .b3 = 1e5};
+  s->iono_valid = true;
+  s->gps_l2c_sv_capability = 0x12345678;
+  s->l2c_capability_valid = true;
+}
+
+START_TEST(test_nav_snapshot_roundtrip)
+{
+  ephemeris_t e[3];
+  almanac_t a[2];
+  nav_snapshot_t s;
+  fill_snapshot(&s, e, a);
+
+  u8 buff[2048];
+  s32 len = nav_snapshot_save(&s, buff, sizeof(buff));
+  fail_unless(len == (s32)nav_snapshot_size(&s),
+              "Snapshot length mismatch %d", len);
+
+  ephemeris_t e_out[3];
+  almanac_t a_out[2];
+  nav_snapshot_t out = {.ephemerides = e_out, .n_ephemerides = 3,
+                        .almanacs = a_out, .n_almanacs = 2};
+
+  /* Without a time only the valid flag is used to filter. */
+  fail_unless(nav_snapshot_load(buff, len, NULL, &out) == NAV_SNAPSHOT_OK);
+  fail_unless(out.n_ephemerides == 3);
+  fail_unless(out.n_almanacs == 1);
+  for (u8 i = 0; i < 3; i++) {
+    fail_unless(ephemeris_equal(&e[i], &e_out[i]),
+                "Ephemeris %d not restored", i);
+  }
+  fail_unless(e_out[1].glo.gamma == e[1].glo.gamma);
+  fail_unless(e_out[1].glo.tau == e[1].glo.tau);
+  fail_unless(almanac_equal(&a[0], &a_out[0]));
+  fail_unless(out.iono_valid);
+  fail_unless(memcmp(&out.iono, &s.iono, sizeof(ionosphere_t)) == 0);
+  fail_unless(out.l2c_capability_valid);
+  fail_unless(out.gps_l2c_sv_capability == 0x12345678);
+
+  /* With a time the stale SBAS ephemeris is dropped. */
+  gps_time_t t = {.wn = 1876, .tow = 7500};
+  out.n_ephemerides = 3;
+  out.n_almanacs = 2;
+  fail_unless(nav_snapshot_load(buff, len, &t, &out) == NAV_SNAPSHOT_OK);
+  fail_unless(out.n_ephemerides == 2);
+  fail_unless(sid_is_equal(e_out[0].sid, e[0].sid));
+  fail_unless(sid_is_equal(e_out[1].sid, e[1].sid));
+  fail_unless(out.n_almanacs == 1);
+
+  /* Records that don't fit are dropped. */
+  out.n_ephemerides = 1;
+  out.n_almanacs = 0;
+  fail_unless(nav_snapshot_load(buff, len, &t, &out) == NAV_SNAPSHOT_OK);
+  fail_unless(out.n_ephemerides == 1);
+  fail_unless(out.n_almanacs == 0);
+}
+END_TEST
+
+START_TEST(test_nav_snapshot_errors)
+{
+  ephemeris_t e[3];
+  almanac_t a[2];
+  nav_snapshot_t s;
+  fill_snapshot(&s, e, a);
+
+  u8 buff[2048];
+  fail_unless(nav_snapshot_save(&s, buff, 10) == NAV_SNAPSHOT_ERR_SHORT);
+  s32 len = nav_snapshot_save(&s, buff, sizeof(buff));
+  fail_unless(len > 0);
+
+  ephemeris_t e_out[3];
+  almanac_t a_out[2];
+  nav_snapshot_t out = {.ephemerides = e_out, .n_ephemerides = 3,
+                        .almanacs = a_out, .n_almanacs = 2};
+
+  fail_unless(nav_snapshot_load(buff, len - 1, NULL, &out) ==
+              NAV_SNAPSHOT_ERR_SHORT);
+
+  buff[len / 2] ^= 0x10;
+  fail_unless(nav_snapshot_load(buff, len, NULL, &out) ==
+              NAV_SNAPSHOT_ERR_CRC);
+  buff[len / 2] ^= 0x10;
+
+  buff[2] = NAV_SNAPSHOT_VERSION + 1;
+  fail_unless(nav_snapshot_load(buff, len, NULL, &out) ==
+              NAV_SNAPSHOT_ERR_VERSION);
+  buff[2] = NAV_SNAPSHOT_VERSION;
+
+  buff[0] = 0;
+  fail_unless(nav_snapshot_load(buff, len, NULL, &out) ==
+              NAV_SNAPSHOT_ERR_MAGIC);
+
+  /* State is untouched by failed loads. */
+  fail_unless(out.n_ephemerides == 3);
+  fail_unless(out.n_almanacs == 2);
+  fail_unless(!out.iono_valid);
+
+  /* Empty state round trips. */
+  nav_snapshot_t empty = {0};
+  len = nav_snapshot_save(&empty, buff, sizeof(buff));
+  fail_unless(len == NAV_SNAPSHOT_HEADER_LEN + NAV_SNAPSHOT_CRC_LEN);
+  fail_unless(nav_snapshot_load(buff, len, NULL, &out) == NAV_SNAPSHOT_OK);
+  fail_unless(out.n_ephemerides == 0);
+  fail_unless(out.n_almanacs == 0);
+  fail_unless(!out.iono_valid);
+  fail_unless(!out.l2c_capability_valid);
+}
+END_TEST
+
+Suite* nav_snapshot_suite(void)
+{
+  Suite *s = suite_create("Navigation data snapshot");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_nav_snapshot_roundtrip);
+  tcase_add_test(tc_core, test_nav_snapshot_errors);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
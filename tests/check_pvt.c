@@ -6,6 +6,18 @@
 
 #include "check_utils.h"
 
+/* Executor running the tasks sequentially in reverse order and counting
+ * them. */
+static void run_reversed(void *ctx, u32 n_tasks,
+                         void (*task)(void *arg, u32 i), void *arg)
+{
+  u32 *n_runs = (u32 *)ctx;
+  for (u32 i = n_tasks; i > 0; i--) {
+    task(arg, i - 1);
+    (*n_runs)++;
+  }
+}
+
 static navigation_measurement_t nm1 = {
   .sid = {.sat = 9},
   .pseudorange = 23946993.888943646,
@@ -146,6 +158,139 @@ START_TEST(test_dops)
 }
 END_TEST
 
+START_TEST(test_pvt_ctx_warm_start)
+{
+  u8 n_used = 6;
+  gnss_solution soln_cold, soln_warm;
+  dops_t dops_cold, dops_warm;
+
+  navigation_measurement_t nms[6] =
+    {nm1, nm2, nm3, nm4, nm5, nm6};
+
+  pvt_ctx_t ctx;
+  pvt_ctx_init(&ctx);
+  fail_unless(!ctx.valid);
+
+  s8 code = calc_PVT_ctx(&ctx, n_used, nms, false, &soln_cold, &dops_cold);
+  fail_unless(code >= 0, "Return code should be >=0 (success). Saw: %d\n",
+              code);
+  fail_unless(ctx.valid, "Context should hold the solution");
+  fail_unless(ctx.n_sids == n_used, "Context should cache the geometry");
+
+  /* Warm started and reusing the cached geometry gives the same answer. */
+  code = calc_PVT_ctx(&ctx, n_used, nms, false, &soln_warm, &dops_warm);
+  fail_unless(code >= 0, "Return code should be >=0 (success). Saw: %d\n",
+              code);
+  for (u8 i = 0; i < 3; i++) {
+    fail_unless(fabs(soln_cold.pos_ecef[i] - soln_warm.pos_ecef[i]) < 1e-3,
+                "Warm start position differs. Saw: %.6f, expected %.6f",
+                soln_warm.pos_ecef[i], soln_cold.pos_ecef[i]);
+  }
+  fail_unless(fabs(soln_cold.clock_offset - soln_warm.clock_offset) < 1e-11);
+  fail_unless(fabs(dops_cold.gdop - dops_warm.gdop) < 1e-6);
+
+  /* A different satellite set doesn't use the cached geometry. */
+  navigation_measurement_t nms_swapped[6] =
+    {nm2, nm1, nm3, nm4, nm5, nm6};
+  code = calc_PVT_ctx(&ctx, n_used, nms_swapped, false, &soln_warm,
+                      &dops_warm);
+  fail_unless(code >= 0, "Return code should be >=0 (success). Saw: %d\n",
+              code);
+  for (u8 i = 0; i < 3; i++) {
+    fail_unless(fabs(soln_cold.pos_ecef[i] - soln_warm.pos_ecef[i]) < 1e-3,
+                "Warm start position differs. Saw: %.6f, expected %.6f",
+                soln_warm.pos_ecef[i], soln_cold.pos_ecef[i]);
+  }
+  fail_unless(sid_is_equal(ctx.sids[0], nm2.sid));
+
+  /* A failed solution invalidates the context. */
+  code = calc_PVT_ctx(&ctx, 3, nms, false, &soln_warm, &dops_warm);
+  fail_unless(code == -7);
+  code = calc_PVT_ctx(&ctx, 5, nms, false, &soln_warm, &dops_warm);
+  fail_unless(code < 0);
+  fail_unless(!ctx.valid);
+}
+END_TEST
+
+START_TEST(test_pvt_batch)
+{
+  navigation_measurement_t nms[6] =
+    {nm1, nm2, nm3, nm4, nm5, nm6};
+
+  pvt_epoch_t epochs[4] = {
+    {.nav_meas = nms, .n_used = 6},
+    {.nav_meas = nms, .n_used = 3},
+    {.nav_meas = nms, .n_used = 6},
+    {.nav_meas = nms, .n_used = 5},
+  };
+  gnss_solution solns[4];
+  dops_t dops[4];
+  s8 codes[4];
+
+  gnss_solution soln_ref;
+  dops_t dops_ref;
+  pvt_ctx_t ctx_ref;
+  pvt_ctx_init(&ctx_ref);
+  s8 code_ref = calc_PVT_ctx(&ctx_ref, 6, nms, false, &soln_ref, &dops_ref);
+  fail_unless(code_ref >= 0);
+
+  /* Cold start every epoch. */
+  u32 n_valid = calc_PVT_batch(NULL, NULL, 4, epochs, false, solns, dops, codes);
+  fail_unless(n_valid == 2, "Expected 2 valid solutions, got %d", n_valid);
+  fail_unless(codes[0] == code_ref);
+  fail_unless(codes[1] == -7);
+  fail_unless(codes[2] == code_ref);
+  fail_unless(!solns[1].valid);
+  for (u8 e = 0; e < 3; e += 2) {
+    fail_unless(solns[e].valid);
+    for (u8 i = 0; i < 3; i++) {
+      fail_unless(fabs(solns[e].pos_ecef[i] - soln_ref.pos_ecef[i]) < 1e-6);
+    }
+    fail_unless(fabs(dops[e].gdop - dops_ref.gdop) < 1e-9);
+  }
+
+  /* Warm start chained through the batch. */
+  pvt_ctx_t ctx;
+  pvt_ctx_init(&ctx);
+  n_valid = calc_PVT_batch(NULL, &ctx, 3, epochs, false, solns, dops, NULL);
+  fail_unless(n_valid == 2);
+  for (u8 i = 0; i < 3; i++) {
+    fail_unless(fabs(solns[2].pos_ecef[i] - soln_ref.pos_ecef[i]) < 1e-3);
+  }
+  fail_unless(ctx.valid);
+
+  /* Chunks on an executor give the same cold start results. */
+  u32 n_runs = 0;
+  executor_t ex = {
+    .n_workers = 3,
+    .ctx = &n_runs,
+    .run = &run_reversed
+  };
+  gnss_solution solns_ex[4];
+  dops_t dops_ex[4];
+  s8 codes_ex[4];
+  n_valid = calc_PVT_batch(&ex, NULL, 4, epochs, false,
+                           solns_ex, dops_ex, codes_ex);
+  fail_unless(n_valid == 2, "Expected 2 valid solutions, got %d", n_valid);
+  fail_unless(n_runs == 3, "Expected 3 tasks, got %d", n_runs);
+  for (u8 e = 0; e < 4; e++) {
+    fail_unless(codes_ex[e] == codes[e]);
+    fail_unless(solns_ex[e].valid == (codes[e] >= 0));
+  }
+
+  /* Each chunk warm starts from its own copy of the context. */
+  n_runs = 0;
+  pvt_ctx_init(&ctx);
+  n_valid = calc_PVT_batch(&ex, &ctx, 4, epochs, false, solns, dops, NULL);
+  fail_unless(n_valid == 2);
+  fail_unless(n_runs == 3);
+  for (u8 i = 0; i < 3; i++) {
+    fail_unless(fabs(solns[2].pos_ecef[i] - soln_ref.pos_ecef[i]) < 1e-3);
+  }
+  /* The last epoch fails, leaving the context of the last chunk invalid. */
+  fail_unless(!ctx.valid);
+}
+END_TEST
 
 Suite* pvt_test_suite(void)
 {
@@ -156,6 +301,8 @@ Suite* pvt_test_suite(void)
   tcase_add_test(tc_core, test_pvt_failed_repair);
   tcase_add_test(tc_core, test_disable_pvt_raim);
   tcase_add_test(tc_core, test_dops);
+  tcase_add_test(tc_core, test_pvt_ctx_warm_start);
+  tcase_add_test(tc_core, test_pvt_batch);
   suite_add_tcase(s, tc_core);
 
   return s;
@@ -0,0 +1,132 @@
+#include <check.h>
+#include <math.h>
+
+#include <libswiftnav/linear_algebra.h>
+#include <libswiftnav/raim.h>
+
+#include "check_utils.h"
+
+#define N_OBS 7
+#define N_STATES 4
+
+static const double A[N_OBS][N_STATES] = {
+  {  0.31, -0.72,  0.62, 1 },
+  { -0.55,  0.10,  0.83, 1 },
+  {  0.82,  0.40,  0.41, 1 },
+  { -0.20, -0.91,  0.36, 1 },
+  {  0.05,  0.68,  0.73, 1 },
+  { -0.77, -0.45,  0.45, 1 },
+  {  0.60, -0.10,  0.79, 1 },
+};
+
+/* Reference solution of the subset without `drop` from the normal
+ * equations. */
+static void solve_without(u8 drop, const double *y, double *x, double *resid)
+{
+  double N[N_STATES * N_STATES] = {0};
+  double Aty[N_STATES] = {0};
+  for (u8 i = 0; i < N_OBS; i++) {
+    if (i == drop) {
+      continue;
+    }
+    for (u8 j = 0; j < N_STATES; j++) {
+      Aty[j] += A[i][j] * y[i];
+      for (u8 k = 0; k < N_STATES; k++) {
+        N[j*N_STATES + k] += A[i][j] * A[i][k];
+      }
+    }
+  }
+  double Ninv[N_STATES * N_STATES];
+  fail_unless(matrix_inverse(N_STATES, N, Ninv) == 0);
+  matrix_multiply(N_STATES, N_STATES, 1, Ninv, Aty, x);
+
+  double sse = 0;
+  for (u8 i = 0; i < N_OBS; i++) {
+    if (i != drop) {
+      double r = y[i] - vector_dot(N_STATES, A[i], x);
+      sse += r * r;
+    }
+  }
+  *resid = sqrt(sse);
+}
+
+START_TEST(test_raim_leave_one_out)
+{
+  double y[N_OBS] = {1.2, -0.4, 3.1, 0.7, -2.2, 0.9, 1.5};
+  /* Fault on observation 4. */
+  y[4] += 50;
+
+  double x[N_STATES];
+  double residual;
+  raim_subset_t subsets[N_OBS];
+  fail_unless(raim_leave_one_out(N_OBS, N_STATES, &A[0][0], y, x, &residual,
+                                 subsets) == 0);
+
+  double x_ref[N_STATES];
+  double resid_ref;
+  solve_without(N_OBS, y, x_ref, &resid_ref);
+  fail_unless(within_epsilon(residual, resid_ref));
+  for (u8 j = 0; j < N_STATES; j++) {
+    fail_unless(fabs(x[j] - x_ref[j]) < 1e-9);
+  }
+
+  u8 best = 0;
+  for (u8 i = 0; i < N_OBS; i++) {
+    fail_unless(subsets[i].valid);
+    solve_without(i, y, x_ref, &resid_ref);
+    fail_unless(fabs(subsets[i].residual - resid_ref) < 1e-9,
+                "Subset %d residual %f, expected %f",
+                i, subsets[i].residual, resid_ref);
+    for (u8 j = 0; j < N_STATES; j++) {
+      fail_unless(fabs(subsets[i].x[j] - x_ref[j]) < 1e-9);
+    }
+    if (subsets[i].residual < subsets[best].residual) {
+      best = i;
+    }
+
+    double r[N_OBS - 1];
+    raim_subset_residuals(N_OBS, N_STATES, &A[0][0], y, i, &subsets[i], r);
+    fail_unless(fabs(vector_norm(N_OBS - 1, r) - resid_ref) < 1e-9);
+  }
+  fail_unless(best == 4, "Expected fault on 4, got %d", best);
+}
+END_TEST
+
+START_TEST(test_raim_rank_deficient)
+{
+  double y[N_OBS] = {0};
+  double x[N_STATES];
+  raim_subset_t subsets[N_OBS];
+
+  /* Under-determined. */
+  fail_unless(raim_leave_one_out(3, N_STATES, &A[0][0], y, x, NULL,
+                                 subsets) == -1);
+
+  /* Exactly determined, no subset has a solution. */
+  fail_unless(raim_leave_one_out(4, N_STATES, &A[0][0], y, x, NULL,
+                                 subsets) == 0);
+  for (u8 i = 0; i < 4; i++) {
+    fail_unless(!subsets[i].valid);
+  }
+
+  /* Only one observation constrains the first state. */
+  double B[5][2] = {{1, 1}, {0, 1}, {0, 1}, {0, 1}, {0, 1}};
+  fail_unless(raim_leave_one_out(5, 2, &B[0][0], y, x, NULL, subsets) == 0);
+  fail_unless(!subsets[0].valid);
+  for (u8 i = 1; i < 5; i++) {
+    fail_unless(subsets[i].valid);
+  }
+}
+END_TEST
+
+Suite* raim_suite(void)
+{
+  Suite *s = suite_create("RAIM");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_raim_leave_one_out);
+  tcase_add_test(tc_core, test_raim_rank_deficient);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
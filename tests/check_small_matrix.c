@@ -0,0 +1,236 @@
+#include <math.h>
+#include <string.h>
+#include <check.h>
+
+#include <libswiftnav/linear_algebra.h>
+#include <libswiftnav/small_matrix.h>
+
+#include "check_utils.h"
+
+#define SMALL_TOL 1e-10
+/* Sizes either side of the specialized range use the generic kernels. */
+#define SMALL_N_MAX (SMALL_KERNELS_MAX_DIM + 3)
+
+static bool small_within(u32 n, const double *a, const double *b)
+{
+  for (u32 i = 0; i < n; i++) {
+    if (fabs(a[i] - b[i]) > SMALL_TOL * MAX(1, fabs(b[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void random_unit_upper(u32 n, double *U)
+{
+  matrix_eye(n, U);
+  for (u32 i = 0; i < n; i++) {
+    for (u32 j = i + 1; j < n; j++) {
+      U[i*n + j] = frand(-1, 1);
+    }
+  }
+}
+
+/* Random symmetric positive definite matrix. */
+static void random_spd(u32 n, double *S)
+{
+  double A[n * n];
+  arr_frand(n * n, -1, 1, A);
+  for (u32 i = 0; i < n; i++) {
+    for (u32 j = 0; j < n; j++) {
+      S[i*n + j] = (i == j) ? n : 0;
+      for (u32 k = 0; k < n; k++) {
+        S[i*n + j] += A[i*n + k] * A[j*n + k];
+      }
+    }
+  }
+}
+
+START_TEST(test_small_kernels_dispatch)
+{
+  for (u32 n = 0; n <= SMALL_N_MAX; n++) {
+    const small_kernels_t *k = small_kernels(n);
+    if (n >= SMALL_KERNELS_MIN_DIM && n <= SMALL_KERNELS_MAX_DIM) {
+      fail_unless(k->n == n, "Kernels for %u specialized for %u", n, k->n);
+    } else {
+      fail_unless(k->n == 0, "Expected generic kernels for %u", n);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_small_trmv)
+{
+  seed_rng();
+  for (u32 n = 1; n <= SMALL_N_MAX; n++) {
+    const small_kernels_t *k = small_kernels(n);
+    double U[n * n];
+    double Ut[n * n];
+    double x[n];
+    double y[n];
+    double y_ref[n];
+    random_unit_upper(n, U);
+    matrix_transpose(n, n, U, Ut);
+    arr_frand(n, -1, 1, x);
+
+    memcpy(y, x, sizeof(x));
+    k->trmv_unit_upper(n, U, y);
+    matrix_multiply(n, n, 1, U, x, y_ref);
+    fail_unless(small_within(n, y, y_ref), "trmv mismatch for n = %u", n);
+
+    memcpy(y, x, sizeof(x));
+    k->trmv_unit_upper_t(n, U, y);
+    matrix_multiply(n, n, 1, Ut, x, y_ref);
+    fail_unless(small_within(n, y, y_ref), "trmv_t mismatch for n = %u", n);
+  }
+}
+END_TEST
+
+START_TEST(test_small_gemv_symv)
+{
+  seed_rng();
+  for (u32 n = 1; n <= SMALL_N_MAX; n++) {
+    const small_kernels_t *k = small_kernels(n);
+    u32 m = sizerand(2 * SMALL_N_MAX);
+    double A[m * n];
+    double x[n];
+    double y[m];
+    double y_ref[m];
+    arr_frand(m * n, -1, 1, A);
+    arr_frand(n, -1, 1, x);
+    k->gemv(m, n, A, x, y);
+    matrix_multiply(m, n, 1, A, x, y_ref);
+    fail_unless(small_within(m, y, y_ref), "gemv mismatch for n = %u", n);
+
+    /* Only the upper triangle of S may be read. */
+    double S[n * n];
+    double S_upper[n * n];
+    random_spd(n, S);
+    memcpy(S_upper, S, sizeof(S));
+    for (u32 i = 0; i < n; i++) {
+      for (u32 j = 0; j < i; j++) {
+        S_upper[i*n + j] = NAN;
+      }
+    }
+    double z[n];
+    double z_ref[n];
+    k->symv(n, S_upper, x, z);
+    matrix_multiply(n, n, 1, S, x, z_ref);
+    fail_unless(small_within(n, z, z_ref), "symv mismatch for n = %u", n);
+  }
+}
+END_TEST
+
+START_TEST(test_small_cholesky)
+{
+  seed_rng();
+  for (u32 n = 1; n <= SMALL_N_MAX; n++) {
+    const small_kernels_t *k = small_kernels(n);
+    double S[n * n];
+    double L[n * n];
+    double Lt[n * n];
+    double LLt[n * n];
+    random_spd(n, S);
+    memcpy(L, S, sizeof(S));
+    fail_unless(k->cholesky(n, L) == 0, "cholesky failed for n = %u", n);
+    for (u32 i = 0; i < n; i++) {
+      fail_unless(L[i*n + i] > 0, "cholesky diagonal not positive");
+      for (u32 j = i + 1; j < n; j++) {
+        fail_unless(L[i*n + j] == 0, "cholesky upper triangle not zero");
+      }
+    }
+    matrix_transpose(n, n, L, Lt);
+    matrix_multiply(n, n, n, L, Lt, LLt);
+    fail_unless(small_within(n * n, LLt, S), "L L^T != S for n = %u", n);
+
+    /* Not positive definite. */
+    memcpy(L, S, sizeof(S));
+    L[(n-1)*n + n-1] = -1;
+    fail_unless(k->cholesky(n, L) == -1,
+                "cholesky of indefinite matrix for n = %u", n);
+  }
+}
+END_TEST
+
+START_TEST(test_small_udu)
+{
+  seed_rng();
+  for (u32 n = 1; n <= SMALL_N_MAX; n++) {
+    const small_kernels_t *k = small_kernels(n);
+    double S[n * n];
+    double M[n * n];
+    double M_ref[n * n];
+    double U[n * n];
+    double U_ref[n * n];
+    double D[n];
+    double D_ref[n];
+    random_spd(n, S);
+    memcpy(M, S, sizeof(S));
+    memcpy(M_ref, S, sizeof(S));
+    k->udu(n, M, U, D);
+    matrix_udu(n, M_ref, U_ref, D_ref);
+    fail_unless(small_within(n * n, U, U_ref), "U mismatch for n = %u", n);
+    fail_unless(small_within(n, D, D_ref), "D mismatch for n = %u", n);
+    fail_unless(small_within(n * n, M, M_ref), "M mismatch for n = %u", n);
+  }
+}
+END_TEST
+
+START_TEST(test_small_lesq3)
+{
+  seed_rng();
+  for (u32 n = 1; n <= SMALL_N_MAX; n++) {
+    const small_kernels_t *k = small_kernels(n);
+    double A[n * 3];
+    double y[n];
+    double x[3];
+    arr_frand(n * 3, -1, 1, A);
+    arr_frand(n, -10, 10, y);
+
+    if (n < 3) {
+      fail_unless(k->lesq3(n, A, y, x) == -1,
+                  "Under-determined lesq3 for n = %u", n);
+      continue;
+    }
+
+    fail_unless(k->lesq3(n, A, y, x) == 0, "lesq3 failed for n = %u", n);
+    /* Normal equations, A^T (A x - y) = 0. */
+    double r[n];
+    matrix_multiply(n, 3, 1, A, x, r);
+    for (u32 i = 0; i < n; i++) {
+      r[i] -= y[i];
+    }
+    for (u32 j = 0; j < 3; j++) {
+      double s = 0;
+      for (u32 i = 0; i < n; i++) {
+        s += A[i*3 + j] * r[i];
+      }
+      fail_unless(fabs(s) < SMALL_TOL * n * 10,
+                  "Residual not orthogonal for n = %u (%g)", n, s);
+    }
+
+    /* Rank deficient. */
+    for (u32 i = 0; i < n; i++) {
+      A[i*3 + 2] = 2 * A[i*3 + 0];
+    }
+    fail_unless(k->lesq3(n, A, y, x) == -1,
+                "Rank deficient lesq3 for n = %u", n);
+  }
+}
+END_TEST
+
+Suite* small_matrix_suite(void)
+{
+  Suite *s = suite_create("Small matrix kernels");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_small_kernels_dispatch);
+  tcase_add_test(tc_core, test_small_trmv);
+  tcase_add_test(tc_core, test_small_gemv_symv);
+  tcase_add_test(tc_core, test_small_cholesky);
+  tcase_add_test(tc_core, test_small_udu);
+  tcase_add_test(tc_core, test_small_lesq3);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
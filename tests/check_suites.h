@@ -29,5 +29,10 @@ Suite* glo_decoder_test_suite(void);
 Suite* troposphere_suite(void);
 Suite* correlator_suite(void);
 Suite* counter_checker_suite(void);
+Suite* nav_snapshot_suite(void);
+Suite* nav_msg_suite(void);
+Suite* raim_suite(void);
+Suite* small_matrix_suite(void);
+Suite* lambda_suite(void);
 
 #endif /* CHECK_SUITES_H */